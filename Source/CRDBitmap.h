@@ -25,6 +25,8 @@
 	NSData *data;
 	NSCursor *cursor;
 	NSColor *color;
+	const uint32 *pixels;
+	int width, height;
 }
 
 - (id)initWithBitmapData:(const unsigned char *)d size:(NSSize)s view:(CRDSessionView *)v;
@@ -33,11 +35,12 @@
 - (id)initWithImage:(NSImage *)img;
 
 - (void)drawInRect:(NSRect)dstRect fromRect:(NSRect)srcRect operation:(NSCompositingOperation)op;
-- (CRDBitmap *)invert;
 
 - (void)overlayColor:(NSColor *)c;
 
 - (NSImage *)image;
+- (const uint32 *)pixels;
+- (NSSize)size;
 - (void)setColor:(NSColor *)color;
 - (NSColor *)color;
 - (NSCursor *)cursor;
@@ -17,12 +17,10 @@
 
 /*	Notes:
 		- The ivar 'data' is used because NSBitmapImageRep does not copy the bitmap data.
-		- The stored bitmap (for non cursors/glyphs) is ARGB8888 regardless of source type for simplicity.
+		- The stored bitmap (for non cursors/glyphs) is in the backing store's pixel format regardless of source type, so that it can be blitted without Quartz. Its NSImage is only made if asked for.
 		- Using an accelerated buffer would speed up drawing. An option could be used for the situations where an NSImage is required. My tests on a machine with a capable graphics card show that CGImage would speed normal drawing up about 30-40%, and CGLayer would be 2-12 times quicker. The hassle is that some situations, a normal NSImage is needed (eg: when using the image as a pattern for NSColor and patblt), so it would either have to create both or have a switch for which to create, and neither CGImage nor CGLayer have a way to draw only a portion of itself, meaning the only way to do it is clip drawing to match the origin. I've written some basic code to use CFLayer, but it needs more work before I commit it.
 */
 
-#import <Quartz/Quartz.h>
-
 #import "CRDBitmap.h"
 #import "AppController.h"
 #import "CRDShared.h"
@@ -30,105 +28,49 @@
 
 @implementation CRDBitmap
 
-// Currently is adequately optimized: only somewhat critical
-- (id)initWithBitmapData:(const unsigned char *)sourceBitmap size:(NSSize)s view:(CRDSessionView *)v
+// Wraps backing store pixels (see pixconv.h) in an image rep, which keeps pixelData alive rather than copying it
+static NSBitmapImageRep *CRDImageRepWithPixels(NSData *pixelData, int w, int h, CGBitmapInfo alphaInfo)
 {
-	if (!(self = [super init]))
-		return nil;
-
-	int bitsPerPixel = [v bitsPerPixel],  bytesPerPixel = (bitsPerPixel + 7) / 8;
-	
-	uint8 *outputBitmap, *nc;
-	const uint8 *p, *end;
-	unsigned realLength, newLength;
-	unsigned int *colorMap;
-	int width = (int)s.width, height = (int)s.height;
+	CGColorSpaceRef cs = CGColorSpaceCreateDeviceRGB();
+	CGDataProviderRef provider = CGDataProviderCreateWithCFData((CFDataRef)pixelData);
+	CGImageRef cgImage = CGImageCreate(w, h, 8, 32, w * 4, cs, alphaInfo | kCGBitmapByteOrder32Little, provider, NULL, NO, kCGRenderingIntentDefault);
+	NSBitmapImageRep *rep = [[[NSBitmapImageRep alloc] initWithCGImage:cgImage] autorelease];
 	
-	realLength = width * height * bytesPerPixel;
-	newLength = width * height * 4;
+	CGImageRelease(cgImage);
+	CGDataProviderRelease(provider);
+	CFRelease(cs);
 	
-	p = sourceBitmap;
-	end = p + realLength;
-	
-	nc = outputBitmap = malloc(newLength);
-	
-	if (bitsPerPixel == 8)
-	{
-		colorMap = [v colorMap];
-		while (p < end)
-		{
-			nc[0] = 255;
-			nc[1] = colorMap[*p] & 0xff;
-			nc[2] = (colorMap[*p] >> 8) & 0xff;
-			nc[3] = (colorMap[*p] >> 16) & 0xff;
-			
-			p++;
-			nc += 4;
-		}
-	}
-	else if (bitsPerPixel == 16)
-	{
-		while (p < end)
-		{
-			unsigned short c = p[0] | (p[1] << 8);
-
-			nc[0] = 255;
-			nc[1] = (( (c >> 11) & 0x1f) * 255 + 15) / 31;
-			nc[2] = (( (c >> 5) & 0x3f) * 255 + 31) / 63;
-			nc[3] = ((c & 0x1f) * 255 + 15) / 31;
-			
-			p += bytesPerPixel;
-			nc += 4;
-		}
-	}
-	else if (bitsPerPixel == 15)
-	{
-		while (p < end)
-		{
-			unsigned short c = p[0] | (p[1] << 8);
+	return rep;
+}
 
-			nc[0] = 255;
-			nc[1] = (( (c >> 10) & 0x1f) * 255 + 15) / 31;
-			nc[2] = (( (c >> 5) & 0x1f) * 255 + 15) / 31;
-			nc[3] = ((c & 0x1f) * 255 + 15) / 31;
-			
-			p += bytesPerPixel;
-			nc += 4;
-		}
-	}
-	else if (bitsPerPixel == 24 || bitsPerPixel == 32)
+// Clears the alpha of pixels whose AND mask bit is set, a byte of mask at a time
+static void CRDApplyCursorAndMask(uint32 *np, const uint8 *a, int w)
+{
+	for (int j = 0; j < w; j += 8, a++)
 	{
-		while (p < end)
-		{
-			nc[0] = 255;
-			nc[1] = p[2];
-			nc[2] = p[1];
-			nc[3] = p[0];
-			
-			p += bytesPerPixel;
-			nc += 4;
-		}
+		if (*a == 0)
+			continue;
+		
+		for (int k = 0; k < 8 && j + k < w; k++)
+			if (*a & (0x80 >> k))
+				np[j + k] &= PIXCONV_LE32(0x00ffffff);
 	}
+}
+
+// Converts to backing store pixels, so that ui_memblt and ui_triblt can combine them with the screen directly (see -[CRDSessionView applyROP3:...])
+- (id)initWithBitmapData:(const unsigned char *)sourceBitmap size:(NSSize)s view:(CRDSessionView *)v
+{
+	if (!(self = [super init]))
+		return nil;
 	
-	data = [[NSData alloc] initWithBytesNoCopy:(void *)outputBitmap length:newLength];
-	
-	unsigned char *planes[2] = {(unsigned char *)[data bytes], NULL};
+	width = (int)s.width;
+	height = (int)s.height;
 	
-	NSBitmapImageRep *bitmap = [[[NSBitmapImageRep alloc] initWithBitmapDataPlanes:planes
-													 pixelsWide:width
-													 pixelsHigh:height
-												  bitsPerSample:8
-												samplesPerPixel:4
-													   hasAlpha:YES
-													   isPlanar:NO
-												 colorSpaceName:NSDeviceRGBColorSpace
-												   bitmapFormat:NSAlphaFirstBitmapFormat
-													bytesPerRow:width * 4
-												   bitsPerPixel:32] autorelease];
+	uint32 *outputBitmap = malloc(width * height * 4);
+	pixconv_row([v bitsPerPixel], outputBitmap, sourceBitmap, width * height, [v colorMap]);
 	
-	image = [[NSImage alloc] init];
-	[image addRepresentation:bitmap];
-	[image setFlipped:YES];
+	data = [[NSData alloc] initWithBytesNoCopy:outputBitmap length:width * height * 4];
+	pixels = (const uint32 *)[data bytes];
 	
 	return self;
 }
@@ -139,15 +81,15 @@
 	if (!(self = [super init]))
 		return nil;
 	
-	int width = s.width, height = s.height, scanline = ((int)width + 7) / 8;
+	int w = s.width, h = s.height, scanline = (w + 7) / 8;
 	
-	data = [[NSData alloc] initWithBytes:d length:scanline * height];
+	data = [[NSData alloc] initWithBytes:d length:scanline * h];
 
 	unsigned char *planes[2] = {(unsigned char *)[data bytes], (unsigned char *)[data bytes]};
 	
 	NSBitmapImageRep *bitmap = [[[NSBitmapImageRep alloc] initWithBitmapDataPlanes:planes
-													 pixelsWide:width
-													 pixelsHigh:height
+													 pixelsWide:w
+													 pixelsHigh:h
 												  bitsPerSample:1
 												samplesPerPixel:2
 													   hasAlpha:YES
@@ -179,118 +121,81 @@
 		return self;
 	}
 
-	int andScanlineLength = CRDRoundUpToEven(s.width/8.0f), xorScanlineLength = CRDRoundUpToEven(s.width * bpp / 8.0f);
-	const uint8 *d = xorMask, *a = andMask;
-		
-	data = [[NSMutableData alloc] initWithCapacity:(int)s.width * (int)s.height * 4];
-	uint8 *np = (uint8 *)[data bytes];
+	int andScanlineLength = CRDRoundUpToEven(s.width/8.0f), xorScanlineLength = CRDRoundUpToEven(s.width * ((bpp == 15) ? 16 : bpp) / 8.0f);
+	const uint8 *d, *a;
 	
-	unsigned short c;
-	unsigned int alphaBit, alphaIndex, x, *colorMap = [v colorMap];
-
-	for (int i = 0; i < h; i++)
+	data = [[NSMutableData alloc] initWithLength:w * h * 4];
+	uint32 *np = (uint32 *)[data mutableBytes];
+	
+	unsigned int *colorMap = [v colorMap];
+	
+	// One loop per depth, so that nothing is decided per pixel; AND mask bits make pixels transparent
+	switch (bpp)
 	{
-		a = andMask + andScanlineLength * i;
-		d = xorMask + xorScanlineLength * i;
-		
-		for (int j = 0; j < w; j++)
+		case 1: // white where the XOR and AND bits differ, transparent where both are set
 		{
-			alphaBit = a[j/8] & (0x80 >> (j % 8));
+			uint32 white = PIXCONV_ARGB(0xff, 0xff, 0xff, 0xff), black = PIXCONV_ARGB(0xff, 0, 0, 0);
 			
-			switch (bpp)
+			for (int i = 0; i < h; i++, np += w)
 			{
-				case 1:
-					x = (d[j/8] & (0x80 >> (j % 8))) ^ alphaBit;
-					np[0] = np[1] = np[2] = x ? 0xff : 0;					
-					np[3] = (alphaBit && x) ? 0 : 0xff;
-					break;
-					
-				case 4: // two colormap indices packed into each byte
-					if (j % 2)
-					{
-						c = ((*d) & 0xf0) >> 4;
-						d++;
-					}
-					else
-						c = *d & 0xf;
-					
-					np[0] = colorMap[c] & 0xff;
-					np[1] = (colorMap[c] >> 8) & 0xff;
-					np[2] = (colorMap[c] >> 16) & 0xff;
-					np[3] = alphaBit ? 0 : 0xff;
-					break;
+				a = andMask + andScanlineLength * i;
+				d = xorMask + xorScanlineLength * i;
 				
-				case 8:
-					np[0] = colorMap[*d] & 0xff;
-					np[1] = (colorMap[*d] >> 8) & 0xff;
-					np[2] = (colorMap[*d] >> 16) & 0xff;
-					np[3] = alphaBit ? 0 : 0xff;
-					d++;	
-					break;
-					
-				case 15:
-					c = d[0] | (d[1] << 8);
-
-					np[0] = (( (c >> 10) & 0x1f) * 255 + 15) / 31;
-					np[1] = (( (c >> 5) & 0x1f) * 255 + 15) / 31;
-					np[2] = ((c & 0x1f) * 255 + 15) / 31;
-					np[3] = alphaBit ? 0 : 0xff;
-					break;
-					
-				case 16:
-					c = d[0] | (d[1] << 8);
-					
-					np[0] = (( (c >> 11) & 0x1f) * 255 + 15) / 31;
-					np[1] = (( (c >> 5) & 0x3f) * 255 + 31) / 63;
-					np[2] = ((c & 0x1f) * 255 + 15) / 31;
-					np[3] = alphaBit ? 0 : 0xff;
-					
-					d += 2;		
-					break;
-					
-				case 24:
-					np[0] = d[2];
-					np[1] = d[1];
-					np[2] = d[0]; 
-					np[3] = alphaBit ? 0 : 0xff; 
-					d += 3;
-					break;
-
-				case 32:
-					np[0] = d[2];
-					np[1] = d[1];
-					np[2] = d[0];
-					np[3] = d[3];			
-					d += 4;
-					break;
-
-
-				default:
-					CRDLog(CRDLogLevelError, @"Error Rendering Cursor - Unknown Bitrate: %i", bpp);
-					np[0] = np[1] = np[2] = 0;
-					np[3] = 0xff;
-					break;
+				for (int j = 0; j < w; j++)
+				{
+					uint8 bit = 0x80 >> (j % 8), andBit = a[j/8] & bit, xorBit = d[j/8] & bit;
+					np[j] = (andBit && !xorBit) ? 0 : (andBit ^ xorBit) ? white : black;
+				}
 			}
-
-			np += 4;
+			break;
 		}
+			
+		case 4: // two colormap indices packed into each byte
+			for (int i = 0; i < h; i++, np += w)
+			{
+				a = andMask + andScanlineLength * i;
+				d = xorMask + xorScanlineLength * i;
+				
+				for (int j = 0; j + 1 < w; j += 2)
+				{
+					np[j] = colorMap[d[j/2] & 0xf];
+					np[j + 1] = colorMap[d[j/2] >> 4];
+				}
+				if (w % 2)
+					np[w - 1] = colorMap[d[w/2] & 0xf];
+				
+				CRDApplyCursorAndMask(np, a, w);
+			}
+			break;
+			
+		case 8:
+		case 15:
+		case 16:
+		case 24:
+			for (int i = 0; i < h; i++, np += w)
+			{
+				a = andMask + andScanlineLength * i;
+				d = xorMask + xorScanlineLength * i;
+				
+				pixconv_row(bpp, np, d, w, colorMap);
+				CRDApplyCursorAndMask(np, a, w);
+			}
+			break;
+			
+		case 32: // already backing store pixels, with their own alpha
+			for (int i = 0; i < h; i++, np += w)
+				memcpy(np, xorMask + xorScanlineLength * i, w * 4);
+			break;
+			
+		default:
+			CRDLog(CRDLogLevelError, @"Error Rendering Cursor - Unknown Bitrate: %i", bpp);
+			for (int j = 0; j < w * h; j++)
+				np[j] = PIXCONV_ARGB(0xff, 0, 0, 0);
+			break;
 	}
 	
-	
-	unsigned char *planes[2] = {(unsigned char *)[data bytes], NULL};
-	NSBitmapImageRep *bitmap = [[[NSBitmapImageRep alloc] initWithBitmapDataPlanes:planes
-													 pixelsWide:s.width
-													 pixelsHigh:s.height
-												  bitsPerSample:8
-												samplesPerPixel:4
-													   hasAlpha:YES
-													   isPlanar:NO
-												 colorSpaceName:NSDeviceRGBColorSpace
-													bytesPerRow:w * 4
-												   bitsPerPixel:0] autorelease];	
-	
 	image = [[NSImage alloc] init];
-	[image addRepresentation:bitmap];
+	[image addRepresentation:CRDImageRepWithPixels(data, w, h, kCGImageAlphaPremultipliedFirst)];
 	
 	if (bpp != 1)
 		[image setFlipped:YES];
@@ -331,57 +236,30 @@
 	} [image unlockFocus];
 }
 
-- (CRDBitmap *)invert
-{ 
-	NSData *tiffData = [image TIFFRepresentation];
-	CIImage *ci = [CIImage imageWithData:tiffData];
-
-	if([image isFlipped]) {
-		NSAffineTransform *affineTransform = [NSAffineTransform transform];
-		[affineTransform translateXBy:0 yBy:128];
-		[affineTransform scaleXBy:1 yBy:-1];
-
-		CIFilter *transform = [CIFilter filterWithName:@"CIAffineTransform"];
-		[transform setValue:ci forKey:@"inputImage"];
-		[transform setValue:affineTransform forKey:@"inputTransform"];
-
-		// get the new CIImage, flipped and ready to serve
-		ci = [transform valueForKey:@"outputImage"];
-	}
-
-	CIFilter *invert = [CIFilter filterWithName:@"CIColorInvert"];
-	[invert setValue:ci forKey:@"inputImage"];
-	ci = [invert valueForKey:@"outputImage"];
-
-	int width = [ci extent].size.width;
-	int rows = [ci extent].size.height;
-	int rowBytes = (width * 4);
-	
-	NSBitmapImageRep* rep = [[NSBitmapImageRep alloc] initWithBitmapDataPlanes:nil pixelsWide:width pixelsHigh:rows bitsPerSample:8 samplesPerPixel:4 hasAlpha:YES isPlanar:NO colorSpaceName:NSCalibratedRGBColorSpace bitmapFormat:0 bytesPerRow:rowBytes bitsPerPixel:0];
-
-	CGColorSpaceRef colorSpace = CGColorSpaceCreateWithName ( kCGColorSpaceGenericRGB );
-	CGContextRef context = CGBitmapContextCreate([rep bitmapData], width, rows, 8, rowBytes, colorSpace, kCGImageAlphaPremultipliedLast );
-	 
-	CIContext* ciContext = [CIContext contextWithCGContext:context options:nil];
-	[ciContext drawImage:ci atPoint:CGPointZero fromRect: [ci extent]];
-
-	CGContextRelease( context );
-	CGColorSpaceRelease( colorSpace );
-
-	NSImage *invertedImage = [[[NSImage alloc] initWithSize:NSMakeSize([ci extent].size.width, [ci extent].size.height)] autorelease];
-	[invertedImage addRepresentation:rep];
-	[rep release];
-
-	return [[(CRDBitmap*)[CRDBitmap alloc] initWithImage:invertedImage] autorelease];
-} 
-
 #pragma mark -
 #pragma mark Accessors
 -(NSImage *)image
 {
+	if (image == nil && pixels != NULL)
+	{
+		image = [[NSImage alloc] init];
+		[image addRepresentation:CRDImageRepWithPixels(data, width, height, kCGImageAlphaNoneSkipFirst)];
+		[image setFlipped:YES];
+	}
+	
 	return image;
 }
 
+-(const uint32 *)pixels
+{
+	return pixels;
+}
+
+-(NSSize)size
+{
+	return NSMakeSize(width, height);
+}
+
 -(void)dealloc
 {
 	[cursor release];
@@ -49,8 +49,8 @@
 	
 
 // For managing the current draw session (the time bracketed between ui_begin_update and ui_end_update)
-static void schedule_display(RDConnectionRef conn);
 static void schedule_display_in_rect(RDConnectionRef conn, NSRect r);
+static void schedule_display_around_points(RDConnectionRef conn, const RDPoint *points, int npoints, int penWidth);
 
 
 #pragma mark -
@@ -69,14 +69,15 @@ void ui_resize_window(RDConnectionRef conn)
 #pragma mark -
 #pragma mark Colormap 
 
+// Palette entries are kept as backing store pixels, so that 8 bpp bitmaps convert by lookup alone (see pixconv.c). Always 256 entries, since any index may appear in a bitmap.
 RDColorMapRef ui_create_colourmap(RDColorMap * colors)
 {
-	unsigned int *colorMap = malloc(colors->ncolours * sizeof(unsigned));
+	unsigned int *colorMap = calloc(256, sizeof(unsigned));
 	
-	for (int i = 0; i < colors->ncolours; i++)
+	for (int i = 0; i < colors->ncolours && i < 256; i++)
 	{
 		RDColorEntry colorEntry = colors->colours[i];
-		colorMap[i] = (colorEntry.blue << 16) | (colorEntry.green << 8) | colorEntry.red;
+		colorMap[i] = PIXCONV_ARGB(0xff, colorEntry.red, colorEntry.green, colorEntry.blue);
 	}
 	
 	return colorMap;
@@ -86,6 +87,7 @@ void ui_set_colourmap(RDConnectionRef conn, RDColorMapRef map)
 {
 	LOCALS_FROM_CONN;
 	[v setColorMap:(unsigned int *)map];
+	conn->brushTileGeneration++;
 }
 
 
@@ -100,54 +102,16 @@ RDBitmapRef ui_create_bitmap(RDConnectionRef conn, int width, int height, uint8
 void ui_paint_bitmap(RDConnectionRef conn, int x, int y, int cx, int cy, int width, int height, uint8 * data)
 {
 	CRDBitmap *bitmap = [[CRDBitmap alloc] initWithBitmapData:data size:NSMakeSize(width, height) view:conn->ui];
-	ui_memblt(conn, 0, x, y, cx, cy, bitmap, 0, 0);
+	ui_memblt(conn, ROP3_SRCCOPY, x, y, cx, cy, bitmap, 0, 0);
 	[bitmap release];
 }
 
 void ui_memblt(RDConnectionRef conn, uint8 opcode, int x, int y, int cx, int cy, RDBitmapRef src, int srcx, int srcy)
 {
 	LOCALS_FROM_CONN;
-	
-	CRDBitmap *bmp = (CRDBitmap *)src;
 	NSRect r = NSMakeRect(x, y, cx, cy);
-	NSPoint p = NSMakePoint(srcx, srcy);
-	NSCompositingOperation compositingOp;
-	switch (opcode)
-	{
-		case 0:
-		case 12:
-			compositingOp = NSCompositeCopy;
-			break;
-
-		case 6:
-			compositingOp = NSCompositePlusLighter;
-			break;
-
-		case 8: // AND
-			compositingOp = NSCompositePlusDarker;
-			break;
-
-		case 14: // OR
-			compositingOp = NSCompositePlusLighter;
-			break;
-
-		case 2: //Inverted AND
-			bmp = [bmp invert];
-			compositingOp = NSCompositePlusDarker;
-			break;
-
-		case 11: // Inverted OR
-			bmp = [bmp invert];
-			compositingOp = NSCompositePlusLighter;
-			break;
-
-		default:
-			CHECKOPCODE(opcode);
-			compositingOp = NSCompositeCopy;
-	}
 	
-	[v drawBitmap:bmp inRect:r from:p operation:compositingOp];
-
+	[v applyROP3:opcode toRect:r source:(CRDBitmap *)src from:NSMakePoint(srcx, srcy) pattern:NULL origin:NSZeroPoint];
 	schedule_display_in_rect(conn, r);
 }
 
@@ -159,172 +123,76 @@ void ui_destroy_bitmap(RDBitmapRef bmp)
 
 
 #pragma mark -
-#pragma mark Desktop Cache
+#pragma mark Offscreen Surfaces
 
-// Takes a section of the desktop cache (backing store) and stores it into the rdesktop bitmap cache (using RDP colors). Adequately optimized, not critical.
-void ui_desktop_save(RDConnectionRef conn, uint32 offset, int x, int y, int w, int h)
+RDSurfaceRef ui_create_surface(RDConnectionRef conn, int width, int height)
 {
 	LOCALS_FROM_CONN;
+	return [v createSurfaceWithSize:NSMakeSize(width, height)];
+}
+
+// Selects where primary orders draw; NULL is the screen
+void ui_set_surface(RDConnectionRef conn, RDSurfaceRef surface)
+{
+	LOCALS_FROM_CONN;
+	conn->currentSurface = surface;
+	[v setDrawingTarget:surface];
+}
+
+void ui_destroy_surface(RDSurfaceRef surface)
+{
+	if (surface == NULL)
+		return;
 	
-	unsigned char *screenDumpBytes = malloc(w*h*4);
-	CGColorSpaceRef genericColorSpace = CGColorSpaceCreateWithName(kCGColorSpaceGenericRGB);
-	CGContextRef screenDumpContext = CGBitmapContextCreate(screenDumpBytes, w, h, 8, w*4, genericColorSpace, kCGImageAlphaPremultipliedFirst); 
-	CGColorSpaceRelease(genericColorSpace);
-	
-	CGContextSaveGState(screenDumpContext); {
-		CGImageRef backingStoreImage = CGBitmapContextCreateImage([v rdBufferContext]);
-		CGContextDrawImage(screenDumpContext, CGRectMake(-x, -y, conn->screenWidth, conn->screenHeight), backingStoreImage);
-		CGImageRelease(backingStoreImage);
-	} CGContextRestoreGState(screenDumpContext);
-	
-	// Translate the 32-bit ARGB screen dump into RDP colors
-	uint8 *output, *o, *p;
-	uint32 i=0, len=w*h, bytespp = (conn->serverBpp+7)/8;
+	void *surfaceData = CGBitmapContextGetData(surface);
+	CGContextRelease(surface);
+	free(surfaceData);
+}
+
+void ui_surface_blt(RDConnectionRef conn, uint8 opcode, int x, int y, int cx, int cy, RDSurfaceRef src, int srcx, int srcy)
+{
+	LOCALS_FROM_CONN;
+	NSRect r = NSMakeRect(x, y, cx, cy);
 	
-	p = screenDumpBytes;
-	output = o = malloc(len*bytespp);
-	uint32 *colorMap = [v colorMap], q;
+	[v drawSurface:src inRect:r from:NSMakePoint(srcx, srcy) rop:opcode];
 	
-	if (conn->serverBpp == 16)
-	{
-		while (i++ < len)
-		{
-			unsigned short c =	( ((p[1] * 31 + 127) / 255) << 11) |
-								( ((p[2] * 63 + 127) / 255) << 5) |
-								( (p[3] * 31 + 127) / 255);
+	if (conn->currentSurface == NULL)
+		schedule_display_in_rect(conn, r);
+}
 
-			o[0] = c & 0xff;
-			o[1] = (c >> 8) & 0xff;
-			
-			p += 4;
-			o += bytespp;
-		}
-	}
-	else if (conn->serverBpp == 15)
-	{
-		while (i++ < len)
-		{
-			unsigned short c =	(1 << 15) |
-								(((p[1] * 31 + 127) / 255) << 10) |
-								(((p[2] * 31 + 127) / 255) << 5) |
-								((p[3] * 31 + 127) / 255);
-								
-			o[0] = c & 0xff;
-			o[1] = (c >> 8) & 0xff;
-			
-			p += 4;
-			o += bytespp;
-		}		
-	}
-	else if (conn->serverBpp == 8)
-	{
-		// Find closest color in colormap; use memoization table to speed operation up. Use closest match because the above screen dump doesn't always get byte-perfect screen dumps
-		// I'm not entirely sure why this is neccessary, and it seems to produce less-than-perfect matches. 0.4.3 didn't have this issue.
-		NSMutableDictionary *memoizedColors = [NSMutableDictionary dictionaryWithCapacity:32];
-		
-		while (i++ < len)
-		{
-			uint32 searchColor = (p[3] << 16) | (p[2] << 8) | p[1]; // transform ARGB into BGR
-			NSNumber *memoizedIndex = [memoizedColors objectForKey:[NSNumber numberWithUnsignedInt:searchColor]];
-			
-			if (memoizedIndex)
-				o[0] = [memoizedIndex unsignedCharValue];
-			else
-			{
-				o[0] = 0;
-				float bestDelta = FLT_MAX;
-				unsigned int bestIndex = 0;
-				for (unsigned int k = 0; k <= 0xff; k++)
-				{
-					uint32 referenceColor = colorMap[k];
-					
-					if (referenceColor == searchColor)
-					{
-						bestIndex = k;
-						break;
-					}
-					
-					float thisDelta = sqrtf(
-							powf((float)(searchColor & 0xff) - (referenceColor & 0xff), 2.0) + 
-							powf((float)((searchColor >> 8) & 0xff) - ((referenceColor >> 8) & 0xff), 2.0) + 
-							powf((float)((searchColor >> 16) & 0xff) - ((referenceColor >> 16) & 0xff), 2.0)
-						);
 
-					if (thisDelta < bestDelta)
-					{
-						bestDelta = thisDelta;
-						bestIndex = k;
-					}
-				}
-				
-				o[0] = bestIndex;
-				[memoizedColors setObject:[NSNumber numberWithUnsignedChar:bestIndex] forKey:[NSNumber numberWithUnsignedInt:searchColor]];		
-			}
+#pragma mark -
+#pragma mark Desktop Cache
 
-			p += 4;
-			o += bytespp;
-		}
-	}
-	/* TODO: Check if 32bpp copy is correct.
-	   I couldn't trigger a desksave on 32bpp capable server (Vista). ::atmosfear */
-	else if (conn->serverBpp == 32)
-	{
-		while (i++ < len)
-		{
-			o[3] = p[0];
-			o[2] = p[1];
-			o[1] = p[2];
-			o[0] = p[3];
-			
-			p += 4;
-			o += bytespp;
-		}
-	}
-	else // 24
+// Saves a section of the backing store into the rdesktop desktop cache. The cache holds backing store pixels as-is (4 bytes per pixel), so save and restore are a memcpy per row with no color conversion.
+void ui_desktop_save(RDConnectionRef conn, uint32 offset, int x, int y, int w, int h)
+{
+	LOCALS_FROM_CONN;
+	int pitch;
+	uint32 *pixels;
+	
+	if (x < 0 || y < 0 || w <= 0 || h <= 0 || x + w > [v width] || y + h > [v height])
 	{
-		while (i++ < len)
-		{
-			o[2] = p[1];
-			o[1] = p[2];
-			o[0] = p[3];
-			
-			p += 4;
-			o += bytespp;
-		}
+		error("desktop save %d,%d %dx%d outside screen\n", x, y, w, h);
+		return;
 	}
 	
-	// Put the translated screen dump into the rdesktop bitmap cache
-	offset *= bytespp;
-	cache_put_desktop(conn, offset, w, h, w*bytespp, bytespp, output);
-	
-	free(screenDumpBytes);
-	free(output);
-	CGContextRelease(screenDumpContext);
+	pixels = [v backingStorePixelAtX:x y:y pitch:&pitch];
+	cache_put_desktop(conn, offset * 4, w, h, pitch, 4, (uint8 *)pixels);
 }
 
 void ui_desktop_restore(RDConnectionRef conn, uint32 offset, int x, int y, int w, int h)
 {
 	LOCALS_FROM_CONN;
-		
-	offset *= (conn->serverBpp+7)/8;
-	uint8 *data = cache_get_desktop(conn, offset, w, h, (conn->serverBpp+7)/8);
+	uint8 *data = cache_get_desktop(conn, offset * 4, w, h, 4);
 	
 	if (data == NULL)
 		return; 
 	
 	NSRect r = NSMakeRect(x, y, w, h);
-	CRDBitmap *b = [[CRDBitmap alloc] initWithBitmapData:(const unsigned char *)data size:NSMakeSize(w, h) view:v];
-	
-	[[b image] setFlipped:NO];
-	[v focusBackingStore]; {
-		[[[[b image] representations] objectAtIndex:0] setProperty:NSImageColorSyncProfileData withValue:[[NSColorSpace genericRGBColorSpace] ICCProfileData]];
-		[b drawInRect:r fromRect:NSMakeRect(0,0,w,h) operation:NSCompositeCopy];
-	} [v releaseBackingStore];
-	
-	[b release]; b = nil;
+	[v drawPixels:(const uint32 *)data inRect:r];
 	
 	schedule_display_in_rect(conn, r);
-	
 }
 
 
@@ -333,28 +201,76 @@ void ui_desktop_restore(RDConnectionRef conn, uint32 offset, int x, int y, int w
 
 void ui_begin_update(RDConnectionRef conn)
 {
-	conn->updateEntireScreen = NO;
 }
 
 void ui_end_update(RDConnectionRef conn)
 {
 	LOCALS_FROM_CONN;
+	RDTileMap *dirty = &conn->dirtyTiles;
+	
+	BOOL needsPresent;
+	
+	if (tilemap_is_empty(dirty))
+		return;
+	
+	needsPresent = [v addDirtyTiles:dirty];
 	
-	if (conn->updateEntireScreen)
-		[v performSelectorOnMainThread:@selector(setNeedsDisplayOnMainThread:) withObject:[NSNumber numberWithBool:YES] waitUntilDone:NO];
+	// The connection is complete once its first frame has been handed over for presenting
+	if (timing_mark(conn, CONNECT_PHASE_FIRST_FRAME))
+		timing_log(conn);
 	
-	conn->updateEntireScreen = NO;
+	// Only the first update since the last present asks the main thread for another; later ones are merged into it
+	if (needsPresent)
+		[v performSelectorOnMainThread:@selector(schedulePresent) withObject:nil waitUntilDone:NO];
+	
+	if (conn->recorder != NULL && ![v recordUpdate:conn->recorder tiles:dirty])
+	{
+		CRDLog(CRDLogLevelError, @"Stopped recording the session: couldn't write to the recording");
+		record_close(conn->recorder);
+		conn->recorder = NULL;
+	}
+	
+	tilemap_clear(dirty);
 }
 
-static void schedule_display(RDConnectionRef conn)
+// Drawing into an offscreen surface doesn't change the screen until it is blitted there. The map is sized on first use and whenever the screen changes size, which redraws everything anyway.
+static void schedule_display_in_rect(RDConnectionRef conn, NSRect r)
 {
-	conn->updateEntireScreen = YES;
+	if (conn->currentSurface != NULL)
+		return;
+	
+	if (conn->dirtyTiles.width != conn->screenWidth || conn->dirtyTiles.height != conn->screenHeight)
+	{
+		if (!tilemap_init(&conn->dirtyTiles, conn->screenWidth, conn->screenHeight))
+		{
+			CRDLog(CRDLogLevelError, @"Couldn't allocate the dirty tiles of a %dx%d screen", conn->screenWidth, conn->screenHeight);
+			return;
+		}
+	}
+	
+	NSRect bounds = NSIntegralRect(r);
+	tilemap_add(&conn->dirtyTiles, bounds.origin.x, bounds.origin.y, bounds.size.width, bounds.size.height);
 }
 
-static void schedule_display_in_rect(RDConnectionRef conn, NSRect r)
+// Lines and polygons mark their bounds, widened by half the pen and a pixel for antialiasing. points[0] is where they start and each of the rest is relative to the one before, as RDP sends them.
+static void schedule_display_around_points(RDConnectionRef conn, const RDPoint *points, int npoints, int penWidth)
 {
-	// Since CRDSessionView simply flushes its entire buffer to view on draw, it's simpler and quicker to simply update the entire view. This remains from the non-OpenGL implementation but may be useful in the future.
-	conn->updateEntireScreen = YES;
+	if (npoints < 1)
+		return;
+	
+	int x = points[0].x, y = points[0].y, left = x, top = y, right = x, bottom = y, margin = penWidth / 2 + 1, i;
+	
+	for (i = 1; i < npoints; i++)
+	{
+		x += points[i].x;
+		y += points[i].y;
+		left = MIN(left, x);
+		top = MIN(top, y);
+		right = MAX(right, x);
+		bottom = MAX(bottom, y);
+	}
+	
+	schedule_display_in_rect(conn, NSMakeRect(left - margin, top - margin, right - left + 1 + 2 * margin, bottom - top + 1 + 2 * margin));
 }
 
 
@@ -394,7 +310,9 @@ void ui_line(RDConnectionRef conn, uint8 opcode, int startx, int starty, int end
 	
 	CHECKOPCODE(opcode);
 	[v drawLineFrom:start to:end color:[v nscolorForRDCColor:pen->colour] width:pen->width];
-	schedule_display(conn);
+	
+	RDPoint ends[2] = {{startx, starty}, {endx - startx, endy - starty}};
+	schedule_display_around_points(conn, ends, 2, pen->width);
 }
 
 void ui_screenblt(RDConnectionRef conn, uint8 opcode, int x, int y, int cx, int cy, int srcx, int srcy)
@@ -403,8 +321,7 @@ void ui_screenblt(RDConnectionRef conn, uint8 opcode, int x, int y, int cx, int
 	NSRect src = NSMakeRect(srcx, srcy, cx, cy);
 	NSPoint dest = NSMakePoint(x, y);
 	
-	CHECKOPCODE(opcode);
-	[v screenBlit:src to:dest];
+	[v screenBlit:src to:dest rop:opcode];
 	schedule_display_in_rect(conn, NSMakeRect(x, y, cx, cy));
 }
 
@@ -412,23 +329,8 @@ void ui_destblt(RDConnectionRef conn, uint8 opcode, int x, int y, int cx, int cy
 {
 	LOCALS_FROM_CONN;
 	NSRect r = NSMakeRect(x, y, cx, cy);
-	/* XXX */
-	switch (opcode)
-	{
-		case 0:
-			[v fillRect:r withColor:[NSColor blackColor]];
-			break;
-		case 5:
-			[v swapRect:r];
-			break;
-		case 15:
-			[v fillRect:r withColor:[NSColor whiteColor]];
-			break;
-		default:
-			CHECKOPCODE(opcode);
-			break;
-	}
 	
+	[v applyROP3:opcode toRect:r source:nil from:NSZeroPoint pattern:NULL origin:NSZeroPoint];
 	schedule_display_in_rect(conn, r);
 }
 
@@ -437,7 +339,7 @@ void ui_polyline(RDConnectionRef conn, uint8 opcode, RDPoint* points, int npoint
 	LOCALS_FROM_CONN;
 	CHECKOPCODE(opcode);
 	[v polyline:points npoints:npoints color:[v nscolorForRDCColor:pen->colour] width:pen->width];
-	schedule_display(conn);
+	schedule_display_around_points(conn, points, npoints, pen->width);
 }
 
 void ui_polygon(RDConnectionRef conn, uint8 opcode, uint8 fillmode, RDPoint* point, int npoints, RDBrush *brush, int bgcolour, int fgcolour)
@@ -560,129 +462,150 @@ void ui_polygon(RDConnectionRef conn, uint8 opcode, uint8 fillmode, RDPoint* poi
 			break;
 	}
 	
-	schedule_display(conn);
+	schedule_display_around_points(conn, point, npoints, 1);
 }
 
-/* XXX Still needs origins */
-void ui_patblt(RDConnectionRef conn, uint8 opcode, int x, int y, int cx, int cy, RDBrush * brush, int bgcolor, int fgcolor)
+// Expands a hatch or pattern brush into an 8x8 tile of backing store pixels. Tiles are cached per connection since the same few brushes (scrollbars, dithered backgrounds, selections) are used over and over.
+static const uint32 *brush_tile(RDConnectionRef conn, RDBrush *brush, int bgcolour, int fgcolour)
 {
 	LOCALS_FROM_CONN;
-	NSRect dest = NSMakeRect(x, y, cx, cy);
-	NSRect glyphSize;
-	CRDBitmap *bitmap;
-	NSImage *fill;
-	NSColor *fillColor;
-	uint8 i, ipattern[8];
+	RDBrushTile *tile;
+	RDBrushData *bd = NULL;
+	uint8 pattern[8];
+	uint32 hash, on, off;
+	int i, k, Bpp;
 	
-	if (opcode == 6)
+	memset(pattern, 0, sizeof(pattern));
+	
+	if (brush->style == 2)
 	{
-		[v swapRect:dest];
-		schedule_display_in_rect(conn, dest);
-		return;
+		if (brush->pattern[0] >= sizeof(hatch_patterns) / 8)
+			return NULL;
+		memcpy(pattern, hatch_patterns + brush->pattern[0] * 8, 8);
+	}
+	else if (brush->style == 3 && brush->bd == NULL)	/* rdp4 brush */
+	{
+		for (i = 0; i != 8; i++)
+			pattern[7 - i] = brush->pattern[i];
+	}
+	else if (brush->style == 3 && brush->bd->colour_code > 1)	/* > 1 bpp */
+	{
+		bd = brush->bd;
+		bgcolour = fgcolour = 0;
+	}
+	else if (brush->style == 3)
+	{
+		memcpy(pattern, brush->bd->data, 8);
+	}
+	else
+	{
+		return NULL;
 	}
 	
-	CHECKOPCODE(opcode);
+	hash = brush->style + (uint32)(uintptr_t)bd + fgcolour * 31 + bgcolour * 17;
+	for (i = 0; i < 8; i++)
+		hash = hash * 33 + pattern[i];
+	
+	tile = &conn->brushTileCache[hash % BRUSH_TILE_CACHE_SIZE];
+	
+	if (tile->valid && tile->generation == conn->brushTileGeneration && tile->style == brush->style &&
+			tile->bd == bd && tile->fgcolour == fgcolour && tile->bgcolour == bgcolour &&
+			!memcmp(tile->pattern, pattern, 8))
+		return tile->pixels;
+	
+	if (bd != NULL)
+	{
+		const uint8 *p = bd->data;
+		Bpp = bd->colour_code - 2;
+		
+		for (i = 0; i < 64; i++, p += Bpp)
+		{
+			if (Bpp == 1)
+				tile->pixels[i] = [v pixelForRDCColor:p[0]];
+			else if (Bpp == 2)
+				tile->pixels[i] = [v pixelForRDCColor:p[0] | (p[1] << 8)];
+			else
+				tile->pixels[i] = CFSwapInt32HostToLittle(0xff000000 | (p[2] << 16) | (p[1] << 8) | p[0]);
+		}
+	}
+	else
+	{
+		/* Set bits are foreground for hatches but background for patterns */
+		on = [v pixelForRDCColor:(brush->style == 2) ? fgcolour : bgcolour];
+		off = [v pixelForRDCColor:(brush->style == 2) ? bgcolour : fgcolour];
+		
+		for (i = 0; i < 8; i++)
+			for (k = 0; k < 8; k++)
+				tile->pixels[i * 8 + k] = (pattern[i] & (0x80 >> k)) ? on : off;
+	}
+	
+	tile->valid = True;
+	tile->generation = conn->brushTileGeneration;
+	tile->style = brush->style;
+	tile->bd = bd;
+	tile->fgcolour = fgcolour;
+	tile->bgcolour = bgcolour;
+	memcpy(tile->pattern, pattern, 8);
+	
+	return tile->pixels;
+}
+
+// The 8x8 tile for a PATBLT or TRIBLT brush, or NULL if the brush isn't supported. Solid brushes are expanded into solid.
+static const uint32 *brush_pattern(RDConnectionRef conn, RDBrush *brush, int bgcolour, int fgcolour, uint32 *solid)
+{
+	LOCALS_FROM_CONN;
+	const uint32 *tile;
+	uint32 pixel;
+	int i;
 	
 	switch (brush->style)
 	{
 		case 0: /* Solid */
-			[v fillRect:dest withColor:[v nscolorForRDCColor:fgcolor]];
-			schedule_display_in_rect(conn, dest);
-			break;
+			pixel = [v pixelForRDCColor:fgcolour];
+			for (i = 0; i < 64; i++)
+				solid[i] = pixel;
+			return solid;
 			
 		case 2: /* Hatch */
-
-			glyphSize = NSMakeRect(0, 0, 8, 8);
-            bitmap = ui_create_glyph(conn, 8, 8, hatch_patterns + brush->pattern[0] * 8);
-			fill = [bitmap image];
-			[fill lockFocus];
-			
-			[[NSGraphicsContext currentContext] setCompositingOperation:NSCompositeSourceAtop];
-			[[v nscolorForRDCColor:fgcolor] set];
-			[NSBezierPath fillRect:glyphSize];
-			
-			[[NSGraphicsContext currentContext] setCompositingOperation:NSCompositeDestinationAtop];
-			[[v nscolorForRDCColor:bgcolor] set];
-			[NSBezierPath fillRect:glyphSize];
-			
-			[fill unlockFocus];
-			
-			fillColor = [NSColor colorWithPatternImage:fill];
-			[v fillRect:dest withColor:fillColor patternOrigin:NSMakePoint(brush->xorigin, brush->yorigin)];
-            ui_destroy_glyph(bitmap);
-            break;
-			
 		case 3: /* Pattern */
-			if (brush->bd == 0)	/* rdp4 brush */
-			{
-				for (i = 0; i != 8; i++)
-					ipattern[7 - i] = brush->pattern[i];
-				
-				glyphSize = NSMakeRect(0, 0, 8, 8);
-				bitmap = ui_create_glyph(conn, 8, 8, ipattern);
-				fill = [bitmap image];
-				[fill lockFocus];
-				
-				[[NSGraphicsContext currentContext] setCompositingOperation:NSCompositeSourceAtop];
-				[[v nscolorForRDCColor:bgcolor] set];
-				[NSBezierPath fillRect:glyphSize];
-				
-				[[NSGraphicsContext currentContext] setCompositingOperation:NSCompositeDestinationAtop];
-				[[v nscolorForRDCColor:fgcolor] set];
-				[NSBezierPath fillRect:glyphSize];
-				
-				[fill unlockFocus];
-				
-				fillColor = [NSColor colorWithPatternImage:fill];
-				[v fillRect:dest withColor:fillColor patternOrigin:NSMakePoint(brush->xorigin, brush->yorigin)];
-				ui_destroy_glyph(bitmap);
-			}
-			else if (brush->bd->colour_code > 1)	/* > 1 bpp */
-			{
-				bitmap = ui_create_glyph(conn, 8, 8, brush->bd->data);
-				fill = [bitmap image];
-				
-				fillColor = [NSColor colorWithPatternImage:fill];
-				[v fillRect:dest withColor:fillColor patternOrigin:NSMakePoint(brush->xorigin, brush->yorigin)];
-				ui_destroy_glyph(bitmap);
-			}
-			else
-			{
-				glyphSize = NSMakeRect(0, 0, 8, 8);
-				bitmap = ui_create_glyph(conn, 8, 8, brush->bd->data);
-				fill = [bitmap image];
-				[fill lockFocus];
-				
-				[[NSGraphicsContext currentContext] setCompositingOperation:NSCompositeSourceAtop];
-				[[v nscolorForRDCColor:bgcolor] set];
-				[NSBezierPath fillRect:glyphSize];
-				
-				[[NSGraphicsContext currentContext] setCompositingOperation:NSCompositeDestinationAtop];
-				[[v nscolorForRDCColor:fgcolor] set];
-				[NSBezierPath fillRect:glyphSize];
-				
-				[fill unlockFocus];
-				
-				fillColor = [NSColor colorWithPatternImage:fill];
-				[v fillRect:dest withColor:fillColor patternOrigin:NSMakePoint(brush->xorigin, brush->yorigin)];
-				ui_destroy_glyph(bitmap);
-			}
-			break;
-			
-		default:
-			unimpl("brush %d\n", brush->style);
+			if ((tile = brush_tile(conn, brush, bgcolour, fgcolour)) != NULL)
+				return tile;
 			break;
 	}
+	
+	unimpl("brush %d\n", brush->style);
+	return NULL;
+}
+
+void ui_patblt(RDConnectionRef conn, uint8 opcode, int x, int y, int cx, int cy, RDBrush * brush, int bgcolor, int fgcolor)
+{
+	LOCALS_FROM_CONN;
+	NSRect dest = NSMakeRect(x, y, cx, cy);
+	const uint32 *tile = NULL;
+	uint32 solid[64];
+	
+	if (ROP3_USES_PAT(opcode) && (tile = brush_pattern(conn, brush, bgcolor, fgcolor, solid)) == NULL)
+		return;
+	
+	[v applyROP3:opcode toRect:dest source:nil from:NSZeroPoint pattern:tile origin:NSMakePoint(brush->xorigin, brush->yorigin)];
 	schedule_display_in_rect(conn, dest);
 }
 
-void ui_triblt(uint8 opcode, 
+void ui_triblt(RDConnectionRef conn, uint8 opcode, 
 			   int x, int y, int cx, int cy,
 			   RDBitmapRef src, int srcx, int srcy,
 			   RDBrush *brush, int bgcolour, int fgcolour)
 {
-	CHECKOPCODE(opcode);
-	UNIMPL;
+	LOCALS_FROM_CONN;
+	NSRect dest = NSMakeRect(x, y, cx, cy);
+	const uint32 *tile = NULL;
+	uint32 solid[64];
+	
+	if (ROP3_USES_PAT(opcode) && (tile = brush_pattern(conn, brush, bgcolour, fgcolour, solid)) == NULL)
+		return;
+	
+	[v applyROP3:opcode toRect:dest source:(CRDBitmap *)src from:NSMakePoint(srcx, srcy) pattern:tile origin:NSMakePoint(brush->xorigin, brush->yorigin)];
+	schedule_display_in_rect(conn, dest);
 }
 
 void ui_ellipse(RDConnectionRef conn, uint8 opcode, uint8 fillmode, int x, int y, int cx, int cy,
@@ -948,9 +871,28 @@ void ui_reset_clip(RDConnectionRef conn)
 #pragma mark -
 #pragma mark Cursors and Pointers
 
+// Returns a cursor converted before from the same data when there is one. Cursors made from palette indices aren't kept, since the palette may change under them.
 RDCursorRef ui_create_cursor(RDConnectionRef conn, signed int x, signed int y, int width, int height, uint8 * andmask, uint8 * xormask, int bpp)
 {
-	return [[CRDBitmap alloc] initWithCursorData:xormask alpha:andmask size:NSMakeSize(width, height) hotspot:NSMakePoint(x, y) view:conn->ui bpp:bpp];
+	CRDBitmap *cursor;
+	int andlen, xorlen;
+	BOOL cacheable = width > 0 && height > 0 && andmask != NULL && xormask != NULL && bpp != 4 && bpp != 8;
+	
+	if (cacheable)
+	{
+		andlen = CRDRoundUpToEven(width / 8.0f) * height;
+		xorlen = CRDRoundUpToEven(width * ((bpp == 15) ? 16 : bpp) / 8.0f) * height;
+		
+		if ( (cursor = cache_get_cursor_shape(conn, x, y, width, height, andmask, andlen, xormask, xorlen, bpp)) )
+			return [cursor retain];
+	}
+	
+	cursor = [[CRDBitmap alloc] initWithCursorData:xormask alpha:andmask size:NSMakeSize(width, height) hotspot:NSMakePoint(x, y) view:conn->ui bpp:bpp];
+	
+	if (cacheable)
+		cache_put_cursor_shape(conn, x, y, width, height, andmask, andlen, xormask, xorlen, bpp, [cursor retain]);
+	
+	return cursor;
 }
 
 void ui_set_null_cursor(RDConnectionRef conn)
@@ -967,6 +909,15 @@ void ui_set_cursor(RDConnectionRef conn, RDCursorRef cursor)
 {
 	LOCALS_FROM_CONN;
 	id c = (CRDBitmap *)cursor;
+	
+	// The same pointer found in the shape cache again; nothing to wait for the main thread about
+	if (c == conn->currentCursor)
+		return;
+	
+	[c retain];
+	[conn->currentCursor release];
+	conn->currentCursor = c;
+	
 	[v performSelectorOnMainThread:@selector(setCursor:) withObject:[c cursor] waitUntilDone:YES];
 }
 
@@ -24,7 +24,7 @@
 @class CRDServerCell;
 @class CRDSessionView;
 
-@interface CRDSession : NSObject <NSMachPortDelegate, NSStreamDelegate, NSWindowDelegate>
+@interface CRDSession : NSObject <NSWindowDelegate>
 {
 	// Represented rdesktop object
 	RDConnectionRef conn;
@@ -38,10 +38,14 @@
 	
 	// Working between main thread and connection thread
 	volatile BOOL connectionRunLoopFinished;
-	NSRunLoop *connectionRunLoop;
+	RDEventLoop *eventLoop;
 	NSThread *connectionThread;
-	NSMachPort *inputEventPort;
-	NSMutableArray *inputEventStack;
+	CRDInputEventRing inputEventRing;
+	NSMutableData *inputOverflow; // CRDInputEvents that didn't fit in the ring, @synchronized on itself
+	volatile BOOL inputOverflowing; // set by the main thread once inputOverflow holds any
+	CRDInputLatency inputLatency;
+	volatile BOOL sessionVisible;
+	int suppressOutputTimer;
 
 	// General information about instance
 	BOOL isTemporary, modified, temporarilyFullscreen, _usesScrollers;
@@ -62,6 +66,8 @@
 	NSScrollView *scrollEnclosure;
 	CRDServerCell *cellRepresentation;
 	NSWindow *window;
+	NSTimer *thumbnailTimer;
+	NSImage *cellThumbnail;
 }
 
 @property (copy,nonatomic) NSString *hostName, *label, *clientHostname;
@@ -85,6 +91,7 @@
 - (void)disconnectAsync:(NSNumber *)nonblocking;
 - (void)sendInputOnConnectionThread:(uint32)time type:(uint16)type flags:(uint16)flags param1:(uint16)param1 param2:(uint16)param2;
 - (void)runConnectionRunLoop;
+- (void)setVisible:(BOOL)visible;
 
 // Clipboard
 - (void)announceNewClipboardData;
@@ -16,6 +16,8 @@
 */
 
 #import <CoreServices/CoreServices.h>
+#import <libkern/OSAtomic.h>
+#import <mach/mach_time.h>
 
 #import "CRDSession.h"
 #import "CRDSessionView.h"
@@ -33,10 +35,41 @@
 - (void)createViewWithFrameValue:(NSValue *)frameRect;
 - (void)setUpConnectionThread;
 - (void)discardConnectionThread;
+- (void)processIncomingData;
+- (void)sendQueuedInput;
+- (void)sendInputEvents:(const CRDInputEvent *)queued count:(int)count;
+- (void)updateOutputSuppression;
+- (void)suppressOutput;
 @end
 
 #pragma mark -
 
+// Event loop callbacks, on the connection thread
+static void CRDSessionSocketReady(RDEventLoop *loop, int fd, int events, void *context)
+{
+	if ( (events & EVLOOP_ERROR) && !(events & EVLOOP_READ) )
+	{
+		evloop_remove_fd(loop, fd);
+		[g_appController performSelectorOnMainThread:@selector(disconnectInstance:) withObject:(CRDSession *)context waitUntilDone:NO];
+		return;
+	}
+	
+	[(CRDSession *)context processIncomingData];
+}
+
+static void CRDSessionWakeup(RDEventLoop *loop, void *context)
+{
+	[(CRDSession *)context sendQueuedInput];
+	[(CRDSession *)context updateOutputSuppression];
+}
+
+static void CRDSessionSuppressOutputTimer(RDEventLoop *loop, void *context)
+{
+	[(CRDSession *)context suppressOutput];
+}
+
+#pragma mark -
+
 @implementation CRDSession
 
 - (id)init
@@ -56,7 +89,7 @@
 	otherAttributes = [[NSMutableDictionary alloc] init];
 	
 	cellRepresentation = [[CRDServerCell alloc] init];
-	inputEventStack = [[NSMutableArray alloc] init];
+	inputOverflow = [[NSMutableData alloc] init];
 	
 	[self setStatus:CRDConnectionClosed];
 	
@@ -115,10 +148,6 @@
 	while (connectionStatus != CRDConnectionClosed)
 		usleep(1000);
 	
-	[inputEventPort invalidate];
-	[inputEventPort release];
-	[inputEventStack release];
-	
 	[label release];
 	[hostName release];
 	[clientHostname release];
@@ -126,7 +155,9 @@
 	[password release];
 	[domain release];
 	[otherAttributes release];
+	[inputOverflow release];
 	[rdpFilename release];
+	[cellThumbnail release];
 	
 		
 	[cellRepresentation release];
@@ -183,15 +214,9 @@
 #pragma mark -
 #pragma mark Working with rdesktop
 
-// Invoked on incoming data arrival, starts the processing of incoming packets
-- (void)stream:(NSStream *)stream handleEvent:(NSStreamEvent)streamEvent
+// Invoked by the event loop when the socket is readable, starts the processing of incoming packets
+- (void)processIncomingData
 {
-	if (streamEvent == NSStreamEventErrorOccurred)
-	{
-		[g_appController performSelectorOnMainThread:@selector(disconnectInstance:) withObject:self waitUntilDone:NO];
-		return;
-	}
-
 	uint8 type;
 	RDStreamRef s;
 	uint32 ext_disc_reason;
@@ -204,6 +229,8 @@
 		s = rdp_recv(conn, &type);
 		if (s == NULL)
 		{
+			// Stop polling the dead socket while the main thread tears the connection down
+			evloop_remove_fd(eventLoop, conn->tcpSocket);
 			[g_appController performSelectorOnMainThread:@selector(disconnectInstance:) withObject:self waitUntilDone:NO];
 			return;
 		}
@@ -232,7 +259,10 @@
 				unimpl("PDU %d\n", type);
 		}
 		
-	} while ( (conn->nextPacket < s->end) && (connectionStatus == CRDConnectionConnected) );
+		arena_reset(&conn->arena);
+		
+		// PDUs already pulled off the socket by the read-ahead won't make it readable again
+	} while ( (conn->nextPacket < s->end || tcp_data_buffered(conn)) && (connectionStatus == CRDConnectionConnected) );
 }
 
 // Using the current properties, attempt to connect to a server. Blocks until timeout or failure.
@@ -292,6 +322,9 @@
 	
 	conn->rdp5PerformanceFlags = performanceFlags;
 	
+	// Further limited once the link has been measured, see rdp_connect
+	conn->autoPerformanceFlags = CRDPreferenceIsEnabled(CRDAdaptToNetwork);
+	
 
 	// Simple heuristic to guess if user wants to auto log-in
 	unsigned logonFlags = RDP_LOGON_NORMAL;
@@ -311,6 +344,33 @@
 	conn->tcpPort = (!port || port>=65536) ? CRDDefaultPort : port;
 	strncpy(conn->username, CRDMakeWindowsString(username), sizeof(conn->username));
 
+	// Bitmap cache geometry (cells per cache), for sessions with large desktops
+	NSArray *cacheCells = [[NSUserDefaults standardUserDefaults] arrayForKey:CRDDefaultsBitmapCacheCells];
+	for (int i = 0; i < MIN([cacheCells count], BITMAP_CACHE_SIZE); i++)
+		conn->bmpcacheCells[i] = [[cacheCells objectAtIndex:i] intValue];
+	
+	NSString *cacheTracePath = [[NSUserDefaults standardUserDefaults] stringForKey:CRDDefaultsBitmapCacheTracePath];
+	if ([cacheTracePath length])
+		conn->bmpcacheTrace = fopen([[cacheTracePath stringByExpandingTildeInPath] fileSystemRepresentation], "w");
+	
+	// Connection phase timings, one line per connection
+	NSString *timingPath = [[NSUserDefaults standardUserDefaults] stringForKey:CRDDefaultsConnectTimingPath];
+	if ([timingPath length])
+		conn->connectTimingFile = fopen([[timingPath stringByExpandingTildeInPath] fileSystemRepresentation], "a");
+	
+	// Session recording, one file per connection in the given folder (see Tools/record_play.c)
+	NSString *recordingFolder = [[[NSUserDefaults standardUserDefaults] stringForKey:CRDDefaultsRecordingPath] stringByExpandingTildeInPath];
+	if ([recordingFolder length])
+	{
+		NSString *recordingName = [NSString stringWithFormat:@"%@ %@", [label length] ? label : hostName, [[NSDate date] descriptionWithCalendarFormat:@"%Y-%m-%d %H.%M.%S" timeZone:nil locale:nil]];
+		NSString *recordingPath = CRDFindAvailableFileName(recordingFolder, [recordingName stringByReplacingOccurrencesOfString:@"/" withString:@"-"], @".cordrec");
+		
+		CRDCreateDirectory(recordingFolder);
+		conn->recorder = record_open([recordingPath fileSystemRepresentation], time(NULL), 0);
+		if (conn->recorder == NULL)
+			CRDLog(CRDLogLevelError, @"Couldn't start recording the session to %@", recordingPath);
+	}
+
 	// Set remote keymap to match local OS X input type
 	if (CRDPreferenceIsEnabled(CRDSetServerKeyboardLayout))
 		conn->keyboardLayout = [CRDKeyboard windowsKeymapForMacKeymap:[CRDKeyboard currentKeymapIdentifier]];
@@ -391,16 +451,25 @@
 	if (connected)
 	{
 		[self setStatus:CRDConnectionConnected];
+		sessionVisible = YES;
 		[self setUpConnectionThread];
 
-		NSStream *is = conn->inputStream;
-		[is setDelegate:self];
-		[is scheduleInRunLoop:connectionRunLoop forMode:NSDefaultRunLoopMode];
+		if (eventLoop == NULL || evloop_add_fd(eventLoop, conn->tcpSocket, EVLOOP_READ, CRDSessionSocketReady, self) == -1)
+			CRDLog(CRDLogLevelError, @"Couldn't watch the socket for %@, no updates will be received", label);
 
 		[self performSelectorOnMainThread:@selector(createViewWithFrameValue:) withObject:[NSValue valueWithRect:NSMakeRect(0.0, 0.0, conn->screenWidth, conn->screenHeight)] waitUntilDone:YES];
 	}
 	else if (connectionStatus == CRDConnectionConnecting)
 	{
+		// Show how far the connection got
+		timing_log(conn);
+		if (conn->connectTimingFile != NULL)
+			fclose(conn->connectTimingFile);
+		if (conn->recorder != NULL)
+			record_close(conn->recorder);
+		conn->connectTimingFile = NULL;
+		conn->recorder = NULL;
+		
 		[self setStatus:CRDConnectionClosed];
 		[self performSelectorOnMainThread:@selector(setStatusAsNumber:) withObject:[NSNumber numberWithInt:CRDConnectionClosed] waitUntilDone:NO];
 	}
@@ -426,7 +495,8 @@
 		// Try to forcefully break the connection thread out of its run loop
 		@synchronized(self)
 		{
-			[inputEventPort sendBeforeDate:[NSDate dateWithTimeIntervalSinceNow:TIMEOUT_LENGTH] components:nil from:nil reserved:0];
+			if (eventLoop != NULL)
+				evloop_stop(eventLoop);
 		}
 		
 		time_t start = time(NULL);
@@ -438,22 +508,28 @@
 
 		
 		// Clear out the bitmap cache
-		int i, k;
-		for (i = 0; i < BITMAP_CACHE_SIZE; i++)
-		{
-			for (k = 0; k < BITMAP_CACHE_ENTRIES; k++)
-			{	
-				ui_destroy_bitmap(conn->bmpcache[i][k].bitmap);
-				conn->bmpcache[i][k].bitmap = NULL;
-			}
-		}
+		int i;
+		cache_free_bitmaps(conn);
 		
 		for (i = 0; i < CURSOR_CACHE_SIZE; i++)
 			ui_destroy_cursor(conn->cursorCache[i]);
+		cache_free_cursor_shapes(conn);
+		ui_destroy_cursor(conn->currentCursor);
 		
+		conn->currentSurface = NULL;
+		cache_reset_offscreen(conn);
 		
-		free(conn->rdpdrClientname);
 		
+		free(conn->rdpdrClientname);
+		xfree(conn->fastPathFragment.data);
+		tilemap_destroy(&conn->dirtyTiles);
+		if (conn->connectTimingFile != NULL)
+			fclose(conn->connectTimingFile);
+		if (conn->recorder != NULL && !record_close(conn->recorder))
+			CRDLog(CRDLogLevelError, @"Couldn't finish the recording of %@", label);
+		CRDLog(CRDLogLevelDebug, @"%@: %llu scratch allocations over %llu PDUs, %llu of them from malloc; %llu xmalloc calls in all",
+				label, conn->arena.allocs, conn->arena.resets, conn->arena.mallocs, xmalloc_count());
+		arena_free(&conn->arena);
 		
 		memset(conn, 0, sizeof(RDConnection));
 		free(conn);
@@ -478,13 +554,14 @@
 	
 	connectionRunLoopFinished = NO;
 	
-	BOOL gotInput;
-	do
+	// Sleeps until the server sends something, input is queued, a timer is due or disconnectAsync: stops the loop
+	int dispatched = 0;
+	while (eventLoop != NULL && connectionStatus == CRDConnectionConnected && dispatched >= 0)
 	{
 		pool = [[NSAutoreleasePool alloc] init];
-		gotInput = [[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.25]];
+		dispatched = evloop_run_once(eventLoop, -1);
 		[pool release];
-	} while (connectionStatus == CRDConnectionConnected && gotInput);
+	}
 	
 	pool = [[NSAutoreleasePool alloc] init];
 	
@@ -689,6 +766,18 @@ static uint32 getUTF16StringByteCount(uint8 *data,uint32 length)
 	NSString *fullHost = (port && port != CRDDefaultPort) ? [NSString stringWithFormat:@"%@:%i", hostName, (int)port] : hostName;
 	[cellRepresentation setDisplayedText:label username:username address:fullHost];
 	
+	// While connected, the picture is a thumbnail of the session, refreshed every so often
+	if (connectionStatus == CRDConnectionConnected && thumbnailTimer == nil)
+		thumbnailTimer = [[NSTimer scheduledTimerWithTimeInterval:CRDThumbnailRefreshInterval target:self selector:@selector(refreshThumbnail:) userInfo:nil repeats:YES] retain];
+	else if (connectionStatus != CRDConnectionConnected && thumbnailTimer != nil)
+	{
+		[thumbnailTimer invalidate];
+		[thumbnailTimer release];
+		thumbnailTimer = nil;
+		[cellThumbnail release];
+		cellThumbnail = nil;
+	}
+	
 	// Update the image
 	if (connectionStatus != CRDConnectionConnecting)
 	{
@@ -698,13 +787,23 @@ static uint32 getUTF16StringByteCount(uint8 *data,uint32 length)
 			iconBaseName = @"RDP Document Gray";
 			
 		NSImage *base = [NSImage imageNamed:iconBaseName];
+		NSRect baseRect = NSMakeRect(0, 0, SERVER_CELL_FULL_IMAGE_SIZE, SERVER_CELL_FULL_IMAGE_SIZE);
+		
+		if (connectionStatus == CRDConnectionConnected && cellThumbnail == nil)
+			cellThumbnail = [[view thumbnailWithSize:baseRect.size] retain];
+		
+		if (cellThumbnail != nil)
+		{
+			base = cellThumbnail;
+			baseRect = NSInsetRect(baseRect, (baseRect.size.width - [base size].width) / 2.0, (baseRect.size.height - [base size].height) / 2.0);
+		}
 		[base setFlipped:YES];
 		
 		NSImage *cellImage = [[[NSImage alloc] initWithSize:NSMakeSize(SERVER_CELL_FULL_IMAGE_SIZE, SERVER_CELL_FULL_IMAGE_SIZE)] autorelease];
 		
 		[cellImage lockFocus]; {
 			[[NSGraphicsContext currentContext] setImageInterpolation:NSImageInterpolationHigh];
-			[base drawInRect:CRDRectFromSize([cellImage size]) fromRect:CRDRectFromSize([base size]) operation:NSCompositeSourceOver fraction:1.0];
+			[base drawInRect:baseRect fromRect:CRDRectFromSize([base size]) operation:NSCompositeSourceOver fraction:1.0];
 		} [cellImage unlockFocus];
 
 		if ([self isTemporary])
@@ -713,7 +812,7 @@ static uint32 getUTF16StringByteCount(uint8 *data,uint32 length)
 			[cellImage lockFocus]; {
 				[[NSGraphicsContext currentContext] setImageInterpolation:NSImageInterpolationHigh];
 
-				[base drawInRect:CRDRectFromSize([cellImage size]) fromRect:CRDRectFromSize([base size]) operation:NSCompositeSourceOver fraction:1.0];
+				[base drawInRect:baseRect fromRect:CRDRectFromSize([base size]) operation:NSCompositeSourceOver fraction:1.0];
 			
 				NSImage *clockIcon = [NSImage imageNamed:@"Clock icon"];
 				NSSize clockSize = [clockIcon size], iconSize = [cellImage size];
@@ -728,6 +827,19 @@ static uint32 getUTF16StringByteCount(uint8 *data,uint32 length)
 	[g_appController cellNeedsDisplay:cellRepresentation];
 }
 
+// The view only makes a new thumbnail when the screen has changed, so the cell is redrawn only then
+- (void)refreshThumbnail:(NSTimer *)timer
+{
+	NSImage *thumbnail = [view thumbnailWithSize:NSMakeSize(SERVER_CELL_FULL_IMAGE_SIZE, SERVER_CELL_FULL_IMAGE_SIZE)];
+	
+	if (thumbnail == nil || thumbnail == cellThumbnail)
+		return;
+	
+	[cellThumbnail release];
+	cellThumbnail = [thumbnail retain];
+	[self updateCellData];
+}
+
 - (void)createWindow:(BOOL)useScrollView
 {	
 	[NSAnimationContext beginGrouping];
@@ -836,6 +948,7 @@ static uint32 getUTF16StringByteCount(uint8 *data,uint32 length)
 #pragma mark -
 #pragma mark Sending input from other threads
 
+// Must only be called from one thread other than the connection thread (the main thread), as the ring has a single producer
 - (void)sendInputOnConnectionThread:(uint32)time type:(uint16)type flags:(uint16)flags param1:(uint16)param1 param2:(uint16)param2
 {
 	if (connectionStatus != CRDConnectionConnected)
@@ -844,40 +957,167 @@ static uint32 getUTF16StringByteCount(uint8 *data,uint32 length)
 	if ([NSThread currentThread] == connectionThread)
 	{
 		rdp_send_input(conn, time, type, flags, param1, param2);
+		return;
 	}
-	else
-	{	
-		// Push this event onto the event stack and handle it in the connection thread
-		CRDInputEvent queuedEvent = CRDMakeInputEvent(time, type, flags, param1, param2), *ie;
-		
-		ie = malloc(sizeof(CRDInputEvent));
-		memcpy(ie, &queuedEvent, sizeof(CRDInputEvent));
+	
+	CRDInputEventRing *ring = &inputEventRing;
+	uint32_t head = ring->head;
+	CRDInputEvent event = CRDMakeInputEvent(time, type, flags, param1, param2);
+	
+	event.queuedAt = mach_absolute_time();
+	
+	// If the connection thread has fallen behind, mouse motion is dropped and anything else (button and key transitions) waits in the overflow queue, so the main thread never waits. Nothing goes into the ring while the overflow holds events, which keeps them in order.
+	if (inputOverflowing || head - ring->tail == CRDInputEventRingSize)
+	{
+		if (type == RDP_INPUT_MOUSE && flags == MOUSE_FLAG_MOVE)
+		{
+			inputLatency.dropped++;
+			return;
+		}
 		
-		@synchronized(inputEventStack)
+		@synchronized(inputOverflow)
 		{
-			[inputEventStack addObject:[NSValue valueWithPointer:ie]];
+			[inputOverflow appendBytes:&event length:sizeof(event)];
+			inputOverflowing = YES;
 		}
+	}
+	else
+	{
+		ring->events[head % CRDInputEventRingSize] = event;
 		
-		// Inform the connection thread it has unprocessed events
-		[inputEventPort sendBeforeDate:[NSDate date] components:nil from:nil reserved:0];
+		// Publish the event before the new head
+		OSMemoryBarrier();
+		ring->head = head + 1;
+	}
+	
+	// The event loop folds wakeups together while one is pending, and clears it before calling sendQueuedInput, which picks up everything queued so far
+	@synchronized(self)
+	{
+		if (eventLoop != NULL)
+			evloop_wakeup(eventLoop);
 	}
 }
 
-// Called by the connection thread in the run loop when new user input needs to be sent
-- (void)handleMachMessage:(void *)msg
+// Called by the connection thread in the event loop when new user input needs to be sent
+- (void)sendQueuedInput
 {
-    @synchronized(inputEventStack)
+	CRDInputEventRing *ring = &inputEventRing;
+	CRDInputEvent queued[CRDInputEventRingSize];
+	uint32_t head, tail = ring->tail;
+	NSData *overflow = nil;
+	int count, i;
+	
+	// The event loop cleared its wakeup before calling this, so any event published after head is read wakes it again
+	head = ring->head;
+	OSMemoryBarrier();
+	
+	count = head - tail;
+	for (i = 0; i < count; i++)
+		queued[i] = ring->events[(tail + i) % CRDInputEventRingSize];
+	
+	// Release the slots, then send everything pending together
+	OSMemoryBarrier();
+	ring->tail = head;
+	
+	// Overflowed events came after everything in the ring, so they wait while it holds events this drain didn't see; those sent a wakeup of their own
+	if (inputOverflowing)
 	{
-		while ([inputEventStack count] != 0)
+		OSMemoryBarrier();
+		if (ring->head == head)
 		{
-			CRDInputEvent *ie = [[inputEventStack objectAtIndex:0] pointerValue];
-			[inputEventStack removeObjectAtIndex:0];
-			if (ie != NULL)
-				[self sendInputOnConnectionThread:ie->time type:ie->type flags:ie->deviceFlags param1:ie->param1 param2:ie->param2];
-			
-			free(ie);
+			@synchronized(inputOverflow)
+			{
+				overflow = [inputOverflow copy];
+				[inputOverflow setLength:0];
+				inputOverflowing = NO;
+			}
+		}
+	}
+	
+	[self sendInputEvents:queued count:count];
+	[self sendInputEvents:[overflow bytes] count:[overflow length] / sizeof(CRDInputEvent)];
+	[overflow release];
+}
+
+// Sends events taken from the queues, oldest first, and notes how long they waited
+- (void)sendInputEvents:(const CRDInputEvent *)queued count:(int)count
+{
+	RDInputEvent events[RDP_INPUT_MAX_EVENTS];
+	uint64_t oldest, queuedSum = 0, now;
+	int n, i;
+	
+	if (count == 0 || connectionStatus != CRDConnectionConnected)
+		return;
+	
+	oldest = queued[0].queuedAt;
+	for (n = 0; n < count; n += i)
+	{
+		for (i = 0; i < RDP_INPUT_MAX_EVENTS && n + i < count; i++)
+		{
+			const CRDInputEvent *ie = &queued[n + i];
+			events[i].time = ie->time;
+			events[i].type = ie->type;
+			events[i].deviceFlags = ie->deviceFlags;
+			events[i].param1 = ie->param1;
+			events[i].param2 = ie->param2;
+			queuedSum += ie->queuedAt;
+		}
+		rdp_send_input_events(conn, events, i);
+	}
+	
+	now = mach_absolute_time();
+	inputLatency.events += count;
+	inputLatency.batches++;
+	inputLatency.total += now * count - queuedSum;
+	inputLatency.max = MAX(inputLatency.max, now - oldest);
+}
+
+// Called on the main thread when the session view may have been hidden or shown
+- (void)setVisible:(BOOL)visible
+{
+	if (sessionVisible == visible)
+		return;
+	
+	sessionVisible = visible;
+	
+	@synchronized(self)
+	{
+		if (eventLoop != NULL)
+			evloop_wakeup(eventLoop);
+	}
+}
+
+// A hidden session asks the server to stop sending updates. Hiding is put off for a moment so that flipping through tabs doesn't cost every session passed over a full repaint.
+- (void)updateOutputSuppression
+{
+	if (connectionStatus != CRDConnectionConnected)
+		return;
+	
+	if (sessionVisible)
+	{
+		if (suppressOutputTimer != 0)
+			evloop_cancel_timer(eventLoop, suppressOutputTimer);
+		suppressOutputTimer = 0;
+		
+		if (conn->currentStatus == 0)
+		{
+			rdp_send_client_window_status(conn, 1);
+			if (conn->serverRefreshRect)
+				rdp_send_refresh_rect(conn, 0, 0, conn->screenWidth, conn->screenHeight);
 		}
 	}
+	else if (conn->currentStatus == 1 && suppressOutputTimer == 0 && conn->serverSuppressOutput)
+	{
+		suppressOutputTimer = evloop_add_timer(eventLoop, CRDSuppressOutputDelay, 0, CRDSessionSuppressOutputTimer, self);
+	}
+}
+
+- (void)suppressOutput
+{
+	suppressOutputTimer = 0;
+	
+	if (!sessionVisible && connectionStatus == CRDConnectionConnected)
+		rdp_send_client_window_status(conn, 0);
 }
 
 
@@ -1220,11 +1460,13 @@ static uint32 getUTF16StringByteCount(uint8 *data,uint32 length)
 	@synchronized(self)
 	{
 		connectionThread = [NSThread currentThread];
-		connectionRunLoop  = [NSRunLoop currentRunLoop];
 
-		inputEventPort = [[NSMachPort alloc] init];
-		[inputEventPort setDelegate:self];
-		[connectionRunLoop addPort:inputEventPort forMode:(NSString *)kCFRunLoopCommonModes];
+		eventLoop = evloop_new();
+		if (eventLoop == NULL)
+			CRDLog(CRDLogLevelError, @"Couldn't create the event loop for %@", label);
+		else
+			evloop_set_wakeup_handler(eventLoop, CRDSessionWakeup, self);
+		conn->eventLoop = eventLoop;
 	}
 }
 
@@ -1232,22 +1474,51 @@ static uint32 getUTF16StringByteCount(uint8 *data,uint32 length)
 {
 	@synchronized(self)
 	{
-		[connectionRunLoop removePort:inputEventPort forMode:(NSString *)kCFRunLoopCommonModes];
-		[inputEventPort invalidate];
-		[inputEventPort release];
-		inputEventPort = nil;
+		if (eventLoop != NULL)
+		{
+			RDEventLoopStats stats;
+			evloop_get_stats(eventLoop, &stats);
+			
+			if (stats.wakeups != 0)
+				CRDLog(CRDLogLevelInfo, @"Connection thread for %@: %llu wakeups (%llu coalesced), dispatch latency mean %.3f ms, max %.3f ms, %llu timers, %llu iterations",
+						label, stats.wakeups, stats.coalesced, stats.latencyTotal / 1000.0 / stats.wakeups, stats.latencyMax / 1000.0,
+						stats.timers, stats.iterations);
+			
+			evloop_free(eventLoop);
+			eventLoop = NULL;
+		}
+		conn->eventLoop = NULL;
+		suppressOutputTimer = 0;
 	
-		@synchronized(inputEventStack)
+		// Anything still queued is discarded
+		inputEventRing.tail = inputEventRing.head;
+		@synchronized(inputOverflow)
 		{
-			while ([inputEventStack count] != 0)
-			{
-				free([[inputEventStack objectAtIndex:0] pointerValue]);
-				[inputEventStack removeObjectAtIndex:0];
-			}
+			[inputOverflow setLength:0];
+			inputOverflowing = NO;
+		}
+		
+		if (inputLatency.batches != 0)
+		{
+			mach_timebase_info_data_t timebase;
+			mach_timebase_info(&timebase);
+			double unitsPerMs = 1e6 * timebase.denom / timebase.numer;
+			
+			CRDLog(CRDLogLevelInfo, @"Input to %@: %llu events in %llu batches, latency mean %.3f ms, max %.3f ms, %llu motion events dropped",
+					label, inputLatency.events, inputLatency.batches, inputLatency.total / unitsPerMs / inputLatency.events,
+					inputLatency.max / unitsPerMs, inputLatency.dropped);
+		}
+		memset(&inputLatency, 0, sizeof(inputLatency));
+		
+		if (conn->ui != nil)
+		{
+			CRDFrameStats frames = [conn->ui frameStats];
+			
+			if (frames.decoded != 0)
+				CRDLog(CRDLogLevelInfo, @"Frames for %@: %llu decoded, %llu presented, %llu dropped", label, frames.decoded, frames.presented, frames.dropped);
 		}
 		
 		connectionThread = nil;
-		connectionRunLoop = nil;
 	}
 }
 
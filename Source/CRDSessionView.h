@@ -36,15 +36,37 @@
 	GLuint rdBufferTexture;
 	int rdBufferWidth, rdBufferHeight;
 	
+	// Where drawing goes: the back buffer, or an offscreen surface selected by the server
+	CGContextRef targetContext;
+	unsigned char *targetBitmapData;
+	int targetWidth, targetHeight;
+	
 	NSPoint mouseLoc;
 	NSRect clipRect;
 	NSCursor *cursor;
 	int bitdepth;
 	CRDKeyboard *keyTranslator;
-	unsigned int *colorMap;	// always a size of 256
+	unsigned int *colorMap;	// always a size of 256, as backing store pixels
 	NSSize screenSize;
 	BOOL drawnRect;
 	
+	// Completed updates, copied out of the back buffer by the connection thread for the main thread to upload
+	RDFramebuffer presentBuffers;
+	RDTileMap textureDamage;
+	BOOL textureNeedsFullUpload;
+	
+	// Thumbnail of the presented frame, rescaled only where frames have changed it
+	RDScaler thumbnailScaler;
+	NSMutableData *thumbnailPixels;
+	RDTileMap thumbnailDamage;
+	BOOL thumbnailNeedsFullScale;
+	NSImage *thumbnail;
+	
+	// Presentation pacing
+	BOOL presentPending;
+	NSTimeInterval minimumPresentInterval, lastPresentTime;
+	CRDFrameStats frameStats;
+	
 	// For mouse event throttling
 	NSDate *lastMouseEventSentAt;
 	NSValue *deferredMouseMoveLocation;
@@ -60,11 +82,12 @@
 - (void)fillRect:(NSRect)rect withColor:(NSColor *)color;
 - (void)fillRect:(NSRect)rect withColor:(NSColor *)color patternOrigin:(NSPoint)origin;
 - (void)fillRect:(NSRect)rect withRDColor:(int)color;
-- (void)drawBitmap:(CRDBitmap *)image inRect:(NSRect)r from:(NSPoint)origin operation:(NSCompositingOperation)op;
-- (void)screenBlit:(NSRect)from to:(NSPoint)to;
+- (void)applyROP3:(uint8)rop toRect:(NSRect)rect source:(CRDBitmap *)source from:(NSPoint)sourceOrigin pattern:(const uint32 *)tile origin:(NSPoint)patternOrigin;
+- (void)screenBlit:(NSRect)from to:(NSPoint)to rop:(uint8)rop;
 - (void)drawLineFrom:(NSPoint)start to:(NSPoint)end color:(NSColor *)color width:(int)width;
 - (void)drawGlyph:(CRDBitmap *)glyph at:(NSRect)r foregroundColor:(NSColor *)c;
-- (void)swapRect:(NSRect)r;
+- (void)drawPixels:(const uint32 *)pixels inRect:(NSRect)r;
+- (void)drawSurface:(CGContextRef)surface inRect:(NSRect)r from:(NSPoint)origin rop:(uint8)rop;
 
 // Other rdesktop handlers
 - (void)setClip:(NSRect)r;
@@ -75,6 +98,11 @@
 - (void)stopUpdate;
 - (void)focusBackingStore;
 - (void)releaseBackingStore;
+- (uint32 *)backingStorePixelAtX:(int)x y:(int)y pitch:(int *)pitch;
+
+// Offscreen surfaces
+- (CGContextRef)createSurfaceWithSize:(NSSize)s;
+- (void)setDrawingTarget:(CGContextRef)surface;
 
 - (BOOL)checkMouseInBounds:(id)ev;
 - (void)sendMouseInput:(unsigned short)flags;
@@ -82,6 +110,7 @@
 // Converting colors
 - (void)rgbForRDCColor:(int)col r:(unsigned char *)r g:(unsigned char *)g b:(unsigned char *)b;
 - (NSColor *)nscolorForRDCColor:(int)col;
+- (uint32)pixelForRDCColor:(int)col;
 
 // Other
 - (void)setNeedsDisplayInRects:(NSArray *)rects;
@@ -89,6 +118,11 @@
 - (void)writeScreenCaptureToFile:(NSString *)path;
 - (void)setScreenSize:(NSSize)newSize;
 - (void)setNeedsDisplayOnMainThread:(id)object;
+- (BOOL)addDirtyTiles:(const RDTileMap *)tiles;
+- (void)schedulePresent;
+- (CRDFrameStats)frameStats;
+- (NSImage *)thumbnailWithSize:(NSSize)maxSize;
+- (BOOL)recordUpdate:(RDRecorder *)recorder tiles:(const RDTileMap *)tiles;
 - (BOOL)isScrolled;
 
 // Accessors
@@ -32,9 +32,35 @@
 	- (void)createBackingStore:(NSSize)s;
 	- (void)destroyBackingStore;
 	- (void)setScreenSizeByValue:(NSValue*)newSize;
+	- (void)visibilityMayHaveChanged:(NSNotification *)notification;
+	- (void)updatePresentInterval:(NSNotification *)notification;
+	- (void)present;
+	- (CGImageRef)createPresentedImage;
+	- (void)takeNewestFrame;
 
 @end
 
+// A raster operation big enough to share between threads, a band of rows each (see blit_parallel)
+typedef struct
+{
+	uint8 rop;
+	uint32 *dst;
+	int pitch;
+	const uint32 *src;
+	int srcPitch;
+	const uint32 *tile;
+	int patternX, patternY, cx, cy, parts;
+} CRDRopBands;
+
+static void rop_band(void *context, int part)
+{
+	const CRDRopBands *job = context;
+	int first = job->cy * part / job->parts, last = job->cy * (part + 1) / job->parts;
+	const uint32 *src = job->src != NULL ? (const uint32 *)((const uint8 *)job->src + first * job->srcPitch) : NULL;
+	
+	rop3_blt(job->rop, (uint32 *)((uint8 *)job->dst + first * job->pitch), job->pitch, src, job->srcPitch, job->tile, job->patternX, job->patternY + first, job->cx, last - first, CFSwapInt32HostToLittle(0xff000000));
+}
+
 #pragma mark -
 
 @implementation CRDSessionView
@@ -64,15 +90,28 @@
 	keyTranslator = [[CRDKeyboard alloc] init];
 	lastMouseEventSentAt = [[NSDate date] retain];
 	mouseLoc = NSMakePoint(0, 0);
+	minimumPresentInterval = 1.0 / 60.0;
 	
 	[self resetCursorRects];
 	[self resetClip];
 	
+	// The session stops the server's updates while it can't be seen
+	NSNotificationCenter *center = [NSNotificationCenter defaultCenter];
+	[center addObserver:self selector:@selector(visibilityMayHaveChanged:) name:NSApplicationDidHideNotification object:nil];
+	[center addObserver:self selector:@selector(visibilityMayHaveChanged:) name:NSApplicationDidUnhideNotification object:nil];
+	
+	// Spaces notifications are 10.6 and later; the symbol is weakly linked and NULL on 10.5
+	if (&NSWorkspaceActiveSpaceDidChangeNotification != NULL)
+		[[[NSWorkspace sharedWorkspace] notificationCenter] addObserver:self selector:@selector(visibilityMayHaveChanged:) name:NSWorkspaceActiveSpaceDidChangeNotification object:nil];
+	
     return self;
 }
 
 - (void)dealloc
 {
+	[[NSNotificationCenter defaultCenter] removeObserver:self];
+	[[[NSWorkspace sharedWorkspace] notificationCenter] removeObserver:self];
+	
 	[mouseInputScheduler invalidate];
 	[mouseInputScheduler release];
 	[lastMouseEventSentAt release];
@@ -81,6 +120,9 @@
 	[keyTranslator release];
 	[cursor release];
 	[self destroyBackingStore];
+	scale_destroy(&thumbnailScaler);
+	[thumbnailPixels release];
+	[thumbnail release];
 	
 	free(colorMap);
 	colorMap = NULL;
@@ -110,6 +152,36 @@
     [self addCursorRect:[self visibleRect] cursor:cursor]; 
 }
 
+// Switching tabs, or between windowed, unified and fullscreen modes, moves the view in and out of windows
+- (void)viewDidMoveToWindow
+{
+	NSNotificationCenter *center = [NSNotificationCenter defaultCenter];
+	[center removeObserver:self name:NSWindowDidMiniaturizeNotification object:nil];
+	[center removeObserver:self name:NSWindowDidDeminiaturizeNotification object:nil];
+	[center removeObserver:self name:NSWindowDidChangeScreenNotification object:nil];
+	
+	if ([self window] != nil)
+	{
+		[center addObserver:self selector:@selector(visibilityMayHaveChanged:) name:NSWindowDidMiniaturizeNotification object:[self window]];
+		[center addObserver:self selector:@selector(visibilityMayHaveChanged:) name:NSWindowDidDeminiaturizeNotification object:[self window]];
+		[center addObserver:self selector:@selector(updatePresentInterval:) name:NSWindowDidChangeScreenNotification object:[self window]];
+		[self updatePresentInterval:nil];
+	}
+	
+	[self visibilityMayHaveChanged:nil];
+}
+
+- (void)visibilityMayHaveChanged:(NSNotification *)notification
+{
+	NSWindow *window = [self window];
+	
+	// Before 10.6 there is no way to ask, so a window is taken to be on the active space
+	BOOL onActiveSpace = ![window respondsToSelector:@selector(isOnActiveSpace)] || [window isOnActiveSpace];
+	BOOL visible = (window != nil) && ![window isMiniaturized] && onActiveSpace && ![NSApp isHidden];
+	
+	[controller setVisible:visible];
+}
+
 - (void)setFrame:(NSRect)frame
 {	
 	[super setFrame:frame];
@@ -120,7 +192,7 @@
 
 - (void)cacheDisplayInRect:(NSRect)rect toBitmapImageRep:(NSBitmapImageRep *)bitmapImageRep
 {
-	CGImageRef rdBufferImage = CGBitmapContextCreateImage(rdBufferContext);
+	CGImageRef rdBufferImage = [self createPresentedImage];
 	
 	[NSGraphicsContext saveGraphicsState];
 	[NSGraphicsContext setCurrentContext:[NSGraphicsContext graphicsContextWithBitmapImageRep:bitmapImageRep]];
@@ -182,6 +254,7 @@
 	glShadeModel(GL_SMOOTH);
 	glClearColor(0.0f, 0.0f, 0.0f, 0.0f); 
 	glGenTextures(1, &rdBufferTexture);
+	textureNeedsFullUpload = YES;
 }
 
 - (void)reshape
@@ -481,38 +554,88 @@
 	[self releaseBackingStore];
 }
 
+// Solid fills are written straight into the current target, shared between threads when large (see blit.c)
 - (void)fillRect:(NSRect)rect withRDColor:(int)color
 {
-	[self focusBackingStore];
-	
-	CGContextRef context = [[NSGraphicsContext currentContext] graphicsPort];
-	unsigned char r, g, b;
+	NSRect r = NSIntersectionRect(NSIntersectionRect(rect, clipRect), NSMakeRect(0, 0, targetWidth, targetHeight));
+	int pitch;
 	
-	[self rgbForRDCColor:color r:&r g:&g b:&b];
-	CGContextSetRGBFillColor(context, r/255.0f, g/255.0f, b/255.0f, 1.0);
-	CGContextFillRect(context, CGRECT_FROM_NSRECT(rect));
+	if (NSIsEmptyRect(r))
+		return;
 	
-	[self releaseBackingStore];
+	uint32 *origin = [self backingStorePixelAtX:0 y:0 pitch:&pitch];
+	blit_fill(origin, pitch, NSMinX(r), NSMinY(r), NSWidth(r), NSHeight(r), [self pixelForRDCColor:color]);
 }
 
-- (void)drawBitmap:(CRDBitmap *)image inRect:(NSRect)to from:(NSPoint)origin operation:(NSCompositingOperation)op
+// Applies a ternary raster operation (see rop.c) to rect, combining it with source pixels from sourceOrigin and an 8x8 tile of backing store pixels aligned to patternOrigin. Writes straight into the backing store. source and tile may be nil when rop doesn't use them.
+- (void)applyROP3:(uint8)rop toRect:(NSRect)rect source:(CRDBitmap *)source from:(NSPoint)sourceOrigin pattern:(const uint32 *)tile origin:(NSPoint)patternOrigin
 {
-	[self focusBackingStore];
+	NSRect r = NSIntersectionRect(NSIntersectionRect(rect, clipRect), NSMakeRect(0, 0, targetWidth, targetHeight));
+	const uint32 *src = NULL;
+	int sw = 0;
 	
-	[image drawInRect:to
-			 fromRect:NSMakeRect(origin.x, origin.y, NSWidth(to), NSHeight(to))
-			operation:op];
-	[self releaseBackingStore];
+	if (ROP3_USES_SRC(rop))
+	{
+		if ([source pixels] == NULL)
+			return;
+		
+		// Also clip to the part of the source that exists
+		NSSize s = [source size];
+		sw = s.width;
+		r = NSIntersectionRect(r, NSOffsetRect(NSMakeRect(0, 0, s.width, s.height), NSMinX(rect) - sourceOrigin.x, NSMinY(rect) - sourceOrigin.y));
+	}
+	
+	if (ROP3_USES_PAT(rop) && tile == NULL)
+		return;
+	
+	if (NSIsEmptyRect(r))
+		return;
+	
+	int x0 = NSMinX(r), y0 = NSMinY(r), pitch;
+	uint32 *dst = [self backingStorePixelAtX:x0 y:y0 pitch:&pitch];
+	
+	if (sw != 0)
+		src = [source pixels] + (int)(sourceOrigin.y + y0 - NSMinY(rect)) * sw + (int)(sourceOrigin.x + x0 - NSMinX(rect));
+	
+	CRDRopBands job = {rop, dst, pitch, src, sw * 4, tile, x0 - (int)patternOrigin.x, y0 - (int)patternOrigin.y, (int)NSWidth(r), (int)NSHeight(r), 1};
+	
+	if (NSWidth(r) * NSHeight(r) >= BLIT_THREAD_MIN_PIXELS)
+		job.parts = BLIT_MAX_THREADS;
+	
+	blit_parallel(job.parts, rop_band, &job);
 }
 
-- (void)screenBlit:(NSRect)from to:(NSPoint)to
+// Moves from to to within the current target, in place even when they overlap (see blit.c). Operations other than a copy read a copy of the source, since rop3_blt needs it apart from the destination.
+- (void)screenBlit:(NSRect)from to:(NSPoint)to rop:(uint8)rop
 {
-	[self focusBackingStore];
-	NSRectClip(NSMakeRect(to.x, to.y, NSWidth(from), NSHeight(from)));
-	CGImageRef rdBufferImage = CGBitmapContextCreateImage(rdBufferContext);
-	CGContextDrawImage([[NSGraphicsContext currentContext] graphicsPort], CGRectMake(to.x - from.origin.x, to.y - from.origin.y,  screenSize.width, screenSize.height), rdBufferImage);
-	CGImageRelease(rdBufferImage);
-	[self releaseBackingStore];
+	NSRect bounds = NSMakeRect(0, 0, targetWidth, targetHeight);
+	NSRect r = NSIntersectionRect(NSIntersectionRect(NSMakeRect(to.x, to.y, NSWidth(from), NSHeight(from)), clipRect), bounds);
+	
+	// Also clip to the part of the source on screen
+	r = NSIntersectionRect(r, NSOffsetRect(bounds, to.x - NSMinX(from), to.y - NSMinY(from)));
+	
+	if (NSIsEmptyRect(r))
+		return;
+	
+	int x = NSMinX(r), y = NSMinY(r), cx = NSWidth(r), cy = NSHeight(r), pitch, i;
+	int sx = x + NSMinX(from) - to.x, sy = y + NSMinY(from) - to.y;
+	uint32 *origin = [self backingStorePixelAtX:0 y:0 pitch:&pitch], *source = NULL;
+	
+	if (rop == ROP3_SRCCOPY)
+	{
+		blit_move(origin, pitch, x, y, cx, cy, sx, sy);
+		return;
+	}
+	
+	if (ROP3_USES_SRC(rop))
+	{
+		source = malloc(cx * cy * 4);
+		for (i = 0; i < cy; i++)
+			memcpy(source + i * cx, (uint32 *)((uint8 *)origin + (sy + i) * pitch) + sx, cx * 4);
+	}
+	
+	rop3_blt(rop, (uint32 *)((uint8 *)origin + y * pitch) + x, pitch, source, cx * 4, NULL, 0, 0, cx, cy, CFSwapInt32HostToLittle(0xff000000));
+	free(source);
 }
 
 - (void)drawLineFrom:(NSPoint)start to:(NSPoint)end color:(NSColor *)color width:(int)width
@@ -538,19 +661,59 @@
 	[glyph drawInRect:r fromRect:NSMakeRect(0, 0, NSWidth(r), NSHeight(r)) operation:NSCompositeSourceOver];
 }
 
-- (void)swapRect:(NSRect)r
+// Copies w*h backing store pixels (top row first, see backingStorePixelAtX:) into r, honouring the clip
+- (void)drawPixels:(const uint32 *)pixels inRect:(NSRect)r
 {
-	[self focusBackingStore];
-	CGContextRef context = (CGContextRef)[[NSGraphicsContext currentContext] graphicsPort];
-	CGContextSaveGState(context);
-	CGContextSetBlendMode(context, kCGBlendModeDifference);
-	CGContextSetRGBFillColor(context, 1.0, 1.0, 1.0, 1.0);
-	CGContextFillRect(context, CGRectMake(r.origin.x, r.origin.y, r.size.width, r.size.height));
-	CGContextFlush(context);
-	CGContextRestoreGState(context);
-	[self releaseBackingStore];
+	NSRect c = NSIntersectionRect(NSIntersectionRect(r, clipRect), NSMakeRect(0, 0, targetWidth, targetHeight));
+	
+	if (NSIsEmptyRect(c))
+		return;
+	
+	int w = NSWidth(r), x0 = NSMinX(c) - NSMinX(r), y0 = NSMinY(c) - NSMinY(r), cw = NSWidth(c), y, pitch;
+	uint8 *dst = (uint8 *)[self backingStorePixelAtX:NSMinX(c) y:NSMinY(c) pitch:&pitch];
+	
+	pixels += y0 * w + x0;
+	for (y = 0; y < NSHeight(c); y++)
+	{
+		memcpy(dst, pixels, cw * 4);
+		dst += pitch;
+		pixels += w;
+	}
 }
 
+// Combines part of an offscreen surface with r on the current target through a ternary raster operation (see rop.c), honouring the clip. A surface drawn onto itself goes through screenBlit:to:rop:, which handles overlap.
+- (void)drawSurface:(CGContextRef)surface inRect:(NSRect)r from:(NSPoint)origin rop:(uint8)rop
+{
+	int sw = CGBitmapContextGetWidth(surface), sh = CGBitmapContextGetHeight(surface);
+	
+	if (!ROP3_USES_SRC(rop))
+	{
+		[self applyROP3:rop toRect:r source:nil from:NSZeroPoint pattern:NULL origin:NSZeroPoint];
+		return;
+	}
+	
+	CGContextFlush(surface);
+	if ((uint8 *)CGBitmapContextGetData(surface) == targetBitmapData)
+	{
+		[self screenBlit:NSMakeRect(origin.x, origin.y, NSWidth(r), NSHeight(r)) to:r.origin rop:rop];
+		return;
+	}
+	
+	NSRect c = NSIntersectionRect(NSIntersectionRect(r, clipRect), NSMakeRect(0, 0, targetWidth, targetHeight));
+	
+	// Also clip to the part of the source that exists
+	c = NSIntersectionRect(c, NSOffsetRect(NSMakeRect(0, 0, sw, sh), NSMinX(r) - origin.x, NSMinY(r) - origin.y));
+	
+	if (NSIsEmptyRect(c))
+		return;
+	
+	// Surfaces are stored bottom-up, so the source rows run backwards
+	int sx = origin.x + NSMinX(c) - NSMinX(r), sy = origin.y + NSMinY(c) - NSMinY(r), pitch;
+	uint32 *dst = [self backingStorePixelAtX:NSMinX(c) y:NSMinY(c) pitch:&pitch];
+	const uint32 *src = (const uint32 *)CGBitmapContextGetData(surface) + (sh - 1 - sy) * sw + sx;
+	
+	rop3_blt(rop, dst, pitch, src, -sw * 4, NULL, 0, 0, NSWidth(c), NSHeight(c), CFSwapInt32HostToLittle(0xff000000));
+}
 
 #pragma mark -
 #pragma mark Clipping backing store drawing
@@ -562,7 +725,7 @@
 
 - (void)resetClip
 {
-	clipRect = CRDRectFromSize(screenSize);
+	clipRect = NSMakeRect(0, 0, targetWidth, targetHeight);
 }
 
 
@@ -582,17 +745,62 @@
 - (void)focusBackingStore
 {
 	[NSGraphicsContext saveGraphicsState];
-	[NSGraphicsContext setCurrentContext:[NSGraphicsContext graphicsContextWithGraphicsPort:rdBufferContext flipped:NO]];
-	CGContextSaveGState(rdBufferContext);
+	[NSGraphicsContext setCurrentContext:[NSGraphicsContext graphicsContextWithGraphicsPort:targetContext flipped:NO]];
+	CGContextSaveGState(targetContext);
 	NSRectClip(clipRect);
 }
 
 - (void)releaseBackingStore
 {
-	CGContextRestoreGState(rdBufferContext);
+	CGContextRestoreGState(targetContext);
 	[NSGraphicsContext restoreGraphicsState];
 }
 
+// Address of pixel (x, y) in session coordinates. Rows are stored bottom-up, so pitch (the byte distance to row y + 1) is negative.
+- (uint32 *)backingStorePixelAtX:(int)x y:(int)y pitch:(int *)pitch
+{
+	CGContextFlush(targetContext);
+	
+	if (pitch != NULL)
+		*pitch = -targetWidth * 4;
+	
+	return (uint32 *)(targetBitmapData + (targetHeight - 1 - y) * targetWidth * 4) + x;
+}
+
+
+#pragma mark -
+#pragma mark Offscreen surfaces
+
+// Creates a bitmap context in the same format as the back buffer. Owns its pixels; release with ui_destroy_surface().
+- (CGContextRef)createSurfaceWithSize:(NSSize)s
+{
+	int w = MAX(s.width, 1), h = MAX(s.height, 1);
+	void *surfaceData = calloc(w * h * 4, 1);
+	
+	CGColorSpaceRef cs = CGColorSpaceCreateDeviceRGB();
+	CGContextRef surface = CGBitmapContextCreate(surfaceData, w, h, 8, w * 4, cs, kCGImageAlphaPremultipliedFirst | kCGBitmapByteOrder32Little);
+	CFRelease(cs);
+	
+	if (surface == NULL)
+		free(surfaceData);
+	
+	return surface;
+}
+
+// Directs subsequent drawing into surface, or back into the back buffer if NULL
+- (void)setDrawingTarget:(CGContextRef)surface
+{
+	if (surface == NULL)
+		surface = rdBufferContext;
+	
+	targetContext = surface;
+	targetBitmapData = CGBitmapContextGetData(surface);
+	targetWidth = CGBitmapContextGetWidth(surface);
+	targetHeight = CGBitmapContextGetHeight(surface);
+	
+	[self resetClip];
+}
+
 - (void)createBackingStore:(NSSize)s
 {
 	rdBufferWidth = s.width;
@@ -604,6 +812,15 @@
 	CGColorSpaceRef cs = CGColorSpaceCreateDeviceRGB(); // instead of CGColorSpaceCreateWithName(kCGColorSpaceGenericRGB);, see http://www.jizoh.jp/issue/colorissue.html
 	rdBufferContext = CGBitmapContextCreate(rdBufferBitmapData, rdBufferWidth, rdBufferHeight, 8, rdBufferWidth*4, cs, kCGImageAlphaPremultipliedFirst | kCGBitmapByteOrder32Little);
     CFRelease(cs);
+	
+	if (!framebuf_init(&presentBuffers, rdBufferWidth, rdBufferHeight, -rdBufferWidth * 4))
+		CRDLog(CRDLogLevelError, @"Couldn't allocate presentation buffers for a %dx%d screen", rdBufferWidth, rdBufferHeight);
+	if (!tilemap_init(&textureDamage, rdBufferWidth, rdBufferHeight) || !tilemap_init(&thumbnailDamage, rdBufferWidth, rdBufferHeight))
+		CRDLog(CRDLogLevelError, @"Couldn't allocate the damage tiles of a %dx%d screen", rdBufferWidth, rdBufferHeight);
+	textureNeedsFullUpload = YES;
+	thumbnailNeedsFullScale = YES;
+	
+	[self setDrawingTarget:NULL];
 }
 
 - (void)destroyBackingStore
@@ -613,22 +830,70 @@
 
     CGContextRelease(rdBufferContext);
 	free(rdBufferBitmapData);
+	framebuf_destroy(&presentBuffers);
+	tilemap_destroy(&textureDamage);
+	tilemap_destroy(&thumbnailDamage);
 	
 	rdBufferBitmapData = NULL;
-	rdBufferContext = NULL;
+	rdBufferContext = targetContext = NULL;
+	targetBitmapData = NULL;
+	targetWidth = targetHeight = 0;
 	rdBufferTexture = rdBufferBitmapLength = rdBufferWidth = rdBufferHeight = 0;
     drawnRect = NO;
 }
 
-- (void)generateTexture
+// Takes the newest complete frame, if there is one, and notes what it changed for the texture and the thumbnail. Never waits for the connection thread, which may be drawing the next update meanwhile.
+- (void)takeNewestFrame
 {
-	CGContextFlush(rdBufferContext);
+	const RDFrame *frame = framebuf_acquire(&presentBuffers);
+	
+	if (frame == NULL)
+		return;
+	
+	if (tilemap_is_full(&frame->damage))
+		textureNeedsFullUpload = thumbnailNeedsFullScale = YES;
+	
+	if (!textureNeedsFullUpload)
+		tilemap_union(&textureDamage, &frame->damage);
+	if (!thumbnailNeedsFullScale)
+		tilemap_union(&thumbnailDamage, &frame->damage);
+}
 
+// Uploads the tiles of the presented frame that changed since the last upload, or all of it when the texture is new
+- (void)generateTexture
+{
+	const RDFrame *frame;
+	BOOL fullUpload;
+	int row, i, n;
+	
+	// Cleared before the frame is taken, so that a frame published from here on asks for a present of its own
+	@synchronized(self)
+	{
+		if (presentPending)
+		{
+			presentPending = NO;
+			frameStats.presented++;
+			lastPresentTime = [NSDate timeIntervalSinceReferenceDate];
+		}
+	}
+	
+	[self takeNewestFrame];
+	frame = framebuf_front(&presentBuffers);
+	fullUpload = textureNeedsFullUpload;
+	
+	if (!fullUpload && tilemap_is_empty(&textureDamage))
+		return;
+	
+	textureNeedsFullUpload = NO;
+	
+	if (frame->data == NULL)
+	{
+		tilemap_clear(&textureDamage);
+		return;
+	}
+	
 	glBindTexture(GL_TEXTURE_RECTANGLE_EXT, rdBufferTexture);
 	
-	glTexParameteri(GL_TEXTURE_RECTANGLE_EXT, GL_TEXTURE_STORAGE_HINT_APPLE, GL_STORAGE_SHARED_APPLE); 
-	glPixelStorei(GL_UNPACK_CLIENT_STORAGE_APPLE, GL_TRUE);
-		
 	GLenum format;
 	
 #ifdef __LITTLE_ENDIAN__
@@ -637,11 +902,34 @@
 	format = GL_UNSIGNED_INT_8_8_8_8;
 #endif
 
+	// Not client storage: the frames are reused for later updates, so the texture keeps its own copy
+	if (fullUpload)
+	{
+		glTexImage2D(GL_TEXTURE_RECTANGLE_EXT, 0, GL_RGBA, rdBufferWidth, rdBufferHeight, 0, GL_BGRA, format, frame->data);
 
-	glTexImage2D(GL_TEXTURE_RECTANGLE_EXT, 0, GL_RGBA, rdBufferWidth, rdBufferHeight, 0, GL_BGRA, format, rdBufferBitmapData);
-
-	glTexParameteri(GL_TEXTURE_RECTANGLE_EXT, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_RECTANGLE_EXT, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_RECTANGLE_EXT, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_RECTANGLE_EXT, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		tilemap_clear(&textureDamage);
+		return;
+	}
+	
+	// One upload for each run of changed tiles in a row of them. Rows are stored bottom-up, so a run at y in session coordinates starts at texture row height - (y + cy).
+	RDTileRect spans[textureDamage.columns / 2 + 1];
+	
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, rdBufferWidth);
+	for (row = 0; row < textureDamage.rows; row++)
+		for (i = 0, n = tilemap_row_spans(&textureDamage, row, spans); i < n; i++)
+		{
+			RDTileRect r = spans[i];
+			
+			glPixelStorei(GL_UNPACK_SKIP_PIXELS, r.x);
+			glPixelStorei(GL_UNPACK_SKIP_ROWS, rdBufferHeight - r.y - r.cy);
+			glTexSubImage2D(GL_TEXTURE_RECTANGLE_EXT, 0, r.x, rdBufferHeight - r.y - r.cy, r.cx, r.cy, GL_BGRA, format, frame->data);
+		}
+	glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+	glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	tilemap_clear(&textureDamage);
 }
 
 
@@ -650,26 +938,11 @@
 
 - (void)rgbForRDCColor:(int)col r:(unsigned char *)r g:(unsigned char *)g b:(unsigned char *)b
 {
-	if (bitdepth == 16)
-	{
-		*r = (( (col >> 11) & 0x1f) * 255 + 15) / 31;
-		*g = (( (col >> 5) & 0x3f) * 255 + 31) / 63;
-		*b = ((col & 0x1f) * 255 + 15) / 31;
-		return;
-	}
-	else if (bitdepth == 15)
-	{
-		*r = (( (col >> 10) & 0x1f) * 255 + 15) / 31;
-		*g = (( (col >> 5) & 0x1f) * 255 + 15) / 31;
-		*b = ((col & 0x1f) * 255 + 15) / 31;
-		return;
-	}
+	uint32 pixel = CFSwapInt32LittleToHost([self pixelForRDCColor:col]);
 	
-	int t = (bitdepth == 8) ? colorMap[col] : col;
-
-	*b = (t >> 16) & 0xff;
-	*g = (t >> 8)  & 0xff;
-	*r = t & 0xff;
+	*r = (pixel >> 16) & 0xff;
+	*g = (pixel >> 8) & 0xff;
+	*b = pixel & 0xff;
 }
 
 - (NSColor *)nscolorForRDCColor:(int)col
@@ -684,6 +957,13 @@
 }
 
 
+// Backing store pixel as laid out in memory (32-bit little endian ARGB)
+- (uint32)pixelForRDCColor:(int)col
+{
+	return pixconv_colour(bitdepth, col, colorMap);
+}
+
+
 #pragma mark -
 #pragma mark Other
 
@@ -733,7 +1013,7 @@
 		[xform scaleXBy:1.0 yBy:-1.0];
 		[xform concat];
 		
-		CGImageRef screenDump = CGBitmapContextCreateImage(rdBufferContext);
+		CGImageRef screenDump = [self createPresentedImage];
 		CGContextDrawImage([[NSGraphicsContext currentContext] graphicsPort], CGRectMake(0,0,width, height), screenDump);		
 		CGImageRelease(screenDump);
 	} [NSGraphicsContext restoreGraphicsState];
@@ -744,11 +1024,174 @@
 	[img release];
 }
 
+// The screen as last presented, for reading it on the main thread while the connection thread draws. Release with CGImageRelease().
+- (CGImageRef)createPresentedImage
+{
+	const RDFrame *frame = framebuf_front(&presentBuffers);
+	
+	if (frame->data == NULL)
+		return CGBitmapContextCreateImage(rdBufferContext);
+	
+	CGColorSpaceRef cs = CGColorSpaceCreateDeviceRGB();
+	CGContextRef context = CGBitmapContextCreate(frame->data, rdBufferWidth, rdBufferHeight, 8, rdBufferWidth * 4, cs, kCGImageAlphaPremultipliedFirst | kCGBitmapByteOrder32Little);
+	CGImageRef image = CGBitmapContextCreateImage(context);
+	
+	CGContextRelease(context);
+	CFRelease(cs);
+	return image;
+}
+
+// The presented frame shrunk to fit within maxSize, keeping its shape. Only the parts that changed since the last call are scaled again; the same image is returned if nothing did. Main thread only.
+- (NSImage *)thumbnailWithSize:(NSSize)maxSize
+{
+	[self takeNewestFrame];
+	
+	const RDFrame *frame = framebuf_front(&presentBuffers);
+	if (frame->data == NULL || rdBufferWidth <= 0 || rdBufferHeight <= 0)
+		return nil;
+	
+	float scale = MIN(maxSize.width / rdBufferWidth, maxSize.height / rdBufferHeight);
+	int w = MAX(1, (int)roundf(rdBufferWidth * scale)), h = MAX(1, (int)roundf(rdBufferHeight * scale)), row, i, n;
+	
+	if (thumbnailScaler.sw != rdBufferWidth || thumbnailScaler.sh != rdBufferHeight || thumbnailScaler.dw != w || thumbnailScaler.dh != h)
+	{
+		scale_destroy(&thumbnailScaler);
+		if (!scale_init(&thumbnailScaler, SCALE_AREA, rdBufferWidth, rdBufferHeight, w, h))
+			return nil;
+		
+		[thumbnailPixels release];
+		thumbnailPixels = [[NSMutableData alloc] initWithLength:w * h * 4];
+		thumbnailNeedsFullScale = YES;
+	}
+	
+	if (!thumbnailNeedsFullScale && tilemap_is_empty(&thumbnailDamage) && thumbnail != nil)
+		return thumbnail;
+	
+	// Top-down, so that the image comes out the right way up
+	const uint32 *source = framebuf_origin(&presentBuffers, frame);
+	uint32 *pixels = [thumbnailPixels mutableBytes];
+	RDTileRect spans[thumbnailDamage.columns / 2 + 1];
+	
+	if (thumbnailNeedsFullScale)
+		scale_rect(&thumbnailScaler, source, -rdBufferWidth * 4, pixels, w * 4, 0, 0, rdBufferWidth, rdBufferHeight);
+	else
+		for (row = 0; row < thumbnailDamage.rows; row++)
+			for (i = 0, n = tilemap_row_spans(&thumbnailDamage, row, spans); i < n; i++)
+				scale_rect(&thumbnailScaler, source, -rdBufferWidth * 4, pixels, w * 4, spans[i].x, spans[i].y, spans[i].cx, spans[i].cy);
+	
+	thumbnailNeedsFullScale = NO;
+	tilemap_clear(&thumbnailDamage);
+	
+	CGColorSpaceRef cs = CGColorSpaceCreateDeviceRGB();
+	CGDataProviderRef provider = CGDataProviderCreateWithCFData((CFDataRef)[NSData dataWithData:thumbnailPixels]);
+	CGImageRef image = CGImageCreate(w, h, 8, 32, w * 4, cs, kCGImageAlphaNoneSkipFirst | kCGBitmapByteOrder32Little, provider, NULL, NO, kCGRenderingIntentDefault);
+	
+	[thumbnail release];
+	thumbnail = [[NSImage alloc] initWithSize:NSMakeSize(w, h)];
+	[thumbnail addRepresentation:[[[NSBitmapImageRep alloc] initWithCGImage:image] autorelease]];
+	
+	CGImageRelease(image);
+	CGDataProviderRelease(provider);
+	CFRelease(cs);
+	
+	return thumbnail;
+}
+
 - (void)setNeedsDisplayOnMainThread:(id)object
 {
 	[self setNeedsDisplay:[object boolValue]];
 }
 
+// Called by the connection thread at the end of an update, with the tiles it drew in; tiles for a screen of another size, as just after a resize, mark all of it. Copies what changed into a frame of its own and hands it over, without waiting for the main thread. Returns YES if the main thread needs to be asked to present it, NO if a present is already on its way.
+- (BOOL)addDirtyTiles:(const RDTileMap *)tiles
+{
+	BOOL needsPresent;
+	
+	if (tiles->width != rdBufferWidth || tiles->height != rdBufferHeight)
+		tiles = NULL;
+	
+	if (presentBuffers.frames[0].data != NULL)
+	{
+		CGContextFlush(rdBufferContext);
+		framebuf_publish(&presentBuffers, (uint32 *)(rdBufferBitmapData + (rdBufferHeight - 1) * rdBufferWidth * 4), tiles);
+	}
+	
+	@synchronized(self)
+	{
+		frameStats.decoded++;
+		if (presentPending)
+			frameStats.dropped++;
+		
+		needsPresent = !presentPending;
+		presentPending = YES;
+	}
+	
+	return needsPresent;
+}
+
+// Called by the connection thread after addDirtyTiles:, with the same tiles. Returns NO once the recording can't be written.
+- (BOOL)recordUpdate:(RDRecorder *)recorder tiles:(const RDTileMap *)tiles
+{
+	if (rdBufferBitmapData == NULL)
+		return YES;
+	
+	return record_update(recorder, (uint32 *)(rdBufferBitmapData + (rdBufferHeight - 1) * rdBufferWidth * 4), -rdBufferWidth * 4, rdBufferWidth, rdBufferHeight, tiles, timing_now() / 1000);
+}
+
+// Draws pending updates no sooner than one display refresh (or 1/CRDMaximumFrameRate seconds, if longer) after the last time
+- (void)schedulePresent
+{
+	NSTimeInterval wait = lastPresentTime + minimumPresentInterval - [NSDate timeIntervalSinceReferenceDate];
+	
+	if (wait > 0)
+		[self performSelector:@selector(present) withObject:nil afterDelay:wait inModes:[NSArray arrayWithObject:NSRunLoopCommonModes]];
+	else
+		[self present];
+}
+
+- (void)present
+{
+	[self setNeedsDisplay:YES];
+}
+
+- (void)updatePresentInterval:(NSNotification *)notification
+{
+	double refreshRate = 0.0;
+	NSNumber *screenNumber = [[[[self window] screen] deviceDescription] objectForKey:@"NSScreenNumber"];
+	
+	if (screenNumber != nil)
+	{
+		// CGDisplayCurrentMode rather than CGDisplayCopyDisplayMode, which is 10.6 and later
+		CFDictionaryRef mode = CGDisplayCurrentMode([screenNumber unsignedIntValue]);
+		CFNumberRef rate = (mode != NULL) ? CFDictionaryGetValue(mode, kCGDisplayRefreshRate) : NULL;
+		
+		if (rate != NULL)
+			CFNumberGetValue(rate, kCFNumberDoubleType, &refreshRate);
+	}
+	
+	// Built in displays report 0
+	if (refreshRate <= 0.0)
+		refreshRate = 60.0;
+	
+	NSInteger maximumFrameRate = [[NSUserDefaults standardUserDefaults] integerForKey:CRDDefaultsMaximumFrameRate];
+	if (maximumFrameRate > 0 && maximumFrameRate < refreshRate)
+		refreshRate = maximumFrameRate;
+	
+	minimumPresentInterval = 1.0 / refreshRate;
+}
+
+- (CRDFrameStats)frameStats
+{
+	CRDFrameStats stats;
+	
+	@synchronized(self)
+	{
+		stats = frameStats;
+	}
+	
+	return stats;
+}
+
 - (void)setScreenSize:(NSSize)newSize
 {
 	// Avoid crashes caused by destroying/creating the backing store
@@ -788,7 +1231,10 @@
 	[keyTranslator setController:instance];
 
 	if (instance)
+	{
 		bitdepth = [instance conn]->serverBpp;
+		[self visibilityMayHaveChanged:nil];
+	}
 }
 
 - (int)bitsPerPixel
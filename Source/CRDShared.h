@@ -49,8 +49,33 @@ typedef struct _CRDInputEvent
 {
 	unsigned int time; 
 	unsigned short type, deviceFlags, param1, param2;
+	uint64_t queuedAt; // mach_absolute_time() when queued, for latency statistics
 } CRDInputEvent;
 
+// Single producer (main thread), single consumer (connection thread) queue of
+// input events. Indices run freely and are masked on access.
+#define CRDInputEventRingSize 256
+
+typedef struct _CRDInputEventRing
+{
+	CRDInputEvent events[CRDInputEventRingSize];
+	volatile uint32_t head; // written only by the producer
+	volatile uint32_t tail; // written only by the consumer
+} CRDInputEventRing;
+
+typedef struct _CRDInputLatency
+{
+	uint64_t events, batches, dropped;
+	uint64_t total, max; // mach_absolute_time() units, queued to written
+} CRDInputLatency;
+
+typedef struct _CRDFrameStats
+{
+	uint64_t decoded;	// updates that changed the screen
+	uint64_t presented;	// times the screen was drawn with them
+	uint64_t dropped;	// updates merged into a later one before they could be presented
+} CRDFrameStats;
+
 typedef enum _CRDLogLevel
 {
 	CRDLogLevelOff   = 0,
@@ -140,6 +165,8 @@ BOOL CRDLog(CRDLogLevel logLevel, NSString *format, ...);
 extern const NSInteger CRDDefaultPort;
 extern const NSInteger CRDDefaultScreenWidth, CRDDefaultScreenHeight, CRDDefaultFrameWidth, CRDDefaultFrameHeight;
 extern const NSInteger CRDMouseEventLimit;
+extern const NSInteger CRDSuppressOutputDelay;
+extern const NSTimeInterval CRDThumbnailRefreshInterval;
 extern const NSInteger CRDInspectorMaxWidth;
 extern const NSInteger CRDForwardAudio, CRDLeaveAudio, CRDDisableAudio;
 extern const NSPoint CRDWindowCascadeStart;
@@ -161,6 +188,11 @@ extern NSString * const CRDDefaultsUnifiedDrawerWidth;
 extern NSString * const CRDDefaultsDisplayMode;
 extern NSString * const CRDDefaultsQuickConnectServers;
 extern NSString * const CRDDefaultsSendWindowsKey;
+extern NSString * const CRDDefaultsBitmapCacheCells;
+extern NSString * const CRDDefaultsBitmapCacheTracePath;
+extern NSString * const CRDDefaultsConnectTimingPath;
+extern NSString * const CRDDefaultsMaximumFrameRate;
+extern NSString * const CRDDefaultsRecordingPath;
 
 // User-configurable NSUserDefaults keys (preferences)
 extern NSString * const CRDPrefsReconnectIntoFullScreen;
@@ -172,6 +204,7 @@ extern NSString * const CRDPrefsIgnoreCustomModifiers;
 extern NSString * const CRDSetServerKeyboardLayout;
 extern NSString * const CRDForwardOnlyDefinedPaths;
 extern NSString * const CRDUseSocksProxy;
+extern NSString * const CRDAdaptToNetwork;
 extern NSString * const CRDSavedServersPath;
 
 // Notifications
@@ -29,6 +29,8 @@ const NSInteger CRDDefaultScreenHeight = 640;
 const NSInteger CRDDefaultFrameWidth = 600;
 const NSInteger CRDDefaultFrameHeight = 400;
 const NSInteger CRDMouseEventLimit = 20;
+const NSInteger CRDSuppressOutputDelay = 500; // milliseconds a session stays hidden before the server is told
+const NSTimeInterval CRDThumbnailRefreshInterval = 1.0; // seconds between refreshes of a connected server's picture in the list
 const NSInteger CRDInspectorMaxWidth = 500;
 const NSInteger CRDForwardAudio = 0;
 const NSInteger CRDLeaveAudio = 1;
@@ -55,6 +57,11 @@ NSString * const CRDDefaultsUnifiedDrawerWidth = @"drawer_width";
 NSString * const CRDDefaultsDisplayMode = @"windowed_mode";
 NSString * const CRDDefaultsQuickConnectServers = @"RecentServers";
 NSString * const CRDDefaultsSendWindowsKey = @"SendWindowsKey";
+NSString * const CRDDefaultsBitmapCacheCells = @"CRDBitmapCacheCells";
+NSString * const CRDDefaultsBitmapCacheTracePath = @"CRDBitmapCacheTracePath";
+NSString * const CRDDefaultsConnectTimingPath = @"CRDConnectTimingPath";
+NSString * const CRDDefaultsMaximumFrameRate = @"CRDMaximumFrameRate";
+NSString * const CRDDefaultsRecordingPath = @"CRDRecordingPath";
 
 
 // User-configurable NSUserDefaults keys (preferences)
@@ -67,6 +74,7 @@ NSString * const CRDPrefsIgnoreCustomModifiers = @"IgnoreModifierKeyCustomizatio
 NSString * const CRDSetServerKeyboardLayout = @"CRDSetServerKeyboardLayout";
 NSString * const CRDForwardOnlyDefinedPaths = @"CRDForwardOnlyDefinedPaths";
 NSString * const CRDUseSocksProxy = @"CRDUseSocksProxy";
+NSString * const CRDAdaptToNetwork = @"CRDAdaptToNetwork";
 NSString * const CRDSavedServersPath = @"savedServersPath";
 
 #pragma mark -
@@ -275,6 +283,7 @@ inline CRDInputEvent CRDMakeInputEvent(unsigned int time, unsigned short type, u
 	ie.param1 = param1;
 	ie.param2 = param2;
 	ie.deviceFlags = deviceFlags;
+	ie.queuedAt = 0;
 	return ie;
 }
 
@@ -381,8 +390,15 @@ void CRDFillDefaultConnection(RDConnectionRef conn)
 	conn->bitmapCache = 1;
 	conn->bitmapCachePersist = 0;
 	conn->bitmapCachePrecache = 1;
+	conn->bitmapCacheV3 = 0;
+	conn->fastPathInput = 1;
+	conn->multifragmentMaxSize = RDP5_MULTIFRAGMENT_DEFAULT_SIZE;
+	conn->bmpcacheCells[0] = conn->bmpcacheCells[1] = conn->bmpcacheCells[2] = BMPCACHE_DEFAULT_CELLS;
+	conn->bmpcacheResidentCells = BMPCACHE2_RESIDENT_CELLS;
 	conn->polygonEllipseOrders = 1;
 	conn->desktopSave = 1;
+	conn->offscreenCacheSize = OFFSCREEN_CACHE_DEFAULT_SIZE;
+	conn->offscreenCacheEntries = OFFSCREEN_CACHE_DEFAULT_ENTRIES;
 	conn->serverRdpVersion = 1;
 	conn->keyboardLayout = 0x409; // en-us keyboard
 	conn->keyboardType = 4;
@@ -391,6 +407,7 @@ void CRDFillDefaultConnection(RDConnectionRef conn)
 	conn->licenseIssued	= 0;
 	conn->pstcacheEnumerated = 0;
 	conn->ioRequest	= NULL;
+	conn->tcpSocket = -1;
 	conn->bmpcacheLru[0] = conn->bmpcacheLru[1] = conn->bmpcacheLru[2] = NOT_SET;
 	conn->bmpcacheMru[0] = conn->bmpcacheMru[1] = conn->bmpcacheMru[2] = NOT_SET;
 	conn->errorCode = ConnectionErrorNone;
@@ -407,8 +424,7 @@ void CRDFillDefaultConnection(RDConnectionRef conn)
 	strcpy(conn->rdpdrClientname, hostString);
 	strncpy(conn->hostname, hostString, 64);
 	
-	conn->rectsNeedingUpdate = NULL;
-	conn->updateEntireScreen = 0;
+	memset(&conn->dirtyTiles, 0, sizeof(conn->dirtyTiles));
 }
 
 
@@ -29,6 +29,10 @@
 #include <stdarg.h>
 #include <sys/stat.h>
 #include <stdlib.h>
+#include <libkern/OSAtomic.h>
+
+// Calls to xmalloc and xrealloc by every connection, see xmalloc_count()
+static volatile int64_t xmallocCalls;
 
 char * next_arg(char *src, char needle)
 {
@@ -87,6 +91,7 @@ void toupper_str(char *p)
 
 void * xmalloc(int size)
 {
+    OSAtomicIncrement64(&xmallocCalls);
     void *mem = malloc(size);
     if (mem == NULL)
     {
@@ -104,6 +109,7 @@ void * xrealloc(void *oldmem, int size)
     if (size < 1)
         size = 1;
 	
+    OSAtomicIncrement64(&xmallocCalls);
     mem = realloc(oldmem, size);
     if (mem == NULL)
     {
@@ -119,6 +125,12 @@ void xfree(void *mem)
     free(mem);
 }
 
+// Calls to xmalloc and xrealloc so far, from all threads
+uint64 xmalloc_count(void)
+{
+    return (uint64)xmallocCalls;
+}
+
 /* report an error */
 void error(char *format, ...)
 {
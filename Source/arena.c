@@ -0,0 +1,134 @@
+/*	Copyright (c) 2007-2012 Dorian Johnson <2011@dorianj.net>
+	
+	This file is part of CoRD.
+	CoRD is free software; you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation; either version 2 of the License, or (at your option) any later
+	version.
+
+	CoRD is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+	FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License along with
+	CoRD; if not, write to the Free Software Foundation, Inc., 51 Franklin St,
+	Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+/*	Purpose: Per-connection scratch arena.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+/* From CRDVestigialGlue.m, or whatever the arena is built with */
+void *xmalloc(int size);
+void xfree(void *mem);
+
+/*
+ * Scratch memory for buffers that only live while a single PDU is being
+ * processed (decompressed bitmaps, palettes, polygon points). Allocation is
+ * a pointer bump; everything is released at once by arena_reset(), which
+ * the receive loop calls after each rdp_recv() iteration.
+ *
+ * A caller done with a buffer early, such as one bitmap of an update, can
+ * give it back with arena_release() so that the next one reuses the same,
+ * still cached, memory instead of moving on through the block.
+ *
+ * Requests that do not fit in the current block are served from overflow
+ * chunks. On reset the overflow is freed and the main block is grown to the
+ * high water mark, so steady state traffic never touches malloc.
+ */
+
+#define ARENA_ALIGN		16
+#define ARENA_ROUND(n)		(((n) + (ARENA_ALIGN - 1)) & ~(ARENA_ALIGN - 1))
+
+struct _RDArenaChunk
+{
+	struct _RDArenaChunk *next;
+	/* data follows, padded to ARENA_ALIGN */
+};
+
+#define ARENA_CHUNK_HEADER	ARENA_ROUND(sizeof(struct _RDArenaChunk))
+#define ARENA_MAX(a, b)		((a) > (b) ? (a) : (b))
+
+/* Allocate size bytes valid until the next arena_reset */
+void *
+arena_alloc(RDArena * arena, int size)
+{
+	struct _RDArenaChunk *chunk;
+	uint32_t needed;
+
+	if (size < 1)
+		size = 1;
+
+	needed = ARENA_ROUND((uint32_t) size);
+	arena->allocs++;
+
+	if (arena->used + needed <= arena->size)
+	{
+		void *p = arena->data + arena->used;
+		arena->last = arena->used;
+		arena->used += needed;
+		arena->highWater = ARENA_MAX(arena->highWater, arena->used + arena->overflowed);
+		return p;
+	}
+
+	chunk = (struct _RDArenaChunk *) xmalloc(ARENA_CHUNK_HEADER + needed);
+	chunk->next = arena->overflow;
+	arena->overflow = chunk;
+	arena->overflowed += needed;
+	arena->highWater = ARENA_MAX(arena->highWater, arena->used + arena->overflowed);
+	arena->mallocs++;
+	return (uint8_t *) chunk + ARENA_CHUNK_HEADER;
+}
+
+/* Give back p early if it was the last allocation from the block; anything
+   else waits for the next arena_reset */
+void
+arena_release(RDArena * arena, void *p)
+{
+	if (p == arena->data + arena->last && arena->used > arena->last)
+		arena->used = arena->last;
+}
+
+/* Release everything allocated since the last reset */
+void
+arena_reset(RDArena * arena)
+{
+	struct _RDArenaChunk *chunk, *next;
+
+	if (arena->overflow != NULL)
+	{
+		for (chunk = arena->overflow; chunk != NULL; chunk = next)
+		{
+			next = chunk->next;
+			xfree(chunk);
+		}
+		arena->overflow = NULL;
+
+		if (arena->highWater > arena->size)
+		{
+			arena->size = ARENA_MAX(ARENA_ROUND(arena->highWater), ARENA_DEFAULT_SIZE);
+			xfree(arena->data);
+			arena->data = (uint8_t *) xmalloc(arena->size);
+			arena->mallocs++;
+		}
+	}
+
+	arena->used = arena->last = 0;
+	arena->overflowed = 0;
+	arena->highWater = 0;
+	arena->resets++;
+}
+
+/* Free the arena's backing store */
+void
+arena_free(RDArena * arena)
+{
+	arena_reset(arena);
+	xfree(arena->data);
+	memset(arena, 0, sizeof(*arena));
+}
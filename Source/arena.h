@@ -0,0 +1,50 @@
+/*	Copyright (c) 2007-2012 Dorian Johnson <2011@dorianj.net>
+	
+	This file is part of CoRD.
+	CoRD is free software; you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation; either version 2 of the License, or (at your option) any later
+	version.
+
+	CoRD is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+	FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License along with
+	CoRD; if not, write to the Free Software Foundation, Inc., 51 Franklin St,
+	Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef _ARENA_H
+#define _ARENA_H
+
+/* Plain C that only allocates through xmalloc() and xfree(), so that it can
+   be measured on its own (see Tools/arena_bench.c) */
+
+#include <stdint.h>
+
+/* Initial size of the arena, grown to the high water mark */
+#define ARENA_DEFAULT_SIZE 0x40000
+
+/* Bump allocator for per-PDU scratch buffers, see arena.c */
+typedef struct _RDArena
+{
+	uint8_t *data;
+	uint32_t size, used;
+	uint32_t last;		/* offset of the latest allocation from data */
+	uint32_t highWater;	/* most bytes in use at once since the last reset */
+	struct _RDArenaChunk *overflow;
+	uint32_t overflowed;	/* bytes in overflow chunks */
+
+	/* Statistics over the arena's life */
+	uint64_t allocs;	/* arena_alloc() calls */
+	uint64_t mallocs;	/* xmalloc() calls made for them */
+	uint64_t resets;	/* arena_reset() calls, one for each PDU */
+} RDArena;
+
+void *arena_alloc(RDArena * arena, int size);
+void arena_release(RDArena * arena, void *p);
+void arena_reset(RDArena * arena);
+void arena_free(RDArena * arena);
+
+#endif
@@ -0,0 +1,319 @@
+/*	Copyright (c) 2007-2012 Dorian Johnson <2011@dorianj.net>
+	
+	This file is part of CoRD.
+	CoRD is free software; you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation; either version 2 of the License, or (at your option) any later
+	version.
+
+	CoRD is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+	FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License along with
+	CoRD; if not, write to the Free Software Foundation, Inc., 51 Franklin St,
+	Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+/*	Purpose: Screen to screen blits.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "blit.h"
+
+/*
+ * SCREENBLT moves part of the framebuffer to another place in it, usually
+ * overlapping itself: a scrolled text view or web page moves nearly all of
+ * its window by a few lines. Each row is moved with memmove(), which copes
+ * with overlap along the row, and the rows are taken in the order that
+ * reads every source row before anything is written over it.
+ *
+ * Large blits are shared between a few threads. Bands of rows can be moved
+ * independently when the source doesn't overlap the destination, or when it
+ * only moved sideways. A vertical scroll, where every band reads from its
+ * neighbour, is split into strips of columns instead, each moved top to
+ * bottom or bottom to top as a whole. Anything that overlaps and moved
+ * diagonally runs on the calling thread alone.
+ *
+ * The same threads take other work that splits into independent parts,
+ * such as large fills here or the rows of tiles a frame is copied by (see
+ * blit_parallel).
+ */
+
+#define BLIT_COLUMN_ALIGN	16	/* pixels, so that strips don't share cache lines */
+
+typedef struct
+{
+	uint8_t *origin;
+	int pitch;
+	int x, y, cx, cy, srcx, srcy;
+	int columns;		/* split into strips of columns rather than bands of rows */
+	int parts;
+} blit_job;
+
+typedef struct
+{
+	uint32_t *origin;
+	int pitch;
+	int x, y, cx, cy;
+	uint32_t pixel;
+	int parts;
+} fill_job;
+
+static struct
+{
+	pthread_mutex_t busy;	/* held while the workers run a blit */
+	pthread_mutex_t lock;
+	pthread_cond_t start, finished;
+	int threads;		/* including the caller, 0 until first needed */
+	int workers;		/* started so far; they live as long as the process */
+	unsigned generation;	/* bumped for each job handed to the workers */
+	void (*work) (void *context, int part);
+	void *context;
+	int parts;
+	int next, pending;	/* parts of the job not yet taken, not yet finished */
+} pool =
+{
+	PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER,
+	0, 0, 0, NULL, NULL, 0, 0, 0
+};
+
+/* Moves a block of rows, width pixels wide, left pixels and top rows into the job */
+static void
+blit_rows(const blit_job * job, int left, int width, int top, int rows)
+{
+	uint8_t *dst = job->origin + (job->y + top) * job->pitch + (job->x + left) * 4;
+	uint8_t *src = job->origin + (job->srcy + top) * job->pitch + (job->srcx + left) * 4;
+	int step = job->pitch, i;
+
+	/* Walk away from the source, toward lower addresses if the destination is above it in memory */
+	if ((dst > src) == (step > 0))
+	{
+		dst += (rows - 1) * step;
+		src += (rows - 1) * step;
+		step = -step;
+	}
+
+	for (i = 0; i < rows; i++, dst += step, src += step)
+		memmove(dst, src, width * 4);
+}
+
+/* The first column of a strip, rounded so that strips start on a cache line */
+static int
+strip_edge(const blit_job * job, int part)
+{
+	int edge;
+
+	if (part == 0)
+		return 0;
+	if (part == job->parts)
+		return job->cx;
+
+	edge = ((job->x + job->cx * part / job->parts + BLIT_COLUMN_ALIGN - 1) & ~(BLIT_COLUMN_ALIGN - 1)) - job->x;
+	return edge < job->cx ? edge : job->cx;
+}
+
+static void
+blit_part(void *context, int part)
+{
+	const blit_job *job = context;
+	int first, last;
+
+	if (job->columns)
+	{
+		first = strip_edge(job, part);
+		last = strip_edge(job, part + 1);
+		if (last > first)
+			blit_rows(job, first, last - first, 0, job->cy);
+	}
+	else
+	{
+		first = job->cy * part / job->parts;
+		last = job->cy * (part + 1) / job->parts;
+		if (last > first)
+			blit_rows(job, 0, job->cx, first, last - first);
+	}
+}
+
+/* Takes parts of the current job until none are left; called with pool.lock held */
+static void
+blit_take_parts(void)
+{
+	int part;
+
+	while (pool.next < pool.parts)
+	{
+		part = pool.next++;
+		pthread_mutex_unlock(&pool.lock);
+		pool.work(pool.context, part);
+		pthread_mutex_lock(&pool.lock);
+
+		if (--pool.pending == 0)
+			pthread_cond_signal(&pool.finished);
+	}
+}
+
+static void *
+blit_worker(void *unused)
+{
+	/* A worker started after the first blit looks at the current one too,
+	   which by then has nothing left to take */
+	unsigned seen = 0;
+
+	(void) unused;
+	pthread_mutex_lock(&pool.lock);
+	for (;;)
+	{
+		while (pool.generation == seen)
+			pthread_cond_wait(&pool.start, &pool.lock);
+
+		seen = pool.generation;
+		blit_take_parts();
+	}
+
+	return NULL;
+}
+
+static int
+blit_threads(void)
+{
+	long cpus;
+
+	if (pool.threads == 0)
+	{
+		cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		pool.threads = cpus < 1 ? 1 : cpus > BLIT_MAX_THREADS ? BLIT_MAX_THREADS : cpus;
+	}
+
+	return pool.threads;
+}
+
+/* Calls work(context, part) for parts 0 to parts - 1, shared between the
+   calling thread and the workers, and returns when all are done. The parts
+   must not depend on each other. */
+void
+blit_parallel(int parts, void (*work) (void *context, int part), void *context)
+{
+	pthread_t thread;
+	int part, workers = parts < blit_threads() ? parts - 1 : blit_threads() - 1;
+
+	/* Another connection has the workers; this one does its own work */
+	if (workers <= 0 || pthread_mutex_trylock(&pool.busy) != 0)
+	{
+		for (part = 0; part < parts; part++)
+			work(context, part);
+		return;
+	}
+
+	pthread_mutex_lock(&pool.lock);
+
+	while (pool.workers < workers && pthread_create(&thread, NULL, blit_worker, NULL) == 0)
+	{
+		pthread_detach(thread);
+		pool.workers++;
+	}
+
+	pool.work = work;
+	pool.context = context;
+	pool.parts = parts;
+	pool.next = 0;
+	pool.pending = parts;
+	pool.generation++;
+	pthread_cond_broadcast(&pool.start);
+
+	blit_take_parts();
+	while (pool.pending > 0)
+		pthread_cond_wait(&pool.finished, &pool.lock);
+
+	pthread_mutex_unlock(&pool.lock);
+	pthread_mutex_unlock(&pool.busy);
+}
+
+/* Moves the cx x cy block at srcx, srcy to x, y. origin is pixel 0, 0 and
+   pitch the byte distance from one row to the next, negative for bottom-up
+   buffers. Both blocks must lie within the buffer. */
+void
+blit_move(uint32_t * origin, int pitch, int x, int y, int cx, int cy, int srcx, int srcy)
+{
+	blit_job job;
+	int overlap;
+
+	if (cx <= 0 || cy <= 0 || (x == srcx && y == srcy))
+		return;
+
+	job.origin = (uint8_t *) origin;
+	job.pitch = pitch;
+	job.x = x;
+	job.y = y;
+	job.cx = cx;
+	job.cy = cy;
+	job.srcx = srcx;
+	job.srcy = srcy;
+	job.columns = 0;
+	job.parts = 1;
+
+	if ((long) cx * cy >= BLIT_THREAD_MIN_PIXELS)
+	{
+		overlap = abs(x - srcx) < cx && abs(y - srcy) < cy;
+
+		if (!overlap || y == srcy)
+		{
+			job.parts = blit_threads();
+		}
+		else if (x == srcx)
+		{
+			job.parts = blit_threads();
+			job.columns = 1;
+		}
+	}
+
+	blit_parallel(job.parts, blit_part, &job);
+}
+
+static void
+fill_part(void *context, int part)
+{
+	const fill_job *job = context;
+	int first = job->cy * part / job->parts, last = job->cy * (part + 1) / job->parts, row, i;
+
+	for (row = first; row < last; row++)
+	{
+		uint32_t *p = (uint32_t *) ((uint8_t *) job->origin + (long) (job->y + row) * job->pitch) + job->x;
+
+		for (i = 0; i < job->cx; i++)
+			p[i] = job->pixel;
+	}
+}
+
+/* Sets the cx x cy block at x, y to pixel, laid out as for blit_move. The
+   block must lie within the buffer. */
+void
+blit_fill(uint32_t * origin, int pitch, int x, int y, int cx, int cy, uint32_t pixel)
+{
+	fill_job job;
+
+	if (cx <= 0 || cy <= 0)
+		return;
+
+	job.origin = origin;
+	job.pitch = pitch;
+	job.x = x;
+	job.y = y;
+	job.cx = cx;
+	job.cy = cy;
+	job.pixel = pixel;
+	job.parts = (long) cx * cy >= BLIT_THREAD_MIN_PIXELS ? blit_threads() : 1;
+
+	blit_parallel(job.parts, fill_part, &job);
+}
+
+/* Caps the threads work is shared between, the caller included */
+void
+blit_set_threads(int threads)
+{
+	pool.threads = threads < 1 ? 1 : threads > BLIT_MAX_THREADS ? BLIT_MAX_THREADS : threads;
+}
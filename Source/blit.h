@@ -0,0 +1,34 @@
+/*	Copyright (c) 2007-2012 Dorian Johnson <2011@dorianj.net>
+	
+	This file is part of CoRD.
+	CoRD is free software; you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation; either version 2 of the License, or (at your option) any later
+	version.
+
+	CoRD is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+	FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License along with
+	CoRD; if not, write to the Free Software Foundation, Inc., 51 Franklin St,
+	Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef _BLIT_H
+#define _BLIT_H
+
+/* Only depends on POSIX, so that it can be checked and measured on its own
+   (see Tools/blit_bench.c) */
+
+#include <stdint.h>
+
+#define BLIT_MAX_THREADS	4
+#define BLIT_THREAD_MIN_PIXELS	(256 * 256)	/* smaller blits aren't worth waking threads for */
+
+void blit_move(uint32_t * origin, int pitch, int x, int y, int cx, int cy, int srcx, int srcy);
+void blit_fill(uint32_t * origin, int pitch, int x, int y, int cx, int cy, uint32_t pixel);
+void blit_parallel(int parts, void (*work) (void *context, int part), void *context);
+void blit_set_threads(int threads);
+
+#endif
@@ -23,6 +23,7 @@
 
 #define NUM_ELEMENTS(array) (sizeof(array) / sizeof(array[0]))
 #define IS_PERSISTENT(id) (conn->pstcacheFd[id] > 0)
+#define IS_CACHED_CELL(id, idx) ((id) < BITMAP_CACHE_SIZE && conn->bmpcache[id] != NULL && (idx) < conn->bmpcacheCells[id])
 #define TO_TOP -1
 #define CACHE_IS_SET(idx) (idx >= 0)
 
@@ -36,6 +37,109 @@
 
 static void cache_bump_bitmap(RDConnectionRef conn, uint8 id, uint16 idx, int bump);
 static void cache_evict_bitmap(RDConnectionRef conn, uint8 id);
+
+/* The geometry advertised when none was configured: what RDP4 and RDP5
+ * servers have always been offered, with the large persistent cache 2 when
+ * its file can be used */
+static int
+cache_default_cells(RDConnectionRef conn, uint8 id)
+{
+	static const int v1[BITMAP_CACHE_SIZE] = { BMPCACHE_C0_CELLS, BMPCACHE_C1_CELLS, BMPCACHE_C2_CELLS };
+	static const int v2[BITMAP_CACHE_SIZE] = { BMPCACHE2_C0_CELLS, BMPCACHE2_C1_CELLS, BMPCACHE2_C2_CELLS };
+
+	if (!conn->useRdp5)
+		return v1[id];
+	if (id == 2 && pstcache_init(conn, id))
+		return BMPCACHE2_NUM_PSTCELLS;
+	return v2[id];
+}
+
+/* Allocate the bitmap caches for the geometry in bmpcacheCells. Called before
+ * the capabilities are sent; the geometry is fixed for the connection after that. */
+void
+cache_init_bitmaps(RDConnectionRef conn)
+{
+	uint8 id;
+
+	for (id = 0; id < BITMAP_CACHE_SIZE; id++)
+	{
+		if (conn->bmpcache[id] != NULL)
+			continue;
+
+		if (conn->bmpcacheCells[id] == BMPCACHE_DEFAULT_CELLS)
+			conn->bmpcacheCells[id] = cache_default_cells(conn, id);
+
+		conn->bmpcacheCells[id] = MAX(0, MIN(conn->bmpcacheCells[id], BITMAP_CACHE_MAX_CELLS));
+		if (conn->bmpcacheCells[id] == 0)
+			continue;
+
+		conn->bmpcache[id] = (struct bmpcache_entry *) xmalloc(conn->bmpcacheCells[id] * sizeof(struct bmpcache_entry));
+		memset(conn->bmpcache[id], 0, conn->bmpcacheCells[id] * sizeof(struct bmpcache_entry));
+	}
+}
+
+/* Write back persistent cache state and release every cached bitmap */
+void
+cache_free_bitmaps(RDConnectionRef conn)
+{
+	uint8 id;
+	int idx;
+
+	cache_save_state(conn);
+
+	for (id = 0; id < BITMAP_CACHE_SIZE; id++)
+	{
+		if (IS_PERSISTENT(id))
+		{
+			rd_close_file(conn->pstcacheFd[id]);
+			conn->pstcacheFd[id] = 0;
+		}
+
+		ui_destroy_bitmap(conn->volatileBc[id]);
+		conn->volatileBc[id] = NULL;
+
+		if (conn->bmpcache[id] == NULL)
+			continue;
+
+		for (idx = 0; idx < conn->bmpcacheCells[id]; idx++)
+			ui_destroy_bitmap(conn->bmpcache[id][idx].bitmap);
+
+		xfree(conn->bmpcache[id]);
+		conn->bmpcache[id] = NULL;
+		conn->bmpcacheCount[id] = 0;
+		conn->bmpcacheLru[id] = conn->bmpcacheMru[id] = NOT_SET;
+	}
+
+	if (conn->bmpcacheTrace != NULL)
+	{
+		fclose(conn->bmpcacheTrace);
+		conn->bmpcacheTrace = NULL;
+	}
+}
+
+/* Record a bitmap arriving in the cache, for replay against other geometries.
+ * Each line is "P id width height key"; cache hits are logged by
+ * cache_get_bitmap() as "G id key". The key is a hash of the pixel data, so
+ * identical content sent twice is recognised as such by the replay tool. */
+void
+cache_trace_bitmap(RDConnectionRef conn, uint8 id, uint16 idx, int width, int height, int Bpp, uint8 * data)
+{
+	uint32 key = 2166136261u;
+	int i, length = width * height * Bpp;
+
+	if (conn->bmpcacheTrace == NULL)
+		return;
+
+	for (i = 0; i < length; i++)
+		key = (key ^ data[i]) * 16777619u;
+	key ^= (width << 16) | height;
+
+	if (IS_CACHED_CELL(id, idx))
+		conn->bmpcache[id][idx].traceKey = key;
+
+	fprintf(conn->bmpcacheTrace, "P %d %d %d %08x\n", id, width, height, key);
+}
+
 /* Setup the bitmap cache lru/mru linked list */
 void
 cache_rebuild_bmpcache_linked_list(RDConnectionRef conn, uint8 id, sint16 * idx, int count)
@@ -177,13 +281,16 @@ cache_evict_bitmap(RDConnectionRef conn, uint8 id)
 RDBitmapRef
 cache_get_bitmap(RDConnectionRef conn, uint8 id, uint16 idx)
 {
-	if ((id < NUM_ELEMENTS(conn->bmpcache)) && (idx < NUM_ELEMENTS(conn->bmpcache[0])))
+	if (IS_CACHED_CELL(id, idx))
 	{
 		if (conn->bmpcache[id][idx].bitmap || pstcache_load_bitmap(conn, id, idx))
 		{
 			if (IS_PERSISTENT(id))
 				cache_bump_bitmap(conn, id, idx, BUMP_COUNT);
 
+			if (conn->bmpcacheTrace != NULL)
+				fprintf(conn->bmpcacheTrace, "G %d %08x\n", id, conn->bmpcache[id][idx].traceKey);
+
 			return conn->bmpcache[id][idx].bitmap;
 		}
 	}
@@ -202,7 +309,7 @@ cache_put_bitmap(RDConnectionRef conn, uint8 id, uint16 idx, RDBitmapRef bitmap)
 {
 	RDBitmapRef old;
 
-	if ((id < NUM_ELEMENTS(conn->bmpcache)) && (idx < NUM_ELEMENTS(conn->bmpcache[0])))
+	if (IS_CACHED_CELL(id, idx))
 	{
 		old = conn->bmpcache[id][idx].bitmap;
 		if (old != NULL)
@@ -215,7 +322,7 @@ cache_put_bitmap(RDConnectionRef conn, uint8 id, uint16 idx, RDBitmapRef bitmap)
 				conn->bmpcache[id][idx].previous = conn->bmpcache[id][idx].next = NOT_SET;
 
 			cache_bump_bitmap(conn, id, idx, TO_TOP);
-			if (conn->bmpcacheCount[id] > BMPCACHE2_C2_CELLS)
+			if (conn->bmpcacheCount[id] > conn->bmpcacheResidentCells)
 				cache_evict_bitmap(conn, id);
 		}
 	}
@@ -239,8 +346,8 @@ cache_save_state(RDConnectionRef conn)
 	uint32 id = 0, t = 0;
 	int idx;
 
-	for (id = 0; id < NUM_ELEMENTS(conn->bmpcache); id++)
-		if (IS_PERSISTENT(id))
+	for (id = 0; id < BITMAP_CACHE_SIZE; id++)
+		if (IS_PERSISTENT(id) && conn->bmpcache[id] != NULL)
 		{
 			DEBUG_RDP5(("Saving cache state for bitmap cache %d...", id));
 			idx = conn->bmpcacheLru[id];
@@ -312,10 +419,14 @@ cache_put_text(RDConnectionRef conn, uint8 cache_id, void *data, int length)
 {
 	RDDataBlob *text;
 
+	if (length > TEXT_CACHE_ENTRY_SIZE)
+	{
+		error("put text %d, length %d\n", cache_id, length);
+		return;
+	}
+
 	text = &conn->textCache[cache_id];
-	if (text->data != NULL)
-		xfree(text->data);
-	text->data = xmalloc(length);
+	text->data = conn->textCacheData[cache_id];
 	text->size = length;
 	memcpy(text->data, data, length);
 }
@@ -331,7 +442,7 @@ cache_get_desktop(RDConnectionRef conn, uint32 offset, int cx, int cy, int bytes
 
 	if ((offset + length) <= sizeof(conn->deskCache))
 	{
-		return &conn->deskCache[offset];
+		return (uint8 *) conn->deskCache + offset;
 	}
 
 	error("get desktop %d:%d\n", offset, length);
@@ -352,7 +463,7 @@ cache_put_desktop(RDConnectionRef conn, uint32 offset, int cx, int cy, int scanl
 		cx *= bytes_per_pixel;
 		while (cy--)
 		{
-			memcpy(&conn->deskCache[offset], data, cx);
+			memcpy((uint8 *) conn->deskCache + offset, data, cx);
 			data += scanline;
 			offset += cx;
 		}
@@ -400,6 +511,92 @@ cache_put_cursor(RDConnectionRef conn, uint16 cache_idx, RDCursorRef cursor)
 	}
 }
 
+/*
+ * Servers send the same few pointers over and over, as a new pointer PDU
+ * whenever the mouse crosses into a text field or a link, often into a
+ * different cache slot each time. Converting each to an NSCursor is far
+ * dearer than recognising it, so converted cursors are also kept by their
+ * content: FNV-1a over the hotspot, size, depth and both masks picks the
+ * entry, and a full comparison confirms it.
+ */
+static uint32
+cache_hash_cursor_shape(sint16 x, sint16 y, uint16 width, uint16 height, const uint8 * andmask, int andlen,
+			const uint8 * xormask, int xorlen, int bpp)
+{
+	uint32 hash = 2166136261u;
+	int i;
+
+	hash = (hash ^ (uint16) x) * 16777619u;
+	hash = (hash ^ (uint16) y) * 16777619u;
+	hash = (hash ^ width) * 16777619u;
+	hash = (hash ^ height) * 16777619u;
+	hash = (hash ^ bpp) * 16777619u;
+	for (i = 0; i < andlen; i++)
+		hash = (hash ^ andmask[i]) * 16777619u;
+	for (i = 0; i < xorlen; i++)
+		hash = (hash ^ xormask[i]) * 16777619u;
+
+	return hash;
+}
+
+/* Retrieve a cursor converted earlier from the same pointer data, or NULL */
+RDCursorRef
+cache_get_cursor_shape(RDConnectionRef conn, sint16 x, sint16 y, uint16 width, uint16 height, const uint8 * andmask,
+		       int andlen, const uint8 * xormask, int xorlen, int bpp)
+{
+	uint32 hash = cache_hash_cursor_shape(x, y, width, height, andmask, andlen, xormask, xorlen, bpp);
+	RDCursorShape *shape = &conn->cursorShapeCache[hash % CURSOR_SHAPE_CACHE_SIZE];
+
+	if (shape->cursor == NULL || shape->hash != hash || shape->x != x || shape->y != y ||
+	    shape->width != width || shape->height != height || shape->bpp != bpp ||
+	    shape->andlen != andlen || shape->xorlen != xorlen ||
+	    memcmp(shape->data, andmask, andlen) || memcmp(shape->data + andlen, xormask, xorlen))
+		return NULL;
+
+	return shape->cursor;
+}
+
+/* Store a converted cursor by its pointer data, replacing whatever shared its entry.
+   The cache takes over the caller's reference to cursor. */
+void
+cache_put_cursor_shape(RDConnectionRef conn, sint16 x, sint16 y, uint16 width, uint16 height, const uint8 * andmask,
+		       int andlen, const uint8 * xormask, int xorlen, int bpp, RDCursorRef cursor)
+{
+	uint32 hash = cache_hash_cursor_shape(x, y, width, height, andmask, andlen, xormask, xorlen, bpp);
+	RDCursorShape *shape = &conn->cursorShapeCache[hash % CURSOR_SHAPE_CACHE_SIZE];
+
+	if (shape->cursor != NULL)
+		ui_destroy_cursor(shape->cursor);
+	xfree(shape->data);
+
+	shape->hash = hash;
+	shape->x = x;
+	shape->y = y;
+	shape->width = width;
+	shape->height = height;
+	shape->bpp = bpp;
+	shape->andlen = andlen;
+	shape->xorlen = xorlen;
+	shape->data = (uint8 *) xmalloc(andlen + xorlen);
+	memcpy(shape->data, andmask, andlen);
+	memcpy(shape->data + andlen, xormask, xorlen);
+	shape->cursor = cursor;
+}
+
+void
+cache_free_cursor_shapes(RDConnectionRef conn)
+{
+	int i;
+
+	for (i = 0; i < CURSOR_SHAPE_CACHE_SIZE; i++)
+	{
+		if (conn->cursorShapeCache[i].cursor != NULL)
+			ui_destroy_cursor(conn->cursorShapeCache[i].cursor);
+		xfree(conn->cursorShapeCache[i].data);
+		memset(&conn->cursorShapeCache[i], 0, sizeof(RDCursorShape));
+	}
+}
+
 /* Retrieve brush from cache */
 RDBrushData *
 cache_get_brush_data(RDConnectionRef conn, uint8 colour_code, uint8 idx)
@@ -429,9 +626,81 @@ cache_put_brush_data(RDConnectionRef conn, uint8 colour_code, uint8 idx, RDBrush
 			xfree(bd->data);
 		}
 		memcpy(bd, brush_data, sizeof(RDBrushData));
+		conn->brushTileGeneration++;	/* expanded tiles may reference the old data */
 	}
 	else
 	{
 		error("put brush %d %d\n", colour_code, idx);
 	}
 }
+
+/* Retrieve an offscreen bitmap from the cache */
+RDSurfaceRef
+cache_get_offscreen(RDConnectionRef conn, uint16 idx)
+{
+	if (idx < conn->offscreenCacheEntries && idx < NUM_ELEMENTS(conn->offscreenCache))
+		return conn->offscreenCache[idx].surface;
+
+	error("get offscreen %d\n", idx);
+	return NULL;
+}
+
+/* Store an offscreen bitmap in the cache, replacing any previous one */
+void
+cache_put_offscreen(RDConnectionRef conn, uint16 idx, uint16 width, uint16 height, RDSurfaceRef surface)
+{
+	RDOffscreenBitmap *entry;
+	uint32 budget = conn->offscreenCacheSize * 1024;
+
+	if (idx >= conn->offscreenCacheEntries || idx >= NUM_ELEMENTS(conn->offscreenCache))
+	{
+		error("put offscreen %d\n", idx);
+		ui_destroy_surface(surface);
+		return;
+	}
+
+	cache_delete_offscreen(conn, idx);
+
+	entry = &conn->offscreenCache[idx];
+	entry->surface = surface;
+	entry->width = width;
+	entry->height = height;
+
+	/* The server sizes the cache using its own colour depth */
+	conn->offscreenCacheUsed += width * height * ((conn->serverBpp + 7) / 8);
+	if (conn->offscreenCacheUsed > budget)
+		warning("offscreen cache over budget (%d > %d bytes)\n", conn->offscreenCacheUsed, budget);
+}
+
+/* Remove an offscreen bitmap from the cache */
+void
+cache_delete_offscreen(RDConnectionRef conn, uint16 idx)
+{
+	RDOffscreenBitmap *entry;
+
+	if (idx >= NUM_ELEMENTS(conn->offscreenCache))
+		return;
+
+	entry = &conn->offscreenCache[idx];
+	if (entry->surface == NULL)
+		return;
+
+	if (entry->surface == conn->currentSurface)
+		ui_set_surface(conn, NULL);
+
+	ui_destroy_surface(entry->surface);
+	conn->offscreenCacheUsed -= entry->width * entry->height * ((conn->serverBpp + 7) / 8);
+	memset(entry, 0, sizeof(RDOffscreenBitmap));
+}
+
+/* Drop all offscreen bitmaps */
+void
+cache_reset_offscreen(RDConnectionRef conn)
+{
+	int i;
+
+	for (i = 0; i < NUM_ELEMENTS(conn->offscreenCache); i++)
+		cache_delete_offscreen(conn, i);
+
+	conn->offscreenCacheUsed = 0;
+}
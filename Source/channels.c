@@ -76,6 +76,7 @@ channel_send(RDConnectionRef conn, RDStreamRef s, RDVirtualChannel * channel)
 	uint32 length, flags;
 	uint32 thislength, remaining;
 	uint8 *data;
+	RDStream header;
 
 	/* first fragment sent in-place */
 	s_pop_layer(s, channel_hdr);
@@ -99,7 +100,14 @@ channel_send(RDConnectionRef conn, RDStreamRef s, RDVirtualChannel * channel)
 	DEBUG_CHANNEL(("Sending %d bytes with FLAG_FIRST\n", thislength));
 	sec_send_to_channel(conn, s, conn->useEncryption ? SEC_ENCRYPT : 0, channel->mcs_id);
 
-	/* subsequent segments copied (otherwise would have to generate headers backwards) */
+	if (remaining == 0)
+		return;
+
+	/* subsequent segments are sent from where they are: their headers are
+	   built in a stream of our own, which tcp_send writes along with the
+	   data, so the connection's streams are left alone */
+	memset(&header, 0, sizeof(header));
+
 	while (remaining > 0)
 	{
 		thislength = MIN(remaining, CHANNEL_CHUNK_LENGTH);
@@ -110,15 +118,17 @@ channel_send(RDConnectionRef conn, RDStreamRef s, RDVirtualChannel * channel)
 
 		DEBUG_CHANNEL(("Sending %d bytes with flags %d\n", thislength, flags));
 
-		s = sec_init(conn, conn->useEncryption ? SEC_ENCRYPT : 0, thislength + 8);
+		s = sec_init_stream(conn, &header, conn->useEncryption ? SEC_ENCRYPT : 0, 8);
 		out_uint32_le(s, length);
 		out_uint32_le(s, flags);
-		out_uint8p(s, data, thislength);
 		s_mark_end(s);
+		s_set_tail(s, data, thislength);
 		sec_send_to_channel(conn, s, conn->useEncryption ? SEC_ENCRYPT : 0, channel->mcs_id);
 
 		data += thislength;
 	}
+
+	xfree(header.data);
 }
 
 void
@@ -25,20 +25,51 @@
 #define MAX_SOUND_FORMATS 10
 
 #define BITMAP_CACHE_SIZE 3
-#define BITMAP_CACHE_ENTRIES 0xa00
+#define BITMAP_CACHE_MAX_CELLS 0x7fff	/* cache indices are 15 bits, 0x7fff is the volatile cell */
 
 #define CURSOR_CACHE_SIZE 0x20
+#define CURSOR_SHAPE_CACHE_SIZE 32
 #define BRUSH_CACHE_ENTRIES 2
 #define BRUSH_CACHE_SIZE 64
+#define BRUSH_TILE_CACHE_SIZE 64
 #define TEXT_CACHE_SIZE 256
+#define TEXT_CACHE_ENTRY_SIZE 256
 
 #define FONT_CACHE_SIZE 12
 #define FONT_CACHE_ENTRIES 256
 
+/* Offscreen bitmap cache: protocol maximums, and what we ask for by default */
+#define OFFSCREEN_CACHE_ENTRIES 500
+#define OFFSCREEN_CACHE_SIZE 7680	/* KB */
+#define OFFSCREEN_CACHE_DEFAULT_ENTRIES 100
+#define OFFSCREEN_CACHE_DEFAULT_SIZE 7680
+#define SCREEN_BITMAP_SURFACE 0xffff
+#define SCREEN_BITMAP_CACHE_ID 0xff
+
 #define TIMEOUT_LENGTH 20
 
+/* How much tcp_recv() asks the socket for at once */
+#define TCP_READ_AHEAD_SIZE 0x10000
+
 #define NOT_SET -1
 
+/* Connection phases, each timestamped when it completes (see timing.c) */
+enum RDP_CONNECT_PHASE
+{
+	CONNECT_PHASE_START = 0,
+	CONNECT_PHASE_TCP,
+	CONNECT_PHASE_ISO,
+	CONNECT_PHASE_MCS_CONNECT,
+	CONNECT_PHASE_MCS_ATTACH,
+	CONNECT_PHASE_MCS_JOIN,
+	CONNECT_PHASE_SECURITY,
+	CONNECT_PHASE_LICENCE,
+	CONNECT_PHASE_DEMAND_ACTIVE,
+	CONNECT_PHASE_FINALIZE,
+	CONNECT_PHASE_FIRST_FRAME,
+	CONNECT_PHASE_COUNT
+};
+
 
 /* ISO PDU codes */
 enum ISO_PDU_CODE
@@ -143,9 +174,10 @@ enum RDP_DATA_PDU_TYPE
 	RDP_DATA_PDU_CONTROL = 20,
 	RDP_DATA_PDU_POINTER = 27,
 	RDP_DATA_PDU_INPUT = 28,
+	RDP_DATA_PDU_REFRESH_RECT = 33,
 	RDP_DATA_PDU_SYNCHRONISE = 31,
 	RDP_DATA_PDU_BELL = 34,
-	RDP_DATA_PDU_CLIENT_WINDOW_STATUS = 35,
+	RDP_DATA_PDU_CLIENT_WINDOW_STATUS = 35,	/* suppress output */
 	RDP_DATA_PDU_LOGON = 38,	/* PDUTYPE2_SAVE_SESSION_INFO */
 	RDP_DATA_PDU_FONT2 = 39,
 	RDP_DATA_PDU_KEYBOARD_INDICATORS = 41,
@@ -207,6 +239,26 @@ enum RDP_INPUT_DEVICE
 	RDP_INPUT_MOUSE = 0x8001
 };
 
+/* Input events sent in one PDU (the fast-path count is one byte) */
+#define RDP_INPUT_MAX_EVENTS 255
+
+/* Fast-path input */
+#define FASTPATH_INPUT_ACTION_FASTPATH	0x00
+#define FASTPATH_INPUT_ENCRYPTED	0x80
+#define FASTPATH_INPUT_MAX_HEADER_EVENTS 15
+
+enum FASTPATH_INPUT_EVENT_CODE
+{
+	FASTPATH_INPUT_EVENT_SCANCODE = 0,
+	FASTPATH_INPUT_EVENT_MOUSE = 1,
+	FASTPATH_INPUT_EVENT_MOUSEX = 2,
+	FASTPATH_INPUT_EVENT_SYNC = 3,
+	FASTPATH_INPUT_EVENT_UNICODE = 4
+};
+
+#define FASTPATH_INPUT_KBDFLAGS_RELEASE  0x01
+#define FASTPATH_INPUT_KBDFLAGS_EXTENDED 0x02
+
 /* Device flags */
 #define KBD_FLAG_RIGHT          0x0001
 #define KBD_FLAG_EXT            0x0100
@@ -250,11 +302,29 @@ enum RDP_INPUT_DEVICE
 #define ALTERNATE 1
 #define WINDING   2
 
+/* Default bitmap cache geometry for each version of the capability set,
+   used for caches whose bmpcacheCells are BMPCACHE_DEFAULT_CELLS */
+#define BMPCACHE_DEFAULT_CELLS  -1
+#define BMPCACHE_C0_CELLS       0x258
+#define BMPCACHE_C1_CELLS       0x12c
+#define BMPCACHE_C2_CELLS       0x106
+
 /* RDP bitmap cache (version 2) constants */
 #define BMPCACHE2_C0_CELLS      0x78
 #define BMPCACHE2_C1_CELLS      0x78
 #define BMPCACHE2_C2_CELLS      0x150
-#define BMPCACHE2_NUM_PSTCELLS  0x9f6
+#define BMPCACHE2_NUM_PSTCELLS  0x9f6	/* cache 2, when it is persistent */
+
+/* Bitmaps a persistent cache keeps in memory; the rest are reloaded from disk */
+#define BMPCACHE2_RESIDENT_CELLS 0x150
+
+/* Keys per persistent key list PDU */
+#define BMPCACHE2_KEYS_PER_PDU  169
+
+/* Bitmap cache v3 (TS_BITMAP_DATA_EX) */
+#define BMPCACHE3_CODEC_NONE    0
+#define BMPCACHE3_EXHEADER_PRESENT 0x01
+#define BMPCACHE3_EXHEADER_SIZE 24
 
 #define PDU_FLAG_FIRST  0x01
 #define PDU_FLAG_LAST   0x02
@@ -273,6 +343,8 @@ enum RDP_INPUT_DEVICE
 #define RDP_CAPLEN_ORDER     0x58
 #define ORDER_CAP_NEGOTIATE  2
 #define ORDER_CAP_NOSUPPORT  4
+#define ORDER_CAP_EXTRA_FLAGS 0x80
+#define ORDER_CAP_EX_BMPCACHE3 0x0002
 
 #define RDP_CAPSET_BMPCACHE	4
 #define RDP_CAPLEN_BMPCACHE	0x28
@@ -293,13 +365,33 @@ enum RDP_INPUT_DEVICE
 #define RDP_CAPSET_COLCACHE	10
 #define RDP_CAPLEN_COLCACHE	0x08
 
+#define RDP_CAPSET_INPUT	13
+#define RDP_CAPLEN_INPUT	0x58
+#define INPUT_FLAG_SCANCODES	0x0001
+#define INPUT_FLAG_MOUSEX	0x0004
+#define INPUT_FLAG_FASTPATH_INPUT	0x0008
+#define INPUT_FLAG_UNICODE	0x0010
+#define INPUT_FLAG_FASTPATH_INPUT2	0x0020
+
 #define RDP_CAPSET_BRUSHCACHE 15
 #define RDP_CAPLEN_BRUSHCACHE 0x08
 
+#define RDP_CAPSET_OFFSCREEN 17
+#define RDP_CAPLEN_OFFSCREEN 0x0C
+
 #define RDP_CAPSET_BMPCACHE2 19
 #define RDP_CAPLEN_BMPCACHE2 0x28
 #define BMPCACHE2_FLAG_PERSIST ((uint32)1<<31)
 
+#define RDP_CAPSET_MULTIFRAGMENTUPDATE 26
+#define RDP_CAPLEN_MULTIFRAGMENTUPDATE 0x08
+
+#define RDP_CAPSET_SURFACE_COMMANDS 28
+#define RDP_CAPLEN_SURFACE_COMMANDS 0x0C
+#define SURFCMDS_SET_SURFACE_BITS	0x00000002
+#define SURFCMDS_FRAME_MARKER	0x00000010
+#define SURFCMDS_STREAM_SURFACE_BITS	0x00000040
+
 #define RDP_SOURCE "MSTSC"
 
 /* Logon flags */
@@ -319,6 +411,22 @@ enum RDP_INPUT_DEVICE
 #define RDP5_NO_CURSORSETTINGS 0x40	/* disables cursor blinking */
 #define RDP5_FONT_SMOOTHING    0x80 /* enables ClearType */
 
+/* Link classes for automatic bulk compression, see timing_estimate_network() */
+enum RDP_NETWORK_CLASS
+{
+	NETWORK_CLASS_UNKNOWN = 0,
+	NETWORK_CLASS_LAN,
+	NETWORK_CLASS_BROADBAND,
+	NETWORK_CLASS_WAN,
+	NETWORK_CLASS_LOW_SPEED
+};
+
+#define NETWORK_LAN_RTT		5000	/* us */
+#define NETWORK_BROADBAND_RTT	25000
+#define NETWORK_WAN_RTT		100000
+#define NETWORK_BROADBAND_KBPS	10000
+#define NETWORK_LOW_SPEED_KBPS	2000
+
 /* compression types */
 #define RDP_MPPC_BIG        0x01
 #define RDP_MPPC_COMPRESSED	0x20
@@ -328,6 +436,29 @@ enum RDP_INPUT_DEVICE
 
 #define RDP5_COMPRESSED	0x80
 
+/* Fast-path update header: update code, then fragmentation */
+#define RDP5_UPDATE_CODE_MASK	0x0f
+#define RDP5_FRAGMENT_SHIFT	4
+#define RDP5_FRAGMENT_MASK	0x03
+
+enum RDP5_FRAGMENTATION
+{
+	RDP5_FRAGMENT_SINGLE = 0,
+	RDP5_FRAGMENT_LAST = 1,
+	RDP5_FRAGMENT_FIRST = 2,
+	RDP5_FRAGMENT_NEXT = 3
+};
+
+/* Largest reassembled fast-path update we ask the server for, by default */
+#define RDP5_MULTIFRAGMENT_DEFAULT_SIZE 0x40000
+
+/* Surface commands (fast-path update 4) */
+#define SURFCMD_SET_SURFACE_BITS	0x0001
+#define SURFCMD_FRAME_MARKER	0x0004
+#define SURFCMD_STREAM_SURFACE_BITS	0x0006
+#define SURFCMD_FRAMEACTION_BEGIN	0x0000
+#define SURFCMD_FRAMEACTION_END	0x0001
+
 /* Keymap flags */
 #define MapRightShiftMask (1<<0)
 #define MapLeftShiftMask  (1<<1)
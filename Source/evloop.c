@@ -0,0 +1,459 @@
+/*	Copyright (c) 2007-2012 Dorian Johnson <2011@dorianj.net>
+	
+	This file is part of CoRD.
+	CoRD is free software; you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation; either version 2 of the License, or (at your option) any later
+	version.
+
+	CoRD is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+	FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License along with
+	CoRD; if not, write to the Free Software Foundation, Inc., 51 Franklin St,
+	Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+/*	Purpose: Event loop for the connection thread.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#ifdef __APPLE__
+#include <mach/mach_time.h>
+#else
+#include <time.h>
+#endif
+
+#include "evloop.h"
+
+/*
+ * The connection thread sleeps in poll() until the server's socket, a
+ * redirected device or a timer needs it, or until another thread calls
+ * evloop_wakeup() because it has queued input. Wakeups go through a pipe and
+ * coalesce: while one is pending further calls only note that they happened,
+ * and the wakeup handler is expected to pick up everything queued so far.
+ *
+ * Everything except evloop_wakeup() and evloop_stop() must be called on the
+ * thread running the loop. Callbacks may add and remove descriptors and
+ * timers, including their own.
+ *
+ * The loop itself is plain POSIX and is built and measured on Linux too (see
+ * Tools/evloop_bench.c). The protocol core running on it is not: tcp.m reads
+ * and writes through NSStream, so it still needs Foundation.
+ */
+
+typedef struct
+{
+	RDEventLoopFDCallback callback;
+	void *context;
+} evloop_fd;
+
+typedef struct
+{
+	int id;			/* 0 once cancelled */
+	uint64_t due;		/* evloop_now() */
+	uint32_t interval;	/* microseconds */
+	int repeat;
+	RDEventLoopCallback callback;
+	void *context;
+} evloop_timer;
+
+struct _RDEventLoop
+{
+	/* Entry 0 is the read end of the wakeup pipe; removed entries have fd -1 until the end of the iteration */
+	struct pollfd *pfds;
+	evloop_fd *fds;
+	int num_fds, fd_capacity;
+
+	evloop_timer *timers;
+	int num_timers, timer_capacity, next_timer_id;
+
+	int wake_pipe[2];
+	volatile int32_t wakeup_pending;
+	volatile uint64_t wakeup_time;
+	RDEventLoopCallback wakeup_handler;
+	void *wakeup_context;
+
+	volatile int stopped;
+	int compact;
+	RDEventLoopStats stats;
+};
+
+/* Monotonic time in microseconds */
+uint64_t
+evloop_now(void)
+{
+#ifdef __APPLE__
+	static mach_timebase_info_data_t timebase;
+
+	if (timebase.denom == 0)
+		mach_timebase_info(&timebase);
+
+	return mach_absolute_time() * timebase.numer / timebase.denom / 1000;
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+static int
+evloop_set_nonblocking(int fd)
+{
+	return fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) == -1
+		|| fcntl(fd, F_SETFD, FD_CLOEXEC) == -1 ? -1 : 0;
+}
+
+RDEventLoop *
+evloop_new(void)
+{
+	RDEventLoop *loop = calloc(1, sizeof(RDEventLoop));
+
+	if (loop == NULL)
+		return NULL;
+
+	if (pipe(loop->wake_pipe) == -1)
+	{
+		free(loop);
+		return NULL;
+	}
+
+	if (evloop_set_nonblocking(loop->wake_pipe[0]) == -1 || evloop_set_nonblocking(loop->wake_pipe[1]) == -1
+	    || evloop_add_fd(loop, loop->wake_pipe[0], EVLOOP_READ, NULL, NULL) == -1)
+	{
+		evloop_free(loop);
+		return NULL;
+	}
+
+	loop->next_timer_id = 1;
+	return loop;
+}
+
+void
+evloop_free(RDEventLoop * loop)
+{
+	if (loop == NULL)
+		return;
+
+	close(loop->wake_pipe[0]);
+	close(loop->wake_pipe[1]);
+	free(loop->pfds);
+	free(loop->fds);
+	free(loop->timers);
+	free(loop);
+}
+
+static int
+evloop_find_fd(RDEventLoop * loop, int fd)
+{
+	int i;
+
+	for (i = 1; i < loop->num_fds; i++)
+		if (loop->pfds[i].fd == fd)
+			return i;
+	return -1;
+}
+
+/* Call callback when fd becomes ready for events, until it is removed.
+   Adding a descriptor that is already watched replaces its events and
+   callback. */
+int
+evloop_add_fd(RDEventLoop * loop, int fd, int events, RDEventLoopFDCallback callback, void *context)
+{
+	int i = loop->num_fds ? evloop_find_fd(loop, fd) : -1;
+
+	if (fd < 0)
+		return -1;
+
+	if (i == -1)
+	{
+		if (loop->num_fds == loop->fd_capacity)
+		{
+			int capacity = loop->fd_capacity ? loop->fd_capacity * 2 : 8;
+			struct pollfd *pfds = realloc(loop->pfds, capacity * sizeof(struct pollfd));
+			evloop_fd *fds;
+
+			if (pfds == NULL)
+				return -1;
+			loop->pfds = pfds;
+
+			if ((fds = realloc(loop->fds, capacity * sizeof(evloop_fd))) == NULL)
+				return -1;
+			loop->fds = fds;
+			loop->fd_capacity = capacity;
+		}
+		i = loop->num_fds++;
+	}
+
+	loop->pfds[i].fd = fd;
+	loop->pfds[i].events = ((events & EVLOOP_READ) ? POLLIN : 0) | ((events & EVLOOP_WRITE) ? POLLOUT : 0);
+	loop->pfds[i].revents = 0;
+	loop->fds[i].callback = callback;
+	loop->fds[i].context = context;
+	return 0;
+}
+
+void
+evloop_remove_fd(RDEventLoop * loop, int fd)
+{
+	int i = evloop_find_fd(loop, fd);
+
+	if (i == -1)
+		return;
+
+	/* poll() skips negative descriptors, so the slot can stay until the iteration is over */
+	loop->pfds[i].fd = -1;
+	loop->pfds[i].revents = 0;
+	loop->compact = 1;
+}
+
+/* Call callback after ms milliseconds, and every ms milliseconds after that
+   if repeat is set. Returns an id for evloop_cancel_timer(), or 0. */
+int
+evloop_add_timer(RDEventLoop * loop, uint32_t ms, int repeat, RDEventLoopCallback callback, void *context)
+{
+	evloop_timer *timer;
+
+	if (loop->num_timers == loop->timer_capacity)
+	{
+		int capacity = loop->timer_capacity ? loop->timer_capacity * 2 : 8;
+		evloop_timer *timers = realloc(loop->timers, capacity * sizeof(evloop_timer));
+
+		if (timers == NULL)
+			return 0;
+		loop->timers = timers;
+		loop->timer_capacity = capacity;
+	}
+
+	timer = &loop->timers[loop->num_timers++];
+	timer->id = loop->next_timer_id++;
+	timer->interval = ms * 1000;
+	timer->due = evloop_now() + timer->interval;
+	timer->repeat = repeat;
+	timer->callback = callback;
+	timer->context = context;
+	return timer->id;
+}
+
+void
+evloop_cancel_timer(RDEventLoop * loop, int timer)
+{
+	int i;
+
+	for (i = 0; i < loop->num_timers; i++)
+	{
+		if (timer != 0 && loop->timers[i].id == timer)
+		{
+			loop->timers[i].id = 0;
+			loop->compact = 1;
+			return;
+		}
+	}
+}
+
+/* callback runs on the loop's thread after one or more evloop_wakeup() calls */
+void
+evloop_set_wakeup_handler(RDEventLoop * loop, RDEventLoopCallback callback, void *context)
+{
+	loop->wakeup_handler = callback;
+	loop->wakeup_context = context;
+}
+
+/* Safe to call from any thread */
+void
+evloop_wakeup(RDEventLoop * loop)
+{
+	char c = 0;
+
+	if (!__sync_bool_compare_and_swap(&loop->wakeup_pending, 0, 1))
+	{
+		__sync_fetch_and_add(&loop->stats.coalesced, 1);
+		return;
+	}
+
+	/* The loop only reads the time after the pipe becomes readable */
+	loop->wakeup_time = evloop_now();
+	__sync_synchronize();
+	if (write(loop->wake_pipe[1], &c, 1) == -1 && errno != EAGAIN)
+		loop->wakeup_pending = 0;
+}
+
+/* Safe to call from any thread. evloop_run_once() returns -1 from now on. */
+void
+evloop_stop(RDEventLoop * loop)
+{
+	char c = 0;
+
+	loop->stopped = 1;
+	__sync_synchronize();
+	write(loop->wake_pipe[1], &c, 1);
+}
+
+static int
+evloop_dispatch_wakeup(RDEventLoop * loop)
+{
+	char buffer[64];
+	uint64_t latency;
+
+	while (read(loop->wake_pipe[0], buffer, sizeof(buffer)) > 0)
+		;
+
+	/* Clear the flag before running the handler, so anything queued while it runs wakes the loop again */
+	if (!__sync_bool_compare_and_swap(&loop->wakeup_pending, 1, 0))
+		return 0;
+
+	latency = evloop_now() - loop->wakeup_time;
+	loop->stats.wakeups++;
+	loop->stats.latencyTotal += latency;
+	if (latency > loop->stats.latencyMax)
+		loop->stats.latencyMax = latency;
+
+	if (loop->wakeup_handler != NULL)
+		loop->wakeup_handler(loop, loop->wakeup_context);
+	return 1;
+}
+
+static int
+evloop_run_timers(RDEventLoop * loop)
+{
+	int i, count = loop->num_timers, dispatched = 0;
+	uint64_t now = evloop_now();
+
+	/* Timers added by a callback wait for the next iteration */
+	for (i = 0; i < count; i++)
+	{
+		evloop_timer *timer = &loop->timers[i];
+
+		if (timer->id == 0 || timer->due > now)
+			continue;
+
+		if (timer->repeat)
+		{
+			timer->due += timer->interval;
+			if (timer->due <= now)
+				timer->due = now + timer->interval;
+		}
+		else
+		{
+			timer->id = 0;
+			loop->compact = 1;
+		}
+
+		timer->callback(loop, timer->context);
+		loop->stats.timers++;
+		dispatched++;
+	}
+
+	return dispatched;
+}
+
+static void
+evloop_compact(RDEventLoop * loop)
+{
+	int i, n;
+
+	for (i = n = 1; i < loop->num_fds; i++)
+	{
+		if (loop->pfds[i].fd < 0)
+			continue;
+		loop->pfds[n] = loop->pfds[i];
+		loop->fds[n++] = loop->fds[i];
+	}
+	loop->num_fds = n;
+
+	for (i = n = 0; i < loop->num_timers; i++)
+		if (loop->timers[i].id != 0)
+			loop->timers[n++] = loop->timers[i];
+	loop->num_timers = n;
+
+	loop->compact = 0;
+}
+
+/* Milliseconds until the next timer is due, capped by timeout (-1 for none) */
+static int
+evloop_timeout(RDEventLoop * loop, int timeout)
+{
+	uint64_t now = evloop_now(), next = 0;
+	int i, ms;
+
+	for (i = 0; i < loop->num_timers; i++)
+		if (loop->timers[i].id != 0 && (next == 0 || loop->timers[i].due < next))
+			next = loop->timers[i].due;
+
+	if (next == 0)
+		return timeout;
+
+	ms = next <= now ? 0 : (int) ((next - now + 999) / 1000);
+	return (timeout < 0 || ms < timeout) ? ms : timeout;
+}
+
+/* Wait up to timeout milliseconds (-1 for as long as it takes) for something
+   to happen and dispatch it. Returns the number of callbacks run, or -1 once
+   the loop has been stopped or poll() fails. */
+int
+evloop_run_once(RDEventLoop * loop, int timeout)
+{
+	int i, count, ready, dispatched = 0;
+
+	if (loop->stopped)
+		return -1;
+
+	ready = poll(loop->pfds, loop->num_fds, evloop_timeout(loop, timeout));
+	loop->stats.iterations++;
+	if (ready == -1)
+		return errno == EINTR ? 0 : -1;
+
+	if (loop->pfds[0].revents)
+		dispatched += evloop_dispatch_wakeup(loop);
+
+	/* Descriptors added by a callback are left for the next iteration */
+	count = loop->num_fds;
+	for (i = 1; i < count && !loop->stopped; i++)
+	{
+		short revents = loop->pfds[i].revents;
+		int events = 0;
+
+		if (loop->pfds[i].fd < 0 || revents == 0)
+			continue;
+
+		loop->pfds[i].revents = 0;
+		if (revents & (POLLIN | POLLHUP))
+			events |= EVLOOP_READ;
+		if (revents & POLLOUT)
+			events |= EVLOOP_WRITE;
+		if (revents & (POLLERR | POLLHUP | POLLNVAL))
+			events |= EVLOOP_ERROR;
+
+		loop->fds[i].callback(loop, loop->pfds[i].fd, events, loop->fds[i].context);
+		dispatched++;
+	}
+
+	if (!loop->stopped)
+		dispatched += evloop_run_timers(loop);
+
+	if (loop->compact)
+		evloop_compact(loop);
+
+	return loop->stopped ? -1 : dispatched;
+}
+
+/* Dispatch events until evloop_stop() */
+void
+evloop_run(RDEventLoop * loop)
+{
+	while (evloop_run_once(loop, -1) >= 0)
+		;
+}
+
+void
+evloop_get_stats(RDEventLoop * loop, RDEventLoopStats * stats)
+{
+	*stats = loop->stats;
+}
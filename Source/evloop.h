@@ -0,0 +1,58 @@
+/*	Copyright (c) 2007-2012 Dorian Johnson <2011@dorianj.net>
+	
+	This file is part of CoRD.
+	CoRD is free software; you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation; either version 2 of the License, or (at your option) any later
+	version.
+
+	CoRD is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+	FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License along with
+	CoRD; if not, write to the Free Software Foundation, Inc., 51 Franklin St,
+	Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef _EVLOOP_H
+#define _EVLOOP_H
+
+/* Only depends on POSIX, so that it can be built and measured without the
+   rest of the client (see Tools/evloop_bench.c) */
+
+#include <stdint.h>
+
+#define EVLOOP_READ	0x01
+#define EVLOOP_WRITE	0x02
+#define EVLOOP_ERROR	0x04	/* hangup or error, always reported */
+
+typedef struct _RDEventLoop RDEventLoop;
+
+typedef void (*RDEventLoopFDCallback) (RDEventLoop * loop, int fd, int events, void *context);
+typedef void (*RDEventLoopCallback) (RDEventLoop * loop, void *context);
+
+typedef struct _RDEventLoopStats
+{
+	uint64_t iterations;	/* calls to poll() */
+	uint64_t wakeups;	/* wakeups dispatched to the wakeup handler */
+	uint64_t coalesced;	/* evloop_wakeup() calls folded into one already pending */
+	uint64_t latencyTotal, latencyMax;	/* microseconds from evloop_wakeup() to the handler */
+	uint64_t timers;	/* timer callbacks run */
+} RDEventLoopStats;
+
+RDEventLoop *evloop_new(void);
+void evloop_free(RDEventLoop * loop);
+uint64_t evloop_now(void);
+int evloop_add_fd(RDEventLoop * loop, int fd, int events, RDEventLoopFDCallback callback, void *context);
+void evloop_remove_fd(RDEventLoop * loop, int fd);
+int evloop_add_timer(RDEventLoop * loop, uint32_t ms, int repeat, RDEventLoopCallback callback, void *context);
+void evloop_cancel_timer(RDEventLoop * loop, int timer);
+void evloop_set_wakeup_handler(RDEventLoop * loop, RDEventLoopCallback callback, void *context);
+void evloop_wakeup(RDEventLoop * loop);
+void evloop_stop(RDEventLoop * loop);
+int evloop_run_once(RDEventLoop * loop, int timeout);
+void evloop_run(RDEventLoop * loop);
+void evloop_get_stats(RDEventLoop * loop, RDEventLoopStats * stats);
+
+#endif
@@ -0,0 +1,239 @@
+/*	Copyright (c) 2007-2012 Dorian Johnson <2011@dorianj.net>
+	
+	This file is part of CoRD.
+	CoRD is free software; you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation; either version 2 of the License, or (at your option) any later
+	version.
+
+	CoRD is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+	FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License along with
+	CoRD; if not, write to the Free Software Foundation, Inc., 51 Franklin St,
+	Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+/*	Purpose: Presentation buffers.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "framebuf.h"
+#include "blit.h"
+
+/*
+ * The connection thread draws into the backing store whenever the server
+ * sends something, and the main thread uploads from it whenever it draws
+ * the screen; reading it directly could catch an update half done. So at
+ * the end of each update the connection thread copies what changed into
+ * the frame it owns and swaps that frame with the one waiting to be
+ * presented, in a single atomic exchange. The main thread swaps the
+ * waiting frame with its own the same way when it draws, and neither ever
+ * waits for the other: with three frames there is always one free.
+ *
+ * A frame only needs what was drawn since it was last filled, which each
+ * frame keeps a map of tiles for. The presenter only needs what changed
+ * since the frame it last took, which may be several updates back when it
+ * skipped some; that map goes with the frame. Large copies are shared
+ * between threads a few rows of tiles each.
+ */
+
+#define FRAMEBUF_FRESH	4	/* or'd into ready until the presenter takes it */
+#define FRAMEBUF_INDEX	3
+#define FRAMEBUF_MAX_COLUMNS	128	/* tiles across, beyond which spans are allocated for a copy */
+
+static int
+framebuf_exchange(volatile int *slot, int value)
+{
+	int old;
+
+	do
+		old = *slot;
+	while (!__sync_bool_compare_and_swap(slot, old, value));
+
+	return old;
+}
+
+typedef struct
+{
+	RDFramebuffer *fb;
+	uint32_t *dst;
+	const uint32_t *src;
+	const RDTileMap *tiles;
+	int parts;
+} copy_job;
+
+static void
+tiles_merge(RDTileMap * map, const RDTileMap * dirty)
+{
+	if (dirty == NULL)
+		tilemap_fill(map);
+	else
+		tilemap_union(map, dirty);
+}
+
+/* Clears the frames to zero, as the backing store starts. pitch is the
+   source's, negative if it is stored bottom-up. Returns 0 if out of memory. */
+int
+framebuf_init(RDFramebuffer * fb, int width, int height, int pitch)
+{
+	int i;
+
+	memset(fb, 0, sizeof(*fb));
+	fb->width = width;
+	fb->height = height;
+	fb->pitch = pitch;
+
+	for (i = 0; i < FRAMEBUF_COUNT; i++)
+	{
+		fb->frames[i].data = calloc((size_t) height * abs(pitch), 1);
+		if (fb->frames[i].data == NULL)
+		{
+			framebuf_destroy(fb);
+			return 0;
+		}
+		if (!tilemap_init(&fb->frames[i].damage, width, height) || !tilemap_init(&fb->stale[i], width, height))
+		{
+			framebuf_destroy(fb);
+			return 0;
+		}
+	}
+	if (!tilemap_init(&fb->carry, width, height))
+	{
+		framebuf_destroy(fb);
+		return 0;
+	}
+
+	fb->front = 0;
+	fb->back = 1;
+	fb->ready = 2;
+	tilemap_fill(&fb->carry);
+	return 1;
+}
+
+void
+framebuf_destroy(RDFramebuffer * fb)
+{
+	int i;
+
+	for (i = 0; i < FRAMEBUF_COUNT; i++)
+	{
+		free(fb->frames[i].data);
+		fb->frames[i].data = NULL;
+		tilemap_destroy(&fb->frames[i].damage);
+		tilemap_destroy(&fb->stale[i]);
+	}
+	tilemap_destroy(&fb->carry);
+}
+
+/* Pixel 0, 0 of a frame; rows are pitch bytes apart as in the source */
+uint32_t *
+framebuf_origin(const RDFramebuffer * fb, const RDFrame * frame)
+{
+	return (uint32_t *) (frame->data + (fb->pitch < 0 ? (size_t) (fb->height - 1) * -fb->pitch : 0));
+}
+
+static void
+copy_rect(RDFramebuffer * fb, uint32_t * dst, const uint32_t * src, RDTileRect r)
+{
+	int row;
+
+	/* Whole rows are one block of memory, whichever way up they are stored */
+	if (r.cx == fb->width && abs(fb->pitch) == fb->width * 4)
+	{
+		row = fb->pitch < 0 ? r.y + r.cy - 1 : r.y;
+		memcpy((uint8_t *) dst + (long) row * fb->pitch, (const uint8_t *) src + (long) row * fb->pitch,
+		       (size_t) r.cy * fb->width * 4);
+		return;
+	}
+
+	for (row = r.y; row < r.y + r.cy; row++)
+		memcpy((uint8_t *) dst + (long) row * fb->pitch + r.x * 4,
+		       (const uint8_t *) src + (long) row * fb->pitch + r.x * 4, r.cx * 4);
+}
+
+/* Copies the tiles set in one band of tile rows */
+static void
+copy_part(void *context, int part)
+{
+	const copy_job *job = context;
+	const RDTileMap *tiles = job->tiles;
+	RDTileRect spans[(FRAMEBUF_MAX_COLUMNS + 1) / 2], *many = NULL, *s = spans;
+	int row, i, n;
+
+	if (tiles->columns > FRAMEBUF_MAX_COLUMNS && (s = many = malloc((tiles->columns + 1) / 2 * sizeof(*s))) == NULL)
+		return;
+
+	for (row = tiles->rows * part / job->parts; row < tiles->rows * (part + 1) / job->parts; row++)
+		for (i = 0, n = tilemap_row_spans(tiles, row, s); i < n; i++)
+			copy_rect(job->fb, job->dst, job->src, s[i]);
+
+	free(many);
+}
+
+/* Called by the decoding thread at the end of an update: dirty (NULL for
+   everything) is what it drew in the buffer at origin since the last call.
+   The update becomes the newest frame, replacing the waiting one if the
+   presenter hasn't taken it yet. */
+void
+framebuf_publish(RDFramebuffer * fb, const uint32_t * origin, const RDTileMap * dirty)
+{
+	RDFrame *frame = &fb->frames[fb->back];
+	RDTileMap *stale = &fb->stale[fb->back];
+	copy_job job;
+	int i, old;
+
+	for (i = 0; i < FRAMEBUF_COUNT; i++)
+		tiles_merge(&fb->stale[i], dirty);
+	tiles_merge(&fb->carry, dirty);
+
+	if (!tilemap_is_empty(stale))
+	{
+		job.fb = fb;
+		job.dst = framebuf_origin(fb, frame);
+		job.src = origin;
+		job.tiles = stale;
+		job.parts = stale->count * TILE_SIZE * TILE_SIZE >= BLIT_THREAD_MIN_PIXELS ? BLIT_MAX_THREADS : 1;
+		blit_parallel(job.parts, copy_part, &job);
+	}
+	tilemap_clear(stale);
+
+	frame->seq = ++fb->published;
+	tilemap_copy(&frame->damage, &fb->carry);
+
+	/* The exchange is a full barrier, so the frame is complete before the presenter can see it */
+	old = framebuf_exchange(&fb->ready, fb->back | FRAMEBUF_FRESH);
+	fb->back = old & FRAMEBUF_INDEX;
+
+	/* If the frame just replaced was taken, the presenter has everything
+	   but this update; if not, it is still further back, and the next
+	   frame must cover all this one does */
+	if (!(old & FRAMEBUF_FRESH))
+	{
+		tilemap_clear(&fb->carry);
+		tiles_merge(&fb->carry, dirty);
+	}
+}
+
+/* Called by the presenting thread: the newest frame if one was published
+   since the last call, otherwise NULL. It stays the presenter's, and
+   unchanged, until the next call that returns a frame. */
+const RDFrame *
+framebuf_acquire(RDFramebuffer * fb)
+{
+	if (!(fb->ready & FRAMEBUF_FRESH))
+		return NULL;
+
+	fb->front = framebuf_exchange(&fb->ready, fb->front) & FRAMEBUF_INDEX;
+	return &fb->frames[fb->front];
+}
+
+/* The frame the presenter has, for reading the screen outside of drawing it */
+const RDFrame *
+framebuf_front(const RDFramebuffer * fb)
+{
+	return &fb->frames[fb->front];
+}
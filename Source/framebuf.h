@@ -0,0 +1,65 @@
+/*	Copyright (c) 2007-2012 Dorian Johnson <2011@dorianj.net>
+	
+	This file is part of CoRD.
+	CoRD is free software; you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation; either version 2 of the License, or (at your option) any later
+	version.
+
+	CoRD is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+	FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License along with
+	CoRD; if not, write to the Free Software Foundation, Inc., 51 Franklin St,
+	Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef _FRAMEBUF_H
+#define _FRAMEBUF_H
+
+/* Plain C depending only on tiles.c and blit.c, so that it can be checked
+   and measured on its own (see Tools/framebuf_bench.c) */
+
+#include <stdint.h>
+
+#include "tiles.h"
+
+#define FRAMEBUF_COUNT	3
+
+typedef struct _RDFrame
+{
+	uint8_t *data;
+	unsigned long seq;	/* updates published before this frame, itself included */
+	RDTileMap damage;	/* changed since the frame the presenter last took */
+} RDFrame;
+
+/* Three copies of the screen: one the decoding thread is filling, one
+   waiting to be presented and one being presented. Each is laid out like
+   the buffer it is copied from. */
+typedef struct _RDFramebuffer
+{
+	int width, height, pitch;
+	RDFrame frames[FRAMEBUF_COUNT];
+
+	/* Only touched by the decoding thread */
+	int back;
+	RDTileMap stale[FRAMEBUF_COUNT];	/* drawn since the frame was last filled */
+	RDTileMap carry;	/* changed since the frame the presenter may still have */
+	unsigned long published;
+
+	/* Only touched by the presenting thread */
+	int front;
+
+	/* Handed between them: the newest frame, with FRAMEBUF_FRESH set until it is taken */
+	volatile int ready;
+} RDFramebuffer;
+
+int framebuf_init(RDFramebuffer * fb, int width, int height, int pitch);
+void framebuf_destroy(RDFramebuffer * fb);
+void framebuf_publish(RDFramebuffer * fb, const uint32_t * origin, const RDTileMap * dirty);
+const RDFrame *framebuf_acquire(RDFramebuffer * fb);
+const RDFrame *framebuf_front(const RDFramebuffer * fb);
+uint32_t *framebuf_origin(const RDFramebuffer * fb, const RDFrame * frame);
+
+#endif
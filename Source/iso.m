@@ -124,9 +124,14 @@ iso_recv_msg(RDConnectionRef conn, uint8 * code, uint8 * rdpver)
 RDStreamRef
 iso_init(RDConnectionRef conn, int length)
 {
-	RDStreamRef s;
+	return iso_init_stream(&conn->outStream, length);
+}
 
-	s = tcp_init(conn, length + 7);
+/* Like iso_init, in a stream the caller owns */
+RDStreamRef
+iso_init_stream(RDStreamRef s, int length)
+{
+	s = tcp_init_stream(s, length + 7);
 	s_push_layer(s, iso_hdr, 7);
 
 	return s;
@@ -139,7 +144,7 @@ iso_send(RDConnectionRef conn, RDStreamRef s)
 	uint16 length;
 
 	s_pop_layer(s, iso_hdr);
-	length = s->end - s->p;
+	length = s->end - s->p + s->tail_len;
 
 	out_uint8(s, 3);	/* version */
 	out_uint8(s, 0);	/* reserved */
@@ -200,6 +205,7 @@ iso_connect(RDConnectionRef conn, const char *server, char *username, RD_BOOL re
 		return False;
 	}
 
+	timing_mark(conn, CONNECT_PHASE_ISO);
 	return True;
 }
 
@@ -305,10 +305,12 @@ licence_process(RDConnectionRef conn, RDStreamRef s)
 
 		case LICENCE_TAG_ISSUE:
 			licence_process_issue(conn, s);
+			timing_mark(conn, CONNECT_PHASE_LICENCE);
 			break;
 
 		case LICENCE_TAG_REISSUE:
 		case LICENCE_TAG_RESULT:
+			timing_mark(conn, CONNECT_PHASE_LICENCE);
 			break;
 
 		default:
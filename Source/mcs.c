@@ -302,9 +302,14 @@ mcs_recv_cjcf(RDConnectionRef conn)
 RDStreamRef
 mcs_init(RDConnectionRef conn, int length)
 {
-	RDStreamRef s;
+	return mcs_init_stream(&conn->outStream, length);
+}
 
-	s = iso_init(conn, length + 8);
+/* Like mcs_init, in a stream the caller owns */
+RDStreamRef
+mcs_init_stream(RDStreamRef s, int length)
+{
+	s = iso_init_stream(s, length + 8);
 	s_push_layer(s, mcs_hdr, 8);
 
 	return s;
@@ -317,7 +322,7 @@ mcs_send_to_channel(RDConnectionRef conn, RDStreamRef s, uint16 channel)
 	uint16 length;
 
 	s_pop_layer(s, mcs_hdr);
-	length = s->end - s->p - 8;
+	length = s->end - s->p - 8 + s->tail_len;
 	length |= 0x8000;
 
 	out_uint8(s, (MCS_SDRQ << 2));
@@ -379,28 +384,32 @@ mcs_connect(RDConnectionRef conn, const char *server, RDStreamRef mcs_data, char
 	mcs_send_connect_initial(conn, mcs_data);
 	if (!mcs_recv_connect_response(conn, mcs_data))
 		goto error;
+	timing_mark(conn, CONNECT_PHASE_MCS_CONNECT);
 
+	tcp_begin_batch(conn);
 	mcs_send_edrq(conn);
-
 	mcs_send_aurq(conn);
+	tcp_end_batch(conn);
+
 	if (!mcs_recv_aucf(conn))
 		goto error;
+	timing_mark(conn, CONNECT_PHASE_MCS_ATTACH);
 
+	/* Send every join request before waiting for any confirm, so joining
+	   costs one round trip instead of one per channel */
+	tcp_begin_batch(conn);
 	mcs_send_cjrq(conn, conn->mcsUserid + MCS_USERCHANNEL_BASE);
-
-	if (!mcs_recv_cjcf(conn))
-		goto error;
-
 	mcs_send_cjrq(conn, MCS_GLOBAL_CHANNEL);
-	if (!mcs_recv_cjcf(conn))
-		goto error;
-
 	for (i = 0; i < conn->numChannels; i++)
-	{
 		mcs_send_cjrq(conn, conn->channels[i].mcs_id);
+	tcp_end_batch(conn);
+
+	for (i = 0; i < conn->numChannels + 2; i++)
+	{
 		if (!mcs_recv_cjcf(conn))
 			goto error;
 	}
+	timing_mark(conn, CONNECT_PHASE_MCS_JOIN);
 	return True;
 
       error:
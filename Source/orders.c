@@ -215,7 +215,7 @@ process_destblt(RDConnectionRef conn, RDStreamRef s, DESTBLT_ORDER * os, uint32
 	DEBUG(("DESTBLT(op=0x%x,x=%d,y=%d,cx=%d,cy=%d)\n",
 	       os->opcode, os->x, os->y, os->cx, os->cy));
 
-	ui_destblt(conn, ROP2_S(os->opcode), os->x, os->y, os->cx, os->cy);
+	ui_destblt(conn, os->opcode, os->x, os->y, os->cx, os->cy);
 }
 
 /* Process a pattern blt order */
@@ -252,7 +252,7 @@ process_patblt(RDConnectionRef conn, RDStreamRef s, PATBLT_ORDER * os, uint32 pr
 
 	setup_brush(conn, &brush, &os->brush);
 	
-	ui_patblt(conn, ROP2_P(os->opcode), os->x, os->y, os->cx, os->cy,
+	ui_patblt(conn, os->opcode, os->x, os->y, os->cx, os->cy,
 		  &brush, os->bgcolour, os->fgcolour);
 }
 
@@ -284,7 +284,7 @@ process_screenblt(RDConnectionRef conn, RDStreamRef s, SCREENBLT_ORDER * os, uin
 	DEBUG(("SCREENBLT(op=0x%x,x=%d,y=%d,cx=%d,cy=%d,srcx=%d,srcy=%d)\n",
 	       os->opcode, os->x, os->y, os->cx, os->cy, os->srcx, os->srcy));
 
-	ui_screenblt(conn, ROP2_S(os->opcode), os->x, os->y, os->cx, os->cy, os->srcx, os->srcy);
+	ui_screenblt(conn, os->opcode, os->x, os->y, os->cx, os->cy, os->srcx, os->srcy);
 }
 
 /* Process a line order */
@@ -441,11 +441,19 @@ process_memblt(RDConnectionRef conn, RDStreamRef s, MEMBLT_ORDER * os, uint32 pr
 	DEBUG(("MEMBLT(op=0x%x,x=%d,y=%d,cx=%d,cy=%d,id=%d,idx=%d)\n",
 	       os->opcode, os->x, os->y, os->cx, os->cy, os->cache_id, os->cache_idx));
 
+	if (os->cache_id == SCREEN_BITMAP_CACHE_ID)
+	{
+		RDSurfaceRef surface = cache_get_offscreen(conn, os->cache_idx);
+		if (surface != NULL)
+			ui_surface_blt(conn, os->opcode, os->x, os->y, os->cx, os->cy, surface, os->srcx, os->srcy);
+		return;
+	}
+
 	bitmap = cache_get_bitmap(conn, os->cache_id, os->cache_idx);
 	if (bitmap == NULL)
 		return;
 
-	ui_memblt(conn, ROP2_S(os->opcode), os->x, os->y, os->cx, os->cy, bitmap, os->srcx, os->srcy);
+	ui_memblt(conn, os->opcode, os->x, os->y, os->cx, os->cy, bitmap, os->srcx, os->srcy);
 }
 
 /* Process a 3-way blt order */
@@ -506,7 +514,7 @@ process_triblt(RDConnectionRef conn, RDStreamRef s, TRIBLT_ORDER * os, uint32 pr
 
 	setup_brush(conn, &brush, &os->brush);
 	
-	ui_triblt(os->opcode, os->x, os->y, os->cx, os->cy,
+	ui_triblt(conn, os->opcode, os->x, os->y, os->cx, os->cy,
 		  bitmap, os->srcx, os->srcy, &brush, os->bgcolour, os->fgcolour);
 }
 
@@ -558,7 +566,7 @@ process_polygon(RDConnectionRef conn, RDStreamRef s, POLYGON_ORDER * os, uint32
 		return;
 	}
 
-	points = (RDPoint*) xmalloc((os->npoints + 1) * sizeof(RDPoint));
+	points = (RDPoint*) arena_alloc(&conn->arena, (os->npoints + 1) * sizeof(RDPoint));
 	memset(points, 0, (os->npoints + 1) * sizeof(RDPoint));
 
 	points[0].x = os->x;
@@ -585,8 +593,6 @@ process_polygon(RDConnectionRef conn, RDStreamRef s, POLYGON_ORDER * os, uint32
 			   os->fgcolour);
 	else
 		error("polygon parse error\n");
-
-	xfree(points);
 }
 
 /* Process a polygon2 order */
@@ -646,7 +652,7 @@ process_polygon2(RDConnectionRef conn, RDStreamRef s, POLYGON2_ORDER * os, uint3
 
 	setup_brush(conn, &brush, &os->brush);
 	
-	points = (RDPoint*) xmalloc((os->npoints + 1) * sizeof(RDPoint));
+	points = (RDPoint*) arena_alloc(&conn->arena, (os->npoints + 1) * sizeof(RDPoint));
 	memset(points, 0, (os->npoints + 1) * sizeof(RDPoint));
 
 	points[0].x = os->x;
@@ -673,8 +679,6 @@ process_polygon2(RDConnectionRef conn, RDStreamRef s, POLYGON2_ORDER * os, uint3
 			   &brush, os->bgcolour, os->fgcolour);
 	else
 		error("polygon2 parse error\n");
-
-	xfree(points);
 }
 
 /* Process a polyline order */
@@ -723,7 +727,7 @@ process_polyline(RDConnectionRef conn, RDStreamRef s, POLYLINE_ORDER * os, uint3
 		return;
 	}
 
-	points = (RDPoint*) xmalloc((os->lines + 1) * sizeof(RDPoint));
+	points = (RDPoint*) arena_alloc(&conn->arena, (os->lines + 1) * sizeof(RDPoint));
 	memset(points, 0, (os->lines + 1) * sizeof(RDPoint));
 
 	points[0].x = os->x;
@@ -751,8 +755,6 @@ process_polyline(RDConnectionRef conn, RDStreamRef s, POLYLINE_ORDER * os, uint3
 		ui_polyline(conn, os->opcode - 1, points, os->lines + 1, &pen);
 	else
 		error("polyline parse error\n");
-
-	xfree(points);
 }
 
 /* Process an ellipse order */
@@ -931,7 +933,7 @@ process_raw_bmpcache(RDConnectionRef conn, RDStreamRef s)
 	in_uint8p(s, data, bufsize);
 
 	DEBUG(("RAW_BMPCACHE(cx=%d,cy=%d,id=%d,idx=%d)\n", width, height, cache_id, cache_idx));
-	inverted = (uint8 *) xmalloc(width * height * Bpp);
+	inverted = (uint8 *) arena_alloc(&conn->arena, width * height * Bpp);
 	for (y = 0; y < height; y++)
 	{
 		memcpy(&inverted[(height - y - 1) * (width * Bpp)], &data[y * (width * Bpp)],
@@ -939,8 +941,9 @@ process_raw_bmpcache(RDConnectionRef conn, RDStreamRef s)
 	}
 
 	bitmap = ui_create_bitmap(conn, width, height, inverted);
-	xfree(inverted);
 	cache_put_bitmap(conn, cache_id, cache_idx, bitmap);
+	cache_trace_bitmap(conn, cache_id, cache_idx, width, height, Bpp, inverted);
+	arena_release(&conn->arena, inverted);
 }
 
 /* Process a bitmap cache order */
@@ -984,19 +987,19 @@ process_bmpcache(RDConnectionRef conn, RDStreamRef s)
 
 	DEBUG(("BMPCACHE(cx=%d,cy=%d,id=%d,idx=%d,bpp=%d,size=%d,pad1=%d,bufsize=%d,pad2=%d,rs=%d,fs=%d)\n", width, height, cache_id, cache_idx, bpp, size, pad1, bufsize, pad2, row_size, final_size));
 
-	bmpdata = (uint8 *) xmalloc(width * height * Bpp);
+	bmpdata = (uint8 *) arena_alloc(&conn->arena, width * height * Bpp);
 
 	if (bitmap_decompress(bmpdata, width, height, data, size, Bpp))
 	{
 		bitmap = ui_create_bitmap(conn, width, height, bmpdata);
 		cache_put_bitmap(conn, cache_id, cache_idx, bitmap);
+		cache_trace_bitmap(conn, cache_id, cache_idx, width, height, Bpp, bmpdata);
 	}
 	else
 	{
 		DEBUG(("Failed to decompress bitmap data\n"));
 	}
-
-	xfree(bmpdata);
+	arena_release(&conn->arena, bmpdata);
 }
 
 /* Process a bitmap cache v2 order */
@@ -1044,14 +1047,14 @@ process_bmpcache2(RDConnectionRef conn, RDStreamRef s, uint16 flags, RD_BOOL com
 	DEBUG(("BMPCACHE2(compr=%d,flags=%x,cx=%d,cy=%d,id=%d,idx=%d,Bpp=%d,bs=%d)\n",
 	       compressed, flags, width, height, cache_id, cache_idx, Bpp, bufsize));
 
-	bmpdata = (uint8 *) xmalloc(width * height * Bpp);
+	bmpdata = (uint8 *) arena_alloc(&conn->arena, width * height * Bpp);
 
 	if (compressed)
 	{
 		if (!bitmap_decompress(bmpdata, width, height, data, bufsize, Bpp))
 		{
 			DEBUG(("Failed to decompress bitmap data\n"));
-			xfree(bmpdata);
+			arena_release(&conn->arena, bmpdata);
 			return;
 		}
 	}
@@ -1067,6 +1070,7 @@ process_bmpcache2(RDConnectionRef conn, RDStreamRef s, uint16 flags, RD_BOOL com
 	if (bitmap)
 	{
 		cache_put_bitmap(conn, cache_id, cache_idx, bitmap);
+		cache_trace_bitmap(conn, cache_id, cache_idx, width, height, Bpp, bmpdata);
 		if (flags & PERSIST)
 			pstcache_save_bitmap(conn, cache_id, cache_idx, bitmap_id, width, height,
 					     width * height * Bpp, bmpdata);
@@ -1075,8 +1079,80 @@ process_bmpcache2(RDConnectionRef conn, RDStreamRef s, uint16 flags, RD_BOOL com
 	{
 		DEBUG(("process_bmpcache2: ui_create_bitmap failed\n"));
 	}
+	arena_release(&conn->arena, bmpdata);
+}
+
+/* Process a bitmap cache v3 order */
+static void
+process_bmpcache3(RDConnectionRef conn, RDStreamRef s, uint16 flags)
+{
+	RDBitmapRef bitmap;
+	int y;
+	uint8 cache_id, bpp, Bpp, exflags, codec_id;
+	uint16 cache_idx, width, height;
+	uint32 bufsize;
+	uint8 *data, *bmpdata, *bitmap_id;
+
+	cache_id = flags & ID_MASK;
+
+	in_uint16_le(s, cache_idx);
+	in_uint8p(s, bitmap_id, 8);	/* key1, key2 */
+
+	/* TS_BITMAP_DATA_EX */
+	in_uint8(s, bpp);
+	in_uint8(s, exflags);
+	in_uint8s(s, 1);	/* reserved */
+	in_uint8(s, codec_id);
+	in_uint16_le(s, width);
+	in_uint16_le(s, height);
+	in_uint32_le(s, bufsize);
+	if (exflags & BMPCACHE3_EXHEADER_PRESENT)
+		in_uint8s(s, BMPCACHE3_EXHEADER_SIZE);
+	in_uint8p(s, data, bufsize);
+
+	Bpp = (bpp + 7) / 8;
+
+	DEBUG(("BMPCACHE3(flags=%x,cx=%d,cy=%d,id=%d,idx=%d,bpp=%d,codec=%d,bs=%d)\n",
+	       flags, width, height, cache_id, cache_idx, bpp, codec_id, bufsize));
 
-	xfree(bmpdata);
+	if (flags & CBR3_DO_NOT_CACHE)
+		return;
+
+	if (codec_id != BMPCACHE3_CODEC_NONE)
+	{
+		unimpl("bitmap cache v3 codec %d\n", codec_id);
+		return;
+	}
+
+	if (Bpp != (conn->serverBpp + 7) / 8 || bufsize < (uint32) width * height * Bpp)
+	{
+		warning("BMPCACHE3: unexpected bitmap data (bpp=%d, size=%d)\n", bpp, bufsize);
+		return;
+	}
+
+	/* Uncompressed data is bottom-up */
+	bmpdata = (uint8 *) arena_alloc(&conn->arena, width * height * Bpp);
+	for (y = 0; y < height; y++)
+		memcpy(&bmpdata[(height - y - 1) * (width * Bpp)], &data[y * (width * Bpp)], width * Bpp);
+
+	bitmap = ui_create_bitmap(conn, width, height, bmpdata);
+
+	if (bitmap)
+	{
+		cache_put_bitmap(conn, cache_id, cache_idx, bitmap);
+		cache_trace_bitmap(conn, cache_id, cache_idx, width, height, Bpp, bmpdata);
+		/* v3 orders always carry a key and have no PERSIST flag; the key
+		   only names a persistent bitmap when we offered persistent keys,
+		   which is when servers set PERSIST on v2 orders */
+		if (conn->bitmapCachePersist)
+			pstcache_save_bitmap(conn, cache_id, cache_idx, bitmap_id, width, height,
+					     width * height * Bpp, bmpdata);
+	}
+	else
+	{
+		DEBUG(("process_bmpcache3: ui_create_bitmap failed\n"));
+	}
+	arena_release(&conn->arena, bmpdata);
 }
 
 /* Process a colourmap cache order */
@@ -1092,7 +1168,7 @@ process_colcache(RDConnectionRef conn, RDStreamRef s)
 	in_uint8(s, cache_id);
 	in_uint16_le(s, map.ncolours);
 
-	map.colours = (RDColorEntry *) xmalloc(sizeof(RDColorEntry) * map.ncolours);
+	map.colours = (RDColorEntry *) arena_alloc(&conn->arena, sizeof(RDColorEntry) * map.ncolours);
 
 	for (i = 0; i < map.ncolours; i++)
 	{
@@ -1109,8 +1185,6 @@ process_colcache(RDConnectionRef conn, RDStreamRef s)
 
 	if (cache_id)
 		ui_set_colourmap(conn, hmap);
-
-	xfree(map.colours);
 }
 
 /* Process a font cache order */
@@ -1259,7 +1333,7 @@ process_secondary_order(RDConnectionRef conn, RDStreamRef s)
 	uint8 *next_order;
 
 	in_uint16_le(s, length);
-	in_uint16_le(s, flags);	/* used by bmpcache2 */
+	in_uint16_le(s, flags);	/* used by bmpcache2 and bmpcache3 */
 	in_uint8(s, type);
 
 	next_order = s->p + (sint16) length + 7;
@@ -1294,6 +1368,10 @@ process_secondary_order(RDConnectionRef conn, RDStreamRef s)
 			process_brushcache(conn, s, flags);
  			break;
 
+		case RDP_ORDER_BMPCACHE3:
+			process_bmpcache3(conn, s, flags);
+			break;
+
 		default:
 			unimpl("secondary order %d\n", type);
 	}
@@ -1301,6 +1379,90 @@ process_secondary_order(RDConnectionRef conn, RDStreamRef s)
 	s->p = next_order;
 }
 
+/* Process a create offscreen bitmap order */
+static void
+process_create_offscreen_bitmap(RDConnectionRef conn, RDStreamRef s)
+{
+	RDSurfaceRef surface;
+	uint16 flags, id, cx, cy, count, idx;
+	int i;
+
+	in_uint16_le(s, flags);
+	in_uint16_le(s, cx);
+	in_uint16_le(s, cy);
+	id = flags & OFFSCR_ID_MASK;
+
+	DEBUG(("CREATE_OFFSCR_BITMAP(id=%d,cx=%d,cy=%d,del=%d)\n", id, cx, cy, (flags & OFFSCR_DELETE_LIST) != 0));
+
+	if (flags & OFFSCR_DELETE_LIST)
+	{
+		in_uint16_le(s, count);
+		for (i = 0; i < count; i++)
+		{
+			in_uint16_le(s, idx);
+			cache_delete_offscreen(conn, idx);
+		}
+	}
+
+	surface = ui_create_surface(conn, cx, cy);
+	if (surface == NULL)
+	{
+		error("create offscreen bitmap %d (%dx%d) failed\n", id, cx, cy);
+		return;
+	}
+
+	cache_put_offscreen(conn, id, cx, cy, surface);
+}
+
+/* Process a switch surface order */
+static void
+process_switch_surface(RDConnectionRef conn, RDStreamRef s)
+{
+	RDSurfaceRef surface = NULL;
+	uint16 id;
+
+	in_uint16_le(s, id);
+
+	DEBUG(("SWITCH_SURFACE(id=%d)\n", id));
+
+	if (id != SCREEN_BITMAP_SURFACE)
+	{
+		surface = cache_get_offscreen(conn, id);
+		if (surface == NULL)
+		{
+			error("switch to missing surface %d\n", id);
+			return;
+		}
+	}
+
+	ui_set_surface(conn, surface);
+}
+
+/* Process an alternate secondary order */
+static RD_BOOL
+process_altsec_order(RDConnectionRef conn, RDStreamRef s, uint8 order_flags)
+{
+	uint8 type = order_flags >> RDP_ORDER_ALTSEC_SHIFT;
+
+	switch (type)
+	{
+		case RDP_ORDER_SWITCH_SURFACE:
+			process_switch_surface(conn, s);
+			break;
+
+		case RDP_ORDER_CREATE_OFFSCR_BITMAP:
+			process_create_offscreen_bitmap(conn, s);
+			break;
+
+		default:
+			/* Unknown alternate secondary orders have no length field, so we can't skip them */
+			unimpl("alternate secondary order %d\n", type);
+			return False;
+	}
+
+	return True;
+}
+
 /* Process an order PDU */
 void
 process_orders(RDConnectionRef conn, RDStreamRef s, uint16 num_orders)
@@ -1315,6 +1477,14 @@ process_orders(RDConnectionRef conn, RDStreamRef s, uint16 num_orders)
 	{
 		in_uint8(s, order_flags);
 
+		if ((order_flags & (RDP_ORDER_STANDARD | RDP_ORDER_SECONDARY)) == RDP_ORDER_SECONDARY)
+		{
+			if (!process_altsec_order(conn, s, order_flags))
+				break;
+			processed++;
+			continue;
+		}
+
 		if (!(order_flags & RDP_ORDER_STANDARD))
 		{
 			error("order parsing failed\n");
@@ -53,9 +53,23 @@ enum RDP_SECONDARY_ORDER_TYPE
 	RDP_ORDER_FONTCACHE = 3,
 	RDP_ORDER_RAW_BMPCACHE2 = 4,
 	RDP_ORDER_BMPCACHE2 = 5,
-	RDP_ORDER_BRUSHCACHE = 7
+	RDP_ORDER_BRUSHCACHE = 7,
+	RDP_ORDER_BMPCACHE3 = 8
 };
 
+/* Alternate secondary orders carry their type in the upper six bits of the control flags */
+#define RDP_ORDER_ALTSEC_SHIFT 2
+
+enum RDP_ALTSEC_ORDER_TYPE
+{
+	RDP_ORDER_SWITCH_SURFACE = 0,
+	RDP_ORDER_CREATE_OFFSCR_BITMAP = 1
+};
+
+/* RDP_ORDER_CREATE_OFFSCR_BITMAP */
+#define OFFSCR_ID_MASK		0x7FFF
+#define OFFSCR_DELETE_LIST	0x8000
+
 typedef struct _DESTBLT_ORDER
 {
 	sint16 x;
@@ -334,6 +348,10 @@ RDP_BMPCACHE_ORDER;
 #define LONG_FORMAT		0x80
 #define BUFSIZE_MASK		0x3FFF	/* or 0x1FFF? */
 
+/* RDP_BMPCACHE3_ORDER, cache id shares ID_MASK */
+#define CBR3_IGNORABLE		0x0400
+#define CBR3_DO_NOT_CACHE	0x0800
+
 #define MAX_GLYPH 32
 
 typedef struct _RDP_FONT_GLYPH
@@ -33,6 +33,10 @@ typedef struct _RDStream
 	unsigned char *rdp_hdr;
 	unsigned char *channel_hdr;
 
+	/* Payload sent after end straight from the caller's buffer, see tcp_send() */
+	unsigned char *tail;
+	unsigned int tail_len;
+
 } RDStream;
 
 typedef RDStream * RDStreamRef;
@@ -40,6 +44,7 @@ typedef RDStream * RDStreamRef;
 #define s_push_layer(s,h,n)	{ (s)->h = (s)->p; (s)->p += n; }
 #define s_pop_layer(s,h)	(s)->p = (s)->h;
 #define s_mark_end(s)		(s)->end = (s)->p;
+#define s_set_tail(s,d,n)	{ (s)->tail = (d); (s)->tail_len = (n); }
 #define s_check(s)		((s)->p <= (s)->end)
 #define s_check_rem(s,n)	((s)->p + n <= (s)->end)
 #define s_check_end(s)		((s)->p == (s)->end)
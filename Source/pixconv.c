@@ -0,0 +1,236 @@
+/*	Copyright (c) 2007-2012 Dorian Johnson <2011@dorianj.net>
+	
+	This file is part of CoRD.
+	CoRD is free software; you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation; either version 2 of the License, or (at your option) any later
+	version.
+
+	CoRD is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+	FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License along with
+	CoRD; if not, write to the Free Software Foundation, Inc., 51 Franklin St,
+	Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+/*	Purpose: Pixel format conversion.
+*/
+
+#include "pixconv.h"
+
+/*
+ * Every bitmap the server sends is converted from its colour depth to
+ * backing store pixels once, when it is cached, so this is on the path of
+ * every bitmap update. 5 and 6 bit channels are widened to 8 bits by
+ * rounding, through the tables below one pixel at a time, or eight at a
+ * time with SSE2 or NEON by multiplying and shifting, which gives the same
+ * values: (c * 527 + 23) >> 6 for 5 bits, (c * 259 + 33) >> 6 for 6. 24 bit
+ * pixels are shuffled with SSSE3 or NEON; 8 bit ones are looked up in a
+ * palette already converted to backing store pixels.
+ */
+
+#if !defined(PIXCONV_NO_SIMD) && defined(__SSE2__)
+#include <emmintrin.h>
+#define PIXCONV_SSE2
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#define PIXCONV_SSSE3
+#endif
+#elif !defined(PIXCONV_NO_SIMD) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#include <arm_neon.h>
+#define PIXCONV_NEON
+#endif
+
+const uint8_t pixconv_expand5[32] = {
+	0, 8, 16, 25, 33, 41, 49, 58, 66, 74, 82, 90, 99, 107, 115, 123,
+	132, 140, 148, 156, 165, 173, 181, 189, 197, 206, 214, 222, 230, 239, 247, 255
+};
+
+const uint8_t pixconv_expand6[64] = {
+	0, 4, 8, 12, 16, 20, 24, 28, 32, 36, 40, 45, 49, 53, 57, 61,
+	65, 69, 73, 77, 81, 85, 89, 93, 97, 101, 105, 109, 113, 117, 121, 125,
+	130, 134, 138, 142, 146, 150, 154, 158, 162, 166, 170, 174, 178, 182, 186, 190,
+	194, 198, 202, 206, 210, 215, 219, 223, 227, 231, 235, 239, 243, 247, 251, 255
+};
+
+static uint32_t
+convert15(uint32_t c)
+{
+	return PIXCONV_ARGB(0xff, pixconv_expand5[(c >> 10) & 0x1f], pixconv_expand5[(c >> 5) & 0x1f],
+			    pixconv_expand5[c & 0x1f]);
+}
+
+static uint32_t
+convert16(uint32_t c)
+{
+	return PIXCONV_ARGB(0xff, pixconv_expand5[(c >> 11) & 0x1f], pixconv_expand6[(c >> 5) & 0x3f],
+			    pixconv_expand5[c & 0x1f]);
+}
+
+/* A colour from a drawing order: a palette index, an RGB555 or RGB565 value,
+   or red, green and blue from the low byte up */
+uint32_t
+pixconv_colour(int bpp, uint32_t colour, const uint32_t * palette)
+{
+	switch (bpp)
+	{
+		case 8:
+			return palette[colour & 0xff];
+		case 15:
+			return convert15(colour);
+		case 16:
+			return convert16(colour);
+		default:
+			return PIXCONV_ARGB(0xff, colour & 0xff, (colour >> 8) & 0xff, (colour >> 16) & 0xff);
+	}
+}
+
+static void
+row8(uint32_t * dst, const uint8_t * src, int n, const uint32_t * palette)
+{
+	int i;
+
+	for (i = 0; i + 4 <= n; i += 4)
+	{
+		dst[i] = palette[src[i]];
+		dst[i + 1] = palette[src[i + 1]];
+		dst[i + 2] = palette[src[i + 2]];
+		dst[i + 3] = palette[src[i + 3]];
+	}
+	for (; i < n; i++)
+		dst[i] = palette[src[i]];
+}
+
+static void
+row15_16(uint32_t * dst, const uint8_t * src, int n, int bpp)
+{
+	int i = 0;
+#if defined(PIXCONV_SSE2)
+	__m128i m5 = _mm_set1_epi16(0x1f), mg = _mm_set1_epi16(bpp == 16 ? 0x3f : 0x1f);
+	__m128i k5 = _mm_set1_epi16(527), a5 = _mm_set1_epi16(23);
+	__m128i kg = _mm_set1_epi16(bpp == 16 ? 259 : 527), ag = _mm_set1_epi16(bpp == 16 ? 33 : 23);
+	__m128i alpha = _mm_set1_epi16((short) 0xff00), rshift = _mm_cvtsi32_si128(bpp == 16 ? 11 : 10);
+
+	for (; i + 8 <= n; i += 8)
+	{
+		__m128i c = _mm_loadu_si128((const __m128i *) (src + i * 2));
+		__m128i r = _mm_and_si128(_mm_srl_epi16(c, rshift), m5);
+		__m128i g = _mm_and_si128(_mm_srli_epi16(c, 5), mg);
+		__m128i b = _mm_and_si128(c, m5);
+		__m128i bg, ra;
+
+		r = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(r, k5), a5), 6);
+		g = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(g, kg), ag), 6);
+		b = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(b, k5), a5), 6);
+
+		/* Interleaving the 16 bit halves gives blue, green, red, alpha */
+		bg = _mm_or_si128(b, _mm_slli_epi16(g, 8));
+		ra = _mm_or_si128(r, alpha);
+		_mm_storeu_si128((__m128i *) (dst + i), _mm_unpacklo_epi16(bg, ra));
+		_mm_storeu_si128((__m128i *) (dst + i + 4), _mm_unpackhi_epi16(bg, ra));
+	}
+#elif defined(PIXCONV_NEON)
+	uint16x8_t m5 = vdupq_n_u16(0x1f), mg = vdupq_n_u16(bpp == 16 ? 0x3f : 0x1f);
+	uint16x8_t a5 = vdupq_n_u16(23), ag = vdupq_n_u16(bpp == 16 ? 33 : 23);
+	uint16_t kg = bpp == 16 ? 259 : 527;
+	int16x8_t rshift = vdupq_n_s16(bpp == 16 ? -11 : -10);
+	uint8x8x4_t out;
+
+	out.val[3] = vdup_n_u8(0xff);
+	for (; i + 8 <= n; i += 8)
+	{
+		uint16x8_t c = vreinterpretq_u16_u8(vld1q_u8(src + i * 2));
+		uint16x8_t r = vandq_u16(vshlq_u16(c, rshift), m5);
+		uint16x8_t g = vandq_u16(vshrq_n_u16(c, 5), mg);
+		uint16x8_t b = vandq_u16(c, m5);
+
+		out.val[2] = vmovn_u16(vshrq_n_u16(vaddq_u16(vmulq_n_u16(r, 527), a5), 6));
+		out.val[1] = vmovn_u16(vshrq_n_u16(vaddq_u16(vmulq_n_u16(g, kg), ag), 6));
+		out.val[0] = vmovn_u16(vshrq_n_u16(vaddq_u16(vmulq_n_u16(b, 527), a5), 6));
+		vst4_u8((uint8_t *) (dst + i), out);
+	}
+#endif
+	for (; i < n; i++)
+		dst[i] = bpp == 16 ? convert16(src[i * 2] | (src[i * 2 + 1] << 8)) : convert15(src[i * 2] | (src[i * 2 + 1] << 8));
+}
+
+static void
+row24(uint32_t * dst, const uint8_t * src, int n)
+{
+	int i = 0;
+#if defined(PIXCONV_SSSE3)
+	__m128i shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+	__m128i alpha = _mm_set1_epi32((int) 0xff000000);
+
+	/* Each load reads 16 bytes for 4 pixels, so stop short of the end */
+	for (; i + 6 <= n; i += 4)
+		_mm_storeu_si128((__m128i *) (dst + i),
+				 _mm_or_si128(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (src + i * 3)), shuffle), alpha));
+#elif defined(PIXCONV_NEON)
+	uint8x8x4_t out;
+
+	out.val[3] = vdup_n_u8(0xff);
+	for (; i + 8 <= n; i += 8)
+	{
+		uint8x8x3_t in = vld3_u8(src + i * 3);
+
+		out.val[0] = in.val[0];
+		out.val[1] = in.val[1];
+		out.val[2] = in.val[2];
+		vst4_u8((uint8_t *) (dst + i), out);
+	}
+#endif
+	for (; i < n; i++)
+		dst[i] = PIXCONV_ARGB(0xff, src[i * 3 + 2], src[i * 3 + 1], src[i * 3]);
+}
+
+static void
+row32(uint32_t * dst, const uint8_t * src, int n)
+{
+	int i = 0;
+#if defined(PIXCONV_SSE2)
+	__m128i alpha = _mm_set1_epi32((int) 0xff000000);
+
+	for (; i + 4 <= n; i += 4)
+		_mm_storeu_si128((__m128i *) (dst + i), _mm_or_si128(_mm_loadu_si128((const __m128i *) (src + i * 4)), alpha));
+#elif defined(PIXCONV_NEON)
+	uint32x4_t alpha = vdupq_n_u32(0xff000000);
+
+	for (; i + 4 <= n; i += 4)
+		vst1q_u32(dst + i, vorrq_u32(vreinterpretq_u32_u8(vld1q_u8(src + i * 4)), alpha));
+#endif
+	for (; i < n; i++)
+		dst[i] = PIXCONV_ARGB(0xff, src[i * 4 + 2], src[i * 4 + 1], src[i * 4]);
+}
+
+/* Converts n pixels of bitmap data, which is blue, green, red from the
+   first byte up at 24 and 32 bpp (the fourth byte is ignored). palette is
+   256 backing store pixels, needed at 8 bpp only. */
+void
+pixconv_row(int bpp, uint32_t * dst, const uint8_t * src, int n, const uint32_t * palette)
+{
+	int i;
+
+	switch (bpp)
+	{
+		case 8:
+			row8(dst, src, n, palette);
+			break;
+		case 15:
+		case 16:
+			row15_16(dst, src, n, bpp);
+			break;
+		case 24:
+			row24(dst, src, n);
+			break;
+		case 32:
+			row32(dst, src, n);
+			break;
+		default:
+			for (i = 0; i < n; i++)
+				dst[i] = PIXCONV_ARGB(0xff, 0, 0, 0);
+			break;
+	}
+}
@@ -0,0 +1,43 @@
+/*	Copyright (c) 2007-2012 Dorian Johnson <2011@dorianj.net>
+	
+	This file is part of CoRD.
+	CoRD is free software; you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation; either version 2 of the License, or (at your option) any later
+	version.
+
+	CoRD is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+	FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License along with
+	CoRD; if not, write to the Free Software Foundation, Inc., 51 Franklin St,
+	Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef _PIXCONV_H
+#define _PIXCONV_H
+
+/* Plain C with no dependencies, so that it can be checked and measured on
+   its own (see Tools/pixconv_bench.c) */
+
+#include <stdint.h>
+
+/* Converted pixels are 32 bit ARGB words stored little endian, that is
+   blue, green, red and alpha bytes in memory: the backing store's format */
+#if defined(__BIG_ENDIAN__) || (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+#define PIXCONV_LE32(x)	((((x) & 0xff) << 24) | (((x) & 0xff00) << 8) | (((x) >> 8) & 0xff00) | (((x) >> 24) & 0xff))
+#else
+#define PIXCONV_LE32(x)	(x)
+#endif
+
+#define PIXCONV_ARGB(a, r, g, b)	PIXCONV_LE32(((uint32_t) (a) << 24) | ((uint32_t) (r) << 16) | ((g) << 8) | (b))
+
+/* round(c * 255 / 31) and round(c * 255 / 63) */
+extern const uint8_t pixconv_expand5[32];
+extern const uint8_t pixconv_expand6[64];
+
+uint32_t pixconv_colour(int bpp, uint32_t colour, const uint32_t * palette);
+void pixconv_row(int bpp, uint32_t * dst, const uint8_t * src, int n, const uint32_t * palette);
+
+#endif
@@ -22,6 +22,9 @@ RD_BOOL bitmap_decompress(uint8 * output, int width, int height, uint8 * input,
 
 #pragma mark -
 #pragma mark cache.c
+void cache_init_bitmaps(RDConnectionRef conn);
+void cache_free_bitmaps(RDConnectionRef conn);
+void cache_trace_bitmap(RDConnectionRef conn, uint8 cache_id, uint16 cache_idx, int width, int height, int Bpp, uint8 * data);
 void cache_rebuild_bmpcache_linked_list(RDConnectionRef conn, uint8 cache_id, sint16 * cache_idx, int count);
 RDBitmapRef cache_get_bitmap(RDConnectionRef conn, uint8 cache_id, uint16 cache_idx);
 void cache_put_bitmap(RDConnectionRef conn, uint8 cache_id, uint16 cache_idx, RDBitmapRef bitmap);
@@ -34,8 +37,15 @@ uint8 *cache_get_desktop(RDConnectionRef conn, uint32 offset, int cx, int cy, in
 void cache_put_desktop(RDConnectionRef conn, uint32 offset, int cx, int cy, int scanline, int bytes_per_pixel, uint8 * data);
 RDCursorRef cache_get_cursor(RDConnectionRef conn, uint16 cache_idx);
 void cache_put_cursor(RDConnectionRef conn, uint16 cache_idx, RDCursorRef cursor);
+RDCursorRef cache_get_cursor_shape(RDConnectionRef conn, sint16 x, sint16 y, uint16 width, uint16 height, const uint8 * andmask, int andlen, const uint8 * xormask, int xorlen, int bpp);
+void cache_put_cursor_shape(RDConnectionRef conn, sint16 x, sint16 y, uint16 width, uint16 height, const uint8 * andmask, int andlen, const uint8 * xormask, int xorlen, int bpp, RDCursorRef cursor);
+void cache_free_cursor_shapes(RDConnectionRef conn);
 RDBrushData *cache_get_brush_data(RDConnectionRef conn, uint8 colour_code, uint8 idx);
 void cache_put_brush_data(RDConnectionRef conn, uint8 colour_code, uint8 idx, RDBrushData * brush_data);
+RDSurfaceRef cache_get_offscreen(RDConnectionRef conn, uint16 idx);
+void cache_put_offscreen(RDConnectionRef conn, uint16 idx, uint16 width, uint16 height, RDSurfaceRef surface);
+void cache_delete_offscreen(RDConnectionRef conn, uint16 idx);
+void cache_reset_offscreen(RDConnectionRef conn);
 
 #pragma mark -
 #pragma mark channels.c
@@ -71,6 +81,7 @@ int mppc_expand(RDConnectionRef conn, uint8 * data, uint32 clen, uint8 ctype, ui
 #pragma mark -
 #pragma mark iso.c
 RDStreamRef iso_init(RDConnectionRef conn, int length);
+RDStreamRef iso_init_stream(RDStreamRef s, int length);
 void iso_send(RDConnectionRef conn, RDStreamRef s);
 RDStreamRef iso_recv(RDConnectionRef conn, uint8 * rdpver);
 RD_BOOL iso_connect(RDConnectionRef conn, const char *server, char *username, RD_BOOL reconnect);
@@ -84,6 +95,7 @@ void licence_process(RDConnectionRef conn, RDStreamRef s);
 #pragma mark -
 #pragma mark mcs.c
 RDStreamRef mcs_init(RDConnectionRef conn, int length);
+RDStreamRef mcs_init_stream(RDStreamRef s, int length);
 void mcs_send_to_channel(RDConnectionRef conn, RDStreamRef s, uint16 channel);
 void mcs_send(RDConnectionRef conn, RDStreamRef s);
 RDStreamRef mcs_recv(RDConnectionRef conn, uint16 * channel, uint8 * rdpver);
@@ -124,6 +136,7 @@ void *xmalloc(int size);
 char *xstrdup(const char *s);
 void *xrealloc(void *oldmem, int size);
 void xfree(void *mem);
+uint64 xmalloc_count(void);
 void error(char *format, ...);
 void warning(char *format, ...);
 void unimpl(char *format, ...);
@@ -154,7 +167,9 @@ RDStreamRef rdp_recv(RDConnectionRef conn, uint8 * type);
 void rdp_out_unistr(RDStreamRef s, const char *string, int len);
 int rdp_in_unistr(RDStreamRef s, char *string, int uni_len);
 void rdp_send_input(RDConnectionRef conn, uint32 time, uint16 message_type, uint16 device_flags, uint16 param1, uint16 param2);
+void rdp_send_input_events(RDConnectionRef conn, const RDInputEvent * events, int count);
 void rdp_send_client_window_status(RDConnectionRef conn, int status);
+void rdp_send_refresh_rect(RDConnectionRef conn, int x, int y, int cx, int cy);
 void process_colour_pointer_pdu(RDConnectionRef conn, RDStreamRef s);
 void process_new_pointer_pdu(RDConnectionRef conn, RDStreamRef s);
 void process_cached_pointer_pdu(RDConnectionRef conn, RDStreamRef s);
@@ -202,8 +217,10 @@ void sec_hash_48(uint8 * out, uint8 * in, uint8 * salt1, uint8 * salt2, uint8 sa
 void sec_hash_16(uint8 * out, uint8 * in, uint8 * salt1, uint8 * salt2);
 void buf_out_uint32(uint8 * buffer, uint32 value);
 void sec_sign(uint8 * signature, int siglen, uint8 * session_key, int keylen, uint8 * data, int datalen);
+void sec_encrypt(RDConnectionRef conn, uint8 * data, int length);
 void sec_decrypt(RDConnectionRef conn, uint8 * data, int length);
 RDStreamRef sec_init(RDConnectionRef conn, uint32 flags, int maxlen);
+RDStreamRef sec_init_stream(RDConnectionRef conn, RDStreamRef s, uint32 flags, int maxlen);
 void sec_send_to_channel(RDConnectionRef conn, RDStreamRef s, uint32 flags, uint16 channel);
 void sec_send(RDConnectionRef conn, RDStreamRef s, uint32 flags);
 void sec_process_mcs_data(RDConnectionRef conn, RDStreamRef s);
@@ -221,13 +238,26 @@ RD_BOOL serial_get_event(RDConnectionRef conn, NTHandle handle, uint32 * result)
 #pragma mark -
 #pragma mark tcp.c
 RDStreamRef tcp_init(RDConnectionRef conn, uint32 maxlen);
+RDStreamRef tcp_init_stream(RDStreamRef s, uint32 maxlen);
 void tcp_send(RDConnectionRef conn, RDStreamRef s);
 RDStreamRef tcp_recv(RDConnectionRef conn, RDStreamRef s, uint32 length);
+RD_BOOL tcp_data_buffered(RDConnectionRef conn);
 RD_BOOL tcp_connect(RDConnectionRef conn, const char *server);
+void tcp_begin_batch(RDConnectionRef conn);
+void tcp_end_batch(RDConnectionRef conn);
 void tcp_disconnect(RDConnectionRef conn);
 char *tcp_get_address(RDConnectionRef conn);
 void tcp_reset_state(RDConnectionRef conn);
 
+#pragma mark -
+#pragma mark timing.c
+uint64 timing_now(void);
+void timing_start(RDConnectionRef conn);
+RD_BOOL timing_mark(RDConnectionRef conn, int phase);
+int timing_report(RDConnectionRef conn, RDConnectPhaseTiming * report);
+void timing_estimate_network(RDConnectionRef conn);
+void timing_log(RDConnectionRef conn);
+
 #pragma mark -
 #pragma mark CRDDrawingStubs.m (formerly xclip.c)
 void ui_clip_format_announce(RDConnectionRef conn, uint8 * data, uint32 length);
@@ -251,6 +281,10 @@ void ui_move_pointer(RDConnectionRef conn, int x, int y);
 RDBitmapRef ui_create_bitmap(RDConnectionRef conn, int width, int height, uint8 * data);
 void ui_paint_bitmap(RDConnectionRef conn, int x, int y, int cx, int cy, int width, int height, uint8 * data);
 void ui_destroy_bitmap(RDBitmapRef bmp);
+RDSurfaceRef ui_create_surface(RDConnectionRef conn, int width, int height);
+void ui_set_surface(RDConnectionRef conn, RDSurfaceRef surface);
+void ui_destroy_surface(RDSurfaceRef surface);
+void ui_surface_blt(RDConnectionRef conn, uint8 opcode, int x, int y, int cx, int cy, RDSurfaceRef src, int srcx, int srcy);
 RDGlyphRef ui_create_glyph(RDConnectionRef conn, int width, int height, const uint8 * data);
 void ui_destroy_glyph(RDGlyphRef glyph);
 RDCursorRef ui_create_cursor(RDConnectionRef conn, signed int x, signed int y, int width, int height, uint8 * andmask, uint8 * xormask, int bpp);
@@ -267,7 +301,7 @@ void ui_destblt(RDConnectionRef conn, uint8 opcode, int x, int y, int cx, int cy
 void ui_patblt(RDConnectionRef conn, uint8 opcode, int x, int y, int cx, int cy, RDBrush * brush, int bgcolour, int fgcolour);
 void ui_screenblt(RDConnectionRef conn, uint8 opcode, int x, int y, int cx, int cy, int srcx, int srcy);
 void ui_memblt(RDConnectionRef conn, uint8 opcode, int x, int y, int cx, int cy, RDBitmapRef src, int srcx, int srcy);
-void ui_triblt(uint8 opcode, int x, int y, int cx, int cy, RDBitmapRef src, int srcx, int srcy, RDBrush * brush, int bgcolour, int fgcolour);
+void ui_triblt(RDConnectionRef conn, uint8 opcode, int x, int y, int cx, int cy, RDBitmapRef src, int srcx, int srcy, RDBrush * brush, int bgcolour, int fgcolour);
 void ui_line(RDConnectionRef conn, uint8 opcode, int startx, int starty, int endx, int endy, RDPen * pen);
 void ui_rect(RDConnectionRef conn, int x, int y, int cx, int cy, int colour);
 void ui_polygon(RDConnectionRef conn, uint8 opcode, uint8 fillmode, RDPoint* point, int npoints, RDBrush * brush, int bgcolour, int fgcolour);
@@ -20,9 +20,11 @@
 
 #import "rdesktop.h"
 
-#define MAX_CELL_SIZE		0x1000	/* pixels */
+/* Cache 0 holds 16x16 cells, cache 1 32x32 and cache 2 64x64 */
+#define MAX_CELL_SIZE(id)	(0x100 << (2 * (id)))	/* pixels */
 
-#define IS_PERSISTENT(id) (id < 8 && conn->pstcacheFd[id] > 0)
+#define IS_PERSISTENT(id) (id < BITMAP_CACHE_SIZE && conn->pstcacheFd[id] > 0)
+#define CELL_OFFSET(id, idx) ((idx) * (conn->pstcacheBpp * MAX_CELL_SIZE(id) + sizeof(RDPersistentCacheCellHeader)))
 
 const uint8 zero_key[] = { 0, 0, 0, 0, 0, 0, 0, 0 };
 
@@ -33,11 +35,11 @@ pstcache_touch_bitmap(RDConnectionRef conn, uint8 cache_id, uint16 cache_idx, ui
 {
 	int fd;
 
-	if (!IS_PERSISTENT(cache_id) || cache_idx >= BMPCACHE2_NUM_PSTCELLS)
+	if (!IS_PERSISTENT(cache_id) || cache_idx >= conn->bmpcacheCells[cache_id])
 		return;
 
 	fd = conn->pstcacheFd[cache_id];
-	rd_lseek_file(fd, 12 + cache_idx * (conn->pstcacheBpp * MAX_CELL_SIZE + sizeof(RDPersistentCacheCellHeader)));
+	rd_lseek_file(fd, 12 + CELL_OFFSET(cache_id, cache_idx));
 	rd_write_file(fd, &stamp, sizeof(stamp));
 }
 
@@ -53,18 +55,21 @@ pstcache_load_bitmap(RDConnectionRef conn, uint8 cache_id, uint16 cache_idx)
 	if (!conn->bitmapCachePersist)
 		return False;
 
-	if (!IS_PERSISTENT(cache_id) || cache_idx >= BMPCACHE2_NUM_PSTCELLS)
+	if (!IS_PERSISTENT(cache_id) || cache_idx >= conn->bmpcacheCells[cache_id])
 		return False;
 
 	fd = conn->pstcacheFd[cache_id];
-	rd_lseek_file(fd, cache_idx * (conn->pstcacheBpp * MAX_CELL_SIZE + sizeof(RDPersistentCacheCellHeader)));
+	rd_lseek_file(fd, CELL_OFFSET(cache_id, cache_idx));
 	rd_read_file(fd, &cellhdr, sizeof(RDPersistentCacheCellHeader));
+	if (cellhdr.length > conn->pstcacheBpp * MAX_CELL_SIZE(cache_id))
+		return False;
 	celldata = (uint8 *) xmalloc(cellhdr.length);
 	rd_read_file(fd, celldata, cellhdr.length);
 
 	bitmap = ui_create_bitmap(conn, cellhdr.width, cellhdr.height, celldata);
 	DEBUG(("Load bitmap from disk: id=%d, idx=%d, bmp=0x%p)\n", cache_id, cache_idx, bitmap));
 	cache_put_bitmap(conn, cache_id, cache_idx, bitmap);
+	cache_trace_bitmap(conn, cache_id, cache_idx, cellhdr.width, cellhdr.height, conn->pstcacheBpp, celldata);
 
 	xfree(celldata);
 	return True;
@@ -78,7 +83,10 @@ pstcache_save_bitmap(RDConnectionRef conn, uint8 cache_id, uint16 cache_idx, uin
 	int fd;
 	RDPersistentCacheCellHeader cellhdr;
 
-	if (!IS_PERSISTENT(cache_id) || cache_idx >= BMPCACHE2_NUM_PSTCELLS)
+	if (!IS_PERSISTENT(cache_id) || cache_idx >= conn->bmpcacheCells[cache_id])
+		return False;
+
+	if (length > conn->pstcacheBpp * MAX_CELL_SIZE(cache_id))
 		return False;
 
 	memcpy(cellhdr.key, key, sizeof(RDHashKey));
@@ -88,34 +96,35 @@ pstcache_save_bitmap(RDConnectionRef conn, uint8 cache_id, uint16 cache_idx, uin
 	cellhdr.stamp = 0;
 
 	fd = conn->pstcacheFd[cache_id];
-	rd_lseek_file(fd, cache_idx * (conn->pstcacheBpp * MAX_CELL_SIZE + sizeof(RDPersistentCacheCellHeader)));
+	rd_lseek_file(fd, CELL_OFFSET(cache_id, cache_idx));
 	rd_write_file(fd, &cellhdr, sizeof(RDPersistentCacheCellHeader));
 	rd_write_file(fd, data, length);
 
 	return True;
 }
 
-/* List the bitmap keys from the persistent cache file */
+/* List the bitmap keys from the persistent cache file. keylist must hold
+ * bmpcacheCells[id] keys. The caller is responsible for sending the keys to
+ * the server only once per session. */
 int
 pstcache_enumerate(RDConnectionRef conn, uint8 id, RDHashKey * keylist)
 {
 	int fd, idx, n;
-	sint16 mru_idx[BITMAP_CACHE_ENTRIES];
-	uint32 mru_stamp[BITMAP_CACHE_ENTRIES];
+	sint16 *mru_idx;
+	uint32 *mru_stamp;
 	RDPersistentCacheCellHeader cellhdr;
 
 	if (!(conn->bitmapCache && conn->bitmapCachePersist && IS_PERSISTENT(id)))
 		return 0;
 
-	/* The server disconnects if the bitmap cache content is sent more than once */
-	if (conn->pstcacheEnumerated)
-		return 0;
+	mru_idx = (sint16 *) xmalloc(conn->bmpcacheCells[id] * sizeof(sint16));
+	mru_stamp = (uint32 *) xmalloc(conn->bmpcacheCells[id] * sizeof(uint32));
 
-	DEBUG_RDP5(("Persistent bitmap cache enumeration... "));
-	for (idx = 0; idx < BMPCACHE2_NUM_PSTCELLS; idx++)
+	DEBUG_RDP5(("Persistent bitmap cache %d enumeration... ", id));
+	for (idx = 0; idx < conn->bmpcacheCells[id]; idx++)
 	{
 		fd = conn->pstcacheFd[id];
-		rd_lseek_file(fd, idx * (conn->pstcacheBpp * MAX_CELL_SIZE + sizeof(RDPersistentCacheCellHeader)));
+		rd_lseek_file(fd, CELL_OFFSET(id, idx));
 		if (rd_read_file(fd, &cellhdr, sizeof(RDPersistentCacheCellHeader)) <= 0)
 			break;
 
@@ -146,7 +155,8 @@ pstcache_enumerate(RDConnectionRef conn, uint8 id, RDHashKey * keylist)
 	DEBUG_RDP5(("%d cached bitmaps.\n", idx));
 
 	cache_rebuild_bmpcache_linked_list(conn, id, mru_idx, idx);
-	conn->pstcacheEnumerated = True;
+	xfree(mru_idx);
+	xfree(mru_stamp);
 	return idx;
 }
 
@@ -157,11 +167,14 @@ pstcache_init(RDConnectionRef conn, uint8 cache_id)
 	int fd;
 	char filename[256];
 
-	if (conn->pstcacheEnumerated)
-		return True;
+	if (IS_PERSISTENT(cache_id) || conn->pstcacheEnumerated)
+		return IS_PERSISTENT(cache_id);
 
 	conn->pstcacheFd[cache_id] = 0;
 
+	if (cache_id >= BITMAP_CACHE_SIZE || conn->bmpcacheCells[cache_id] == 0)
+		return False;
+
 	if (!(conn->bitmapCache && conn->bitmapCachePersist))
 		return False;
 
@@ -106,6 +106,15 @@
 	#define NEED_ALIGN
 #endif
 
+#import "arena.h"
+#import "evloop.h"
+#import "tiles.h"
+#import "rop.h"
+#import "blit.h"
+#import "pixconv.h"
+#import "framebuf.h"
+#import "scale.h"
+#import "record.h"
 #import "constants.h"
 #import "parse.h"
 #import "types.h"
@@ -386,25 +386,152 @@ rdp_send_synchronise(RDConnectionRef conn)
 	rdp_send_data(conn, s, RDP_DATA_PDU_SYNCHRONISE);
 }
 
-/* Send a single input event */
-void
-rdp_send_input(RDConnectionRef conn, uint32 time, uint16 message_type, uint16 device_flags, uint16 param1, uint16 param2)
+/* Length of an input event in a fast-path input PDU, 0 if it can't be sent that way */
+static int
+rdp_fastpath_input_length(const RDInputEvent * event)
+{
+	switch (event->type)
+	{
+		case RDP_INPUT_SCANCODE:
+			return 2;
+		case RDP_INPUT_MOUSE:
+			return 7;
+		case RDP_INPUT_SYNCHRONIZE:
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+/* Send up to 255 input events in one fast-path input PDU. Compared to the
+ * slow path there are no TPKT, X.224, MCS or share headers, and each event
+ * is 1-7 bytes instead of 12. */
+static RD_BOOL
+rdp_send_fastpath_input(RDConnectionRef conn, const RDInputEvent * events, int count)
 {
 	RDStreamRef s;
+	uint8 *signature, *data;
+	int i, n, length, datalen;
+	uint8 flags;
 
-	s = rdp_init_data(conn, 16);
+	datalen = (count > FASTPATH_INPUT_MAX_HEADER_EVENTS) ? 1 : 0;
+	for (i = 0; i < count; i++)
+	{
+		if ((n = rdp_fastpath_input_length(&events[i])) == 0)
+			return False;
+		datalen += n;
+	}
 
-	out_uint16_le(s, 1);	/* number of events */
-	out_uint16(s, 0);	/* pad */
+	length = 2 + (conn->useEncryption ? 8 : 0) + datalen;
+	if (length > 0x7f)
+		length++;
+
+	s = tcp_init(conn, length);
 
-	out_uint32_le(s, time);
-	out_uint16_le(s, message_type);
-	out_uint16_le(s, device_flags);
-	out_uint16_le(s, param1);
-	out_uint16_le(s, param2);
+	flags = FASTPATH_INPUT_ACTION_FASTPATH;
+	if (count <= FASTPATH_INPUT_MAX_HEADER_EVENTS)
+		flags |= count << 2;
+	if (conn->useEncryption)
+		flags |= FASTPATH_INPUT_ENCRYPTED;
+	out_uint8(s, flags);
+
+	if (length > 0x7f)
+		out_uint16_be(s, length | 0x8000);
+	else
+		out_uint8(s, length);
+
+	signature = s->p;
+	if (conn->useEncryption)
+		out_uint8s(s, 8);
+
+	data = s->p;
+	if (count > FASTPATH_INPUT_MAX_HEADER_EVENTS)
+		out_uint8(s, count);
+
+	for (i = 0; i < count; i++)
+	{
+		switch (events[i].type)
+		{
+			case RDP_INPUT_SCANCODE:
+				flags = 0;
+				if (events[i].deviceFlags & KBD_FLAG_UP)
+					flags |= FASTPATH_INPUT_KBDFLAGS_RELEASE;
+				if (events[i].deviceFlags & KBD_FLAG_EXT)
+					flags |= FASTPATH_INPUT_KBDFLAGS_EXTENDED;
+				out_uint8(s, (FASTPATH_INPUT_EVENT_SCANCODE << 5) | flags);
+				out_uint8(s, events[i].param1);
+				break;
+
+			case RDP_INPUT_MOUSE:
+				out_uint8(s, FASTPATH_INPUT_EVENT_MOUSE << 5);
+				out_uint16_le(s, events[i].deviceFlags);
+				out_uint16_le(s, events[i].param1);
+				out_uint16_le(s, events[i].param2);
+				break;
+
+			case RDP_INPUT_SYNCHRONIZE:
+				out_uint8(s, (FASTPATH_INPUT_EVENT_SYNC << 5) | (events[i].param1 & 0x1f));
+				break;
+		}
+	}
 
 	s_mark_end(s);
-	rdp_send_data(conn, s, RDP_DATA_PDU_INPUT);
+
+	if (conn->useEncryption)
+	{
+		sec_sign(signature, 8, conn->secSignKey, conn->rc4KeyLen, data, datalen);
+		sec_encrypt(conn, data, datalen);
+	}
+
+	tcp_send(conn, s);
+	return True;
+}
+
+/* Send input events, as few PDUs as possible */
+void
+rdp_send_input_events(RDConnectionRef conn, const RDInputEvent * events, int count)
+{
+	RDStreamRef s;
+	int i, n;
+
+	for (; count > 0; events += n, count -= n)
+	{
+		n = MIN(count, RDP_INPUT_MAX_EVENTS);
+
+		if (conn->useFastPathInput && rdp_send_fastpath_input(conn, events, n))
+			continue;
+
+		s = rdp_init_data(conn, 4 + 12 * n);
+
+		out_uint16_le(s, n);	/* number of events */
+		out_uint16(s, 0);	/* pad */
+
+		for (i = 0; i < n; i++)
+		{
+			out_uint32_le(s, events[i].time);
+			out_uint16_le(s, events[i].type);
+			out_uint16_le(s, events[i].deviceFlags);
+			out_uint16_le(s, events[i].param1);
+			out_uint16_le(s, events[i].param2);
+		}
+
+		s_mark_end(s);
+		rdp_send_data(conn, s, RDP_DATA_PDU_INPUT);
+	}
+}
+
+/* Send a single input event */
+void
+rdp_send_input(RDConnectionRef conn, uint32 time, uint16 message_type, uint16 device_flags, uint16 param1, uint16 param2)
+{
+	RDInputEvent event;
+
+	event.time = time;
+	event.type = message_type;
+	event.deviceFlags = device_flags;
+	event.param1 = param1;
+	event.param2 = param2;
+	rdp_send_input_events(conn, &event, 1);
 }
 
 /* Send a client window information PDU */
@@ -437,38 +564,78 @@ rdp_send_client_window_status(RDConnectionRef conn, int status)
    conn->currentStatus = status;
 }
 
-/* Inform the server on the contents of the persistent bitmap cache */
+/* Ask the server to send an area of the desktop again */
+void
+rdp_send_refresh_rect(RDConnectionRef conn, int x, int y, int cx, int cy)
+{
+	RDStreamRef s;
+
+	s = rdp_init_data(conn, 12);
+
+	out_uint8(s, 1);	/* number of areas */
+	out_uint8s(s, 3);	/* pad */
+	out_uint16_le(s, x);
+	out_uint16_le(s, y);
+	out_uint16_le(s, x + cx - 1);	/* inclusive */
+	out_uint16_le(s, y + cy - 1);
+
+	s_mark_end(s);
+	rdp_send_data(conn, s, RDP_DATA_PDU_REFRESH_RECT);
+}
+
+/* Inform the server on the contents of the persistent bitmap caches */
 static void
 rdp_enum_bmpcache2(RDConnectionRef conn)
 {
 	RDStreamRef s;
-	RDHashKey keylist[BMPCACHE2_NUM_PSTCELLS];
-	uint32 num_keys, offset, count, flags;
+	RDHashKey *keylist;
+	uint32 num_keys, offset, count, flags, total[BITMAP_CACHE_SIZE], first[BITMAP_CACHE_SIZE];
+	int id, n, cells;
 
-	offset = 0;
-	num_keys = pstcache_enumerate(conn, 2, keylist);
+	/* The server disconnects if the bitmap cache content is sent more than once */
+	if (conn->pstcacheEnumerated)
+		return;
+
+	for (id = 0, cells = 0; id < BITMAP_CACHE_SIZE; id++)
+		cells += conn->bmpcacheCells[id];
+
+	if (cells == 0)
+		return;
 
+	/* Keys are sent cache by cache; first[] is where each cache starts in the list */
+	keylist = (RDHashKey *) xmalloc(cells * sizeof(RDHashKey));
+	for (id = 0, num_keys = 0; id < BITMAP_CACHE_SIZE; id++)
+	{
+		first[id] = num_keys;
+		total[id] = pstcache_enumerate(conn, id, keylist + num_keys);
+		num_keys += total[id];
+	}
+
+	conn->pstcacheEnumerated = True;
+
+	offset = 0;
 	while (offset < num_keys)
 	{
-		count = MIN(num_keys - offset, 169);
+		count = MIN(num_keys - offset, BMPCACHE2_KEYS_PER_PDU);
 
 		s = rdp_init_data(conn, 24 + count * sizeof(RDHashKey));
 
 		flags = 0;
 		if (offset == 0)
 			flags |= PDU_FLAG_FIRST;
-		if (num_keys - offset <= 169)
+		if (num_keys - offset <= BMPCACHE2_KEYS_PER_PDU)
 			flags |= PDU_FLAG_LAST;
 
-		/* header */
-		out_uint32_le(s, 0);
-		out_uint16_le(s, count);
-		out_uint16_le(s, 0);
-		out_uint16_le(s, 0);
-		out_uint16_le(s, 0);
-		out_uint16_le(s, 0);
-		out_uint16_le(s, num_keys);
-		out_uint32_le(s, 0);
+		/* header: keys of each cache in this PDU, then totals */
+		for (id = 0; id < 5; id++)
+		{
+			n = 0;
+			if (id < BITMAP_CACHE_SIZE)
+				n = MAX(0, (int) MIN(first[id] + total[id], offset + count) - (int) MAX(first[id], offset));
+			out_uint16_le(s, n);
+		}
+		for (id = 0; id < 5; id++)
+			out_uint16_le(s, id < BITMAP_CACHE_SIZE ? total[id] : 0);
 		out_uint32_le(s, flags);
 
 		/* list */
@@ -477,8 +644,10 @@ rdp_enum_bmpcache2(RDConnectionRef conn)
 		s_mark_end(s);
 		rdp_send_data(conn, s, 0x2b);
 
-		offset += 169;
+		offset += BMPCACHE2_KEYS_PER_PDU;
 	}
+
+	xfree(keylist);
 }
 
 /* Send an (empty) font information PDU */
@@ -521,7 +690,8 @@ rdp_out_general_caps(RDConnectionRef conn, RDStreamRef s)
 	out_uint16(s, 0);	/* Update capability */
 	out_uint16(s, 0);	/* Remote unshare capability */
 	out_uint16(s, 0);	/* Compression level */
-	out_uint16(s, 0);	/* Pad */
+	out_uint8(s, 1);	/* Refresh rect support */
+	out_uint8(s, 1);	/* Suppress output support */
 }
 
 /* Output bitmap capability set */
@@ -578,10 +748,11 @@ rdp_out_order_caps(RDConnectionRef conn, RDStreamRef s)
 	out_uint16(s, 0);	/* Pad */
 	out_uint16_le(s, 1);	/* Max order level */
 	out_uint16_le(s, 0x147);	/* Number of fonts */
-	out_uint16_le(s, 0x2a);	/* Capability flags */
+	out_uint16_le(s, conn->bitmapCacheV3 ? (0x2a | ORDER_CAP_EXTRA_FLAGS) : 0x2a);	/* Capability flags */
 	out_uint8p(s, order_caps, 32);	/* Orders supported */
 	out_uint16_le(s, 0x6a1);	/* Text capability flags */
-	out_uint8s(s, 6);	/* Pad */
+	out_uint16_le(s, conn->bitmapCacheV3 ? ORDER_CAP_EX_BMPCACHE3 : 0);	/* Extra order support flags */
+	out_uint8s(s, 4);	/* Pad */
 	out_uint32_le(s, conn->desktopSave == False ? 0 : DESKTOP_CACHE_SIZE);	/* Desktop cache size */
 	out_uint32(s, 0);	/* Unknown */
 	out_uint32_le(s, 0x4e4);	/* Unknown */
@@ -591,43 +762,80 @@ rdp_out_order_caps(RDConnectionRef conn, RDStreamRef s)
 static void
 rdp_out_bmpcache_caps(RDConnectionRef conn, RDStreamRef s)
 {
-	int Bpp;
+	int Bpp, id;
 	out_uint16_le(s, RDP_CAPSET_BMPCACHE);
 	out_uint16_le(s, RDP_CAPLEN_BMPCACHE);
 
+	cache_init_bitmaps(conn);
+
 	Bpp = (conn->serverBpp + 7) / 8;
 	out_uint8s(s, 24);	/* unused */
-	out_uint16_le(s, 0x258);	/* entries */
-	out_uint16_le(s, 0x100 * Bpp);	/* max cell size */
-	out_uint16_le(s, 0x12c);	/* entries */
-	out_uint16_le(s, 0x400 * Bpp);	/* max cell size */
-	out_uint16_le(s, 0x106);	/* entries */
-	out_uint16_le(s, 0x1000 * Bpp);	/* max cell size */
+	for (id = 0; id < BITMAP_CACHE_SIZE; id++)
+	{
+		out_uint16_le(s, conn->bmpcacheCells[id]);	/* entries */
+		out_uint16_le(s, (0x100 << (2 * id)) * Bpp);	/* max cell size */
+	}
 }
 
 /* Output bitmap cache v2 capability set */
 static void
 rdp_out_bmpcache2_caps(RDConnectionRef conn, RDStreamRef s)
 {
+	int id;
+
 	out_uint16_le(s, RDP_CAPSET_BMPCACHE2);
 	out_uint16_le(s, RDP_CAPLEN_BMPCACHE2);
 
+	cache_init_bitmaps(conn);
+
 	out_uint16_le(s, conn->bitmapCachePersist ? 2 : 0);	/* version */
 
-	out_uint16_be(s, 3);	/* number of caches in this set */
+	out_uint16_be(s, BITMAP_CACHE_SIZE);	/* number of caches in this set */
 
 	/* max cell size for cache 0 is 16x16, 1 = 32x32, 2 = 64x64, etc */
-	out_uint32_le(s, BMPCACHE2_C0_CELLS);
-	out_uint32_le(s, BMPCACHE2_C1_CELLS);
-	if (pstcache_init(conn, 2))
+	for (id = 0; id < BITMAP_CACHE_SIZE; id++)
 	{
-		out_uint32_le(s, BMPCACHE2_NUM_PSTCELLS | BMPCACHE2_FLAG_PERSIST);
-	}
-	else
-	{
-		out_uint32_le(s, BMPCACHE2_C2_CELLS);
+		if (pstcache_init(conn, id))
+			out_uint32_le(s, conn->bmpcacheCells[id] | BMPCACHE2_FLAG_PERSIST);
+		else
+			out_uint32_le(s, conn->bmpcacheCells[id]);
 	}
-	out_uint8s(s, 20);	/* other bitmap caches not used */
+	out_uint8s(s, 32 - 4 * BITMAP_CACHE_SIZE);	/* other bitmap caches not used */
+}
+
+/* Output offscreen bitmap cache capability set */
+static void
+rdp_out_offscreen_caps(RDConnectionRef conn, RDStreamRef s)
+{
+	RD_BOOL enabled = conn->offscreenCacheSize > 0 && conn->offscreenCacheEntries > 0;
+
+	out_uint16_le(s, RDP_CAPSET_OFFSCREEN);
+	out_uint16_le(s, RDP_CAPLEN_OFFSCREEN);
+
+	out_uint32_le(s, enabled ? 1 : 0);	/* support level */
+	out_uint16_le(s, enabled ? MIN(conn->offscreenCacheSize, OFFSCREEN_CACHE_SIZE) : 0);	/* cache size, KB */
+	out_uint16_le(s, enabled ? MIN(conn->offscreenCacheEntries, OFFSCREEN_CACHE_ENTRIES) : 0);	/* cache entries */
+}
+
+/* Output multifragment update capability set */
+static void
+rdp_out_multifragment_caps(RDConnectionRef conn, RDStreamRef s)
+{
+	out_uint16_le(s, RDP_CAPSET_MULTIFRAGMENTUPDATE);
+	out_uint16_le(s, RDP_CAPLEN_MULTIFRAGMENTUPDATE);
+
+	out_uint32_le(s, conn->multifragmentMaxSize);	/* max request size */
+}
+
+/* Output surface commands capability set */
+static void
+rdp_out_surface_commands_caps(RDStreamRef s)
+{
+	out_uint16_le(s, RDP_CAPSET_SURFACE_COMMANDS);
+	out_uint16_le(s, RDP_CAPLEN_SURFACE_COMMANDS);
+
+	out_uint32_le(s, SURFCMDS_SET_SURFACE_BITS | SURFCMDS_FRAME_MARKER | SURFCMDS_STREAM_SURFACE_BITS);
+	out_uint32(s, 0);	/* reserved */
 }
 
 /* Output control capability set */
@@ -710,20 +918,6 @@ rdp_out_brushcache_caps(RDStreamRef s)
 	out_uint32_le(s, 1);	/* cache type */
 }
 
-static const uint8 caps_0x0d[] = {
-	0x01, 0x00, 0x00, 0x00, 0x09, 0x04, 0x00, 0x00,
-	0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-	0x0C, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-	0x00, 0x00, 0x00, 0x00
-};
-
 static const uint8 caps_0x0c[] = { 0x01, 0x00, 0x00, 0x00 };
 
 static const uint8 caps_0x0e[] = { 0x01, 0x00, 0x00, 0x00 };
@@ -737,6 +931,27 @@ static const uint8 caps_0x10[] = {
 	0x00, 0x01, 0x00, 0x01, 0x02, 0x00, 0x00, 0x00
 };
 
+/* Output input capability set */
+static void
+rdp_out_input_caps(RDConnectionRef conn, RDStreamRef s)
+{
+	uint16 flags = INPUT_FLAG_SCANCODES;
+
+	if (conn->fastPathInput)
+		flags |= INPUT_FLAG_FASTPATH_INPUT | INPUT_FLAG_FASTPATH_INPUT2;
+
+	out_uint16_le(s, RDP_CAPSET_INPUT);
+	out_uint16_le(s, RDP_CAPLEN_INPUT);
+
+	out_uint16_le(s, flags);
+	out_uint16(s, 0);	/* pad */
+	out_uint32_le(s, 0x409);	/* keyboard layout */
+	out_uint32_le(s, 4);	/* keyboard type */
+	out_uint32_le(s, 0);	/* keyboard subtype */
+	out_uint32_le(s, 12);	/* function keys */
+	out_uint8s(s, 64);	/* IME file name */
+}
+
 /* Output unknown capability sets */
 static void
 rdp_out_unknown_caps(RDStreamRef s, uint16 id, uint16 length, const uint8 * caps)
@@ -759,7 +974,9 @@ rdp_send_confirm_active(RDConnectionRef conn)
 		RDP_CAPLEN_COLCACHE +
 		RDP_CAPLEN_ACTIVATE + RDP_CAPLEN_CONTROL +
 		RDP_CAPLEN_SHARE +
-		RDP_CAPLEN_BRUSHCACHE + 0x58 + 0x08 + 0x08 + 0x34 /* unknown caps */  +
+		RDP_CAPLEN_BRUSHCACHE + RDP_CAPLEN_OFFSCREEN +
+		RDP_CAPLEN_MULTIFRAGMENTUPDATE + RDP_CAPLEN_SURFACE_COMMANDS +
+		RDP_CAPLEN_INPUT + 0x08 + 0x08 + 0x34 /* unknown caps */  +
 		4 /* w2k fix, why? */ ;
 
 	if (conn->useRdp5)
@@ -785,7 +1002,7 @@ rdp_send_confirm_active(RDConnectionRef conn)
 	out_uint16_le(s, caplen);
 
 	out_uint8p(s, RDP_SOURCE, sizeof(RDP_SOURCE));
-	out_uint16_le(s, 0xe);	/* num_caps */
+	out_uint16_le(s, 0x11);	/* num_caps */
 	out_uint8s(s, 2);	/* pad */
 
 	rdp_out_general_caps(conn, s);
@@ -804,8 +1021,11 @@ rdp_send_confirm_active(RDConnectionRef conn)
 	rdp_out_control_caps(s);
 	rdp_out_share_caps(s);
 	rdp_out_brushcache_caps(s);
+	rdp_out_offscreen_caps(conn, s);
+	rdp_out_multifragment_caps(conn, s);
+	rdp_out_surface_commands_caps(s);
 
-	rdp_out_unknown_caps(s, 0x0d, 0x58, caps_0x0d);	/* CAPSTYPE_INPUT */
+	rdp_out_input_caps(conn, s);
 	rdp_out_unknown_caps(s, 0x0c, 0x08, caps_0x0c); /* CAPSTYPE_SOUND */
 	rdp_out_unknown_caps(s, 0x0e, 0x08, caps_0x0e); /* CAPSTYPE_FONT */
 	rdp_out_unknown_caps(s, 0x10, 0x34, caps_0x10);	/* CAPSTYPE_GLYPHCACHE */
@@ -825,6 +1045,10 @@ rdp_process_general_caps(RDConnectionRef conn, RDStreamRef s)
 
 	if (!pad2octetsB)
 		conn->useRdp5 = False;
+
+	in_uint8s(s, 6);	/* update capability, remote unshare, compression level */
+	in_uint8(s, conn->serverRefreshRect);
+	in_uint8(s, conn->serverSuppressOutput);
 }
 
 /* Process a bitmap capability set */
@@ -862,6 +1086,18 @@ rdp_process_bitmap_caps(RDConnectionRef conn, RDStreamRef s)
 	}
 }
 
+/* Process an input capability set */
+static void
+rdp_process_input_caps(RDConnectionRef conn, RDStreamRef s)
+{
+	uint16 flags;
+
+	in_uint16_le(s, flags);
+	conn->useFastPathInput = conn->fastPathInput &&
+		(flags & (INPUT_FLAG_FASTPATH_INPUT | INPUT_FLAG_FASTPATH_INPUT2));
+	DEBUG(("Server input flags 0x%x, fast-path input %s\n", flags, conn->useFastPathInput ? "on" : "off"));
+}
+
 /* Process server capabilities */
 void
 rdp_process_server_caps(RDConnectionRef conn, RDStreamRef s, uint16 length)
@@ -894,6 +1130,10 @@ rdp_process_server_caps(RDConnectionRef conn, RDStreamRef s, uint16 length)
 			case RDP_CAPSET_BITMAP:
 				rdp_process_bitmap_caps(conn, s);
 				break;
+
+			case RDP_CAPSET_INPUT:
+				rdp_process_input_caps(conn, s);
+				break;
 		}
 
 		s->p = next;
@@ -913,17 +1153,21 @@ process_demand_active(RDConnectionRef conn, RDStreamRef s)
 	in_uint8s(s, len_src_descriptor);
 
 	DEBUG(("DEMAND_ACTIVE(id=0x%x)\n", conn->shareID));
+	timing_mark(conn, CONNECT_PHASE_DEMAND_ACTIVE);
+	conn->useFastPathInput = False;
 	rdp_process_server_caps(conn, s, len_combined_caps);
 
+	/* Offscreen bitmaps don't survive a reactivation */
+	ui_set_surface(conn, NULL);
+	cache_reset_offscreen(conn);
+
+	/* The client half of finalization needs no replies in between, so
+	   send it in one write and then collect the server's half */
+	tcp_begin_batch(conn);
 	rdp_send_confirm_active(conn);
 	rdp_send_synchronise(conn);
 	rdp_send_control(conn, RDP_CTL_COOPERATE);
 	rdp_send_control(conn, RDP_CTL_REQUEST_CONTROL);
-	rdp_recv(conn, &type);	/* RDP_PDU_SYNCHRONIZE */
-	rdp_recv(conn, &type);	/* RDP_CTL_COOPERATE */
-	rdp_recv(conn, &type);	/* RDP_CTL_GRANT_CONTROL */
-	rdp_send_input(conn, 0, RDP_INPUT_SYNCHRONIZE, 0, ui_get_numlock_state(read_keyboard_state()), 0);
-
 	if (conn->useRdp5)
 	{
 		rdp_enum_bmpcache2(conn);
@@ -934,8 +1178,14 @@ process_demand_active(RDConnectionRef conn, RDStreamRef s)
 		rdp_send_fonts(conn, 1);
 		rdp_send_fonts(conn, 2);
 	}
+	tcp_end_batch(conn);
 
+	rdp_recv(conn, &type);	/* RDP_PDU_SYNCHRONIZE */
+	rdp_recv(conn, &type);	/* RDP_CTL_COOPERATE */
+	rdp_recv(conn, &type);	/* RDP_CTL_GRANT_CONTROL */
+	rdp_send_input(conn, 0, RDP_INPUT_SYNCHRONIZE, 0, ui_get_numlock_state(read_keyboard_state()), 0);
 	rdp_recv(conn, &type);	/* RDP_PDU_UNKNOWN 0x28 (Fonts?) */
+	timing_mark(conn, CONNECT_PHASE_FINALIZE);
 	reset_order_state(conn);
 }
 
@@ -1087,14 +1337,14 @@ process_bitmap_updates(RDConnectionRef conn, RDStreamRef s)
 		if (!compress)
 		{
 			int y;
-			bmpdata = (uint8 *) xmalloc(width * height * Bpp);
+			bmpdata = (uint8 *) arena_alloc(&conn->arena, width * height * Bpp);
 			for (y = 0; y < height; y++)
 			{
 				in_uint8a(s, &bmpdata[(height - y - 1) * (width * Bpp)],
 					  width * Bpp);
 			}
 			ui_paint_bitmap(conn, left, top, cx, cy, width, height, bmpdata);
-			xfree(bmpdata);
+			arena_release(&conn->arena, bmpdata);
 			continue;
 		}
 
@@ -1110,7 +1360,7 @@ process_bitmap_updates(RDConnectionRef conn, RDStreamRef s)
 			in_uint8s(s, 4);	/* line_size, final_size */
 		}
 		in_uint8p(s, data, size);
-		bmpdata = (uint8 *) xmalloc(width * height * Bpp);
+		bmpdata = (uint8 *) arena_alloc(&conn->arena, width * height * Bpp);
 		if (bitmap_decompress(bmpdata, width, height, data, size, Bpp))
 		{
 			ui_paint_bitmap(conn, left, top, cx, cy, width, height, bmpdata);
@@ -1119,8 +1369,7 @@ process_bitmap_updates(RDConnectionRef conn, RDStreamRef s)
 		{
 			DEBUG_RDP5(("Failed to decompress data\n"));
 		}
-
-		xfree(bmpdata);
+		arena_release(&conn->arena, bmpdata);
 	}
 }
 
@@ -1137,7 +1386,7 @@ process_palette(RDConnectionRef conn, RDStreamRef s)
 	in_uint16_le(s, map.ncolours);
 	in_uint8s(s, 2);	/* pad */
 
-	map.colours = (RDColorEntry *) xmalloc(sizeof(RDColorEntry) * map.ncolours);
+	map.colours = (RDColorEntry *) arena_alloc(&conn->arena, sizeof(RDColorEntry) * map.ncolours);
 
 	DEBUG(("PALETTE(c=%d)\n", map.ncolours));
 
@@ -1151,8 +1400,6 @@ process_palette(RDConnectionRef conn, RDStreamRef s)
 
 	hmap = ui_create_colourmap(&map);
 	ui_set_colourmap(conn, hmap);
-
-	xfree(map.colours);
 }
 
 /* Process an update PDU */
@@ -1393,14 +1640,41 @@ process_redirect_pdu(RDConnectionRef conn, RDStreamRef s /*, uint32 * ext_disc_r
 	return True;
 }
 
+/* Returns the logon flags with bulk compression chosen for the link. The
+ * estimate is one sample from the handshake, so it only decides what the
+ * user can't see: the desktop experience (rdp5PerformanceFlags) is left as
+ * the user set it. */
+static uint32
+rdp_adapt_to_network(RDConnectionRef conn, uint32 flags)
+{
+	int link = conn->network.linkClass;
+
+	if (link == NETWORK_CLASS_UNKNOWN)
+		return flags;
+
+	/* Compressing costs the server CPU time and saves a LAN nothing */
+	if (link == NETWORK_CLASS_LAN)
+		flags &= ~(RDP_LOGON_COMPRESSION | RDP_LOGON_COMPRESSION2);
+	else
+		flags |= conn->useRdp5 ? RDP_LOGON_COMPRESSION2 : RDP_LOGON_COMPRESSION;
+
+	DEBUG(("network: link class %d, logon flags 0x%x\n", link, flags));
+	return flags;
+}
+
 /* Establish a connection up to the RDP layer */
 RD_BOOL
 rdp_connect(RDConnectionRef conn, const char *server, uint32 flags, NSString *domain, NSString *username, NSString *password,
 	    const char *command, const char *directory, RD_BOOL reconnect)
 {
+	timing_start(conn);
 	if (!sec_connect(conn, server, conn->username, reconnect))
 		return False;
 
+	timing_estimate_network(conn);
+	if (conn->autoPerformanceFlags)
+		flags = rdp_adapt_to_network(conn, flags);
+
 	rdp_send_logon_info(conn, flags, domain, username, password, command, directory);
 	return True;
 }
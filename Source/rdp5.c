@@ -22,11 +22,126 @@
 #import "rdesktop.h"
 
 
+/* Append a fast-path update fragment to the reassembly buffer. Returns the
+ * whole update once the last fragment is in, otherwise NULL. f->p is only
+ * set while a whole update is handed out; it is dropped on the next call,
+ * so that a fragment without a FIRST of its own can't extend it. */
+static RDStreamRef
+rdp5_reassemble(RDConnectionRef conn, RDStreamRef s, uint32 length, uint8 fragmentation)
+{
+	RDStreamRef f = &conn->fastPathFragment;
+	uint32 used;
+
+	if (f->p != NULL)
+		f->p = f->end = NULL;
+
+	if (fragmentation == RDP5_FRAGMENT_FIRST)
+		f->end = f->data;
+	else if (f->end == NULL)
+		return NULL;	/* no FIRST fragment seen */
+
+	used = f->end - f->data;
+	if (used + length > conn->multifragmentMaxSize)
+	{
+		error("fast-path update larger than %u bytes\n", conn->multifragmentMaxSize);
+		f->p = f->end = NULL;
+		return NULL;
+	}
+
+	if (used + length > f->size)
+	{
+		f->size = MAX(used + length, MIN(f->size * 2, conn->multifragmentMaxSize));
+		f->data = (uint8 *) xrealloc(f->data, f->size);
+		f->end = f->data + used;
+	}
+
+	memcpy(f->end, s->p, length);
+	f->end += length;
+
+	if (fragmentation != RDP5_FRAGMENT_LAST)
+		return NULL;
+
+	f->p = f->data;
+	return f;
+}
+
+/* Process a surface commands update */
+static void
+rdp5_process_surface_commands(RDConnectionRef conn, RDStreamRef s)
+{
+	uint16 cmd, action, left, top, right, bottom, width, height;
+	uint8 bpp, Bpp, flags, codec_id;
+	uint32 frame_id, size;
+	uint8 *data, *bmpdata;
+	int y;
+
+	while (s->p + 2 <= s->end)
+	{
+		in_uint16_le(s, cmd);
+
+		switch (cmd)
+		{
+			case SURFCMD_FRAME_MARKER:
+				in_uint16_le(s, action);
+				in_uint32_le(s, frame_id);
+				DEBUG(("FRAME_MARKER(action=%d,id=%d)\n", action, frame_id));
+				break;
+
+			case SURFCMD_SET_SURFACE_BITS:
+			case SURFCMD_STREAM_SURFACE_BITS:
+				in_uint16_le(s, left);
+				in_uint16_le(s, top);
+				in_uint16_le(s, right);
+				in_uint16_le(s, bottom);
+
+				/* TS_BITMAP_DATA_EX */
+				in_uint8(s, bpp);
+				in_uint8(s, flags);
+				in_uint8s(s, 1);	/* reserved */
+				in_uint8(s, codec_id);
+				in_uint16_le(s, width);
+				in_uint16_le(s, height);
+				in_uint32_le(s, size);
+				if (flags & BMPCACHE3_EXHEADER_PRESENT)
+					in_uint8s(s, BMPCACHE3_EXHEADER_SIZE);
+				in_uint8p(s, data, size);
+
+				DEBUG(("SURFACE_BITS(l=%d,t=%d,r=%d,b=%d,w=%d,h=%d,bpp=%d,codec=%d)\n",
+				       left, top, right, bottom, width, height, bpp, codec_id));
+
+				Bpp = (bpp + 7) / 8;
+				if (codec_id != BMPCACHE3_CODEC_NONE)
+				{
+					unimpl("surface bits codec %d\n", codec_id);
+					break;
+				}
+				if (Bpp != (conn->serverBpp + 7) / 8 || size < (uint32) width * height * Bpp)
+				{
+					warning("SURFACE_BITS: unexpected bitmap data (bpp=%d, size=%d)\n", bpp, size);
+					break;
+				}
+
+				/* Uncompressed data is bottom-up */
+				bmpdata = (uint8 *) arena_alloc(&conn->arena, width * height * Bpp);
+				for (y = 0; y < height; y++)
+					memcpy(&bmpdata[(height - y - 1) * (width * Bpp)], &data[y * (width * Bpp)], width * Bpp);
+				ui_paint_bitmap(conn, left, top, MIN(width, right - left), MIN(height, bottom - top),
+						width, height, bmpdata);
+				arena_release(&conn->arena, bmpdata);
+				break;
+
+			default:
+				unimpl("surface command %d\n", cmd);
+				return;
+		}
+	}
+}
+
 void
 rdp5_process(RDConnectionRef conn, RDStreamRef s)
 {
 	uint16 length, count, x, y;
-	uint8 type, ctype;
+	uint8 type, ctype, fragmentation;
 	uint8 *next;
 
 	uint32 roff, rlen;
@@ -53,6 +168,8 @@ rdp5_process(RDConnectionRef conn, RDStreamRef s)
 			ctype = 0;
 			in_uint16_le(s, length);
 		}
+		fragmentation = (type >> RDP5_FRAGMENT_SHIFT) & RDP5_FRAGMENT_MASK;
+		type &= RDP5_UPDATE_CODE_MASK;
 		conn->nextPacket = next = s->p + length;
 			
 		if (ctype & RDP_MPPC_COMPRESSED)
@@ -76,6 +193,16 @@ rdp5_process(RDConnectionRef conn, RDStreamRef s)
 		else
 			ts = s;
 
+		if (fragmentation != RDP5_FRAGMENT_SINGLE)
+		{
+			ts = rdp5_reassemble(conn, ts, (ts == s) ? length : (uint32) (ts->end - ts->p), fragmentation);
+			if (ts == NULL)
+			{
+				s->p = next;
+				continue;
+			}
+		}
+
 		switch (type)
 		{
 			case 0:	/* update orders */
@@ -92,6 +219,9 @@ rdp5_process(RDConnectionRef conn, RDStreamRef s)
 				break;
 			case 3:	/* update synchronize */
 				break;
+			case 4:	/* surface commands */
+				rdp5_process_surface_commands(conn, ts);
+				break;
 			case 5: /* null pointer */
 				ui_set_null_cursor(conn);
 				break;
@@ -739,7 +739,7 @@ rdpdr_init(RDConnectionRef conn)
 #pragma mark -
 #pragma mark Asynchronous IO
 
-// I thought I would replace the select() async method with NSFileHandle, but NSFH doesn't all the things I needed, so this is all going to be reverted to use select (currently, none of this is used at all because non-blocking IO is disabled in process_irp). If I want to re-implement non-blocking IO, I'll use a new thread that simply spins on select() and sends a message to a mach port on the connection thread when it has new data
+// I thought I would replace the select() async method with NSFileHandle, but NSFH doesn't all the things I needed, so this is all going to be reverted to use select (currently, none of this is used at all because non-blocking IO is disabled in process_irp). If I want to re-implement non-blocking IO, the connection thread's event loop can watch the file (see evloop.c)
 
 /* Add a new io request to the table containing pending io requests so it won't block rdesktop */
 static RD_BOOL
@@ -789,15 +789,19 @@ rdpdr_remove_iorequest(RDConnectionRef conn, uint32 fd, RDAsynchronousIORequest
 	if (requestToRemove->buffer)
 		xfree(requestToRemove->buffer);
 
-	RDAsynchronousIORequest *iorq = conn->fileInfo[fd].firstIORequest, *prev;
+	RDAsynchronousIORequest *iorq = conn->fileInfo[fd].firstIORequest, *prev = NULL, *next;
 
 	while (iorq != NULL)
 	{
 		if (iorq == requestToRemove)
 		{
-			prev->next = iorq->next;
+			next = iorq->next;
+			if (prev == NULL)
+				conn->fileInfo[fd].firstIORequest = next;
+			else
+				prev->next = next;
 			xfree(requestToRemove);
-			return iorq->next;
+			return next;
 		}
 		
 		prev = iorq;
@@ -0,0 +1,997 @@
+/*	Copyright (c) 2007-2012 Dorian Johnson <2011@dorianj.net>
+	
+	This file is part of CoRD.
+	CoRD is free software; you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation; either version 2 of the License, or (at your option) any later
+	version.
+
+	CoRD is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+	FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License along with
+	CoRD; if not, write to the Free Software Foundation, Inc., 51 Franklin St,
+	Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+/*	Purpose: Session recording.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "record.h"
+
+/*
+ * A recording is fed the screen and its dirty tiles at the end of every
+ * update. The screen is cut into the same 64x64 tiles, and only the dirty
+ * ones are looked at; of those, only the ones that really differ from what
+ * was last recorded are written, since a tile is dirty when anything in it
+ * was drawn, over and over the same pixels or not.
+ *
+ * Scrolling changes most of a window while adding little to it, so before
+ * looking at the tiles the biggest dirty rectangle is checked for having
+ * moved up or down, by finding a few of its rows in what was recorded
+ * before. Tiles that did are stored as a copy from those rows. Playback
+ * applies tiles in order, so then they are written in an order that never
+ * overwrites rows a later copy still needs.
+ *
+ * A keyframe holds every tile, so that playback can start there rather
+ * than at the beginning. One is written when the frames since the last
+ * add up to more than it did, so that seeking never reads more than about
+ * two keyframes' worth, or when the last is RECORD_KEYFRAME_INTERVAL old,
+ * or when the screen changes size.
+ *
+ * Each tile is run length coded, in the order its pixels are stored:
+ * runs that are as they were in the frame before, runs of one colour,
+ * runs that repeat the row above, and literal pixels between them. So a
+ * keystroke costs about as much as its glyph rather than its tile, and
+ * since screens are mostly flat colour, window edges and text, even a new
+ * tile usually shrinks several times over. A tile that wouldn't shrink is
+ * stored as it is. Pixels are stored as 24-bit
+ * colour; the backing store's alpha is never shown, and plays back opaque.
+ *
+ * All numbers are little-endian.
+ *
+ *	header	"CoRDrec1", u16 version, u16 tile size, u32 flags (0),
+ *		i64 start time (seconds since 1970), u64 index offset
+ *	frame	u8 'K' (keyframe) or 'D', u8 0, u16 width, u16 height, u16 0,
+ *		u32 time (milliseconds since the first frame),
+ *		u32 tiles, u32 payload bytes, then the tiles
+ *	tile	u16 column, u16 row, u8 encoding, u32 bytes, then the pixels:
+ *		24-bit as they are, run length coded, or for a copy the i16
+ *		rows below the tile it comes from
+ *	index	u32 duration, u32 keyframes, then u32 time and u64 offset
+ *		of each
+ *
+ * The index is written when the recording is closed, and its offset filled
+ * into the header. If it never was, because CoRD didn't get to close it,
+ * the player finds the keyframes by walking the frames instead, and plays
+ * up to the last whole one.
+ */
+
+#define RECORD_MAGIC	"CoRDrec1"
+#define RECORD_VERSION	1
+
+#define HEADER_SIZE	32
+#define HEADER_INDEX	24	/* where in the header the index offset is */
+#define FRAME_HEADER_SIZE	20
+#define TILE_HEADER_SIZE	9
+#define KEY_SIZE	12
+
+#define FRAME_KEY	'K'
+#define FRAME_DELTA	'D'
+
+#define TILE_RAW	0
+#define TILE_RLE	1
+#define TILE_COPY	2
+
+#define MOTION_MIN	32	/* smallest rectangle worth looking for scrolling in */
+#define MOTION_PROBES	3
+
+/* Run length opcodes, with a count of 1-64 less one in the low bits */
+#define RLE_LITERAL	0x00	/* that many pixels follow */
+#define RLE_UNCHANGED	0x40	/* as they were in the frame before */
+#define RLE_RUN		0x80	/* one pixel follows, repeated */
+#define RLE_ABOVE	0xc0	/* the same as the row above */
+#define RLE_OP		0xc0
+#define RLE_COUNT	0x3f
+#define RLE_MAX		64
+
+/* Room for one tile at worst: stored as it is, plus what an encoding may overshoot by before giving up */
+#define TILE_MAX_SIZE	(TILE_HEADER_SIZE + RECORD_TILE * RECORD_TILE * 3 + 8)
+
+#define SAME_COLOUR(a, b)	((((a) ^ (b)) & 0xffffff) == 0)
+
+typedef struct _RDFrameHeader
+{
+	int type, width, height;
+	uint32_t time, tiles, length;
+} RDFrameHeader;
+
+static void
+put16(uint8_t * p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+}
+
+static void
+put32(uint8_t * p, uint32_t v)
+{
+	put16(p, v);
+	put16(p + 2, v >> 16);
+}
+
+static void
+put64(uint8_t * p, uint64_t v)
+{
+	put32(p, (uint32_t) v);
+	put32(p + 4, (uint32_t) (v >> 32));
+}
+
+static uint32_t
+get16(const uint8_t * p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static uint32_t
+get32(const uint8_t * p)
+{
+	return get16(p) | (get16(p + 2) << 16);
+}
+
+static uint64_t
+get64(const uint8_t * p)
+{
+	return get32(p) | ((uint64_t) get32(p + 4) << 32);
+}
+
+static void
+put_pixel(uint8_t * p, uint32_t pixel)
+{
+	p[0] = pixel;
+	p[1] = pixel >> 8;
+	p[2] = pixel >> 16;
+}
+
+static uint32_t
+get_pixel(const uint8_t * p)
+{
+	return 0xff000000 | p[0] | (p[1] << 8) | (p[2] << 16);
+}
+
+static int
+min(int a, int b)
+{
+	return a < b ? a : b;
+}
+
+
+/* Recording */
+
+/* Codes n pixels, width to a row, into out; previous is what they were,
+   or NULL. Returns the length, or 0 if it would be longer than limit. out
+   needs room for limit + 8 bytes. */
+static size_t
+rle_encode(const uint32_t * p, const uint32_t * previous, int width, int n, uint8_t * out, size_t limit)
+{
+	uint8_t *o = out, *literal = NULL;
+	int i = 0, run, above, unchanged;
+
+	while (i < n)
+	{
+		if ((size_t) (o - out) > limit)
+			return 0;
+
+		unchanged = 0;
+		if (previous != NULL)
+			while (unchanged < RLE_MAX && i + unchanged < n && SAME_COLOUR(p[i + unchanged], previous[i + unchanged]))
+				unchanged++;
+		for (run = 1; run < RLE_MAX && i + run < n && SAME_COLOUR(p[i + run], p[i]); run++)
+			;
+		above = 0;
+		if (i >= width)
+			while (above < RLE_MAX && i + above < n && SAME_COLOUR(p[i + above], p[i + above - width]))
+				above++;
+
+		/* The single byte ones win a tie */
+		if (unchanged >= 2 && unchanged >= above && unchanged >= run)
+		{
+			*o++ = RLE_UNCHANGED | (unchanged - 1);
+			i += unchanged;
+			literal = NULL;
+		}
+		else if (above >= 2 && above >= run)
+		{
+			*o++ = RLE_ABOVE | (above - 1);
+			i += above;
+			literal = NULL;
+		}
+		else if (run >= 2)
+		{
+			*o++ = RLE_RUN | (run - 1);
+			put_pixel(o, p[i]);
+			o += 3;
+			i += run;
+			literal = NULL;
+		}
+		else
+		{
+			if (literal == NULL || *literal == RLE_LITERAL + RLE_MAX - 1)
+			{
+				literal = o++;
+				*literal = RLE_LITERAL;
+			}
+			else
+				(*literal)++;
+			put_pixel(o, p[i]);
+			o += 3;
+			i++;
+		}
+	}
+
+	return (size_t) (o - out) <= limit ? (size_t) (o - out) : 0;
+}
+
+/* Appends a tile of tw x th pixels at column tx, row ty to out; previous
+   is what it was, or NULL in a keyframe */
+static uint8_t *
+encode_tile(uint8_t * out, const uint32_t * tile, const uint32_t * previous, int tx, int ty, int tw, int th)
+{
+	int n = tw * th, i;
+	size_t length = rle_encode(tile, previous, tw, n, out + TILE_HEADER_SIZE, n * 3);
+	int encoding = TILE_RLE;
+
+	if (length == 0)
+	{
+		encoding = TILE_RAW;
+		length = n * 3;
+		for (i = 0; i < n; i++)
+			put_pixel(out + TILE_HEADER_SIZE + i * 3, tile[i]);
+	}
+
+	put16(out, tx);
+	put16(out + 2, ty);
+	out[4] = encoding;
+	put32(out + 5, length);
+	return out + TILE_HEADER_SIZE + length;
+}
+
+static int
+record_fail(RDRecorder * rec)
+{
+	rec->failed = 1;
+	return 0;
+}
+
+static int
+record_write(RDRecorder * rec, const void *data, size_t length)
+{
+	if (fwrite(data, 1, length, rec->file) != length)
+		return record_fail(rec);
+
+	rec->offset += length;
+	rec->stats.bytes += length;
+	return 1;
+}
+
+static int
+record_resize(RDRecorder * rec, int width, int height)
+{
+	free(rec->shadow);
+	free(rec->marked);
+	free(rec->payload);
+
+	rec->width = width;
+	rec->height = height;
+	rec->tiles_x = (width + RECORD_TILE - 1) / RECORD_TILE;
+	rec->tiles_y = (height + RECORD_TILE - 1) / RECORD_TILE;
+	rec->shadow = calloc((size_t) width * height, 4);
+	rec->marked = calloc((size_t) rec->tiles_x * rec->tiles_y, 1);
+	rec->payload = malloc((size_t) rec->tiles_x * rec->tiles_y * TILE_MAX_SIZE);
+
+	return rec->shadow != NULL && rec->marked != NULL && rec->payload != NULL;
+}
+
+/* dirty may be for a screen of another size when the update resized it,
+   and then everything is looked at */
+static void
+mark_tiles(RDRecorder * rec, const RDTileMap * dirty)
+{
+	int tx, ty;
+
+	if (dirty == NULL || dirty->width != rec->width || dirty->height != rec->height)
+	{
+		memset(rec->marked, 1, (size_t) rec->tiles_x * rec->tiles_y);
+		return;
+	}
+
+	for (ty = 0; ty < rec->tiles_y; ty++)
+		for (tx = 0; tx < rec->tiles_x; tx++)
+			rec->marked[ty * rec->tiles_x + tx] = tilemap_test(dirty, tx, ty);
+}
+
+/* The biggest block of marked tiles, found by growing each run of them in
+   a row down as far as the rows below have it too */
+static RDTileRect
+largest_block(RDRecorder * rec)
+{
+	RDTileRect best = { 0, 0, 0, 0 };
+	int tx, ty, left, right, bottom, i;
+
+	for (ty = 0; ty < rec->tiles_y; ty++)
+		for (tx = 0; tx < rec->tiles_x; tx = right)
+		{
+			const uint8_t *row = rec->marked + ty * rec->tiles_x;
+
+			for (left = tx; left < rec->tiles_x && !row[left]; left++) ;
+			for (right = left; right < rec->tiles_x && row[right]; right++) ;
+			if (right == left)
+				break;
+
+			for (bottom = ty + 1; bottom < rec->tiles_y; bottom++)
+			{
+				for (i = left; i < right && rec->marked[bottom * rec->tiles_x + i]; i++) ;
+				if (i < right)
+					break;
+			}
+
+			if ((long) (right - left) * (bottom - ty) > (long) best.cx * best.cy)
+			{
+				best.x = left;
+				best.y = ty;
+				best.cx = right - left;
+				best.cy = bottom - ty;
+			}
+		}
+
+	best.x *= RECORD_TILE;
+	best.y *= RECORD_TILE;
+	best.cx = min(best.cx * RECORD_TILE, rec->width - best.x);
+	best.cy = min(best.cy * RECORD_TILE, rec->height - best.y);
+	return best;
+}
+
+/* Whether the screen's pixels at x, y differ from what was recorded dy rows below */
+static int
+rows_differ(RDRecorder * rec, const uint32_t * origin, int pitch, int x, int y, int cx, int cy, int dy)
+{
+	int row;
+
+	for (row = 0; row < cy; row++)
+		if (memcmp((const uint8_t *) origin + (long) (y + row) * pitch + x * 4,
+			   rec->shadow + (size_t) (y + row + dy) * rec->width + x, cx * 4) != 0)
+			return 1;
+	return 0;
+}
+
+static int
+one_colour(const uint32_t * p, int n)
+{
+	int i;
+
+	for (i = 1; i < n; i++)
+		if (p[i] != p[0])
+			return 0;
+	return 1;
+}
+
+/* How many rows below its place the biggest dirty rectangle's contents were
+   last recorded (negative if above), or 0 if it didn't scroll; called once
+   the tiles are marked */
+static int
+find_motion(RDRecorder * rec, const uint32_t * origin, int pitch)
+{
+	RDTileRect r = largest_block(rec);
+	int probes[MOTION_PROBES], i, x, cx, dy, d, tried, top, bottom;
+
+	if (r.cx < MOTION_MIN || r.cy < MOTION_MIN)
+		return 0;
+
+	/* Rows across the middle of it, moved on past blank ones, which would match anywhere */
+	cx = min(r.cx / 2, RECORD_TILE);
+	x = r.x + (r.cx - cx) / 2;
+	for (i = 0; i < MOTION_PROBES; i++)
+	{
+		probes[i] = r.y + r.cy * (i + 1) / (MOTION_PROBES + 1);
+		for (tried = 0; tried < 16 && probes[i] < r.y + r.cy - 1; tried++, probes[i]++)
+			if (!one_colour((const uint32_t *) ((const uint8_t *) origin + (long) probes[i] * pitch) + x, cx))
+				break;
+	}
+
+	/* Nearest first, since most scrolling is by a line or a few */
+	for (dy = 1; dy < r.cy; dy++)
+		for (d = dy; d >= -dy; d -= 2 * dy)
+		{
+			for (i = 0, tried = 0; i < MOTION_PROBES; i++)
+			{
+				top = probes[i] + d;
+				bottom = top + 1;
+				if (top < r.y || bottom > r.y + r.cy)
+					continue;
+				if (rows_differ(rec, origin, pitch, x, probes[i], cx, 1, d))
+					break;
+				tried++;
+			}
+			if (i == MOTION_PROBES && tried > 0)
+				return d;
+		}
+
+	return 0;
+}
+
+/* Copies a tile of the screen into the shadow, and if it is to be encoded
+   into rec->tile, with what the shadow had into rec->previous */
+static void
+take_tile(RDRecorder * rec, const uint32_t * origin, int pitch, int x, int y, int tw, int th, int encode)
+{
+	int row;
+
+	for (row = 0; row < th; row++)
+	{
+		const uint8_t *src = (const uint8_t *) origin + (long) (y + row) * pitch + x * 4;
+		uint32_t *shadow = rec->shadow + (size_t) (y + row) * rec->width + x;
+
+		if (encode)
+		{
+			memcpy(rec->previous + row * tw, shadow, tw * 4);
+			memcpy(rec->tile + row * tw, src, tw * 4);
+		}
+		memcpy(shadow, src, tw * 4);
+	}
+}
+
+static uint8_t *
+copy_tile(uint8_t * out, int tx, int ty, int dy)
+{
+	put16(out, tx);
+	put16(out + 2, ty);
+	out[4] = TILE_COPY;
+	put32(out + 5, 2);
+	put16(out + TILE_HEADER_SIZE, (uint16_t) (int16_t) dy);
+	return out + TILE_HEADER_SIZE + 2;
+}
+
+/* Starts a recording at path, keyframe_interval milliseconds between
+   keyframes (0 for the usual). Returns NULL if the file can't be made. */
+RDRecorder *
+record_open(const char *path, int64_t start_time, int keyframe_interval)
+{
+	RDRecorder *rec = calloc(1, sizeof(*rec));
+	uint8_t header[HEADER_SIZE];
+
+	if (rec == NULL)
+		return NULL;
+	if ((rec->file = fopen(path, "wb")) == NULL)
+	{
+		free(rec);
+		return NULL;
+	}
+
+	rec->keyframe_interval = keyframe_interval > 0 ? keyframe_interval : RECORD_KEYFRAME_INTERVAL;
+
+	memset(header, 0, sizeof(header));
+	memcpy(header, RECORD_MAGIC, 8);
+	put16(header + 8, RECORD_VERSION);
+	put16(header + 10, RECORD_TILE);
+	put64(header + 16, (uint64_t) start_time);
+	record_write(rec, header, sizeof(header));
+
+	return rec;
+}
+
+/* Records the screen at origin, rows pitch bytes apart (negative if stored
+   bottom-up), given that only the tiles set in dirty (NULL for everything)
+   changed since the last call. now_ms is any millisecond clock. Returns 0 once writing has
+   failed; the recording can still be closed, and plays up to there. */
+int
+record_update(RDRecorder * rec, const uint32_t * origin, int pitch, int width, int height,
+	      const RDTileMap * dirty, uint64_t now_ms)
+{
+	uint8_t header[FRAME_HEADER_SIZE], *out;
+	uint64_t frame_offset;
+	uint32_t time;
+	int key, tiles = 0, motion = 0, i, tx, ty;
+
+	if (rec->failed || width <= 0 || height <= 0)
+		return !rec->failed;
+
+	key = rec->key_count == 0 || rec->delta_bytes >= rec->key_bytes
+		|| now_ms - rec->last_key_ms >= (uint64_t) rec->keyframe_interval;
+	if (width != rec->width || height != rec->height)
+	{
+		if (!record_resize(rec, width, height))
+			return record_fail(rec);
+		key = 1;
+	}
+
+	if (key)
+		memset(rec->marked, 1, (size_t) rec->tiles_x * rec->tiles_y);
+	else
+	{
+		mark_tiles(rec, dirty);
+		motion = find_motion(rec, origin, pitch);
+	}
+
+	/* Copies from below come before those rows change, and from above after */
+	out = rec->payload;
+	for (i = 0; i < rec->tiles_y; i++)
+		for (ty = motion < 0 ? rec->tiles_y - 1 - i : i, tx = 0; tx < rec->tiles_x; tx++)
+		{
+			int x = tx * RECORD_TILE, y = ty * RECORD_TILE;
+			int tw = min(RECORD_TILE, width - x), th = min(RECORD_TILE, height - y);
+
+			int moved;
+
+			if (!rec->marked[ty * rec->tiles_x + tx])
+				continue;
+
+			/* Most of a scrolled window moved, so that is looked for first */
+			moved = motion != 0 && y + motion >= 0 && y + motion + th <= height
+				&& !rows_differ(rec, origin, pitch, x, y, tw, th, motion);
+			if (!key && !rows_differ(rec, origin, pitch, x, y, tw, th, 0))
+				continue;
+
+			take_tile(rec, origin, pitch, x, y, tw, th, !moved);
+			if (moved)
+				out = copy_tile(out, tx, ty, motion);
+			else
+				out = encode_tile(out, rec->tile, key ? NULL : rec->previous, tx, ty, tw, th);
+			tiles++;
+		}
+
+	if (tiles == 0)
+		return 1;
+
+	if (rec->key_count == 0)
+		rec->first_ms = now_ms;
+	time = (uint32_t) (now_ms - rec->first_ms);
+
+	memset(header, 0, sizeof(header));
+	header[0] = key ? FRAME_KEY : FRAME_DELTA;
+	put16(header + 2, width);
+	put16(header + 4, height);
+	put32(header + 8, time);
+	put32(header + 12, tiles);
+	put32(header + 16, out - rec->payload);
+
+	frame_offset = rec->offset;
+	if (!record_write(rec, header, sizeof(header)) || !record_write(rec, rec->payload, out - rec->payload))
+		return 0;
+
+	if (key)
+	{
+		if (rec->key_count == rec->key_capacity)
+		{
+			int capacity = rec->key_capacity ? rec->key_capacity * 2 : 64;
+			RDRecordKey *keys = realloc(rec->keys, capacity * sizeof(*keys));
+
+			if (keys == NULL)
+				return record_fail(rec);
+			rec->keys = keys;
+			rec->key_capacity = capacity;
+		}
+		rec->keys[rec->key_count].time = time;
+		rec->keys[rec->key_count].offset = frame_offset;
+		rec->key_count++;
+		rec->last_key_ms = now_ms;
+		rec->key_bytes = rec->offset - frame_offset;
+		rec->delta_bytes = 0;
+		rec->stats.keyframes++;
+	}
+	else
+		rec->delta_bytes += rec->offset - frame_offset;
+
+	rec->duration = time;
+	rec->stats.frames++;
+	rec->stats.tiles += tiles;
+	return 1;
+}
+
+/* Writes the index, closes the file and frees the recorder. Returns 0 if
+   anything couldn't be written. */
+int
+record_close(RDRecorder * rec)
+{
+	uint8_t buffer[KEY_SIZE];
+	uint64_t index = rec->offset;
+	int i, ok;
+
+	if (!rec->failed)
+	{
+		put32(buffer, rec->duration);
+		put32(buffer + 4, rec->key_count);
+		record_write(rec, buffer, 8);
+		for (i = 0; i < rec->key_count && !rec->failed; i++)
+		{
+			put32(buffer, rec->keys[i].time);
+			put64(buffer + 4, rec->keys[i].offset);
+			record_write(rec, buffer, KEY_SIZE);
+		}
+
+		put64(buffer, index);
+		if (!rec->failed && (fseek(rec->file, HEADER_INDEX, SEEK_SET) != 0 || fwrite(buffer, 1, 8, rec->file) != 8))
+			record_fail(rec);
+	}
+
+	ok = !rec->failed;
+	if (fclose(rec->file) != 0)
+		ok = 0;
+
+	free(rec->shadow);
+	free(rec->marked);
+	free(rec->payload);
+	free(rec->keys);
+	free(rec);
+	return ok;
+}
+
+
+/* Playback */
+
+static int
+rle_decode(const uint8_t * in, size_t length, uint32_t * p, int width, int n)
+{
+	const uint8_t *end = in + length;
+	int i = 0, op, count;
+	uint32_t pixel;
+
+	while (i < n)
+	{
+		if (in >= end)
+			return 0;
+		op = *in++;
+		count = (op & RLE_COUNT) + 1;
+		if (count > n - i)
+			return 0;
+
+		switch (op & RLE_OP)
+		{
+			case RLE_LITERAL:
+				if (end - in < count * 3)
+					return 0;
+				for (; count > 0; count--, in += 3)
+					p[i++] = get_pixel(in);
+				break;
+
+			case RLE_UNCHANGED:
+				i += count;
+				break;
+
+			case RLE_RUN:
+				if (end - in < 3)
+					return 0;
+				pixel = get_pixel(in);
+				in += 3;
+				while (count--)
+					p[i++] = pixel;
+				break;
+
+			default:
+				if (i < width)
+					return 0;
+				for (; count > 0; count--, i++)
+					p[i] = p[i - width];
+				break;
+		}
+	}
+
+	return in == end;
+}
+
+static int
+playback_goto(RDPlayback * pb, uint64_t offset)
+{
+	if (fseeko(pb->file, (off_t) offset, SEEK_SET) != 0)
+		return 0;
+	pb->position = offset;
+	return 1;
+}
+
+/* 1 if a whole header was read, 0 at the end, -1 if it makes no sense */
+static int
+read_frame_header(RDPlayback * pb, RDFrameHeader * f)
+{
+	uint8_t header[FRAME_HEADER_SIZE];
+
+	if (pb->position + FRAME_HEADER_SIZE > pb->end || fread(header, 1, FRAME_HEADER_SIZE, pb->file) != FRAME_HEADER_SIZE)
+		return 0;
+
+	f->type = header[0];
+	f->width = get16(header + 2);
+	f->height = get16(header + 4);
+	f->time = get32(header + 8);
+	f->tiles = get32(header + 12);
+	f->length = get32(header + 16);
+
+	if ((f->type != FRAME_KEY && f->type != FRAME_DELTA) || f->width == 0 || f->height == 0)
+		return -1;
+	return 1;
+}
+
+/* Walks the frames of a recording that was never closed, for its keyframes
+   and the end of the last whole frame */
+static int
+playback_scan(RDPlayback * pb)
+{
+	RDFrameHeader f;
+	int capacity = 0;
+
+	if (fseeko(pb->file, 0, SEEK_END) != 0)
+		return 0;
+	pb->end = (uint64_t) ftello(pb->file);
+	if (!playback_goto(pb, HEADER_SIZE))
+		return 0;
+
+	while (read_frame_header(pb, &f) > 0)
+	{
+		uint64_t next = pb->position + FRAME_HEADER_SIZE + f.length;
+
+		/* A frame cut short isn't whole */
+		if (next > pb->end || !playback_goto(pb, next))
+			break;
+
+		if (f.type == FRAME_KEY)
+		{
+			if (pb->key_count == capacity)
+			{
+				RDRecordKey *keys = realloc(pb->keys, (capacity = capacity ? capacity * 2 : 64) * sizeof(*keys));
+
+				if (keys == NULL)
+					return 0;
+				pb->keys = keys;
+			}
+			pb->keys[pb->key_count].time = f.time;
+			pb->keys[pb->key_count].offset = next - f.length - FRAME_HEADER_SIZE;
+			pb->key_count++;
+		}
+		pb->duration = f.time;
+	}
+
+	pb->end = pb->position;
+	return 1;
+}
+
+static int
+playback_read_index(RDPlayback * pb, uint64_t index)
+{
+	uint8_t buffer[KEY_SIZE];
+	int i;
+
+	if (!playback_goto(pb, index) || fread(buffer, 1, 8, pb->file) != 8)
+		return 0;
+
+	pb->duration = get32(buffer);
+	pb->key_count = get32(buffer + 4);
+	if (pb->key_count < 0 || (pb->keys = calloc(pb->key_count + 1, sizeof(*pb->keys))) == NULL)
+		return 0;
+
+	for (i = 0; i < pb->key_count; i++)
+	{
+		if (fread(buffer, 1, KEY_SIZE, pb->file) != KEY_SIZE)
+			return 0;
+		pb->keys[i].time = get32(buffer);
+		pb->keys[i].offset = get64(buffer + 4);
+		if (pb->keys[i].offset < HEADER_SIZE || pb->keys[i].offset >= index)
+			return 0;
+	}
+
+	pb->end = index;
+	return 1;
+}
+
+/* Opens a recording, positioned before its first frame. Returns NULL if it
+   can't be read or isn't one. */
+RDPlayback *
+playback_open(const char *path)
+{
+	RDPlayback *pb = calloc(1, sizeof(*pb));
+	uint8_t header[HEADER_SIZE];
+	uint64_t index;
+
+	if (pb == NULL)
+		return NULL;
+	if ((pb->file = fopen(path, "rb")) == NULL)
+	{
+		free(pb);
+		return NULL;
+	}
+
+	if (fread(header, 1, HEADER_SIZE, pb->file) != HEADER_SIZE || memcmp(header, RECORD_MAGIC, 8) != 0
+	    || get16(header + 8) != RECORD_VERSION || get16(header + 10) != RECORD_TILE)
+	{
+		playback_close(pb);
+		return NULL;
+	}
+
+	pb->start_time = (int64_t) get64(header + 16);
+	index = get64(header + HEADER_INDEX);
+
+	if (index == 0 || !playback_read_index(pb, index))
+	{
+		free(pb->keys);
+		pb->keys = NULL;
+		pb->key_count = 0;
+		if (!playback_scan(pb))
+		{
+			playback_close(pb);
+			return NULL;
+		}
+	}
+
+	if (!playback_goto(pb, HEADER_SIZE))
+	{
+		playback_close(pb);
+		return NULL;
+	}
+	return pb;
+}
+
+static int
+decode_frame(RDPlayback * pb, const RDFrameHeader * f)
+{
+	const uint8_t *in = pb->payload, *end = pb->payload + f->length;
+	uint32_t i;
+	int row;
+
+	for (i = 0; i < f->tiles; i++)
+	{
+		int tx, ty, x, y, tw, th, encoding;
+		uint32_t length, p;
+
+		if (end - in < TILE_HEADER_SIZE)
+			return 0;
+		tx = get16(in);
+		ty = get16(in + 2);
+		encoding = in[4];
+		length = get32(in + 5);
+		in += TILE_HEADER_SIZE;
+
+		x = tx * RECORD_TILE;
+		y = ty * RECORD_TILE;
+		if (x >= pb->width || y >= pb->height || (uint32_t) (end - in) < length)
+			return 0;
+		tw = min(RECORD_TILE, pb->width - x);
+		th = min(RECORD_TILE, pb->height - y);
+
+		if (encoding == TILE_COPY)
+		{
+			int dy = (int16_t) get16(in);
+
+			if (length != 2 || y + dy < 0 || y + dy + th > pb->height)
+				return 0;
+			in += length;
+
+			/* In the order that leaves the rows still to be copied alone */
+			for (row = dy > 0 ? 0 : th - 1; row >= 0 && row < th; row += dy > 0 ? 1 : -1)
+				memmove(pb->pixels + (size_t) (y + row) * pb->width + x,
+					pb->pixels + (size_t) (y + row + dy) * pb->width + x, tw * 4);
+			continue;
+		}
+
+		if (encoding == TILE_RLE)
+		{
+			/* Runs left unchanged keep what was there */
+			for (row = 0; row < th; row++)
+				memcpy(pb->tile + row * tw, pb->pixels + (size_t) (y + row) * pb->width + x, tw * 4);
+			if (!rle_decode(in, length, pb->tile, tw, tw * th))
+				return 0;
+		}
+		else if (encoding == TILE_RAW && length == (uint32_t) (tw * th * 3))
+		{
+			for (p = 0; p < length / 3; p++)
+				pb->tile[p] = get_pixel(in + p * 3);
+		}
+		else
+			return 0;
+		in += length;
+
+		for (row = 0; row < th; row++)
+			memcpy(pb->pixels + (size_t) (y + row) * pb->width + x, pb->tile + row * tw, tw * 4);
+	}
+
+	return in == end;
+}
+
+/* Plays the next frame into pb->pixels. Returns 1 if there was one, 0 at
+   the end of the recording, -1 if it is damaged. */
+int
+playback_next(RDPlayback * pb)
+{
+	RDFrameHeader f;
+	int result = read_frame_header(pb, &f);
+
+	if (result <= 0)
+		return result;
+	if (pb->position + FRAME_HEADER_SIZE + f.length > pb->end)
+		return 0;
+
+	if (f.length > pb->payload_size)
+	{
+		uint8_t *payload = realloc(pb->payload, f.length);
+
+		if (payload == NULL)
+			return -1;
+		pb->payload = payload;
+		pb->payload_size = f.length;
+	}
+	if (fread(pb->payload, 1, f.length, pb->file) != f.length)
+		return 0;
+	pb->position += FRAME_HEADER_SIZE + f.length;
+
+	if (f.type == FRAME_KEY && (f.width != pb->width || f.height != pb->height || pb->pixels == NULL))
+	{
+		free(pb->pixels);
+		pb->width = f.width;
+		pb->height = f.height;
+		if ((pb->pixels = calloc((size_t) f.width * f.height, 4)) == NULL)
+			return -1;
+	}
+	else if (pb->pixels == NULL || f.width != pb->width || f.height != pb->height)
+		return -1;
+
+	if (!decode_frame(pb, &f))
+		return -1;
+
+	pb->time = f.time;
+	return 1;
+}
+
+/* Plays the screen as it was at time: the last frame at or before it, or
+   the first if time is earlier. Starts from the nearest keyframe, unless
+   that would be further back than where playback already is. Returns 1,
+   0 if the recording is empty, -1 if it is damaged. */
+int
+playback_seek(RDPlayback * pb, uint32_t time)
+{
+	RDFrameHeader f;
+	int lo = 0, hi = pb->key_count - 1, result;
+
+	if (pb->key_count == 0)
+		return 0;
+
+	while (lo < hi)
+	{
+		int mid = (lo + hi + 1) / 2;
+
+		if (pb->keys[mid].time <= time)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+
+	if (pb->pixels == NULL || pb->position <= pb->keys[lo].offset || pb->time < pb->keys[lo].time || pb->time > time)
+	{
+		if (!playback_goto(pb, pb->keys[lo].offset))
+			return -1;
+		if ((result = playback_next(pb)) <= 0)
+			return -1;
+	}
+
+	for (;;)
+	{
+		uint64_t position = pb->position;
+
+		if ((result = read_frame_header(pb, &f)) < 0)
+			return -1;
+		if (result == 0 || f.time > time)
+			return playback_goto(pb, position) ? 1 : -1;
+		if (!playback_goto(pb, position) || (result = playback_next(pb)) < 0)
+			return -1;
+		if (result == 0)
+			return 1;
+	}
+}
+
+void
+playback_close(RDPlayback * pb)
+{
+	fclose(pb->file);
+	free(pb->pixels);
+	free(pb->keys);
+	free(pb->payload);
+	free(pb);
+}
@@ -0,0 +1,90 @@
+/*	Copyright (c) 2007-2012 Dorian Johnson <2011@dorianj.net>
+	
+	This file is part of CoRD.
+	CoRD is free software; you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation; either version 2 of the License, or (at your option) any later
+	version.
+
+	CoRD is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+	FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License along with
+	CoRD; if not, write to the Free Software Foundation, Inc., 51 Franklin St,
+	Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef _RECORD_H
+#define _RECORD_H
+
+/* Plain C depending only on tiles.c, so that it can be checked and
+   measured on its own (see Tools/record_bench.c, and Tools/record_play.c
+   for playing recordings back) */
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "tiles.h"
+
+#define RECORD_TILE	TILE_SIZE
+#define RECORD_KEYFRAME_INTERVAL	60000	/* longest gap between keyframes in milliseconds, unless told otherwise */
+
+typedef struct _RDRecordKey
+{
+	uint32_t time;		/* milliseconds since the first frame */
+	uint64_t offset;	/* of the keyframe in the file */
+} RDRecordKey;
+
+typedef struct _RDRecordStats
+{
+	unsigned long frames, keyframes, tiles;
+	uint64_t bytes;
+} RDRecordStats;
+
+typedef struct _RDRecorder
+{
+	FILE *file;
+	int keyframe_interval;
+	int width, height, tiles_x, tiles_y;
+	uint32_t *shadow;	/* the screen as recorded so far, top-down */
+	uint8_t *marked;	/* a flag per tile: dirty in this update */
+	uint8_t *payload;	/* scratch: the frame's tiles, encoded */
+	uint32_t tile[RECORD_TILE * RECORD_TILE];	/* scratch: one tile's pixels, gathered */
+	uint32_t previous[RECORD_TILE * RECORD_TILE];	/* scratch: and as they were recorded before */
+	uint64_t first_ms, last_key_ms;
+	uint64_t key_bytes, delta_bytes;	/* the last keyframe's size, and of the frames since */
+	uint32_t duration;
+	RDRecordKey *keys;
+	int key_count, key_capacity;
+	uint64_t offset;
+	int failed;
+	RDRecordStats stats;
+} RDRecorder;
+
+typedef struct _RDPlayback
+{
+	FILE *file;
+	int64_t start_time;	/* seconds since 1970 when recording started */
+	int width, height;
+	uint32_t *pixels;	/* the screen at time, top-down and opaque */
+	uint32_t time, duration;
+	RDRecordKey *keys;
+	int key_count;
+	uint64_t position, end;	/* of the next frame, and past the last */
+	uint8_t *payload;
+	size_t payload_size;
+	uint32_t tile[RECORD_TILE * RECORD_TILE];
+} RDPlayback;
+
+RDRecorder *record_open(const char *path, int64_t start_time, int keyframe_interval);
+int record_update(RDRecorder * rec, const uint32_t * origin, int pitch, int width, int height,
+		  const RDTileMap * dirty, uint64_t now_ms);
+int record_close(RDRecorder * rec);
+
+RDPlayback *playback_open(const char *path);
+int playback_next(RDPlayback * pb);
+int playback_seek(RDPlayback * pb, uint32_t time);
+void playback_close(RDPlayback * pb);
+
+#endif
@@ -0,0 +1,273 @@
+/*	Copyright (c) 2007-2012 Dorian Johnson <2011@dorianj.net>
+	
+	This file is part of CoRD.
+	CoRD is free software; you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation; either version 2 of the License, or (at your option) any later
+	version.
+
+	CoRD is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+	FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License along with
+	CoRD; if not, write to the Free Software Foundation, Inc., 51 Franklin St,
+	Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+/*	Purpose: Ternary raster operations.
+*/
+
+#include "rop.h"
+
+/*
+ * Any of the 256 ROP3 codes is evaluated as a tree of selects: the
+ * destination picks between pairs of truth table bits, the source between
+ * the pairs and the pattern between the halves. That is seventeen bitwise
+ * operations a pixel whatever the code, with no branches, so it vectorizes
+ * like the rest. The codes servers send nearly all the time get kernels of
+ * their own. Pixels are 32 bits in whatever order the caller keeps them,
+ * since every operation is bitwise; opaque is ORed into each result so that
+ * inverting never clears the alpha channel.
+ */
+
+#if !defined(ROP_NO_SIMD) && defined(__SSE2__)
+#include <emmintrin.h>
+typedef __m128i rop_vec;
+#define VEC_WIDTH	4
+#define VEC_LOAD(p)	_mm_loadu_si128((const __m128i *) (p))
+#define VEC_STORE(p, v)	_mm_storeu_si128((__m128i *) (p), v)
+#define VEC_SPLAT(x)	_mm_set1_epi32((int) (x))
+#define VEC_AND(a, b)	_mm_and_si128(a, b)
+#define VEC_OR(a, b)	_mm_or_si128(a, b)
+#define VEC_XOR(a, b)	_mm_xor_si128(a, b)
+#elif !defined(ROP_NO_SIMD) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#include <arm_neon.h>
+typedef uint32x4_t rop_vec;
+#define VEC_WIDTH	4
+#define VEC_LOAD(p)	vld1q_u32(p)
+#define VEC_STORE(p, v)	vst1q_u32(p, v)
+#define VEC_SPLAT(x)	vdupq_n_u32(x)
+#define VEC_AND(a, b)	vandq_u32(a, b)
+#define VEC_OR(a, b)	vorrq_u32(a, b)
+#define VEC_XOR(a, b)	veorq_u32(a, b)
+#endif
+
+/* Pixels handled per call of a row function; a multiple of the 8 pixel
+   pattern width, so one expanded pattern row serves every span */
+#define ROP_SPAN	64
+
+/* Every row function takes the same arguments; the special cases ignore
+   the ones their ROP doesn't read */
+typedef void (*rop_row) (uint32_t * d, const uint32_t * s, const uint32_t * p, int n, const uint32_t * t,
+			 uint32_t opaque);
+
+/* a where sel is 0, b where it is 1 */
+#define MUX(sel, a, b)	((a) ^ ((sel) & ((a) ^ (b))))
+
+/* The truth table spread into masks: t[i] is all ones where bit i of the
+   code is set, followed by the differences between neighbouring masks */
+static void
+rop3_table(uint8_t rop, uint32_t * t)
+{
+	int i;
+
+	for (i = 0; i < 8; i++)
+		t[i] = -(uint32_t) ((rop >> i) & 1);
+	for (i = 0; i < 4; i++)
+		t[8 + i] = t[2 * i] ^ t[2 * i + 1];
+}
+
+static uint32_t
+rop3_eval(const uint32_t * t, uint32_t p, uint32_t s, uint32_t d)
+{
+	uint32_t d0 = t[0] ^ (d & t[8]), d1 = t[2] ^ (d & t[9]);
+	uint32_t d2 = t[4] ^ (d & t[10]), d3 = t[6] ^ (d & t[11]);
+	uint32_t lo = MUX(s, d0, d1), hi = MUX(s, d2, d3);
+
+	return MUX(p, lo, hi);
+}
+
+uint32_t
+rop3_pixel(uint8_t rop, uint32_t pattern, uint32_t source, uint32_t dest)
+{
+	uint32_t t[12];
+
+	rop3_table(rop, t);
+	return rop3_eval(t, pattern, source, dest);
+}
+
+static void
+row_generic(uint32_t * d, const uint32_t * s, const uint32_t * p, int n, const uint32_t * t, uint32_t opaque)
+{
+	int i = 0;
+#ifdef VEC_WIDTH
+	rop_vec v[12], o = VEC_SPLAT(opaque);
+
+	for (i = 0; i < 12; i++)
+		v[i] = VEC_SPLAT(t[i]);
+
+	for (i = 0; i + VEC_WIDTH <= n; i += VEC_WIDTH)
+	{
+		rop_vec dv = VEC_LOAD(d + i), sv = VEC_LOAD(s + i), pv = VEC_LOAD(p + i);
+		rop_vec d0 = VEC_XOR(v[0], VEC_AND(dv, v[8])), d1 = VEC_XOR(v[2], VEC_AND(dv, v[9]));
+		rop_vec d2 = VEC_XOR(v[4], VEC_AND(dv, v[10])), d3 = VEC_XOR(v[6], VEC_AND(dv, v[11]));
+		rop_vec lo = VEC_XOR(d0, VEC_AND(sv, VEC_XOR(d0, d1)));
+		rop_vec hi = VEC_XOR(d2, VEC_AND(sv, VEC_XOR(d2, d3)));
+
+		VEC_STORE(d + i, VEC_OR(VEC_XOR(lo, VEC_AND(pv, VEC_XOR(lo, hi))), o));
+	}
+#endif
+	for (; i < n; i++)
+		d[i] = rop3_eval(t, p[i], s[i], d[i]) | opaque;
+}
+
+static void
+row_srccopy(uint32_t * d, const uint32_t * s, const uint32_t * p, int n, const uint32_t * t, uint32_t opaque)
+{
+	int i = 0;
+#ifdef VEC_WIDTH
+	rop_vec o = VEC_SPLAT(opaque);
+
+	for (; i + VEC_WIDTH <= n; i += VEC_WIDTH)
+		VEC_STORE(d + i, VEC_OR(VEC_LOAD(s + i), o));
+#endif
+	(void) p;
+	(void) t;
+	for (; i < n; i++)
+		d[i] = s[i] | opaque;
+}
+
+static void
+row_patcopy(uint32_t * d, const uint32_t * s, const uint32_t * p, int n, const uint32_t * t, uint32_t opaque)
+{
+	int i = 0;
+#ifdef VEC_WIDTH
+	rop_vec o = VEC_SPLAT(opaque);
+
+	for (; i + VEC_WIDTH <= n; i += VEC_WIDTH)
+		VEC_STORE(d + i, VEC_OR(VEC_LOAD(p + i), o));
+#endif
+	(void) s;
+	(void) t;
+	for (; i < n; i++)
+		d[i] = p[i] | opaque;
+}
+
+static void
+row_srcinvert(uint32_t * d, const uint32_t * s, const uint32_t * p, int n, const uint32_t * t, uint32_t opaque)
+{
+	int i = 0;
+#ifdef VEC_WIDTH
+	rop_vec o = VEC_SPLAT(opaque);
+
+	for (; i + VEC_WIDTH <= n; i += VEC_WIDTH)
+		VEC_STORE(d + i, VEC_OR(VEC_XOR(VEC_LOAD(d + i), VEC_LOAD(s + i)), o));
+#endif
+	(void) p;
+	(void) t;
+	for (; i < n; i++)
+		d[i] = (d[i] ^ s[i]) | opaque;
+}
+
+static void
+row_srcand(uint32_t * d, const uint32_t * s, const uint32_t * p, int n, const uint32_t * t, uint32_t opaque)
+{
+	int i = 0;
+#ifdef VEC_WIDTH
+	rop_vec o = VEC_SPLAT(opaque);
+
+	for (; i + VEC_WIDTH <= n; i += VEC_WIDTH)
+		VEC_STORE(d + i, VEC_OR(VEC_AND(VEC_LOAD(d + i), VEC_LOAD(s + i)), o));
+#endif
+	(void) p;
+	(void) t;
+	for (; i < n; i++)
+		d[i] = (d[i] & s[i]) | opaque;
+}
+
+static void
+row_dstinvert(uint32_t * d, const uint32_t * s, const uint32_t * p, int n, const uint32_t * t, uint32_t opaque)
+{
+	int i = 0;
+#ifdef VEC_WIDTH
+	rop_vec o = VEC_SPLAT(opaque), ones = VEC_SPLAT(0xffffffff);
+
+	for (; i + VEC_WIDTH <= n; i += VEC_WIDTH)
+		VEC_STORE(d + i, VEC_OR(VEC_XOR(VEC_LOAD(d + i), ones), o));
+#endif
+	(void) s;
+	(void) p;
+	(void) t;
+	for (; i < n; i++)
+		d[i] = ~d[i] | opaque;
+}
+
+/* Applies rop to a cx x cy block of dest. The pitches are in bytes and may
+   be negative for bottom-up buffers. pattern is an 8x8 tile whose column
+   pattern_x and row pattern_y line up with the first destination pixel;
+   source and pattern may be NULL when rop does not use them. source must
+   not overlap dest. */
+void
+rop3_blt(uint8_t rop, uint32_t * dest, int dest_pitch, const uint32_t * source, int source_pitch,
+	 const uint32_t * pattern, int pattern_x, int pattern_y, int cx, int cy, uint32_t opaque)
+{
+	static const uint32_t none[ROP_SPAN];
+	uint32_t spans[8][ROP_SPAN], t[12];
+	const uint32_t *s, *p;
+	rop_row row;
+	int x, y, i, n;
+
+	if (cx <= 0 || cy <= 0)
+		return;
+
+	rop3_table(rop, t);
+	switch (rop)
+	{
+		case ROP3_SRCCOPY:
+			row = row_srccopy;
+			break;
+		case ROP3_PATCOPY:
+			row = row_patcopy;
+			break;
+		case ROP3_SRCINVERT:
+			row = row_srcinvert;
+			break;
+		case ROP3_SRCAND:
+			row = row_srcand;
+			break;
+		case ROP3_DSTINVERT:
+			row = row_dstinvert;
+			break;
+		default:
+			row = row_generic;
+			break;
+	}
+
+	if (!ROP3_USES_SRC(rop))
+		source = NULL;
+	if (!ROP3_USES_PAT(rop))
+		pattern = NULL;
+
+	/* The eight pattern rows, each repeated across a span */
+	if (pattern != NULL)
+		for (y = 0; y < 8; y++)
+			for (i = 0; i < ROP_SPAN; i++)
+				spans[y][i] = pattern[y * 8 + ((pattern_x + i) & 7)];
+
+	for (y = 0; y < cy; y++)
+	{
+		p = pattern ? spans[(pattern_y + y) & 7] : none;
+
+		for (x = 0; x < cx; x += n)
+		{
+			n = cx - x < ROP_SPAN ? cx - x : ROP_SPAN;
+			s = source ? source + x : none;
+			row(dest + x, s, p, n, t, opaque);
+		}
+
+		dest = (uint32_t *) ((uint8_t *) dest + dest_pitch);
+		if (source != NULL)
+			source = (const uint32_t *) ((const uint8_t *) source + source_pitch);
+	}
+}
@@ -0,0 +1,60 @@
+/*	Copyright (c) 2007-2012 Dorian Johnson <2011@dorianj.net>
+	
+	This file is part of CoRD.
+	CoRD is free software; you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation; either version 2 of the License, or (at your option) any later
+	version.
+
+	CoRD is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+	FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License along with
+	CoRD; if not, write to the Free Software Foundation, Inc., 51 Franklin St,
+	Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef _ROP_H
+#define _ROP_H
+
+/* Plain C with no dependencies, so that it can be checked and measured on
+   its own (see Tools/rop_bench.c) */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* A ROP3 code is the truth table of a bitwise function of pattern, source
+   and destination: bit (P << 2 | S << 1 | D) holds the result for those
+   inputs. The codes below are the ones with GDI names. */
+#define ROP3_BLACKNESS	0x00
+#define ROP3_NOTSRCERASE	0x11
+#define ROP3_NOTSRCCOPY	0x33
+#define ROP3_SRCERASE	0x44
+#define ROP3_DSTINVERT	0x55
+#define ROP3_PATINVERT	0x5a
+#define ROP3_SRCINVERT	0x66
+#define ROP3_SRCAND	0x88
+#define ROP3_MERGEPAINT	0xbb
+#define ROP3_MERGECOPY	0xc0
+#define ROP3_SRCCOPY	0xcc
+#define ROP3_SRCPAINT	0xee
+#define ROP3_PATCOPY	0xf0
+#define ROP3_PATPAINT	0xfb
+#define ROP3_WHITENESS	0xff
+
+/* Whether the result depends on each operand at all */
+#define ROP3_USES_PAT(rop)	((((rop) >> 4) ^ (rop)) & 0x0f)
+#define ROP3_USES_SRC(rop)	((((rop) >> 2) ^ (rop)) & 0x33)
+#define ROP3_USES_DST(rop)	((((rop) >> 1) ^ (rop)) & 0x55)
+
+/* The ROP3 that applies a ROP2 (GXcopy and friends) to source and
+   destination, or to pattern and destination */
+#define ROP3_FROM_ROP2_S(rop2)	(((rop2) & 0x0f) * 0x11)
+#define ROP3_FROM_ROP2_P(rop2)	((((rop2) & 0x0c) * 0x14) | (((rop2) & 0x03) * 0x05))
+
+uint32_t rop3_pixel(uint8_t rop, uint32_t pattern, uint32_t source, uint32_t dest);
+void rop3_blt(uint8_t rop, uint32_t * dest, int dest_pitch, const uint32_t * source, int source_pitch,
+	      const uint32_t * pattern, int pattern_x, int pattern_y, int cx, int cy, uint32_t opaque);
+
+#endif
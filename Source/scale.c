@@ -0,0 +1,370 @@
+/*	Copyright (c) 2007-2012 Dorian Johnson <2011@dorianj.net>
+	
+	This file is part of CoRD.
+	CoRD is free software; you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation; either version 2 of the License, or (at your option) any later
+	version.
+
+	CoRD is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+	FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License along with
+	CoRD; if not, write to the Free Software Foundation, Inc., 51 Franklin St,
+	Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+/*	Purpose: Framebuffer downscaling.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "scale.h"
+
+/*
+ * Thumbnails of a session are made straight from its framebuffer, in two
+ * passes that share one set of tables. For each destination row, the
+ * source rows it covers are summed with their weights, channel by channel,
+ * into a row of 8.6 fixed point values; then each destination pixel sums
+ * the columns it covers from that row the same way. Area averaging weights
+ * each source pixel by how much of the destination pixel it covers;
+ * bilinear filtering gives the two pixels either side of the destination
+ * pixel's centre weights by distance, which is cheaper but aliases when
+ * shrinking by much. Weights are 14 bit, so both passes fit 16 bit
+ * multiplies into 32 bit sums, which SSE2 does eight at a time with
+ * _mm_madd_epi16 and NEON four at a time.
+ *
+ * A destination pixel only depends on the source pixels in its taps, so
+ * when part of the screen changes only the destination pixels whose taps
+ * reach into it are made again.
+ */
+
+#if !defined(SCALE_NO_SIMD) && defined(__SSE2__)
+#include <emmintrin.h>
+#define SCALE_SSE2
+#elif !defined(SCALE_NO_SIMD) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#include <arm_neon.h>
+#define SCALE_NEON
+#endif
+
+#define SCALE_ONE	(1 << SCALE_WEIGHT_BITS)
+
+/* Each destination pixel covers s / d source pixels; in units of 1 / d,
+   destination pixel i spans [i * s, (i + 1) * s) and source pixel j spans
+   [j * d, (j + 1) * d) */
+static int
+area_taps(RDScaleTaps * taps, int16_t * weights, int s, int d)
+{
+	int i, j, n = 0;
+
+	for (i = 0; i < d; i++)
+	{
+		int64_t lo = (int64_t) i * s, hi = lo + s;
+		int sum = 0, largest = n;
+
+		taps[i].first = lo / d;
+		taps[i].count = (hi - 1) / d - taps[i].first + 1;
+		taps[i].weights = n;
+
+		for (j = taps[i].first; j < taps[i].first + taps[i].count; j++, n++)
+		{
+			int64_t left = (int64_t) j * d > lo ? (int64_t) j * d : lo;
+			int64_t right = (int64_t) (j + 1) * d < hi ? (int64_t) (j + 1) * d : hi;
+
+			weights[n] = ((right - left) * SCALE_ONE + s / 2) / s;
+			sum += weights[n];
+			if (weights[n] > weights[largest])
+				largest = n;
+		}
+
+		/* Rounding mustn't brighten or darken anything */
+		weights[largest] += SCALE_ONE - sum;
+	}
+
+	return n;
+}
+
+/* Destination pixel i's centre is at ((2i + 1) * s / d - 1) / 2 in source pixels */
+static int
+bilinear_taps(RDScaleTaps * taps, int16_t * weights, int s, int d)
+{
+	int i, n = 0;
+
+	for (i = 0; i < d; i++)
+	{
+		int64_t num = ((int64_t) (2 * i + 1) * s - d) * SCALE_ONE, pos;
+		int first, frac;
+
+		pos = num >= 0 ? num / (2 * d) : -((-num + 2 * d - 1) / (2 * d));
+		first = pos >= 0 ? pos / SCALE_ONE : -1;
+		frac = pos - (int64_t) first * SCALE_ONE;
+
+		if (first < 0)
+		{
+			first = 0;
+			frac = 0;
+		}
+		if (first >= s - 1)
+		{
+			first = s - 1;
+			frac = 0;
+		}
+
+		taps[i].first = first;
+		taps[i].weights = n;
+		if (frac == 0)
+		{
+			taps[i].count = 1;
+			weights[n++] = SCALE_ONE;
+		}
+		else
+		{
+			taps[i].count = 2;
+			weights[n++] = SCALE_ONE - frac;
+			weights[n++] = frac;
+		}
+	}
+
+	return n;
+}
+
+/* Prepares to scale an sw x sh framebuffer to dw x dh. Returns 0 if out of memory. */
+int
+scale_init(RDScaler * sc, int filter, int sw, int sh, int dw, int dh)
+{
+	memset(sc, 0, sizeof(*sc));
+	if (sw <= 0 || sh <= 0 || dw <= 0 || dh <= 0)
+		return 0;
+
+	sc->filter = filter;
+	sc->sw = sw;
+	sc->sh = sh;
+	sc->dw = dw;
+	sc->dh = dh;
+
+	sc->xtaps = malloc(dw * sizeof(RDScaleTaps));
+	sc->ytaps = malloc(dh * sizeof(RDScaleTaps));
+	sc->xweights = malloc((sw + 2 * dw) * sizeof(int16_t));
+	sc->yweights = malloc((sh + 2 * dh) * sizeof(int16_t));
+	sc->spans = malloc(2 * dw * sizeof(int));
+	sc->row = malloc((sw * 4 + 4) * sizeof(int16_t));
+
+	if (!sc->xtaps || !sc->ytaps || !sc->xweights || !sc->yweights || !sc->spans || !sc->row)
+	{
+		scale_destroy(sc);
+		return 0;
+	}
+
+	if (filter == SCALE_BILINEAR)
+	{
+		bilinear_taps(sc->xtaps, sc->xweights, sw, dw);
+		bilinear_taps(sc->ytaps, sc->yweights, sh, dh);
+	}
+	else
+	{
+		area_taps(sc->xtaps, sc->xweights, sw, dw);
+		area_taps(sc->ytaps, sc->yweights, sh, dh);
+	}
+
+	return 1;
+}
+
+void
+scale_destroy(RDScaler * sc)
+{
+	free(sc->xtaps);
+	free(sc->ytaps);
+	free(sc->xweights);
+	free(sc->yweights);
+	free(sc->spans);
+	free(sc->row);
+	memset(sc, 0, sizeof(*sc));
+}
+
+/* The destination pixels whose taps reach into source pixels [*pos, *pos + *len) */
+static void
+dest_range(const RDScaleTaps * taps, int s, int d, int *pos, int *len)
+{
+	int lo = *pos < 0 ? 0 : *pos, hi = *pos + *len > s ? s : *pos + *len, first = 0, last = d;
+
+	while (first < d && taps[first].first + taps[first].count <= lo)
+		first++;
+	while (last > first && taps[last - 1].first >= hi)
+		last--;
+
+	*pos = first;
+	*len = hi > lo ? last - first : 0;
+}
+
+/* Turns a changed source rectangle into the destination rectangle that changes with it */
+void
+scale_dest_rect(const RDScaler * sc, int *x, int *y, int *cx, int *cy)
+{
+	dest_range(sc->xtaps, sc->sw, sc->dw, x, cx);
+	dest_range(sc->ytaps, sc->sh, sc->dh, y, cy);
+}
+
+/* Sums source columns [col0, col1) of the rows in taps into sc->row, which starts at column c0 */
+static void
+scale_vertical(RDScaler * sc, const uint8_t * src, int src_pitch, const RDScaleTaps * taps, int col0, int col1, int c0)
+{
+	const int16_t *w = sc->yweights + taps->weights;
+	int channels = (col1 - col0) * 4, k, c = 0;
+	int16_t *row = sc->row + (col0 - c0) * 4;
+
+	src += (long) taps->first * src_pitch + col0 * 4;
+
+#if defined(SCALE_SSE2)
+	/* Sixteen channels at a time down every row, two rows at a time:
+	   interleaving them lets one madd weight and add both */
+	for (; c + 8 <= channels; c += 16)
+	{
+		__m128i s0 = _mm_setzero_si128(), s1 = s0, s2 = s0, s3 = s0, zero = s0, round = _mm_set1_epi32(128);
+		int whole = c + 16 <= channels;
+
+		for (k = 0; k < taps->count; k += 2)
+		{
+			const uint8_t *a = src + (long) k * src_pitch + c;
+			const uint8_t *b = k + 1 < taps->count ? a + src_pitch : a;
+			int wb = k + 1 < taps->count ? w[k + 1] : 0;
+			__m128i weights = _mm_set1_epi32((wb << 16) | (uint16_t) w[k]);
+			__m128i va = whole ? _mm_loadu_si128((const __m128i *) a) : _mm_loadl_epi64((const __m128i *) a);
+			__m128i vb = whole ? _mm_loadu_si128((const __m128i *) b) : _mm_loadl_epi64((const __m128i *) b);
+			__m128i alo = _mm_unpacklo_epi8(va, zero), ahi = _mm_unpackhi_epi8(va, zero);
+			__m128i blo = _mm_unpacklo_epi8(vb, zero), bhi = _mm_unpackhi_epi8(vb, zero);
+
+			s0 = _mm_add_epi32(s0, _mm_madd_epi16(_mm_unpacklo_epi16(alo, blo), weights));
+			s1 = _mm_add_epi32(s1, _mm_madd_epi16(_mm_unpackhi_epi16(alo, blo), weights));
+			s2 = _mm_add_epi32(s2, _mm_madd_epi16(_mm_unpacklo_epi16(ahi, bhi), weights));
+			s3 = _mm_add_epi32(s3, _mm_madd_epi16(_mm_unpackhi_epi16(ahi, bhi), weights));
+		}
+
+		s0 = _mm_srai_epi32(_mm_add_epi32(s0, round), 8);
+		s1 = _mm_srai_epi32(_mm_add_epi32(s1, round), 8);
+		_mm_storeu_si128((__m128i *) (row + c), _mm_packs_epi32(s0, s1));
+		if (!whole)
+		{
+			c += 8;
+			break;
+		}
+
+		s2 = _mm_srai_epi32(_mm_add_epi32(s2, round), 8);
+		s3 = _mm_srai_epi32(_mm_add_epi32(s3, round), 8);
+		_mm_storeu_si128((__m128i *) (row + c + 8), _mm_packs_epi32(s2, s3));
+	}
+#elif defined(SCALE_NEON)
+	for (; c + 8 <= channels; c += 8)
+	{
+		uint32x4_t s0 = vdupq_n_u32(128), s1 = s0;
+
+		for (k = 0; k < taps->count; k++)
+		{
+			uint16x8_t v = vmovl_u8(vld1_u8(src + (long) k * src_pitch + c));
+
+			s0 = vmlal_n_u16(s0, vget_low_u16(v), w[k]);
+			s1 = vmlal_n_u16(s1, vget_high_u16(v), w[k]);
+		}
+
+		vst1q_u16((uint16_t *) (row + c), vcombine_u16(vshrn_n_u32(s0, 8), vshrn_n_u32(s1, 8)));
+	}
+#endif
+	for (; c < channels; c++)
+	{
+		int32_t sum = 128;
+
+		for (k = 0; k < taps->count; k++)
+			sum += src[(long) k * src_pitch + c] * w[k];
+		row[c] = sum >> 8;
+	}
+}
+
+/* Makes destination pixels [x0, x1) of one row from sc->row, which starts at source column c0 */
+static void
+scale_horizontal(RDScaler * sc, uint32_t * dst, int x0, int x1, int c0)
+{
+	int i, k;
+
+	for (i = x0; i < x1; i++)
+	{
+		const RDScaleTaps *taps = &sc->xtaps[i];
+		const int16_t *w = sc->xweights + taps->weights;
+		const int16_t *p = sc->row + (taps->first - c0) * 4;
+#if defined(SCALE_SSE2)
+		__m128i sum = _mm_setzero_si128();
+
+		for (k = 0; k + 2 <= taps->count; k += 2)
+			sum = _mm_add_epi32(sum, _mm_madd_epi16(_mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i *) (p + k * 4)),
+										   _mm_loadl_epi64((const __m128i *) (p + k * 4 + 4))),
+							       _mm_set1_epi32((w[k + 1] << 16) | (uint16_t) w[k])));
+		if (k < taps->count)
+			sum = _mm_add_epi32(sum, _mm_madd_epi16(_mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i *) (p + k * 4)),
+									   _mm_setzero_si128()), _mm_set1_epi32((uint16_t) w[k])));
+
+		sum = _mm_srai_epi32(_mm_add_epi32(sum, _mm_set1_epi32(1 << 19)), 20);
+		sum = _mm_packs_epi32(sum, sum);
+		dst[i] = _mm_cvtsi128_si32(_mm_packus_epi16(sum, sum));
+#elif defined(SCALE_NEON)
+		uint32x4_t sum = vdupq_n_u32(1 << 19);
+		uint16x4_t narrow;
+
+		for (k = 0; k < taps->count; k++)
+			sum = vmlal_n_u16(sum, vld1_u16((const uint16_t *) (p + k * 4)), w[k]);
+
+		narrow = vmovn_u32(vshrq_n_u32(sum, 20));
+		vst1_lane_u32(&dst[i], vreinterpret_u32_u8(vqmovn_u16(vcombine_u16(narrow, narrow))), 0);
+#else
+		uint8_t *out = (uint8_t *) & dst[i];
+		int c;
+
+		for (c = 0; c < 4; c++)
+		{
+			int32_t sum = 1 << 19;
+
+			for (k = 0; k < taps->count; k++)
+				sum += p[k * 4 + c] * w[k];
+			sum >>= 20;
+			out[c] = sum > 255 ? 255 : sum;
+		}
+#endif
+	}
+}
+
+/* Remakes the destination pixels that depend on source rectangle x, y, cx, cy.
+   src and dst are pixel 0, 0 of each; pitches are the byte distance from
+   one row to the next, negative for bottom-up buffers. */
+void
+scale_rect(RDScaler * sc, const uint32_t * src, int src_pitch, uint32_t * dst, int dst_pitch, int x, int y, int cx, int cy)
+{
+	int c0, row, i, n, spans = 0;
+
+	scale_dest_rect(sc, &x, &y, &cx, &cy);
+	if (cx <= 0 || cy <= 0)
+		return;
+
+	/* The source columns the destination columns read, in runs: one for
+	   area averaging, but bilinear filtering shrinking by much skips most */
+	c0 = sc->xtaps[x].first;
+	for (i = x; i < x + cx; i++)
+	{
+		int first = sc->xtaps[i].first, end = first + sc->xtaps[i].count;
+
+		if (spans > 0 && first <= sc->spans[spans - 1])
+		{
+			if (end > sc->spans[spans - 1])
+				sc->spans[spans - 1] = end;
+			continue;
+		}
+
+		sc->spans[spans++] = first;
+		sc->spans[spans++] = end;
+	}
+
+	for (row = y; row < y + cy; row++)
+	{
+		for (n = 0; n < spans; n += 2)
+			scale_vertical(sc, (const uint8_t *) src, src_pitch, &sc->ytaps[row], sc->spans[n], sc->spans[n + 1], c0);
+		scale_horizontal(sc, (uint32_t *) ((uint8_t *) dst + (long) row * dst_pitch), x, x + cx, c0);
+	}
+}
@@ -0,0 +1,54 @@
+/*	Copyright (c) 2007-2012 Dorian Johnson <2011@dorianj.net>
+	
+	This file is part of CoRD.
+	CoRD is free software; you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation; either version 2 of the License, or (at your option) any later
+	version.
+
+	CoRD is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+	FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License along with
+	CoRD; if not, write to the Free Software Foundation, Inc., 51 Franklin St,
+	Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef _SCALE_H
+#define _SCALE_H
+
+/* Plain C with no dependencies, so that it can be checked and measured on
+   its own (see Tools/scale_bench.c) */
+
+#include <stdint.h>
+
+#define SCALE_AREA	0	/* average of everything each pixel covers */
+#define SCALE_BILINEAR	1	/* the four pixels around each pixel's centre */
+
+#define SCALE_WEIGHT_BITS	14	/* a pixel's weights add up to 1 << SCALE_WEIGHT_BITS */
+
+/* The source pixels one destination row or column is made from */
+typedef struct _RDScaleTaps
+{
+	int first, count;
+	int weights;		/* index of the first weight */
+} RDScaleTaps;
+
+typedef struct _RDScaler
+{
+	int filter;
+	int sw, sh, dw, dh;
+	RDScaleTaps *xtaps, *ytaps;	/* dw and dh entries */
+	int16_t *xweights, *yweights;
+	int *spans;		/* scratch: runs of source columns to sum */
+	int16_t *row;		/* scratch: source channels weighted vertically, in 8.6 fixed point */
+} RDScaler;
+
+int scale_init(RDScaler * sc, int filter, int sw, int sh, int dw, int dh);
+void scale_destroy(RDScaler * sc);
+void scale_dest_rect(const RDScaler * sc, int *x, int *y, int *cx, int *cy);
+void scale_rect(RDScaler * sc, const uint32_t * src, int src_pitch, uint32_t * dst, int dst_pitch, int x, int y, int cx,
+		int cy);
+
+#endif
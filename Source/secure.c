@@ -155,9 +155,10 @@ buf_out_uint32(uint8 * buffer, uint32 value)
 	buffer[3] = (value >> 24) & 0xff;
 }
 
-/* Generate a MAC hash (5.2.3.1), using a combination of SHA1 and MD5 */
-void
-sec_sign(uint8 * signature, int siglen, uint8 * session_key, int keylen, uint8 * data, int datalen)
+/* Generate a signature hash over data followed by a separately stored tail */
+static void
+sec_sign_tail(uint8 * signature, int siglen, uint8 * session_key, int keylen, uint8 * data, int datalen,
+	      uint8 * tail, int taillen)
 {
 	uint8 shasig[20];
 	uint8 md5sig[16];
@@ -165,13 +166,15 @@ sec_sign(uint8 * signature, int siglen, uint8 * session_key, int keylen, uint8 *
 	SHA_CTX sha;
 	MD5_CTX md5;
 
-	buf_out_uint32(lenhdr, datalen);
+	buf_out_uint32(lenhdr, datalen + taillen);
 
 	SHA1_Init(&sha);
 	SHA1_Update(&sha, session_key, keylen);
 	SHA1_Update(&sha, pad_54, 40);
 	SHA1_Update(&sha, lenhdr, 4);
 	SHA1_Update(&sha, data, datalen);
+	if (taillen > 0)
+		SHA1_Update(&sha, tail, taillen);
 	SHA1_Final(shasig, &sha);
 
 	MD5_Init(&md5);
@@ -183,6 +186,13 @@ sec_sign(uint8 * signature, int siglen, uint8 * session_key, int keylen, uint8 *
 	memcpy(signature, md5sig, siglen);
 }
 
+/* Generate a MAC hash (5.2.3.1), using a combination of SHA1 and MD5 */
+void
+sec_sign(uint8 * signature, int siglen, uint8 * session_key, int keylen, uint8 * data, int datalen)
+{
+	sec_sign_tail(signature, siglen, session_key, keylen, data, datalen, NULL, 0);
+}
+
 /* Update an encryption key */
 static void
 sec_update(RDConnectionRef conn, uint8 * key, uint8 * update_key)
@@ -211,9 +221,9 @@ sec_update(RDConnectionRef conn, uint8 * key, uint8 * update_key)
 		sec_make_40bit(key);
 }
 
-/* Encrypt data using RC4 */
+/* Encrypt data using RC4, along with the tail that follows it on the wire */
 static void
-sec_encrypt(RDConnectionRef conn, uint8 * data, int length)
+sec_encrypt_tail(RDConnectionRef conn, uint8 * data, int length, uint8 * tail, int taillen)
 {
 	if (conn->secEncryptUseCount == 4096)
 	{
@@ -223,9 +233,18 @@ sec_encrypt(RDConnectionRef conn, uint8 * data, int length)
 	}
 
 	RC4(&conn->rc4EncryptKey, length, data, data);
+	if (taillen > 0)
+		RC4(&conn->rc4EncryptKey, taillen, tail, tail);
 	conn->secEncryptUseCount++;
 }
 
+/* Encrypt data using RC4 */
+void
+sec_encrypt(RDConnectionRef conn, uint8 * data, int length)
+{
+	sec_encrypt_tail(conn, data, length, NULL, 0);
+}
+
 /* Decrypt data using RC4 */
 void
 sec_decrypt(RDConnectionRef conn, uint8 * data, int length)
@@ -296,15 +315,22 @@ sec_rsa_encrypt(uint8 * out, uint8 * in, int len, uint32 modulus_size, uint8 * m
 /* Initialise secure transport packet */
 RDStreamRef
 sec_init(RDConnectionRef conn, uint32 flags, int maxlen)
+{
+	return sec_init_stream(conn, &conn->outStream, flags, maxlen);
+}
+
+/* Like sec_init, in a stream the caller owns rather than the connection's
+   output stream */
+RDStreamRef
+sec_init_stream(RDConnectionRef conn, RDStreamRef s, uint32 flags, int maxlen)
 {
 	int hdrlen;
-	RDStreamRef s;
 
 	if (!conn->licenseIssued)
 		hdrlen = (flags & SEC_ENCRYPT) ? 12 : 4;
 	else
 		hdrlen = (flags & SEC_ENCRYPT) ? 12 : 0;
-	s = mcs_init(conn, maxlen + hdrlen);
+	s = mcs_init_stream(s, maxlen + hdrlen);
 	s_push_layer(s, sec_hdr, hdrlen);
 
 	return s;
@@ -330,8 +356,8 @@ sec_send_to_channel(RDConnectionRef conn, RDStreamRef s, uint32 flags, uint16 ch
 		hexdump(s->p + 8, datalen);
 #endif
 
-		sec_sign(s->p, 8, conn->secSignKey, conn->rc4KeyLen, s->p + 8, datalen);
-		sec_encrypt(conn, s->p + 8, datalen);
+		sec_sign_tail(s->p, 8, conn->secSignKey, conn->rc4KeyLen, s->p + 8, datalen, s->tail, s->tail_len);
+		sec_encrypt_tail(conn, s->p + 8, datalen, s->tail, s->tail_len);
 	}
 
 	mcs_send_to_channel(conn, s, channel);
@@ -899,6 +925,7 @@ sec_connect(RDConnectionRef conn, const char *server, char *username, RD_BOOL re
 	if (conn->useEncryption)
 		sec_establish_key(conn);
 	xfree(mcs_data.data);
+	timing_mark(conn, CONNECT_PHASE_SECURITY);
 	return True;
 }
 
@@ -26,6 +26,8 @@
 #import <netinet/tcp.h>  /* TCP_NODELAY */
 #import <arpa/inet.h>    /* inet_addr */
 #import <errno.h>        /* errno */
+#import <sys/uio.h>      /* writev */
+#import <poll.h>         /* poll */
 #import "rdesktop.h"
 
 
@@ -48,22 +50,130 @@
 RDStreamRef
 tcp_init(RDConnectionRef conn, uint32 maxlen)
 {
-	if (maxlen > conn->outStream.size)
+	return tcp_init_stream(&conn->outStream, maxlen);
+}
+
+/* Initialise s, a stream the caller owns, for a packet of up to maxlen bytes */
+RDStreamRef
+tcp_init_stream(RDStreamRef s, uint32 maxlen)
+{
+	if (maxlen > s->size)
+	{
+		s->data = (uint8 *) xrealloc(s->data, maxlen);
+		s->size = maxlen;
+	}
+
+	s->p = s->data;
+	s->end = s->data + s->size;
+	s_set_tail(s, NULL, 0);
+	return s;
+}
+
+/* Write all of iov to the socket, waiting for space as needed */
+static RD_BOOL
+tcp_writev(RDConnectionRef conn, struct iovec *iov, int iovcnt)
+{
+	struct pollfd pfd;
+	ssize_t sent;
+
+	while (iovcnt > 0)
+	{
+		sent = writev(conn->tcpSocket, iov, iovcnt);
+		if (sent < 0)
+		{
+			if (errno != EAGAIN && errno != EINTR)
+			{
+				error("send: %s\n", strerror(errno));
+				return False;
+			}
+
+			pfd.fd = conn->tcpSocket;
+			pfd.events = POLLOUT;
+			poll(&pfd, 1, -1);
+			continue;
+		}
+
+		while (iovcnt > 0 && sent >= (ssize_t) iov->iov_len)
+		{
+			sent -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+
+		if (iovcnt > 0)
+		{
+			iov->iov_base = (uint8 *) iov->iov_base + sent;
+			iov->iov_len -= sent;
+		}
+	}
+
+	return True;
+}
+
+/* Hold back a PDU until tcp_end_batch() */
+static void
+tcp_batch_append(RDConnectionRef conn, uint8 * data, uint32 length)
+{
+	RDStreamRef b = &conn->sendBatch;
+	uint32 used = b->end - b->data;
+
+	if (length == 0)
+		return;
+
+	if (used + length > b->size)
 	{
-		conn->outStream.data = (uint8 *) xrealloc(conn->outStream.data, maxlen);
-		conn->outStream.size = maxlen;
+		b->size = MAX(used + length, 2 * b->size);
+		b->data = (uint8 *) xrealloc(b->data, b->size);
+		b->end = b->data + used;
 	}
 
-	conn->outStream.p = conn->outStream.data;
-	conn->outStream.end = conn->outStream.data + conn->outStream.size;
-	return &conn->outStream;
+	memcpy(b->end, data, length);
+	b->end += length;
 }
 
-/* Send TCP transport data packet */
+/* Collect the PDUs sent from now on and write them together in
+ * tcp_end_batch(), for sequences that need no reply in between */
+void
+tcp_begin_batch(RDConnectionRef conn)
+{
+	conn->sendBatch.p = conn->sendBatch.end = conn->sendBatch.data;
+	s_set_tail(&conn->sendBatch, NULL, 0);
+	conn->batchingSends = True;
+}
+
+/* Write everything collected since tcp_begin_batch() */
+void
+tcp_end_batch(RDConnectionRef conn)
+{
+	conn->batchingSends = False;
+	if (conn->sendBatch.end > conn->sendBatch.data)
+		tcp_send(conn, &conn->sendBatch);
+}
+
+/* Send TCP transport data packet. A tail set with s_set_tail() is written
+ * together with the headers in one writev, without being copied. */
 void
 tcp_send(RDConnectionRef conn, RDStreamRef s)
 {	
 	NSOutputStream *os = conn->outputStream;
+	struct iovec iov[2];
+	
+	if (conn->batchingSends)
+	{
+		tcp_batch_append(conn, s->data, s->end - s->data);
+		tcp_batch_append(conn, s->tail, s->tail_len);
+		return;
+	}
+	
+	if (s->tail_len > 0 && conn->tcpWritev)
+	{
+		iov[0].iov_base = s->data;
+		iov[0].iov_len = s->end - s->data;
+		iov[1].iov_base = s->tail;
+		iov[1].iov_len = s->tail_len;
+		tcp_writev(conn, iov, 2);
+		return;
+	}
 	
 	int length = s->end - s->data;
 	int sent, total = 0;
@@ -75,63 +185,120 @@ tcp_send(RDConnectionRef conn, RDStreamRef s)
 		}
 		total += sent;
 	}
+	
+	for (total = 0; total < (int) s->tail_len; total += sent)
+	{
+		sent = [os write:s->tail + total maxLength:s->tail_len - total];
+		if (sent < 0) {
+			error("send: %s\n", strerror(errno));
+			return;
+		}
+	}
 }
 
-/* Receive a message on the TCP layer */
-RDStreamRef
-tcp_recv(RDConnectionRef conn, RDStreamRef s, uint32 length)
+/* Make sure length bytes from offset *keep onwards are in the read-ahead
+ * buffer. Reads ask the socket for as much as fits, so a burst of small PDUs
+ * costs one read instead of two per PDU. Bytes before *keep are dropped when
+ * the buffer has to be compacted, in which case *keep is updated. */
+static RD_BOOL
+tcp_read_ahead(RDConnectionRef conn, uint32 * keep, uint32 length)
 {
 	NSInputStream *is = conn->inputStream;
-	unsigned int new_length, end_offset, p_offset;
-	int rcvd = 0;
+	RDReadBuffer *b = &conn->recvBuffer;
+	int rcvd;
 
-	if (s == NULL)
-	{
-		/* read into "new" stream */
-		if (length > conn->inStream.size)
-		{
-			conn->inStream.data = (uint8 *) xrealloc(conn->inStream.data, length);
-			conn->inStream.size = length;
-		}
-		conn->inStream.end = conn->inStream.p = conn->inStream.data;
-		s = &conn->inStream;
-	}
-	else
+	if (b->end - *keep >= length)
+		return True;
+
+	/* Nothing kept: start over at the front of the buffer */
+	if (*keep == b->end)
+		b->start = b->end = *keep = 0;
+
+	if (*keep + length > b->size)
 	{
-		/* append to existing stream */
-		new_length = (s->end - s->data) + length;
-		if (new_length > s->size)
+		memmove(b->data, b->data + *keep, b->end - *keep);
+		b->start -= *keep;
+		b->end -= *keep;
+		*keep = 0;
+
+		if (length > b->size)
 		{
-			p_offset = s->p - s->data;
-			end_offset = s->end - s->data;
-			s->data = (uint8 *) xrealloc(s->data, new_length);
-			s->size = new_length;
-			s->p = s->data + p_offset;
-			s->end = s->data + end_offset;
+			b->size = length;
+			b->data = (uint8 *) xrealloc(b->data, b->size);
 		}
 	}
 
-	while (length > 0)
+	while (b->end - *keep < length)
 	{
-		rcvd = [is read:s->end maxLength:length];
+		rcvd = [is read:b->data + b->end maxLength:b->size - b->end];
 		if (rcvd < 0)
 		{
 			error("recv: %s\n", strerror(errno));
-			return NULL;
+			return False;
 		}
 		else if (rcvd == 0)
 		{
 			error("Connection closed\n");
-			return NULL;
+			return False;
 		}
 
-		s->end += rcvd;
-		length -= rcvd;
+		b->end += rcvd;
+		b->reads++;
+		b->bytes += rcvd;
+
+		/* For timing_mark(): how fast data kept coming once it started */
+		b->burstEnd = timing_now();
+		if (b->burstStart == 0)
+			b->burstStart = b->burstEnd;
+		else
+			b->burstBytes += rcvd;
+	}
+
+	return True;
+}
+
+/* Receive a message on the TCP layer. The returned stream points into the
+ * read-ahead buffer and is valid until the next call. Passing the previous
+ * result as s extends it by length bytes. */
+RDStreamRef
+tcp_recv(RDConnectionRef conn, RDStreamRef s, uint32 length)
+{
+	RDReadBuffer *b = &conn->recvBuffer;
+	uint32 keep, p_offset;
+
+	if (s == NULL)
+	{
+		/* read into "new" stream */
+		keep = b->start;
+		p_offset = 0;
+		s = &conn->inStream;
+	}
+	else
+	{
+		/* append to existing stream, which ends where the unparsed bytes begin */
+		keep = s->data - b->data;
+		p_offset = s->p - s->data;
 	}
 
+	if (!tcp_read_ahead(conn, &keep, b->start - keep + length))
+		return NULL;
+
+	s->data = b->data + keep;
+	s->p = s->data + p_offset;
+	s->end = b->data + b->start + length;
+	s->size = s->end - s->data;
+	b->start += length;
+
 	return s;
 }
 
+/* Whether there are received bytes that haven't been handed to tcp_recv's callers */
+RD_BOOL
+tcp_data_buffered(RDConnectionRef conn)
+{
+	return conn->recvBuffer.start < conn->recvBuffer.end;
+}
+
 /* Establish a connection on the TCP layer */
 RD_BOOL
 tcp_connect(RDConnectionRef conn, const char *server)
@@ -180,12 +347,26 @@ tcp_connect(RDConnectionRef conn, const char *server)
 	else if (conn->errorCode == ConnectionErrorCanceled)
 		goto Cleanup;
 	
+	timing_mark(conn, CONNECT_PHASE_TCP);
+	
 	conn->inputStream = [is retain];
 	conn->outputStream = [os retain];
 	
-	conn->outStream.size = conn->inStream.size = 4096;
-	conn->inStream.data = xmalloc(conn->inStream.size);
+	// The connection thread polls the socket itself. writev goes around the stream, which is only safe when nothing sits between it and the socket.
+	conn->tcpSocket = -1;
+	CFDataRef handle = CFWriteStreamCopyProperty((CFWriteStreamRef)os, kCFStreamPropertySocketNativeHandle);
+	if (handle != NULL)
+	{
+		conn->tcpSocket = *(CFSocketNativeHandle *)CFDataGetBytePtr(handle);
+		CFRelease(handle);
+	}
+	conn->tcpWritev = conn->tcpSocket >= 0 && !CRDPreferenceIsEnabled(CRDUseSocksProxy);
+	
+	conn->outStream.size = 4096;
 	conn->outStream.data = xmalloc(conn->outStream.size);
+	conn->recvBuffer.size = TCP_READ_AHEAD_SIZE;
+	conn->recvBuffer.data = xmalloc(conn->recvBuffer.size);
+	conn->recvBuffer.start = conn->recvBuffer.end = 0;
 	
 Cleanup:
 	return conn->errorCode == ConnectionErrorNone;
@@ -202,6 +383,17 @@ tcp_disconnect(RDConnectionRef conn)
 	[conn->outputStream close];
 	[conn->outputStream release];	
 	conn->outputStream = NULL;
+	conn->tcpSocket = -1;
+	conn->tcpWritev = False;
+
+	DEBUG(("tcp: %u reads, %llu bytes received\n", conn->recvBuffer.reads, conn->recvBuffer.bytes));
+	xfree(conn->recvBuffer.data);
+	conn->recvBuffer.data = NULL;
+	conn->recvBuffer.size = conn->recvBuffer.start = conn->recvBuffer.end = 0;
+
+	xfree(conn->sendBatch.data);
+	memset(&conn->sendBatch, 0, sizeof(conn->sendBatch));
+	conn->batchingSends = False;
 }
 
 char *
@@ -237,11 +429,13 @@ tcp_get_address(RDConnectionRef conn)
 void
 tcp_reset_state(RDConnectionRef conn)
 {
-	/* Clear the incoming stream */
+	/* Clear the incoming stream, which points into the read-ahead buffer */
 	[(id)conn->inputStream release];
 	conn->inputStream = NULL;
-	if (conn->inStream.data != NULL)
-		xfree(conn->inStream.data);
+	if (conn->recvBuffer.data != NULL)
+		xfree(conn->recvBuffer.data);
+	conn->recvBuffer.data = NULL;
+	conn->recvBuffer.size = conn->recvBuffer.start = conn->recvBuffer.end = 0;
 	conn->inStream.p = NULL;
 	conn->inStream.end = NULL;
 	conn->inStream.data = NULL;
@@ -266,6 +460,11 @@ tcp_reset_state(RDConnectionRef conn)
 	conn->outStream.sec_hdr = NULL;
 	conn->outStream.rdp_hdr = NULL;
 	conn->outStream.channel_hdr = NULL;
+
+	if (conn->sendBatch.data != NULL)
+		xfree(conn->sendBatch.data);
+	memset(&conn->sendBatch, 0, sizeof(conn->sendBatch));
+	conn->batchingSends = False;
 }
 
 
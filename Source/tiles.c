@@ -0,0 +1,297 @@
+/*	Copyright (c) 2007-2012 Dorian Johnson <2011@dorianj.net>
+	
+	This file is part of CoRD.
+	CoRD is free software; you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation; either version 2 of the License, or (at your option) any later
+	version.
+
+	CoRD is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+	FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License along with
+	CoRD; if not, write to the Free Software Foundation, Inc., 51 Franklin St,
+	Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+/*	Purpose: Screen tile maps.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "tiles.h"
+
+/*
+ * Damage is kept as a bit for each 64x64 tile of the screen rather than as
+ * a list of rectangles. Marking a glyph or a bitmap sets a bit or two, with
+ * no merging to decide, and what is copied, uploaded or recorded afterwards
+ * is found by walking the set bits, so every step costs in proportion to
+ * the tiles that changed however large the desktop is. A 3840x2160 screen
+ * is 60x34 tiles: its whole map fits in 34 words. At most a tile's worth
+ * of pixels along each edge of a change is copied needlessly, and tiles are
+ * independent of each other, so the work on them can be shared between
+ * threads by rows.
+ *
+ * Each row of tiles has its own words, and bits past the last column are
+ * never set, so that a whole row is cheap to test and to walk.
+ */
+
+#define WORD_BITS	64
+
+static int
+tile_popcount(uint64_t word)
+{
+	return __builtin_popcountll(word);
+}
+
+/* Bits first to last of a word, both included */
+static uint64_t
+tile_mask(int first, int last)
+{
+	uint64_t high = last == WORD_BITS - 1 ? ~(uint64_t) 0 : ((uint64_t) 1 << (last + 1)) - 1;
+
+	return high & ~(((uint64_t) 1 << first) - 1);
+}
+
+/* Sizes the map for a width x height screen, with nothing set. Returns 0
+   if out of memory, leaving it an empty 0x0 map. */
+int
+tilemap_init(RDTileMap * map, int width, int height)
+{
+	tilemap_destroy(map);
+	if (width <= 0 || height <= 0)
+		return 1;
+
+	map->columns = (width + TILE_SIZE - 1) >> TILE_SHIFT;
+	map->rows = (height + TILE_SIZE - 1) >> TILE_SHIFT;
+	map->words = (map->columns + WORD_BITS - 1) / WORD_BITS;
+	map->bits = calloc((size_t) map->rows * map->words, sizeof(uint64_t));
+	if (map->bits == NULL)
+	{
+		tilemap_destroy(map);
+		return 0;
+	}
+
+	map->width = width;
+	map->height = height;
+	return 1;
+}
+
+void
+tilemap_destroy(RDTileMap * map)
+{
+	free(map->bits);
+	memset(map, 0, sizeof(*map));
+}
+
+void
+tilemap_clear(RDTileMap * map)
+{
+	if (map->count == 0)
+		return;
+
+	memset(map->bits, 0, (size_t) map->rows * map->words * sizeof(uint64_t));
+	map->count = 0;
+}
+
+void
+tilemap_fill(RDTileMap * map)
+{
+	int row, word;
+
+	for (row = 0; row < map->rows; row++)
+		for (word = 0; word < map->words; word++)
+			map->bits[row * map->words + word] =
+				tile_mask(0, word == map->words - 1 ? (map->columns - 1) % WORD_BITS : WORD_BITS - 1);
+
+	map->count = (long) map->columns * map->rows;
+}
+
+/* Marks the tiles under the cx x cy rectangle at x, y, or the part of it
+   on the screen */
+void
+tilemap_add(RDTileMap * map, int x, int y, int cx, int cy)
+{
+	int left = x < 0 ? 0 : x, top = y < 0 ? 0 : y;
+	int right = cx > map->width - x ? map->width : x + cx, bottom = cy > map->height - y ? map->height : y + cy;
+	int first, last, row, word;
+
+	if (right <= left || bottom <= top)
+		return;
+
+	first = left >> TILE_SHIFT;
+	last = (right - 1) >> TILE_SHIFT;
+
+	for (row = top >> TILE_SHIFT; row <= (bottom - 1) >> TILE_SHIFT; row++)
+	{
+		uint64_t *bits = map->bits + row * map->words;
+
+		for (word = first / WORD_BITS; word <= last / WORD_BITS; word++)
+		{
+			uint64_t mask = tile_mask(word == first / WORD_BITS ? first % WORD_BITS : 0,
+						  word == last / WORD_BITS ? last % WORD_BITS : WORD_BITS - 1);
+
+			map->count += tile_popcount(mask & ~bits[word]);
+			bits[word] |= mask;
+		}
+	}
+}
+
+/* Adds everything other has; if other is for a screen of another size,
+   everything is taken to have changed */
+void
+tilemap_union(RDTileMap * map, const RDTileMap * other)
+{
+	long i, n = (long) map->rows * map->words;
+
+	if (other->count == 0 || map->count == (long) map->columns * map->rows)
+		return;
+	if (other->width != map->width || other->height != map->height)
+	{
+		tilemap_fill(map);
+		return;
+	}
+
+	map->count = 0;
+	for (i = 0; i < n; i++)
+	{
+		map->bits[i] |= other->bits[i];
+		map->count += tile_popcount(map->bits[i]);
+	}
+}
+
+/* Makes map the same as other, which must be for a screen of the same size */
+void
+tilemap_copy(RDTileMap * map, const RDTileMap * other)
+{
+	if (map->count == 0 && other->count == 0)
+		return;
+
+	memcpy(map->bits, other->bits, (size_t) map->rows * map->words * sizeof(uint64_t));
+	map->count = other->count;
+}
+
+int
+tilemap_is_empty(const RDTileMap * map)
+{
+	return map->count == 0;
+}
+
+int
+tilemap_is_full(const RDTileMap * map)
+{
+	return map->count == (long) map->columns * map->rows && map->count > 0;
+}
+
+int
+tilemap_test(const RDTileMap * map, int column, int row)
+{
+	return (map->bits[row * map->words + column / WORD_BITS] >> (column % WORD_BITS)) & 1;
+}
+
+/* Pixels on the screen under tiles that are set */
+long
+tilemap_area(const RDTileMap * map)
+{
+	int row, word, last = map->columns - 1, cut = (map->columns << TILE_SHIFT) - map->width;
+	long area = 0, width;
+
+	for (row = 0; row < map->rows && map->count > 0; row++)
+	{
+		const uint64_t *bits = map->bits + row * map->words;
+
+		/* The last column of tiles may be cut short, and so may the last row */
+		for (width = 0, word = 0; word < map->words; word++)
+			width += (long) tile_popcount(bits[word]) << TILE_SHIFT;
+		if ((bits[last / WORD_BITS] >> (last % WORD_BITS)) & 1)
+			width -= cut;
+
+		area += width * (row == map->rows - 1 ? map->height - (row << TILE_SHIFT) : TILE_SIZE);
+	}
+
+	return area;
+}
+
+/* The smallest rectangle on the screen holding every tile that is set.
+   Returns 0, and leaves bounds alone, if none are. */
+int
+tilemap_bounds(const RDTileMap * map, RDTileRect * bounds)
+{
+	int row, word, top = -1, bottom = 0, left = map->columns, right = 0;
+
+	if (map->count == 0)
+		return 0;
+
+	for (row = 0; row < map->rows; row++)
+		for (word = 0; word < map->words; word++)
+		{
+			uint64_t bits = map->bits[row * map->words + word];
+
+			if (bits == 0)
+				continue;
+			if (top < 0)
+				top = row;
+			bottom = row;
+			if (word * WORD_BITS + __builtin_ctzll(bits) < left)
+				left = word * WORD_BITS + __builtin_ctzll(bits);
+			if (word * WORD_BITS + WORD_BITS - 1 - __builtin_clzll(bits) > right)
+				right = word * WORD_BITS + WORD_BITS - 1 - __builtin_clzll(bits);
+		}
+
+	bounds->x = left << TILE_SHIFT;
+	bounds->y = top << TILE_SHIFT;
+	bounds->cx = ((right + 1) << TILE_SHIFT > map->width ? map->width : (right + 1) << TILE_SHIFT) - bounds->x;
+	bounds->cy = ((bottom + 1) << TILE_SHIFT > map->height ? map->height : (bottom + 1) << TILE_SHIFT) - bounds->y;
+	return 1;
+}
+
+/* Fills spans with the runs of set tiles in a row of them, left to right,
+   as rectangles of the screen; spans needs room for (columns + 1) / 2.
+   Returns how many there are. */
+int
+tilemap_row_spans(const RDTileMap * map, int row, RDTileRect * spans)
+{
+	const uint64_t *bits = map->bits + row * map->words;
+	int n = 0, column = 0, start, top = row << TILE_SHIFT;
+	int height = map->height - top < TILE_SIZE ? map->height - top : TILE_SIZE;
+
+	while (column < map->columns)
+	{
+		uint64_t word = bits[column / WORD_BITS] >> (column % WORD_BITS);
+
+		/* Skip to the next set tile */
+		if (word == 0)
+		{
+			column = (column / WORD_BITS + 1) * WORD_BITS;
+			continue;
+		}
+		column += __builtin_ctzll(word);
+		start = column;
+
+		/* And on past the run it begins */
+		for (;;)
+		{
+			word = ~bits[column / WORD_BITS] >> (column % WORD_BITS);
+			if (word != 0)
+			{
+				column += __builtin_ctzll(word);
+				break;
+			}
+			column = (column / WORD_BITS + 1) * WORD_BITS;
+			if (column >= map->columns)
+				break;
+		}
+		if (column > map->columns)
+			column = map->columns;
+
+		spans[n].x = start << TILE_SHIFT;
+		spans[n].y = top;
+		spans[n].cx = ((column << TILE_SHIFT) > map->width ? map->width : column << TILE_SHIFT) - spans[n].x;
+		spans[n].cy = height;
+		n++;
+	}
+
+	return n;
+}
@@ -0,0 +1,61 @@
+/*	Copyright (c) 2007-2012 Dorian Johnson <2011@dorianj.net>
+	
+	This file is part of CoRD.
+	CoRD is free software; you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation; either version 2 of the License, or (at your option) any later
+	version.
+
+	CoRD is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+	FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License along with
+	CoRD; if not, write to the Free Software Foundation, Inc., 51 Franklin St,
+	Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef _TILES_H
+#define _TILES_H
+
+/* Plain C with no dependencies, so that it can be checked and measured on
+   its own (see Tools/tiles_bench.c) */
+
+#include <stdint.h>
+
+#define TILE_SHIFT	6
+#define TILE_SIZE	(1 << TILE_SHIFT)	/* pixels across and down a tile */
+
+typedef struct _RDTileRect
+{
+	int x, y, cx, cy;
+} RDTileRect;
+
+/* A bit for each TILE_SIZE square of a width x height screen, set when
+   anything in it changed. The tiles along the right and bottom edges may
+   be cut short; rectangles handed out are always clipped to the screen. A
+   map that was never initialised, or was destroyed, is an empty 0x0 one. */
+typedef struct _RDTileMap
+{
+	int width, height;
+	int columns, rows;	/* tiles across and down */
+	int words;		/* 64-bit words of bits for each row of tiles */
+	uint64_t *bits;
+	long count;		/* tiles set */
+} RDTileMap;
+
+int tilemap_init(RDTileMap * map, int width, int height);
+void tilemap_destroy(RDTileMap * map);
+void tilemap_clear(RDTileMap * map);
+void tilemap_fill(RDTileMap * map);
+void tilemap_add(RDTileMap * map, int x, int y, int cx, int cy);
+void tilemap_union(RDTileMap * map, const RDTileMap * other);
+void tilemap_copy(RDTileMap * map, const RDTileMap * other);
+int tilemap_is_empty(const RDTileMap * map);
+int tilemap_is_full(const RDTileMap * map);
+int tilemap_test(const RDTileMap * map, int column, int row);
+long tilemap_area(const RDTileMap * map);
+int tilemap_bounds(const RDTileMap * map, RDTileRect * bounds);
+int tilemap_row_spans(const RDTileMap * map, int row, RDTileRect * spans);
+
+#endif
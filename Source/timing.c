@@ -0,0 +1,214 @@
+/*	Copyright (c) 2007-2012 Dorian Johnson <2011@dorianj.net>
+	
+	This file is part of CoRD.
+	CoRD is free software; you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation; either version 2 of the License, or (at your option) any later
+	version.
+
+	CoRD is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+	FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License along with
+	CoRD; if not, write to the Free Software Foundation, Inc., 51 Franklin St,
+	Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+/*	Purpose: Connection phase timing.
+*/
+
+#import "rdesktop.h"
+#import <mach/mach_time.h>
+
+/*
+ * Each connection phase is stamped with a monotonic time when it completes,
+ * so a slow connect can be pinned on the round trips of one phase. Phases
+ * that happen again later (reactivation after a resize, redirection) keep
+ * the time from the initial connection.
+ *
+ * Once the first frame has been handed over for presenting the timings are
+ * printed in debug builds (see WITH_DEBUG), and if conn->connectTimingFile
+ * is set, appended to it as one JSON object per connection for scripts
+ * that connect without anyone watching.
+ */
+
+static const char *class_names[] = { "unknown", "lan", "broadband", "wan", "low_speed" };
+
+static const char *phase_names[CONNECT_PHASE_COUNT] = {
+	"start",
+	"tcp",
+	"x224",
+	"mcs_connect",
+	"mcs_attach_user",
+	"mcs_channel_join",
+	"security",
+	"licence",
+	"demand_active",
+	"finalize",
+	"first_frame"
+};
+
+/* Monotonic time in microseconds */
+uint64
+timing_now(void)
+{
+	static mach_timebase_info_data_t timebase;
+
+	if (timebase.denom == 0)
+		mach_timebase_info(&timebase);
+
+	return mach_absolute_time() * timebase.numer / timebase.denom / 1000;
+}
+
+/* Forget previous timings and stamp the start of a connection */
+void
+timing_start(RDConnectionRef conn)
+{
+	memset(conn->connectTimes, 0, sizeof(conn->connectTimes));
+	memset(conn->connectBytes, 0, sizeof(conn->connectBytes));
+	memset(conn->connectTransferTimes, 0, sizeof(conn->connectTransferTimes));
+	memset(conn->connectTransferBytes, 0, sizeof(conn->connectTransferBytes));
+	memset(&conn->network, 0, sizeof(conn->network));
+	conn->recvBuffer.burstStart = conn->recvBuffer.burstEnd = conn->recvBuffer.burstBytes = 0;
+	conn->connectTimes[CONNECT_PHASE_START] = timing_now();
+}
+
+/* Stamp the end of a phase. Returns True the first time it is reached. */
+RD_BOOL
+timing_mark(RDConnectionRef conn, int phase)
+{
+	if (conn->connectTimes[CONNECT_PHASE_START] == 0 || conn->connectTimes[phase] != 0)
+		return False;
+
+	conn->connectTimes[phase] = timing_now();
+	conn->connectBytes[phase] = conn->recvBuffer.bytes;
+	conn->connectTransferTimes[phase] = conn->recvBuffer.burstEnd - conn->recvBuffer.burstStart;
+	conn->connectTransferBytes[phase] = conn->recvBuffer.burstBytes;
+	conn->recvBuffer.burstStart = conn->recvBuffer.burstEnd = conn->recvBuffer.burstBytes = 0;
+	return True;
+}
+
+/* The last phase reached before phase */
+static int
+timing_previous(RDConnectionRef conn, int phase)
+{
+	while (--phase > CONNECT_PHASE_START)
+		if (conn->connectTimes[phase] != 0)
+			break;
+	return phase;
+}
+
+/* How long phase took, in microseconds, or 0 if it wasn't reached */
+static uint64
+timing_duration(RDConnectionRef conn, int phase)
+{
+	if (conn->connectTimes[phase] == 0)
+		return 0;
+	return conn->connectTimes[phase] - conn->connectTimes[timing_previous(conn, phase)];
+}
+
+/* Estimate the link's round trip time and bandwidth from the phases so far.
+ * X.224, attach user and the pipelined channel joins are a single round
+ * trip each with little data, so the fastest of them is taken as the RTT.
+ * TCP isn't, since it also holds the name lookup CFStream does on its own.
+ * The MCS connect response carries the server's certificate and is the
+ * first reply of any size. Its bandwidth is
+ * taken from the bytes that arrived after its first read, over the time to
+ * its last read, which leaves out the round trip and however long the
+ * server took to answer. That is a few KB, so when it took less than a
+ * millisecond the link is too fast to tell and the bandwidth is unknown. */
+void
+timing_estimate_network(RDConnectionRef conn)
+{
+	static const int rtt_phases[] = { CONNECT_PHASE_ISO, CONNECT_PHASE_MCS_ATTACH, CONNECT_PHASE_MCS_JOIN };
+	RDNetworkStats *net = &conn->network;
+	uint64 duration;
+	unsigned int i;
+
+	net->rtt = 0;
+	for (i = 0; i < sizeof(rtt_phases) / sizeof(rtt_phases[0]); i++)
+	{
+		duration = timing_duration(conn, rtt_phases[i]);
+		if (duration != 0 && (net->rtt == 0 || duration < net->rtt))
+			net->rtt = duration;
+	}
+
+	net->bandwidth = 0;
+	duration = conn->connectTransferTimes[CONNECT_PHASE_MCS_CONNECT];
+	if (duration >= 1000)
+		net->bandwidth = conn->connectTransferBytes[CONNECT_PHASE_MCS_CONNECT] * 8 * 1000 / duration;
+
+	if (net->rtt == 0)
+		net->linkClass = NETWORK_CLASS_UNKNOWN;
+	else if (net->rtt >= NETWORK_WAN_RTT || (net->bandwidth && net->bandwidth < NETWORK_LOW_SPEED_KBPS))
+		net->linkClass = NETWORK_CLASS_LOW_SPEED;
+	else if (net->rtt >= NETWORK_BROADBAND_RTT || (net->bandwidth && net->bandwidth < NETWORK_BROADBAND_KBPS))
+		net->linkClass = NETWORK_CLASS_WAN;
+	else if (net->rtt >= NETWORK_LAN_RTT)
+		net->linkClass = NETWORK_CLASS_BROADBAND;
+	else
+		net->linkClass = NETWORK_CLASS_LAN;
+}
+
+/* Fill report with one entry per phase after the start, in order. A phase
+ * that wasn't reached (licensing the server skipped)
+ * doesn't count towards the next one's duration. Returns the number of
+ * phases reached. */
+int
+timing_report(RDConnectionRef conn, RDConnectPhaseTiming * report)
+{
+	uint64 start = conn->connectTimes[CONNECT_PHASE_START];
+	int phase, reached = 0;
+
+	for (phase = CONNECT_PHASE_START + 1; phase < CONNECT_PHASE_COUNT; phase++, report++)
+	{
+		report->name = phase_names[phase];
+		report->reached = start != 0 && conn->connectTimes[phase] != 0;
+		report->duration = report->elapsed = 0;
+		if (!report->reached)
+			continue;
+
+		report->duration = timing_duration(conn, phase) / 1000.0;
+		report->elapsed = (conn->connectTimes[phase] - start) / 1000.0;
+		reached++;
+	}
+
+	return reached;
+}
+
+/* Print the report in debug builds, and append it to conn->connectTimingFile */
+void
+timing_log(RDConnectionRef conn)
+{
+	RDConnectPhaseTiming report[CONNECT_PHASE_COUNT - 1];
+	FILE *fp = conn->connectTimingFile;
+	int i;
+
+	if (timing_report(conn, report) == 0)
+		return;
+
+	for (i = 0; i < CONNECT_PHASE_COUNT - 1; i++)
+	{
+		if (report[i].reached)
+			DEBUG(("connect: %-18s %8.1f ms (%8.1f ms total)\n", report[i].name,
+			       report[i].duration, report[i].elapsed));
+	}
+	DEBUG(("connect: link %s, rtt %.1f ms, bandwidth %u kbit/s\n", class_names[conn->network.linkClass],
+	       conn->network.rtt / 1000.0, conn->network.bandwidth));
+
+	if (fp == NULL)
+		return;
+
+	fprintf(fp, "{\"network\": {\"class\": \"%s\", \"rtt_ms\": %.3f, \"kbps\": %u}",
+		class_names[conn->network.linkClass], conn->network.rtt / 1000.0, conn->network.bandwidth);
+	for (i = 0; i < CONNECT_PHASE_COUNT - 1; i++)
+	{
+		if (!report[i].reached)
+			continue;
+		fprintf(fp, ", \"%s\": {\"ms\": %.3f, \"at\": %.3f}",
+			report[i].name, report[i].duration, report[i].elapsed);
+	}
+	fprintf(fp, "}\n");
+	fflush(fp);
+}
@@ -43,6 +43,7 @@ typedef CRDBitmap * RDBitmapRef;
 typedef CRDBitmap * RDGlyphRef;
 typedef unsigned int * RDColorMapRef;
 typedef CRDBitmap * RDCursorRef;
+typedef struct CGContext * RDSurfaceRef;
 
 typedef struct _RDConnection RDConnection;
 typedef struct _RDConnection * RDConnectionRef;
@@ -97,6 +98,36 @@ typedef struct _RDBrush
 	RDBrushData *bd;
 } RDBrush;
 
+/* An 8x8 brush expanded to framebuffer pixels, see ui_patblt() */
+typedef struct _RDBrushTile
+{
+	RD_BOOL valid;
+	uint8 style;
+	uint8 pattern[8];
+	RDBrushData *bd;
+	uint32 fgcolour, bgcolour, generation;
+	uint32 pixels[64];
+} RDBrushTile;
+
+/* A converted cursor and the pointer data it was made from, see ui_create_cursor() */
+typedef struct _RDCursorShape
+{
+	uint32 hash;
+	sint16 x, y;
+	uint16 width, height;
+	int bpp;
+	uint8 *data;		/* AND mask, then XOR mask */
+	int andlen, xorlen;
+	RDCursorRef cursor;
+} RDCursorShape;
+
+typedef struct _RDOffscreenBitmap
+{
+	RDSurfaceRef surface;
+	uint16 width;
+	uint16 height;
+} RDOffscreenBitmap;
+
 typedef struct _RDFontGlyph
 {
 	sint16 offset;
@@ -130,6 +161,17 @@ typedef struct _RDComp
 	RDStream ns;
 } RDComp;
 
+/* Read-ahead buffer for the TCP layer, see tcp_recv() */
+typedef struct _RDReadBuffer
+{
+	uint8 *data;
+	uint32 size, start, end;	/* unparsed bytes are data[start, end) */
+	uint32 reads;	/* socket reads, for statistics */
+	uint64 bytes;
+	uint64 burstStart, burstEnd;	/* us, the first and latest reads since the last timing_mark() */
+	uint64 burstBytes;	/* received by the reads after the first of those */
+} RDReadBuffer;
+
 /* RDPDR */
 typedef uint32 NTStatus;
 typedef uint32 NTHandle;
@@ -255,6 +297,7 @@ struct bmpcache_entry
 	RDBitmapRef bitmap;
 	sint16 previous;
 	sint16 next;
+	uint32 traceKey;	/* content hash, only kept while tracing */
 };
 
 typedef enum _RDConnectionError
@@ -266,6 +309,29 @@ typedef enum _RDConnectionError
 	ConnectionErrorCanceled = 4
 } RDConnectionError;
 
+/* One slow-path style input event, see rdp_send_input_events() */
+typedef struct _RDInputEvent
+{
+	uint32 time;
+	uint16 type, deviceFlags, param1, param2;
+} RDInputEvent;
+
+/* Link characteristics measured while connecting, see timing_estimate_network() */
+typedef struct _RDNetworkStats
+{
+	uint32 rtt;	/* us, 0 if unknown */
+	uint32 bandwidth;	/* kbit/s, 0 if unknown or too fast to measure */
+	int linkClass;	/* NETWORK_CLASS_* */
+} RDNetworkStats;
+
+/* One phase of the connection, see timing_report() */
+typedef struct _RDConnectPhaseTiming
+{
+	const char *name;
+	RD_BOOL reached;
+	double duration, elapsed;	/* ms, since the previous phase reached and since the start */
+} RDConnectPhaseTiming;
+
 typedef struct _RDHostLookupInfo
 {
 	int finished;
@@ -282,7 +348,8 @@ struct _RDConnection
 	char hostname[64];
 	
 	// State flags
-	int isConnected, useRdp5, useEncryption, useBitmapCompression, rdp5PerformanceFlags, consoleSession, bitmapCache, bitmapCachePersist, bitmapCachePrecache, desktopSave, polygonEllipseOrders, licenseIssued, notifyStamp, pstcacheEnumerated;
+	int fastPathInput, useFastPathInput;	/* wanted, and agreed with the server */
+	int isConnected, useRdp5, useEncryption, useBitmapCompression, rdp5PerformanceFlags, consoleSession, bitmapCache, bitmapCachePersist, bitmapCachePrecache, bitmapCacheV3, desktopSave, polygonEllipseOrders, licenseIssued, notifyStamp, pstcacheEnumerated;
     long forwardAudio;
 	RDP_ORDER_STATE orderState;
 	
@@ -292,18 +359,31 @@ struct _RDConnection
 	
 	// Connection details
 	int tcpPort, currentStatus, screenWidth, screenHeight, serverBpp, shareID, serverRdpVersion;
+	RD_BOOL serverRefreshRect, serverSuppressOutput;	/* from the server's general capabilities */
 	
 	// Bitmap caches
 	int pstcacheBpp;
 	int pstcacheFd[8];
+	int bmpcacheCells[BITMAP_CACHE_SIZE];	/* geometry advertised to the server */
+	int bmpcacheResidentCells;	/* in-memory limit for persistent caches */
 	int bmpcacheCount[BITMAP_CACHE_SIZE];
-	unsigned char deskCache[DESKTOP_CACHE_SIZE * 4];
+	FILE *bmpcacheTrace;	/* see cache_trace_bitmap(), NULL unless tracing */
+	uint32 deskCache[DESKTOP_CACHE_SIZE];	/* backing store pixels, see ui_desktop_save() */
 	RDBitmapRef volatileBc[BITMAP_CACHE_SIZE];
 	RDCursorRef cursorCache[CURSOR_CACHE_SIZE];
+	RDCursorShape cursorShapeCache[CURSOR_SHAPE_CACHE_SIZE];
+	RDCursorRef currentCursor;	/* last given to ui_set_cursor(), retained */
 	RDBrushData brushCache[BRUSH_CACHE_ENTRIES][BRUSH_CACHE_SIZE];
+	RDBrushTile brushTileCache[BRUSH_TILE_CACHE_SIZE];
+	uint32 brushTileGeneration;
+	RDOffscreenBitmap offscreenCache[OFFSCREEN_CACHE_ENTRIES];
+	int offscreenCacheSize, offscreenCacheEntries;	/* KB / count advertised to the server, 0 to disable */
+	uint32 offscreenCacheUsed;	/* bytes, as the server accounts them */
+	RDSurfaceRef currentSurface;	/* NULL when drawing to the screen */
 	RDDataBlob textCache[TEXT_CACHE_SIZE];
+	uint8 textCacheData[TEXT_CACHE_SIZE][TEXT_CACHE_ENTRY_SIZE];
 	RDFontGlyph fontCache[FONT_CACHE_SIZE][FONT_CACHE_ENTRIES];
-	struct bmpcache_entry bmpcache[BITMAP_CACHE_SIZE][BITMAP_CACHE_ENTRIES];
+	struct bmpcache_entry *bmpcache[BITMAP_CACHE_SIZE];	/* bmpcacheCells[id] entries each */
 	int bmpcacheLru[BITMAP_CACHE_SIZE], bmpcacheMru[BITMAP_CACHE_SIZE];
 	
 	// Device redirection
@@ -339,7 +419,22 @@ struct _RDConnection
 	NSInputStream *inputStream; 
  	NSOutputStream *outputStream;
 	RDStream inStream, outStream;
+	RDStream sendBatch;	/* PDUs held back by tcp_begin_batch() */
+	RD_BOOL batchingSends;
+	int tcpSocket;	/* native handle, polled by the event loop */
+	RD_BOOL tcpWritev;	/* payloads with a tail may be written to tcpSocket directly */
+	RDReadBuffer recvBuffer;
 	RDStreamRef rdpStream;
+	RDArena arena;
+	uint64 connectTimes[CONNECT_PHASE_COUNT];	/* microseconds, 0 if not reached */
+	uint64 connectBytes[CONNECT_PHASE_COUNT];	/* received by then */
+	uint64 connectTransferTimes[CONNECT_PHASE_COUNT];	/* us from the phase's first read to its last */
+	uint64 connectTransferBytes[CONNECT_PHASE_COUNT];	/* received in that time */
+	RDNetworkStats network;
+	int autoPerformanceFlags;	/* choose bulk compression for the measured link */
+	FILE *connectTimingFile;	/* timing reports are appended here, if set */
+	RDRecorder *recorder;	/* see record_update(), NULL unless recording the session */
+	RDEventLoop *eventLoop;	/* the connection thread's, once connected */
 	
 	// Secure
 	uint32 rc4KeyLen, secEncryptUseCount, secDecryptUseCount;
@@ -350,6 +445,8 @@ struct _RDConnection
 	
 	// Unknown
 	RDComp mppcDict;
+	RDStream fastPathFragment;	/* reassembly of fragmented fast-path updates */
+	uint32 multifragmentMaxSize;	/* advertised to the server, bytes */
 	
 	// UI
 	CRDSessionView *ui;
@@ -357,8 +454,7 @@ struct _RDConnection
 	volatile RDConnectionError errorCode;
 	
 	// Managing current draw session (used by CRDDrawingGlue)
-	void *rectsNeedingUpdate;
-	int updateEntireScreen;
+	RDTileMap dirtyTiles;	/* screen drawn to since the last ui_end_update */
 };
 
 
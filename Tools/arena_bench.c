@@ -0,0 +1,204 @@
+/*	Copyright (c) 2007-2012 Dorian Johnson <2011@dorianj.net>
+	
+	This file is part of CoRD.
+	CoRD is free software; you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation; either version 2 of the License, or (at your option) any later
+	version.
+
+	CoRD is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+	FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License along with
+	CoRD; if not, write to the Free Software Foundation, Inc., 51 Franklin St,
+	Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+/*
+ * arena_bench: compare the old xmalloc/xfree of every per-PDU buffer with
+ * the scratch arena (Source/arena.c) that the receive loop resets after
+ * each PDU.
+ *
+ *	cc -O2 -I../Source -o arena_bench arena_bench.c ../Source/arena.c
+ *	./arena_bench [pdus]
+ *
+ * It replays a mix of PDUs like a busy session: bitmap updates of several
+ * 64x64 tiles, bitmap cache orders, palettes, polylines and polygons, and
+ * PDUs that need no scratch memory at all. Each buffer is filled the way
+ * decompression or parsing fills it. The arena is run twice: keeping every
+ * buffer until the reset, and giving each bitmap back with arena_release()
+ * once it is painted, as the bitmap call sites do. For each it reports the
+ * calls to xmalloc and the time spent, both per PDU; the time is in TSC
+ * cycles on x86 and in nanoseconds elsewhere.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__i386__) || defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+#include "arena.h"
+
+#define BPP		4
+#define ROUNDS		5
+
+static unsigned long mallocs;
+
+void *
+xmalloc(int size)
+{
+	void *mem = malloc(size);
+
+	if (mem == NULL)
+	{
+		fprintf(stderr, "xmalloc %d\n", size);
+		exit(1);
+	}
+	mallocs++;
+	return mem;
+}
+
+void
+xfree(void *mem)
+{
+	free(mem);
+}
+
+#if defined(__i386__) || defined(__x86_64__)
+#define TICK_UNIT	"cycles"
+static unsigned long long
+ticks(void)
+{
+	return __rdtsc();
+}
+#else
+#define TICK_UNIT	"ns"
+static unsigned long long
+ticks(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+#endif
+
+/* The scratch buffers one PDU needs, in bytes, ending with 0 */
+static void
+pdu_buffers(unsigned int n, int *sizes)
+{
+	/* deterministic mix: 35% bitmap updates, 30% bitmap cache orders,
+	   15% polylines and polygons, 2% palettes, 18% nothing */
+	unsigned int r = (n * 2654435761u) >> 8;
+	int i = 0, count;
+
+	if (r % 100 < 35)
+	{
+		/* 1 to 16 tiles, the last one often cut short */
+		for (count = 1 + r / 100 % 16; count > 0; count--)
+			sizes[i++] = (count == 1 && r % 2 ? 64 * (8 + r % 56) : 64 * 64) * BPP;
+		if (r % 50 == 0)
+			sizes[i++] = 1024 * 768 * BPP;	/* rarely, the whole screen */
+	}
+	else if (r % 100 < 65)
+		sizes[i++] = (r % 3 ? 64 * 64 : 32 * 32) * BPP;
+	else if (r % 100 < 80)
+		sizes[i++] = (2 + r / 100 % 60) * 4;
+	else if (r % 100 < 82)
+		sizes[i++] = 256 * 3;
+
+	sizes[i] = 0;
+}
+
+/* Called through a pointer the compiler can't see through, so that buffers
+   which are freed unread are still filled */
+static void *(*volatile fill) (void *, int, size_t) = memset;
+
+static unsigned long long
+run_malloc(int pdus, unsigned long *calls)
+{
+	int sizes[32], n, i;
+	unsigned long long start;
+	unsigned char *p;
+
+	mallocs = 0;
+	start = ticks();
+	for (n = 0; n < pdus; n++)
+	{
+		pdu_buffers(n, sizes);
+		for (i = 0; sizes[i]; i++)
+		{
+			p = xmalloc(sizes[i]);
+			fill(p, n, sizes[i]);
+			xfree(p);
+		}
+	}
+	*calls = mallocs;
+	return ticks() - start;
+}
+
+static unsigned long long
+run_arena(int pdus, int release, unsigned long *calls)
+{
+	RDArena arena;
+	int sizes[32], n, i;
+	unsigned long long start, elapsed;
+	unsigned char *p;
+
+	memset(&arena, 0, sizeof(arena));
+	mallocs = 0;
+	start = ticks();
+	for (n = 0; n < pdus; n++)
+	{
+		pdu_buffers(n, sizes);
+		for (i = 0; sizes[i]; i++)
+		{
+			p = arena_alloc(&arena, sizes[i]);
+			fill(p, n, sizes[i]);
+			if (release && sizes[i] >= 32 * 32 * BPP)
+				arena_release(&arena, p);
+		}
+		arena_reset(&arena);
+	}
+	elapsed = ticks() - start;
+	*calls = mallocs;
+	arena_free(&arena);
+	return elapsed;
+}
+
+int
+main(int argc, char *argv[])
+{
+	int pdus = argc > 1 ? atoi(argv[1]) : 200000;
+	unsigned long long best_malloc = ~0ull, best_arena = ~0ull, best_release = ~0ull, t;
+	unsigned long calls_malloc = 0, calls_arena = 0, calls_release = 0;
+	int sizes[32], n, i, round;
+	long buffers = 0;
+
+	if (pdus < 1)
+		pdus = 1;
+	for (n = 0; n < pdus; n++)
+		for (pdu_buffers(n, sizes), i = 0; sizes[i]; i++)
+			buffers++;
+
+	for (round = 0; round < ROUNDS; round++)
+	{
+		if ((t = run_malloc(pdus, &calls_malloc)) < best_malloc)
+			best_malloc = t;
+		if ((t = run_arena(pdus, 0, &calls_arena)) < best_arena)
+			best_arena = t;
+		if ((t = run_arena(pdus, 1, &calls_release)) < best_release)
+			best_release = t;
+	}
+
+	printf("%d PDUs, %.2f scratch buffers per PDU, best of %d runs\n\n", pdus, (double) buffers / pdus, ROUNDS);
+	printf("%-16s %16s %16s\n", "", "xmalloc/PDU", TICK_UNIT "/PDU");
+	printf("%-16s %16.4f %16.0f\n", "xmalloc/xfree", (double) calls_malloc / pdus, (double) best_malloc / pdus);
+	printf("%-16s %16.4f %16.0f\n", "arena", (double) calls_arena / pdus, (double) best_arena / pdus);
+	printf("%-16s %16.4f %16.0f\n", "arena, released", (double) calls_release / pdus, (double) best_release / pdus);
+	return 0;
+}
@@ -0,0 +1,197 @@
+/*	Copyright (c) 2007-2012 Dorian Johnson <2011@dorianj.net>
+
+	This file is part of CoRD.
+	CoRD is free software; you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation; either version 2 of the License, or (at your option) any later
+	version.
+
+	CoRD is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+	FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License along with
+	CoRD; if not, write to the Free Software Foundation, Inc., 51 Franklin St,
+	Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+/*
+ * blit_bench: check and measure the in-place SCREENBLT (Source/blit.c).
+ *
+ *	cc -O2 -I../Source -o blit_bench blit_bench.c ../Source/blit.c -lpthread
+ *	./blit_bench [width] [height]
+ *
+ * First it makes random blits, small and large, overlapping in every
+ * direction, in a bottom-up framebuffer like the backing store and in a
+ * top-down one, with one thread and with BLIT_MAX_THREADS. Each is compared
+ * with copying the source out and back, and followed by a random fill
+ * compared with setting the pixels one by one. It exits with status 1 if
+ * any check fails.
+ *
+ * Then it times the blits that scrolling and moving windows produce
+ * against what the old screenBlit:to: did at the least: copy the whole
+ * screen out, then the block back in.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "blit.h"
+
+static int width, height;
+
+static double
+now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/* Pixel 0, 0 and the pitch of a frame stored bottom-up or top-down */
+static uint32_t *
+frame_origin(uint32_t * frame, int bottom_up, int *pitch)
+{
+	*pitch = bottom_up ? -width * 4 : width * 4;
+	return bottom_up ? frame + (height - 1) * width : frame;
+}
+
+static void
+reference(uint32_t * origin, int pitch, int x, int y, int cx, int cy, int srcx, int srcy)
+{
+	uint32_t *copy = malloc(cx * cy * 4);
+	int row;
+
+	for (row = 0; row < cy; row++)
+		memcpy(copy + row * cx, (uint32_t *) ((uint8_t *) origin + (srcy + row) * pitch) + srcx, cx * 4);
+	for (row = 0; row < cy; row++)
+		memcpy((uint32_t *) ((uint8_t *) origin + (y + row) * pitch) + x, copy + row * cx, cx * 4);
+	free(copy);
+}
+
+static int
+check(void)
+{
+	uint32_t *frame = malloc(width * height * 4), *expected = malloc(width * height * 4), *origin;
+	int round, i, pitch, bottom_up, threads, failures = 0;
+
+	srand(1);
+	for (round = 0; round < 400 && !failures; round++)
+	{
+		int cx = 1 + rand() % (round % 2 ? width : 64), cy = 1 + rand() % (round % 2 ? height : 64);
+		int x = rand() % (width - cx + 1), y = rand() % (height - cy + 1);
+		int srcx = rand() % 4 ? x + rand() % 41 - 20 : rand() % (width - cx + 1);
+		int srcy = rand() % 4 ? y + rand() % 41 - 20 : rand() % (height - cy + 1);
+
+		/* Keep the source on screen, and make some pure vertical or sideways moves */
+		if (round % 5 == 0)
+			srcx = x;
+		if (round % 7 == 0)
+			srcy = y;
+		srcx = srcx < 0 ? 0 : srcx > width - cx ? width - cx : srcx;
+		srcy = srcy < 0 ? 0 : srcy > height - cy ? height - cy : srcy;
+
+		bottom_up = round % 3 != 0;
+		threads = round % 2 ? BLIT_MAX_THREADS : 1;
+
+		for (i = 0; i < width * height; i++)
+			frame[i] = expected[i] = i * 2654435761u;
+
+		blit_set_threads(threads);
+		origin = frame_origin(frame, bottom_up, &pitch);
+		blit_move(origin, pitch, x, y, cx, cy, srcx, srcy);
+		origin = frame_origin(expected, bottom_up, &pitch);
+		reference(origin, pitch, x, y, cx, cy, srcx, srcy);
+
+		if (memcmp(frame, expected, width * height * 4))
+		{
+			printf("FAIL: %dx%d from %d,%d to %d,%d, %s, %d threads\n", cx, cy, srcx, srcy, x, y,
+			       bottom_up ? "bottom-up" : "top-down", threads);
+			failures++;
+		}
+
+		origin = frame_origin(frame, bottom_up, &pitch);
+		blit_fill(origin, pitch, srcx, srcy, cx, cy, round);
+		origin = frame_origin(expected, bottom_up, &pitch);
+		for (i = 0; i < cx * cy; i++)
+			((uint32_t *) ((uint8_t *) origin + (srcy + i / cx) * pitch))[srcx + i % cx] = round;
+
+		if (memcmp(frame, expected, width * height * 4))
+		{
+			printf("FAIL: %dx%d fill at %d,%d, %s, %d threads\n", cx, cy, srcx, srcy,
+			       bottom_up ? "bottom-up" : "top-down", threads);
+			failures++;
+		}
+	}
+
+	free(frame);
+	free(expected);
+	if (!failures)
+		printf("check: %d random blits and fills match\n\n", round);
+	return failures;
+}
+
+static void
+report(const char *name, uint32_t * frame, int x, int y, int cx, int cy, int srcx, int srcy)
+{
+	uint32_t *origin, *snapshot = malloc(width * height * 4);
+	double start, snapshot_us, one_us, many_us;
+	int i, pitch, reps = 50;
+
+	origin = frame_origin(frame, 1, &pitch);
+
+	start = now_us();
+	for (i = 0; i < reps; i++)
+	{
+		memcpy(snapshot, frame, width * height * 4);
+		reference(origin, pitch, x, y, cx, cy, srcx, srcy);
+	}
+	snapshot_us = (now_us() - start) / reps;
+
+	blit_set_threads(1);
+	start = now_us();
+	for (i = 0; i < reps; i++)
+		blit_move(origin, pitch, x, y, cx, cy, srcx, srcy);
+	one_us = (now_us() - start) / reps;
+
+	blit_set_threads(BLIT_MAX_THREADS);
+	start = now_us();
+	for (i = 0; i < reps; i++)
+		blit_move(origin, pitch, x, y, cx, cy, srcx, srcy);
+	many_us = (now_us() - start) / reps;
+
+	printf("%-16s %4dx%-4d  snapshot %8.1f us  blit %8.1f us  %d threads %8.1f us\n", name, cx, cy, snapshot_us,
+	       one_us, BLIT_MAX_THREADS, many_us);
+	free(snapshot);
+}
+
+int
+main(int argc, char *argv[])
+{
+	uint32_t *frame;
+	int i;
+
+	width = argc > 1 ? atoi(argv[1]) : 1920;
+	height = argc > 2 ? atoi(argv[2]) : 1200;
+
+	if (check())
+		return 1;
+
+	frame = malloc(width * height * 4);
+	for (i = 0; i < width * height; i++)
+		frame[i] = i;
+
+	printf("%dx%d screen\n", width, height);
+	report("scroll 3 lines", frame, 0, 80, width - 20, height - 160 - 48, 0, 128);
+	report("scroll a page", frame, 0, 80, width - 20, height / 4, 0, height - 80 - height / 4);
+	report("scroll sideways", frame, 0, 80, width - 120, height - 160, 100, 80);
+	report("drag a window", frame, width / 8 + 10, height / 8 + 5, width / 2, height / 2, width / 8, height / 8);
+	report("small scroll", frame, width / 4, height / 4, width / 5, height / 10, width / 4, height / 4 + 16);
+
+	free(frame);
+	return 0;
+}
@@ -0,0 +1,264 @@
+/*	Copyright (c) 2007-2012 Dorian Johnson <2011@dorianj.net>
+	
+	This file is part of CoRD.
+	CoRD is free software; you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation; either version 2 of the License, or (at your option) any later
+	version.
+
+	CoRD is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+	FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License along with
+	CoRD; if not, write to the Free Software Foundation, Inc., 51 Franklin St,
+	Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+/*
+ * bmpcache_replay: replay a bitmap cache trace against other cache geometries.
+ *
+ * Record a trace by setting the CRDBitmapCacheTracePath default before
+ * connecting:
+ *
+ *	defaults write net.sf.cord CRDBitmapCacheTracePath ~/Desktop/bmpcache.trace
+ *
+ * then replay it against the geometries you want to compare (cells in
+ * cache 0, 1 and 2):
+ *
+ *	cc -O2 -o bmpcache_replay bmpcache_replay.c
+ *	./bmpcache_replay ~/Desktop/bmpcache.trace 120,120,336 600,300,2550
+ *
+ * Every bitmap the server sent or referenced is looked up in a simulated LRU
+ * cache of the given geometry, using the cache the server would pick for its
+ * size. A miss is a bitmap the server would have had to send again. The
+ * chosen geometry can then be set with
+ *
+ *	defaults write net.sf.cord CRDBitmapCacheCells -array 600 300 2550
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NUM_CACHES 3
+#define MAX_CELLS 0x7fff
+#define NOT_SET -1
+
+typedef struct
+{
+	unsigned int key;
+	int pixels;
+} event;
+
+typedef struct
+{
+	unsigned int key;
+	int pixels, used;
+	int cache, previous, next;	/* LRU list, cache is NOT_SET when not cached */
+} slot;
+
+static event *events;
+static int num_events;
+
+static slot *slots;
+static int num_slots;
+
+/* Find or create the slot for a key */
+static int
+slot_for_key(unsigned int key)
+{
+	int i = (key * 2654435761u) & (num_slots - 1);
+
+	while (slots[i].used && slots[i].key != key)
+		i = (i + 1) & (num_slots - 1);
+
+	slots[i].used = 1;
+	slots[i].key = key;
+	return i;
+}
+
+/* Cache 0 holds up to 16x16 pixels, cache 1 32x32 and cache 2 64x64 */
+static int
+cache_for_pixels(int pixels)
+{
+	int id;
+
+	for (id = 0; id < NUM_CACHES - 1; id++)
+		if (pixels <= (0x100 << (2 * id)))
+			break;
+	return id;
+}
+
+static void
+load_trace(const char *path)
+{
+	FILE *fp;
+	char line[128], op;
+	int id, width, height, capacity = 0x10000, i;
+	unsigned int key;
+
+	if ((fp = fopen(path, "r")) == NULL)
+	{
+		perror(path);
+		exit(1);
+	}
+
+	num_slots = 0x10000;
+	slots = calloc(num_slots, sizeof(slot));
+	events = malloc(capacity * sizeof(event));
+
+	while (fgets(line, sizeof(line), fp))
+	{
+		op = line[0];
+		if (op == 'P' && sscanf(line + 1, "%d %d %d %x", &id, &width, &height, &key) == 4)
+		{
+			i = slot_for_key(key);
+			slots[i].pixels = width * height;
+		}
+		else if (op == 'G' && sscanf(line + 1, "%d %x", &id, &key) == 2)
+		{
+			/* loaded from the persistent cache before tracing started */
+			if (key == 0)
+				continue;
+			i = slot_for_key(key);
+		}
+		else
+		{
+			continue;
+		}
+
+		if (num_events == capacity)
+		{
+			capacity *= 2;
+			events = realloc(events, capacity * sizeof(event));
+		}
+		events[num_events].key = key;
+		events[num_events].pixels = slots[i].pixels;
+		num_events++;
+
+		/* keep the table at most half full */
+		if (num_events * 2 > num_slots)
+		{
+			slot *old = slots;
+			int n, old_slots = num_slots;
+
+			num_slots *= 2;
+			slots = calloc(num_slots, sizeof(slot));
+			for (n = 0; n < old_slots; n++)
+				if (old[n].used)
+					slots[slot_for_key(old[n].key)].pixels = old[n].pixels;
+			free(old);
+		}
+	}
+
+	fclose(fp);
+}
+
+static void
+replay(const char *geometry)
+{
+	int cells[NUM_CACHES] = { 0 }, count[NUM_CACHES] = { 0 };
+	int lru[NUM_CACHES], mru[NUM_CACHES];
+	long hits[NUM_CACHES] = { 0 }, misses[NUM_CACHES] = { 0 }, resent = 0, total = 0;
+	int n, i, id;
+
+	if (sscanf(geometry, "%d,%d,%d", &cells[0], &cells[1], &cells[2]) != NUM_CACHES)
+	{
+		fprintf(stderr, "bad geometry \"%s\", expected cells0,cells1,cells2\n", geometry);
+		return;
+	}
+
+	for (id = 0; id < NUM_CACHES; id++)
+	{
+		if (cells[id] < 0 || cells[id] > MAX_CELLS)
+			cells[id] = MAX_CELLS;
+		lru[id] = mru[id] = NOT_SET;
+	}
+
+	for (n = 0; n < num_slots; n++)
+		slots[n].cache = slots[n].previous = slots[n].next = NOT_SET;
+
+	for (n = 0; n < num_events; n++)
+	{
+		i = slot_for_key(events[n].key);
+		id = cache_for_pixels(events[n].pixels);
+		total += events[n].pixels;
+
+		if (slots[i].cache == id)
+		{
+			hits[id]++;
+
+			/* unlink */
+			if (slots[i].previous != NOT_SET)
+				slots[slots[i].previous].next = slots[i].next;
+			else
+				lru[id] = slots[i].next;
+			if (slots[i].next != NOT_SET)
+				slots[slots[i].next].previous = slots[i].previous;
+			else
+				mru[id] = slots[i].previous;
+		}
+		else
+		{
+			misses[id]++;
+			resent += events[n].pixels;
+
+			if (cells[id] == 0)
+				continue;
+
+			if (count[id] == cells[id])
+			{
+				int victim = lru[id];
+
+				lru[id] = slots[victim].next;
+				if (lru[id] != NOT_SET)
+					slots[lru[id]].previous = NOT_SET;
+				else
+					mru[id] = NOT_SET;
+				slots[victim].cache = NOT_SET;
+				count[id]--;
+			}
+
+			slots[i].cache = id;
+			count[id]++;
+		}
+
+		/* link at the MRU end */
+		slots[i].previous = mru[id];
+		slots[i].next = NOT_SET;
+		if (mru[id] != NOT_SET)
+			slots[mru[id]].next = i;
+		else
+			lru[id] = i;
+		mru[id] = i;
+	}
+
+	printf("%-20s", geometry);
+	for (id = 0; id < NUM_CACHES; id++)
+		printf("  cache %d %6.2f%%", id,
+		       hits[id] + misses[id] ? 100.0 * hits[id] / (hits[id] + misses[id]) : 0.0);
+	printf("  total %6.2f%%  pixels resent %6.2f%%\n",
+	       num_events ? 100.0 * (hits[0] + hits[1] + hits[2]) / num_events : 0.0,
+	       total ? 100.0 * resent / total : 0.0);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int n;
+
+	if (argc < 3)
+	{
+		fprintf(stderr, "usage: %s trace cells0,cells1,cells2 [...]\n", argv[0]);
+		return 1;
+	}
+
+	load_trace(argv[1]);
+	printf("%d bitmap references\n", num_events);
+
+	for (n = 2; n < argc; n++)
+		replay(argv[n]);
+
+	return 0;
+}
@@ -0,0 +1,193 @@
+/*	Copyright (c) 2007-2012 Dorian Johnson <2011@dorianj.net>
+
+	This file is part of CoRD.
+	CoRD is free software; you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation; either version 2 of the License, or (at your option) any later
+	version.
+
+	CoRD is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+	FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License along with
+	CoRD; if not, write to the Free Software Foundation, Inc., 51 Franklin St,
+	Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+/*
+ * evloop_bench: wakeup-to-dispatch latency of the connection thread's event
+ * loop (Source/evloop.c), which only needs POSIX and builds on its own:
+ *
+ *	cc -O2 -I../Source -o evloop_bench evloop_bench.c ../Source/evloop.c -lpthread
+ *	./evloop_bench [wakeups] [interval-us] [server-kbps]
+ *
+ * An input thread calls evloop_wakeup() every interval microseconds (default
+ * 500) in bursts of four, the way input events arrive while dragging. A
+ * server thread writes fixed size updates to a socket at server-kbps
+ * (default 20000), which the loop reads the way rdp_recv() does, and a 10 ms
+ * repeating timer stands in for audio and device polling. Reported are the
+ * loop's own wakeup statistics, how late the timer ran and how long each
+ * update sat in the socket before it was read.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+
+#include "evloop.h"
+
+#define BURST 4
+#define UPDATE_SIZE 4096
+#define TIMER_MS 10
+
+static RDEventLoop *loop;
+static int wakeups_total, interval_us, server_kbps;
+static int wire[2];
+static volatile int done;
+
+static uint64_t handled, timer_runs, timer_late_total, timer_late_max, timer_last;
+static uint64_t updates, update_wait_total, update_wait_max;
+
+static void
+pace(uint64_t until)
+{
+	while (evloop_now() < until)
+		;
+}
+
+static void *
+input_thread(void *unused)
+{
+	uint64_t next = evloop_now();
+	int n;
+
+	for (n = 0; n < wakeups_total; n++)
+	{
+		if (n % BURST == 0)
+			pace(next += (uint64_t) interval_us * BURST);
+		evloop_wakeup(loop);
+	}
+
+	done = 1;
+	evloop_wakeup(loop);
+	return NULL;
+}
+
+static void *
+server_thread(void *unused)
+{
+	unsigned char update[UPDATE_SIZE];
+	uint64_t next = evloop_now(), gap = (uint64_t) UPDATE_SIZE * 8 * 1000 / server_kbps;
+
+	memset(update, 0, sizeof(update));
+	while (!done)
+	{
+		pace(next += gap);
+		*(uint64_t *) update = evloop_now();
+		if (write(wire[1], update, sizeof(update)) <= 0)
+			break;
+	}
+	return NULL;
+}
+
+static void
+input_ready(RDEventLoop * l, void *unused)
+{
+	handled++;
+	if (done)
+		evloop_stop(l);
+}
+
+static void
+socket_ready(RDEventLoop * l, int fd, int events, void *unused)
+{
+	static unsigned char update[UPDATE_SIZE];
+	static int have;
+	uint64_t wait;
+	ssize_t got;
+
+	/* One read per callback, so it never blocks */
+	if ((got = read(fd, update + have, UPDATE_SIZE - have)) <= 0)
+		return;
+
+	have += got;
+	if (have < UPDATE_SIZE)
+		return;
+
+	wait = evloop_now() - *(uint64_t *) update;
+	updates++;
+	update_wait_total += wait;
+	if (wait > update_wait_max)
+		update_wait_max = wait;
+	have = 0;
+}
+
+static void
+timer_fired(RDEventLoop * l, void *unused)
+{
+	uint64_t now = evloop_now(), late;
+
+	if (timer_last != 0)
+	{
+		late = now - timer_last > TIMER_MS * 1000 ? now - timer_last - TIMER_MS * 1000 : 0;
+		timer_late_total += late;
+		if (late > timer_late_max)
+			timer_late_max = late;
+		timer_runs++;
+	}
+	timer_last = now;
+}
+
+int
+main(int argc, char *argv[])
+{
+	RDEventLoopStats stats;
+	pthread_t input, server;
+	uint64_t start;
+
+	wakeups_total = argc > 1 ? atoi(argv[1]) : 20000;
+	interval_us = argc > 2 ? atoi(argv[2]) : 500;
+	server_kbps = argc > 3 ? atoi(argv[3]) : 20000;
+	signal(SIGPIPE, SIG_IGN);
+
+	if ((loop = evloop_new()) == NULL || socketpair(AF_UNIX, SOCK_STREAM, 0, wire) == -1)
+	{
+		perror("evloop_bench");
+		return 1;
+	}
+
+	evloop_set_wakeup_handler(loop, input_ready, NULL);
+	evloop_add_fd(loop, wire[0], EVLOOP_READ, socket_ready, NULL);
+	evloop_add_timer(loop, TIMER_MS, 1, timer_fired, NULL);
+
+	printf("%d wakeups, one every %d us in bursts of %d, server sending %d kbit/s, %d ms timer\n",
+	       wakeups_total, interval_us, BURST, server_kbps, TIMER_MS);
+
+	start = evloop_now();
+	pthread_create(&server, NULL, server_thread, NULL);
+	pthread_create(&input, NULL, input_thread, NULL);
+	evloop_run(loop);
+	pthread_join(input, NULL);
+	close(wire[0]);
+	pthread_join(server, NULL);
+	close(wire[1]);
+
+	evloop_get_stats(loop, &stats);
+	printf("%.2f s, %llu poll() calls\n", (evloop_now() - start) / 1e6, (unsigned long long) stats.iterations);
+	printf("wakeups  %8llu dispatched %8llu coalesced  latency mean %7.2f us  max %8.2f us\n",
+	       (unsigned long long) stats.wakeups, (unsigned long long) stats.coalesced,
+	       stats.wakeups ? (double) stats.latencyTotal / stats.wakeups : 0.0, (double) stats.latencyMax);
+	printf("socket   %8llu updates  wait mean %7.2f us  max %8.2f us\n", (unsigned long long) updates,
+	       updates ? (double) update_wait_total / updates : 0.0, (double) update_wait_max);
+	printf("timer    %8llu runs     late mean %7.2f us  max %8.2f us\n", (unsigned long long) timer_runs,
+	       timer_runs ? (double) timer_late_total / timer_runs : 0.0, (double) timer_late_max);
+
+	evloop_free(loop);
+	return 0;
+}
@@ -0,0 +1,253 @@
+/*	Copyright (c) 2007-2012 Dorian Johnson <2011@dorianj.net>
+
+	This file is part of CoRD.
+	CoRD is free software; you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation; either version 2 of the License, or (at your option) any later
+	version.
+
+	CoRD is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+	FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License along with
+	CoRD; if not, write to the Free Software Foundation, Inc., 51 Franklin St,
+	Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+/*
+ * framebuf_bench: check and measure the handoff of frames from the
+ * connection thread to the main thread (Source/framebuf.c).
+ *
+ *	cc -O2 -I../Source -o framebuf_bench framebuf_bench.c ../Source/framebuf.c ../Source/tiles.c \
+ *		../Source/blit.c -lpthread
+ *	./framebuf_bench [updates]
+ *
+ * First a decoding thread draws numbered updates into a bottom-up buffer
+ * like the backing store and publishes each, while a presenting thread
+ * takes frames as fast as it can and keeps a copy of the screen from their
+ * damaged tiles alone, as the screen texture is. Every frame taken is
+ * compared with the screen replayed up to its update, so a frame caught
+ * half filled, or damage that misses something, fails. It exits with
+ * status 1 if any check fails.
+ *
+ * Then it times publishing typical updates on 1920x1200 and 3840x2160
+ * screens against copying the whole screen for each.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#include "framebuf.h"
+
+#define CHECK_WIDTH	160
+#define CHECK_HEIGHT	120
+
+static RDFramebuffer fb;
+static int updates, failures, taken;
+static volatile int finished;
+
+static double
+now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/* Draws update n into a screen at origin, adding what it touched to dirty;
+   the same every time for the same n */
+static void
+draw_update(uint32_t * origin, int pitch, unsigned long n, RDTileMap * dirty)
+{
+	unsigned seed = n * 2654435761u;
+	int rects = 1 + n % 5, i, x, y;
+
+	for (i = 0; i < rects; i++)
+	{
+		int cx = 1 + (seed = seed * 1103515245 + 12345) % 48, cy = 1 + (seed = seed * 1103515245 + 12345) % 48;
+		int left = (seed = seed * 1103515245 + 12345) % (CHECK_WIDTH - cx + 1);
+		int top = (seed = seed * 1103515245 + 12345) % (CHECK_HEIGHT - cy + 1);
+
+		for (y = top; y < top + cy; y++)
+			for (x = left; x < left + cx; x++)
+				((uint32_t *) ((uint8_t *) origin + y * pitch))[x] = n * 31 + x * 7 + y;
+		if (dirty != NULL)
+			tilemap_add(dirty, left, top, cx, cy);
+	}
+}
+
+static void *
+decoder(void *unused)
+{
+	int pitch = -CHECK_WIDTH * 4;
+	uint32_t *store = calloc(CHECK_WIDTH * CHECK_HEIGHT, 4), *origin = store + (CHECK_HEIGHT - 1) * CHECK_WIDTH;
+	RDTileMap dirty = { 0 };
+	unsigned long n;
+
+	tilemap_init(&dirty, CHECK_WIDTH, CHECK_HEIGHT);
+	for (n = 1; n <= (unsigned long) updates; n++)
+	{
+		tilemap_clear(&dirty);
+		draw_update(origin, pitch, n, &dirty);
+		framebuf_publish(&fb, origin, n % 1000 == 0 ? NULL : &dirty);
+		if (n % 7 == 0)
+			sched_yield();
+	}
+
+	finished = 1;
+	tilemap_destroy(&dirty);
+	free(store);
+	return NULL;
+}
+
+static void *
+presenter(void *unused)
+{
+	int pitch = -CHECK_WIDTH * 4, i, n, row;
+	RDTileRect spans[(CHECK_WIDTH / TILE_SIZE + 2) / 2];
+	uint32_t *texture = calloc(CHECK_WIDTH * CHECK_HEIGHT, 4), *replay = calloc(CHECK_WIDTH * CHECK_HEIGHT, 4);
+	uint32_t *texture_origin = texture + (CHECK_HEIGHT - 1) * CHECK_WIDTH;
+	uint32_t *replay_origin = replay + (CHECK_HEIGHT - 1) * CHECK_WIDTH;
+	unsigned long replayed = 0;
+	const RDFrame *frame;
+
+	while (!failures)
+	{
+		int done = finished;
+
+		if ((frame = framebuf_acquire(&fb)) == NULL)
+		{
+			if (done)
+				break;
+			sched_yield();
+			continue;
+		}
+		taken++;
+
+		while (replayed < frame->seq)
+			draw_update(replay_origin, pitch, ++replayed, NULL);
+
+		if (memcmp(frame->data, replay, CHECK_WIDTH * CHECK_HEIGHT * 4))
+		{
+			printf("FAIL: frame of update %lu doesn't match it\n", frame->seq);
+			failures++;
+			break;
+		}
+
+		for (i = 0; i < frame->damage.rows; i++)
+			for (n = tilemap_row_spans(&frame->damage, i, spans); n-- > 0;)
+			{
+				RDTileRect r = spans[n];
+				uint32_t *from = framebuf_origin(&fb, frame);
+
+				for (row = r.y; row < r.y + r.cy; row++)
+					memcpy((uint8_t *) texture_origin + row * pitch + r.x * 4,
+					       (uint8_t *) from + row * pitch + r.x * 4, r.cx * 4);
+			}
+
+		if (memcmp(texture, replay, CHECK_WIDTH * CHECK_HEIGHT * 4))
+		{
+			printf("FAIL: texture updated from the damage of update %lu is missing something\n", frame->seq);
+			failures++;
+			break;
+		}
+	}
+
+	free(texture);
+	free(replay);
+	return NULL;
+}
+
+static int
+check(void)
+{
+	pthread_t threads[2];
+
+	framebuf_init(&fb, CHECK_WIDTH, CHECK_HEIGHT, -CHECK_WIDTH * 4);
+	pthread_create(&threads[0], NULL, presenter, NULL);
+	pthread_create(&threads[1], NULL, decoder, NULL);
+	pthread_join(threads[1], NULL);
+	pthread_join(threads[0], NULL);
+	framebuf_destroy(&fb);
+
+	if (!failures)
+		printf("check: %d updates published, %d frames presented, all whole\n\n", updates, taken);
+	return failures;
+}
+
+static void
+report(const char *name, int width, int height, const RDTileMap * dirty)
+{
+	uint32_t *store = calloc((size_t) width * height, 4), *copy = malloc((size_t) width * height * 4);
+	uint32_t *origin = store + (height - 1) * width;
+	double start, whole_us, publish_us;
+	int i, reps = 200;
+
+	framebuf_init(&fb, width, height, -width * 4);
+
+	start = now_us();
+	for (i = 0; i < reps; i++)
+		memcpy(copy, store, (size_t) width * height * 4);
+	whole_us = (now_us() - start) / reps;
+
+	start = now_us();
+	for (i = 0; i < reps; i++)
+	{
+		framebuf_publish(&fb, origin, dirty);
+		if (i % 2)
+			framebuf_acquire(&fb);
+	}
+	publish_us = (now_us() - start) / reps;
+
+	printf("%-16s %8ld pixels  whole screen %8.1f us  publish %8.1f us  (%6.1fx)\n", name,
+	       dirty ? tilemap_area(dirty) : (long) width * height, whole_us, publish_us, whole_us / publish_us);
+
+	framebuf_destroy(&fb);
+	free(store);
+	free(copy);
+}
+
+int
+main(int argc, char *argv[])
+{
+	static const int sizes[][2] = { {1920, 1200}, {3840, 2160} };
+	RDTileMap dirty = { 0 };
+	int i, size, width, height;
+
+	updates = argc > 1 ? atoi(argv[1]) : 100000;
+	if (check())
+		return 1;
+
+	for (size = 0; size < 2; size++)
+	{
+		width = sizes[size][0];
+		height = sizes[size][1];
+		if (!tilemap_init(&dirty, width, height))
+			return 1;
+		printf("%s%dx%d screen\n", size ? "\n" : "", width, height);
+
+		tilemap_add(&dirty, 400, 300, 8, 16);
+		report("caret", width, height, &dirty);
+
+		tilemap_clear(&dirty);
+		for (i = 0; i < 40; i++)
+			tilemap_add(&dirty, 200 + i * 9, 500, 9, 16);
+		report("typing", width, height, &dirty);
+
+		tilemap_clear(&dirty);
+		tilemap_add(&dirty, 0, 80, width - 20, height - 208);
+		report("scroll", width, height, &dirty);
+
+		report("whole screen", width, height, NULL);
+	}
+
+	tilemap_destroy(&dirty);
+	return 0;
+}
@@ -0,0 +1,363 @@
+/*	Copyright (c) 2007-2012 Dorian Johnson <2011@dorianj.net>
+
+	This file is part of CoRD.
+	CoRD is free software; you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation; either version 2 of the License, or (at your option) any later
+	version.
+
+	CoRD is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+	FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License along with
+	CoRD; if not, write to the Free Software Foundation, Inc., 51 Franklin St,
+	Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+/*
+ * input_queue_bench: event-to-wire latency of the input queue between the
+ * main thread and the connection thread, under mouse-drag load.
+ *
+ *	cc -O2 -o input_queue_bench input_queue_bench.c -lpthread
+ *	./input_queue_bench [events] [interval-us] [render-us]
+ *
+ * A producer thread stands in for the main thread and queues mouse move
+ * events every interval microseconds (default 250, a fast drag), in bursts
+ * the way AppKit delivers them. A consumer thread stands in for the
+ * connection thread: it waits on a pipe (the Mach port) and writes each
+ * batch to a socket as one PDU. Once per 60 Hz frame it is also busy for
+ * render microseconds (default 4000) drawing the server's updates, which
+ * is when input piles up. This is done once with the old queue (a
+ * malloc per event, a locked array drained from the front and one wakeup
+ * message per event) and once with the lock-free ring and coalesced wakeups
+ * used by -[CRDSession sendInputOnConnectionThread:...]. When the ring is
+ * full, events go to its locked overflow queue; the session drops mouse
+ * motion there instead, but here every event is kept so that all of them
+ * are timed. For each it reports wakeups, PDUs written and the latency from
+ * queueing to the write returning.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/socket.h>
+
+#define RING_SIZE 256
+#define OLD_BATCH 64
+#define MAX_BATCH 255
+#define BURST 4
+
+typedef struct
+{
+	unsigned int time;
+	unsigned short type, deviceFlags, param1, param2;
+	uint64_t queuedAt;
+} input_event;
+
+static int events_total, interval_us, render_us;
+static uint64_t next_frame;
+static int wake_pipe[2], wire[2];
+static uint64_t *latencies;
+static int latency_count;
+static long wakeups, pdus;
+
+/* old queue */
+static pthread_mutex_t old_lock = PTHREAD_MUTEX_INITIALIZER;
+static input_event **old_array;
+static int old_count;
+
+/* ring */
+static input_event ring[RING_SIZE];
+static volatile uint32_t ring_head, ring_tail;
+static volatile int32_t wakeup_pending;
+static pthread_mutex_t overflow_lock = PTHREAD_MUTEX_INITIALIZER;
+static input_event *overflow;
+static int overflow_count;
+static volatile int overflowing;
+
+static uint64_t
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void
+pace(uint64_t until)
+{
+	while (now_ns() < until)
+		;
+}
+
+/* Stand in for processing server updates on the connection thread */
+static void
+render(void)
+{
+	uint64_t t = now_ns();
+
+	if (t < next_frame)
+		return;
+	pace(t + (uint64_t) render_us * 1000);
+	next_frame = t + 16667000;
+}
+
+static void
+wake(void)
+{
+	char c = 0;
+
+	write(wake_pipe[1], &c, 1);
+}
+
+static void
+send_pdu(input_event *events, int count)
+{
+	unsigned char pdu[4 + 7 * MAX_BATCH];
+	int i, length = 0;
+	uint64_t t;
+
+	/* roughly a fast-path input PDU: header and 7 bytes per mouse event */
+	pdu[length++] = 0;
+	pdu[length++] = 0;
+	pdu[length++] = 0;
+	pdu[length++] = count;
+	for (i = 0; i < count; i++)
+	{
+		memcpy(pdu + length, &events[i].deviceFlags, 6);
+		length += 7;
+	}
+	write(wire[1], pdu, length);
+	pdus++;
+
+	t = now_ns();
+	for (i = 0; i < count; i++)
+		latencies[latency_count++] = t - events[i].queuedAt;
+}
+
+static void
+make_event(input_event *ie, int n)
+{
+	ie->time = n;
+	ie->type = 0x8001;
+	ie->deviceFlags = 0x0800;
+	ie->param1 = n % 1280;
+	ie->param2 = n % 800;
+	ie->queuedAt = now_ns();
+}
+
+static void *
+old_producer(void *unused)
+{
+	uint64_t next = now_ns();
+	int n;
+
+	for (n = 0; n < events_total; n++)
+	{
+		input_event *ie = malloc(sizeof(input_event));
+
+		if (n % BURST == 0)
+			pace(next += (uint64_t) interval_us * 1000 * BURST);
+		make_event(ie, n);
+
+		pthread_mutex_lock(&old_lock);
+		old_array[old_count++] = ie;
+		pthread_mutex_unlock(&old_lock);
+		wake();
+	}
+	wake();
+	return NULL;
+}
+
+static void *
+old_consumer(void *unused)
+{
+	input_event batch[OLD_BATCH];
+	char c;
+	int count;
+
+	while (latency_count < events_total)
+	{
+		read(wake_pipe[0], &c, 1);
+		wakeups++;
+		render();
+
+		do
+		{
+			count = 0;
+			pthread_mutex_lock(&old_lock);
+			while (old_count != 0 && count < OLD_BATCH)
+			{
+				input_event *ie = old_array[0];
+
+				memmove(old_array, old_array + 1, --old_count * sizeof(input_event *));
+				batch[count++] = *ie;
+				free(ie);
+			}
+			pthread_mutex_unlock(&old_lock);
+
+			if (count)
+				send_pdu(batch, count);
+		}
+		while (count == OLD_BATCH);
+	}
+	return NULL;
+}
+
+static void *
+ring_producer(void *unused)
+{
+	uint64_t next = now_ns();
+	uint32_t head;
+	int n;
+
+	for (n = 0; n < events_total; n++)
+	{
+		if (n % BURST == 0)
+			pace(next += (uint64_t) interval_us * 1000 * BURST);
+
+		head = ring_head;
+		if (overflowing || head - ring_tail == RING_SIZE)
+		{
+			pthread_mutex_lock(&overflow_lock);
+			make_event(&overflow[overflow_count++], n);
+			overflowing = 1;
+			pthread_mutex_unlock(&overflow_lock);
+		}
+		else
+		{
+			make_event(&ring[head % RING_SIZE], n);
+			__sync_synchronize();
+			ring_head = head + 1;
+		}
+
+		if (__sync_bool_compare_and_swap(&wakeup_pending, 0, 1))
+			wake();
+	}
+	return NULL;
+}
+
+static void *
+ring_consumer(void *unused)
+{
+	input_event *batch = malloc(events_total * sizeof(input_event));
+	uint32_t head, tail;
+	char c;
+	int count, i;
+
+	while (latency_count < events_total)
+	{
+		read(wake_pipe[0], &c, 1);
+		wakeups++;
+		render();
+
+		__sync_bool_compare_and_swap(&wakeup_pending, 1, 0);
+		tail = ring_tail;
+		head = ring_head;
+		__sync_synchronize();
+
+		count = head - tail;
+		for (i = 0; i < count; i++)
+			batch[i] = ring[(tail + i) % RING_SIZE];
+		__sync_synchronize();
+		ring_tail = head;
+
+		/* the overflow follows the ring, once this drain has emptied it */
+		if (overflowing)
+		{
+			__sync_synchronize();
+			if (ring_head == head)
+			{
+				pthread_mutex_lock(&overflow_lock);
+				memcpy(batch + count, overflow, overflow_count * sizeof(input_event));
+				count += overflow_count;
+				overflow_count = 0;
+				overflowing = 0;
+				pthread_mutex_unlock(&overflow_lock);
+			}
+		}
+
+		for (i = 0; i < count; i += MAX_BATCH)
+			send_pdu(batch + i, count - i < MAX_BATCH ? count - i : MAX_BATCH);
+	}
+	free(batch);
+	return NULL;
+}
+
+static void *
+drain_wire(void *unused)
+{
+	char buffer[0x10000];
+
+	while (read(wire[0], buffer, sizeof(buffer)) > 0)
+		;
+	return NULL;
+}
+
+static int
+compare_latency(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+
+	return (x > y) - (x < y);
+}
+
+static void
+run(const char *name, void *(*producer) (void *), void *(*consumer) (void *))
+{
+	pthread_t p, c, d;
+	uint64_t sum = 0;
+	int n;
+
+	pipe(wake_pipe);
+	socketpair(AF_UNIX, SOCK_STREAM, 0, wire);
+	latency_count = 0;
+	wakeups = pdus = 0;
+	next_frame = 0;
+
+	pthread_create(&d, NULL, drain_wire, NULL);
+	pthread_create(&c, NULL, consumer, NULL);
+	pthread_create(&p, NULL, producer, NULL);
+	pthread_join(p, NULL);
+	pthread_join(c, NULL);
+	close(wire[1]);
+	pthread_join(d, NULL);
+	close(wire[0]);
+	close(wake_pipe[0]);
+	close(wake_pipe[1]);
+
+	qsort(latencies, latency_count, sizeof(uint64_t), compare_latency);
+	for (n = 0; n < latency_count; n++)
+		sum += latencies[n];
+
+	printf("%-6s %8ld wakeups %8ld PDUs  %5.1f events/PDU  latency mean %7.2f us  p99 %7.2f us  max %8.2f us\n",
+	       name, wakeups, pdus, (double) latency_count / pdus,
+	       sum / 1000.0 / latency_count,
+	       latencies[latency_count * 99 / 100] / 1000.0,
+	       latencies[latency_count - 1] / 1000.0);
+}
+
+int
+main(int argc, char *argv[])
+{
+	events_total = argc > 1 ? atoi(argv[1]) : 20000;
+	interval_us = argc > 2 ? atoi(argv[2]) : 250;
+	render_us = argc > 3 ? atoi(argv[3]) : 4000;
+
+	latencies = malloc(events_total * sizeof(uint64_t));
+	old_array = malloc(events_total * sizeof(input_event *));
+	overflow = malloc(events_total * sizeof(input_event));
+
+	printf("%d mouse events, one every %d us in bursts of %d, %d us rendering per frame\n",
+	       events_total, interval_us, BURST, render_us);
+	run("old", old_producer, old_consumer);
+	run("ring", ring_producer, ring_consumer);
+
+	return 0;
+}
@@ -0,0 +1,219 @@
+/*	Copyright (c) 2007-2012 Dorian Johnson <2011@dorianj.net>
+
+	This file is part of CoRD.
+	CoRD is free software; you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation; either version 2 of the License, or (at your option) any later
+	version.
+
+	CoRD is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+	FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License along with
+	CoRD; if not, write to the Free Software Foundation, Inc., 51 Franklin St,
+	Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+/*
+ * pixconv_bench: check and measure the conversion of bitmap data to
+ * backing store pixels (Source/pixconv.c).
+ *
+ *	cc -O2 -mssse3 -I../Source -o pixconv_bench pixconv_bench.c ../Source/pixconv.c
+ *	./pixconv_bench [pixels]
+ *
+ * Build with -DPIXCONV_NO_SIMD to time the table-driven scalar code alone.
+ *
+ * First it converts every 15 and 16 bit value, random 24 and 32 bit data
+ * and every palette index, in runs of awkward lengths so that the vector
+ * loops and their tails are both used, and compares each pixel with the
+ * integer division the client used to do. It exits with status 1 if any
+ * check fails.
+ *
+ * Then it times converting a bitmap of the given size (default a 64x64
+ * cache tile repeated to 1920x1200 worth of pixels) at each depth, against
+ * that per-pixel loop.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "pixconv.h"
+
+static uint32_t palette[256];
+
+static double
+now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/* What -[CRDBitmap initWithBitmapData:] did before, one pixel at a time */
+static void
+old_convert(int bpp, uint8_t * out, const uint8_t * p, int n)
+{
+	const uint8_t *end = p + n * ((bpp + 7) / 8);
+
+	while (p < end)
+	{
+		unsigned short c = p[0] | (p[1] << 8);
+
+		if (bpp == 8)
+		{
+			memcpy(out, &palette[*p], 4);
+			p += 1;
+		}
+		else if (bpp == 16)
+		{
+			out[3] = 255;
+			out[2] = (((c >> 11) & 0x1f) * 255 + 15) / 31;
+			out[1] = (((c >> 5) & 0x3f) * 255 + 31) / 63;
+			out[0] = ((c & 0x1f) * 255 + 15) / 31;
+			p += 2;
+		}
+		else if (bpp == 15)
+		{
+			out[3] = 255;
+			out[2] = (((c >> 10) & 0x1f) * 255 + 15) / 31;
+			out[1] = (((c >> 5) & 0x1f) * 255 + 15) / 31;
+			out[0] = ((c & 0x1f) * 255 + 15) / 31;
+			p += 2;
+		}
+		else
+		{
+			out[3] = 255;
+			out[2] = p[2];
+			out[1] = p[1];
+			out[0] = p[0];
+			p += bpp / 8;
+		}
+		out += 4;
+	}
+}
+
+static int
+check_depth(int bpp, const uint8_t * src, int n)
+{
+	uint32_t *got = malloc(n * 4 + 4), *want = malloc(n * 4);
+	int start, len, i, Bpp = (bpp + 7) / 8;
+
+	old_convert(bpp, (uint8_t *) want, src, n);
+
+	/* Runs of every length from 1 to 40 pixels, then the rest in one go */
+	for (start = 0, len = 1; start < n; start += len, len = len < 40 ? len + 1 : n)
+	{
+		if (start + len > n)
+			len = n - start;
+
+		got[start + len] = 0xdeadbeef;
+		pixconv_row(bpp, got + start, src + start * Bpp, len, palette);
+		if (got[start + len] != 0xdeadbeef && start + len < n)
+		{
+			printf("FAIL: %d bpp run of %d wrote past its end\n", bpp, len);
+			return 1;
+		}
+	}
+
+	for (i = 0; i < n; i++)
+		if (got[i] != want[i])
+		{
+			printf("FAIL: %d bpp pixel %d: %08x, expected %08x\n", bpp, i, got[i], want[i]);
+			return 1;
+		}
+
+	free(got);
+	free(want);
+	return 0;
+}
+
+static int
+check(void)
+{
+	int n = 65536 * 4, i;
+	uint8_t *src = malloc(n * 4);
+	int failures = 0;
+
+	for (i = 0; i < 65536; i++)
+	{
+		src[i * 2] = i & 0xff;
+		src[i * 2 + 1] = i >> 8;
+	}
+	failures += check_depth(16, src, 65536);
+	failures += check_depth(15, src, 65536);
+
+	for (i = 0; i < n * 4; i++)
+		src[i] = rand();
+	failures += check_depth(24, src, n);
+	failures += check_depth(32, src, n);
+	failures += check_depth(8, src, n);
+
+	for (i = 0; i < 65536; i++)
+	{
+		uint32_t want16, want15;
+
+		old_convert(16, (uint8_t *) & want16, (uint8_t *) & i, 1);
+		old_convert(15, (uint8_t *) & want15, (uint8_t *) & i, 1);
+		if (pixconv_colour(16, i, palette) != want16 || pixconv_colour(15, i, palette) != want15)
+		{
+			printf("FAIL: pixconv_colour(%04x)\n", i);
+			failures++;
+			break;
+		}
+	}
+
+	free(src);
+	if (!failures)
+		printf("check: 8, 15, 16, 24 and 32 bpp conversions match\n\n");
+	return failures;
+}
+
+int
+main(int argc, char *argv[])
+{
+	int pixels = argc > 1 ? atoi(argv[1]) : 1920 * 1200;
+	int depths[] = { 8, 15, 16, 24, 32 };
+	uint8_t *src = malloc(pixels * 4);
+	uint32_t *dst = malloc(pixels * 4);
+	double start, old_us, new_us;
+	int d, i, reps = 20;
+
+	for (i = 0; i < 256; i++)
+		palette[i] = PIXCONV_ARGB(0xff, i, 255 - i, i * 7);
+
+	if (check())
+		return 1;
+
+	for (i = 0; i < pixels * 4; i++)
+		src[i] = rand();
+
+#ifdef PIXCONV_NO_SIMD
+	printf("%d pixels, tables only\n", pixels);
+#else
+	printf("%d pixels\n", pixels);
+#endif
+	for (d = 0; d < 5; d++)
+	{
+		start = now_us();
+		for (i = 0; i < reps; i++)
+			old_convert(depths[d], (uint8_t *) dst, src, pixels);
+		old_us = (now_us() - start) / reps;
+
+		start = now_us();
+		for (i = 0; i < reps; i++)
+			pixconv_row(depths[d], dst, src, pixels, palette);
+		new_us = (now_us() - start) / reps;
+
+		printf("%2d bpp  per pixel %8.1f us  pixconv %8.1f us  (%5.1fx)  %6.0f Mpixel/s\n", depths[d], old_us,
+		       new_us, old_us / new_us, pixels / new_us);
+	}
+
+	free(src);
+	free(dst);
+	return 0;
+}
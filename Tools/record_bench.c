@@ -0,0 +1,448 @@
+/*	Copyright (c) 2007-2012 Dorian Johnson <2011@dorianj.net>
+
+	This file is part of CoRD.
+	CoRD is free software; you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation; either version 2 of the License, or (at your option) any later
+	version.
+
+	CoRD is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+	FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License along with
+	CoRD; if not, write to the Free Software Foundation, Inc., 51 Franklin St,
+	Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+/*
+ * record_bench: check and measure session recording (Source/record.c).
+ *
+ *	cc -O2 -I../Source -o record_bench record_bench.c ../Source/record.c ../Source/tiles.c
+ *	./record_bench [updates]
+ *
+ * First it draws a stream of numbered updates into a bottom-up buffer like
+ * the backing store, some of them resizing it, and records each with its
+ * dirty tiles. Then it plays the recording back and compares every frame
+ * with the screen replayed up to that update; seeks to random times and
+ * compares again; and plays copies cut short without their index, as a
+ * recording is when CoRD doesn't get to close it. It exits with status 1
+ * if any check fails.
+ *
+ * Then it records a desktop-like 1920x1080 screen through a minute each of
+ * typing, scrolling and redrawing whole windows, and reports the time each
+ * update took to record and the size of the recording, next to the size of
+ * capturing every frame whole.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "record.h"
+
+#define CHECK_WIDTH	300
+#define CHECK_HEIGHT	200
+
+static char path[] = "/tmp/record_bench.XXXXXX";
+
+static double
+now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static unsigned
+next_random(unsigned *seed)
+{
+	return (*seed = *seed * 1103515245 + 12345) >> 8;
+}
+
+/* The screen's size as of update n: it changes every 150 updates */
+static void
+check_size(unsigned long n, int *width, int *height)
+{
+	*width = CHECK_WIDTH - (n / 150 % 3) * 37;
+	*height = CHECK_HEIGHT - (n / 150 % 3) * 23;
+}
+
+/* Draws update n into a screen at origin, adding what it touched to dirty;
+   the same every time for the same n. Some is flat colour, some noise,
+   and some repeats, as a screen does. */
+static void
+draw_update(uint32_t * origin, int pitch, int width, int height, unsigned long n, RDTileMap * dirty)
+{
+	unsigned seed = n * 2654435761u;
+	int rects = 1 + n % 4, i, x, y;
+
+	for (i = 0; i < rects; i++)
+	{
+		int cx = 1 + next_random(&seed) % 90, cy = 1 + next_random(&seed) % 70, kind = next_random(&seed) % 3;
+		int left, top;
+		uint32_t colour = next_random(&seed);
+
+		cx = cx > width ? width : cx;
+		cy = cy > height ? height : cy;
+		left = next_random(&seed) % (width - cx + 1);
+		top = next_random(&seed) % (height - cy + 1);
+
+		for (y = top; y < top + cy; y++)
+			for (x = left; x < left + cx; x++)
+				((uint32_t *) ((uint8_t *) origin + y * pitch))[x] =
+					kind == 0 ? colour : kind == 1 ? next_random(&seed) : colour + (x / 3) * 0x10101;
+		if (dirty != NULL)
+			tilemap_add(dirty, left, top, cx, cy);
+	}
+}
+
+/* Replays updates from 1 to n into screen, which must be big enough for any size */
+static void
+replay(uint32_t * screen, unsigned long n)
+{
+	unsigned long i;
+	int width = 0, height = 0, w, h;
+
+	for (i = 1; i <= n; i++)
+	{
+		check_size(i, &w, &h);
+		if (w != width || h != height)
+			memset(screen, 0, CHECK_WIDTH * CHECK_HEIGHT * 4);
+		width = w;
+		height = h;
+		draw_update(screen + (height - 1) * width, -width * 4, width, height, i, NULL);
+	}
+}
+
+static int
+compare(const RDPlayback * pb, unsigned long n, uint32_t * screen, const char *how)
+{
+	int width, height, x, y;
+
+	check_size(n, &width, &height);
+	if (pb->width != width || pb->height != height)
+	{
+		printf("FAIL: %s update %lu: %dx%d, expected %dx%d\n", how, n, pb->width, pb->height, width, height);
+		return 1;
+	}
+
+	replay(screen, n);
+	for (y = 0; y < height; y++)
+		for (x = 0; x < width; x++)
+		{
+			uint32_t want = screen[(height - 1 - y) * width + x] | 0xff000000;
+
+			if (pb->pixels[y * width + x] != want)
+			{
+				printf("FAIL: %s update %lu: pixel %d,%d is %08x, expected %08x\n", how, n, x, y,
+				       pb->pixels[y * width + x], want);
+				return 1;
+			}
+		}
+	return 0;
+}
+
+/* Records updates 1 to count, update n at time n * 10 ms */
+static int
+record(unsigned long count, int keyframe_interval, int close)
+{
+	uint32_t *screen = calloc(CHECK_WIDTH * CHECK_HEIGHT, 4);
+	RDRecorder *rec = record_open(path, 1234567890, keyframe_interval);
+	int width = 0, height = 0, w, h, ok = 1;
+	unsigned long n;
+	RDTileMap dirty = { 0 };
+
+	for (n = 1; n <= count && ok; n++)
+	{
+		check_size(n, &w, &h);
+		tilemap_clear(&dirty);
+		if (w != width || h != height)
+		{
+			memset(screen, 0, CHECK_WIDTH * CHECK_HEIGHT * 4);
+			tilemap_init(&dirty, w, h);
+		}
+		width = w;
+		height = h;
+		draw_update(screen + (height - 1) * width, -width * 4, width, height, n, &dirty);
+		ok = record_update(rec, screen + (height - 1) * width, -width * 4, width, height, n % 97 ? &dirty : NULL,
+				   n * 10);
+	}
+
+	tilemap_destroy(&dirty);
+	if (close)
+		ok = record_close(rec) && ok;
+	else
+	{
+		/* Leave the file as a crash would */
+		fflush(rec->file);
+		rec->failed = 1;
+		record_close(rec);
+	}
+	free(screen);
+
+	if (!ok)
+		printf("FAIL: couldn't write %s\n", path);
+	return ok;
+}
+
+static int
+check_play(unsigned long count, const char *how)
+{
+	uint32_t *screen = malloc(CHECK_WIDTH * CHECK_HEIGHT * 4);
+	RDPlayback *pb = playback_open(path);
+	unsigned long last = 0, played = 0;
+	int result, failures = 0;
+
+	if (pb == NULL)
+	{
+		printf("FAIL: %s: couldn't open the recording\n", how);
+		return 1;
+	}
+
+	while (!failures && (result = playback_next(pb)) > 0)
+	{
+		unsigned long n = pb->time / 10 + 1;
+
+		if (n <= last)
+		{
+			printf("FAIL: %s: update %lu played after %lu\n", how, n, last);
+			failures++;
+		}
+		failures += compare(pb, n, screen, how);
+		last = n;
+		played++;
+	}
+
+	if (!failures && result < 0)
+	{
+		printf("FAIL: %s: damaged after update %lu\n", how, last);
+		failures++;
+	}
+	if (!failures && count && last != count)
+	{
+		printf("FAIL: %s: ended at update %lu of %lu\n", how, last, count);
+		failures++;
+	}
+
+	playback_close(pb);
+	free(screen);
+	return failures;
+}
+
+static int
+check_seek(unsigned long count, int seeks)
+{
+	uint32_t *screen = malloc(CHECK_WIDTH * CHECK_HEIGHT * 4);
+	RDPlayback *pb = playback_open(path);
+	int i, failures = 0;
+
+	for (i = 0; i < seeks && !failures; i++)
+	{
+		uint32_t time = rand() % (count * 10 + 50);
+
+		if (playback_seek(pb, time) != 1)
+		{
+			printf("FAIL: seeking to %u ms failed\n", time);
+			failures++;
+		}
+		else if (pb->time > time && pb->time != 0)
+		{
+			printf("FAIL: seeking to %u ms played %u ms\n", time, pb->time);
+			failures++;
+		}
+		else
+			failures += compare(pb, pb->time / 10 + 1, screen, "seek to");
+	}
+
+	playback_close(pb);
+	free(screen);
+	return failures;
+}
+
+static int
+check_truncated(unsigned long count)
+{
+	FILE *file = fopen(path, "rb");
+	long size, cut;
+	char *data;
+	int failures = 0, i;
+
+	fseek(file, 0, SEEK_END);
+	size = ftell(file);
+	data = malloc(size);
+	rewind(file);
+	fread(data, 1, size, file);
+	fclose(file);
+
+	for (i = 0; i < 5 && !failures; i++)
+	{
+		cut = 32 + rand() % (size - 32);
+		file = fopen(path, "wb");
+		fwrite(data, 1, cut, file);
+		fclose(file);
+		failures += check_play(0, "cut short");
+	}
+
+	free(data);
+	return failures;
+}
+
+static int
+check(unsigned long updates)
+{
+	int failures = 0;
+
+	srand(1);
+	if (!record(updates, 500, 1))
+		return 1;
+	failures += check_play(updates, "played");
+	failures += check_seek(updates, 300);
+
+	if (!failures && !record(updates, 2000, 0))
+		return 1;
+	failures += check_play(updates, "played unclosed");
+	failures += check_seek(updates, 50);
+	failures += check_truncated(updates);
+
+	if (!failures)
+		printf("check: %lu updates recorded, played, sought and cut short, all whole\n\n", updates);
+	return failures;
+}
+
+/* A desktop: flat background, windows with title bars, and lines of text */
+static void
+draw_text(uint32_t * origin, int pitch, int x, int y, int chars, unsigned seed)
+{
+	int c, gx, gy;
+
+	for (c = 0; c < chars; c++)
+	{
+		unsigned glyph = next_random(&seed);
+
+		for (gy = 0; gy < 13; gy++)
+			for (gx = 0; gx < 7; gx++)
+			{
+				unsigned bits = (glyph >> ((gx + gy * 3) % 24)) & 7;
+				uint32_t *pixel = (uint32_t *) ((uint8_t *) origin + (y + gy) * pitch) + x + c * 7 + gx;
+
+				*pixel = gy < 2 || gy > 10 || gx == 6 ? 0xffffffff : bits < 4 ? 0xffffffff : bits == 7 ? 0xff000000 : 0xff000000 + bits * 0x282828;
+			}
+	}
+}
+
+static void
+draw_desktop(uint32_t * origin, int pitch, int width, int height)
+{
+	int x, y, line;
+
+	for (y = 0; y < height; y++)
+		for (x = 0; x < width; x++)
+			((uint32_t *) ((uint8_t *) origin + y * pitch))[x] = 0xff3a6ea5;
+
+	for (y = 100; y < 1000; y++)
+		for (x = 200; x < 1700; x++)
+			((uint32_t *) ((uint8_t *) origin + y * pitch))[x] = y < 122 ? 0xff0a246a + (x - 200) / 8 : 0xffffffff;
+	for (line = 0; line < 50; line++)
+		draw_text(origin, pitch, 210, 130 + line * 17, 200, line);
+}
+
+typedef struct
+{
+	const char *name;
+	int updates_per_second;
+} workload;
+
+static void
+report(const workload * w, int width, int height)
+{
+	uint32_t *store = malloc((size_t) width * height * 4), *origin = store + (height - 1) * width;
+	int pitch = -width * 4, i, updates = w->updates_per_second * 60, typed = 0;
+	double start, us = 0, worst = 0;
+	RDRecorder *rec;
+	RDTileMap dirty = { 0 };
+
+	tilemap_init(&dirty, width, height);
+	draw_desktop(origin, pitch, width, height);
+	rec = record_open(path, time(NULL), 0);
+
+	/* The first frame is a keyframe of the whole screen */
+	start = now_us();
+	record_update(rec, origin, pitch, width, height, NULL, 0);
+	double first_us = now_us() - start;
+
+	for (i = 1; i <= updates; i++)
+	{
+		tilemap_clear(&dirty);
+		if (w->name[0] == 't')
+		{
+			/* A character and the caret */
+			int line = typed / 200 % 50, column = typed % 200;
+
+			draw_text(origin, pitch, 210 + column * 7, 130 + line * 17, 1, typed * 31 + 7);
+			tilemap_add(&dirty, 210 + column * 7, 130 + line * 17, 9, 13);
+			typed++;
+		}
+		else if (w->name[0] == 's')
+		{
+			/* The window's contents move up a line, and a new one appears at the bottom */
+			int y;
+
+			for (y = 130; y < 130 + 49 * 17; y++)
+				memcpy((uint8_t *) origin + y * pitch + 200 * 4, (uint8_t *) origin + (y + 17) * pitch + 200 * 4, 1500 * 4);
+			draw_text(origin, pitch, 210, 130 + 49 * 17, 200, i + 1000);
+			tilemap_add(&dirty, 200, 122, 1500, 878);
+		}
+		else
+		{
+			/* The window is drawn again, mostly the same, as often happens */
+			int line = i % 50;
+
+			draw_text(origin, pitch, 210, 130 + line * 17, 200, line + i);
+			tilemap_add(&dirty, 200, 100, 1500, 900);
+		}
+
+		start = now_us();
+		record_update(rec, origin, pitch, width, height, &dirty, (uint64_t) i * 1000 / w->updates_per_second);
+		start = now_us() - start;
+		us += start;
+		worst = start > worst ? start : worst;
+	}
+
+	printf("%-10s %4d/s %7.1f us/update (worst %6.1f us, first %6.1f us)  %6.2f MB/min  (%5.0fx smaller than whole frames)\n",
+	       w->name, w->updates_per_second, us / updates, worst, first_us, rec->stats.bytes / 1e6,
+	       (double) updates * width * height * 4 / rec->stats.bytes);
+	printf("%-10s        %lu frames, %lu keyframes, %lu tiles\n", "", rec->stats.frames, rec->stats.keyframes,
+	       rec->stats.tiles);
+
+	record_close(rec);
+	tilemap_destroy(&dirty);
+	free(store);
+}
+
+int
+main(int argc, char *argv[])
+{
+	static const workload workloads[] = { { "typing", 15 }, { "scrolling", 20 }, { "redrawing", 10 } };
+	unsigned long updates = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000;
+	int fd = mkstemp(path), i, failures;
+
+	if (fd < 0)
+		return 1;
+	close(fd);
+
+	failures = check(updates);
+	if (!failures)
+	{
+		printf("1920x1080 desktop, one minute each\n");
+		for (i = 0; i < (int) (sizeof(workloads) / sizeof(workloads[0])); i++)
+			report(&workloads[i], 1920, 1080);
+	}
+
+	unlink(path);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,151 @@
+/*	Copyright (c) 2007-2012 Dorian Johnson <2011@dorianj.net>
+
+	This file is part of CoRD.
+	CoRD is free software; you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation; either version 2 of the License, or (at your option) any later
+	version.
+
+	CoRD is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+	FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License along with
+	CoRD; if not, write to the Free Software Foundation, Inc., 51 Franklin St,
+	Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+/*
+ * record_play: play a session recording without a screen.
+ *
+ * Sessions are recorded, one file for each connection, into the folder
+ * given by the CRDRecordingPath default:
+ *
+ *	defaults write net.sf.cord CRDRecordingPath ~/Documents/CoRD\ Recordings
+ *
+ *	cc -O2 -I../Source -o record_play record_play.c ../Source/record.c ../Source/tiles.c
+ *	./record_play recording.cordrec
+ *	./record_play recording.cordrec seconds picture.ppm [seconds picture.ppm ...]
+ *
+ * With only a recording, it plays every frame and prints what the
+ * recording holds and how fast it played; it exits with status 1 if the
+ * recording is damaged. Otherwise it saves the screen as it was at each
+ * time given as a PPM picture, seeking straight there.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "record.h"
+
+static double
+now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int
+save_ppm(const RDPlayback * pb, const char *path)
+{
+	FILE *file = fopen(path, "wb");
+	int i, ok;
+
+	if (file == NULL)
+		return 0;
+
+	fprintf(file, "P6\n%d %d\n255\n", pb->width, pb->height);
+	for (i = 0; i < pb->width * pb->height; i++)
+	{
+		uint32_t pixel = pb->pixels[i];
+
+		putc((pixel >> 16) & 0xff, file);
+		putc((pixel >> 8) & 0xff, file);
+		putc(pixel & 0xff, file);
+	}
+
+	ok = !ferror(file);
+	return fclose(file) == 0 && ok;
+}
+
+static int
+play_all(RDPlayback * pb)
+{
+	time_t start = (time_t) pb->start_time;
+	unsigned long frames = 0;
+	int result, width = 0, height = 0;
+	double us = now_us();
+
+	printf("recorded %s", ctime(&start));
+	printf("%u.%03u seconds, %d keyframes\n", pb->duration / 1000, pb->duration % 1000, pb->key_count);
+
+	while ((result = playback_next(pb)) > 0)
+	{
+		if (pb->width != width || pb->height != height)
+		{
+			printf("%8u.%03u  %dx%d\n", pb->time / 1000, pb->time % 1000, pb->width, pb->height);
+			width = pb->width;
+			height = pb->height;
+		}
+		frames++;
+	}
+	us = now_us() - us;
+
+	if (result < 0)
+	{
+		printf("damaged after frame %lu, at %u.%03u seconds\n", frames, pb->time / 1000, pb->time % 1000);
+		return 1;
+	}
+
+	printf("%lu frames played in %.1f ms (%.1f us each)\n", frames, us / 1000, frames ? us / frames : 0);
+	return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	RDPlayback *pb;
+	int i, status = 0;
+
+	if (argc < 2 || argc % 2)
+	{
+		fprintf(stderr, "usage: %s recording [seconds picture.ppm ...]\n", argv[0]);
+		return 2;
+	}
+
+	if ((pb = playback_open(argv[1])) == NULL)
+	{
+		fprintf(stderr, "%s: can't read %s as a recording\n", argv[0], argv[1]);
+		return 1;
+	}
+
+	if (argc == 2)
+		status = play_all(pb);
+
+	for (i = 2; i + 1 < argc && !status; i += 2)
+	{
+		uint32_t time = (uint32_t) (atof(argv[i]) * 1000);
+		double us = now_us();
+
+		if (playback_seek(pb, time) != 1)
+		{
+			fprintf(stderr, "%s: couldn't play up to %s seconds\n", argv[0], argv[i]);
+			status = 1;
+		}
+		else if (!save_ppm(pb, argv[i + 1]))
+		{
+			fprintf(stderr, "%s: couldn't write %s\n", argv[0], argv[i + 1]);
+			status = 1;
+		}
+		else
+			printf("%s: %dx%d as of %u.%03u seconds, found in %.1f ms\n", argv[i + 1], pb->width, pb->height,
+			       pb->time / 1000, pb->time % 1000, (now_us() - us) / 1000);
+	}
+
+	playback_close(pb);
+	return status;
+}
@@ -0,0 +1,248 @@
+/*	Copyright (c) 2007-2012 Dorian Johnson <2011@dorianj.net>
+	
+	This file is part of CoRD.
+	CoRD is free software; you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation; either version 2 of the License, or (at your option) any later
+	version.
+
+	CoRD is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+	FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License along with
+	CoRD; if not, write to the Free Software Foundation, Inc., 51 Franklin St,
+	Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+/*
+ * recv_bench: compare the old exact-length receive path with the read-ahead
+ * buffer used by tcp_recv().
+ *
+ *	cc -O2 -o recv_bench recv_bench.c
+ *	./recv_bench [pdus]
+ *
+ * A child process stands in for the server and writes TPKT framed PDUs over
+ * loopback, with sizes roughly like a busy session (mostly small order
+ * updates, some large bitmap updates). The parent receives them once reading
+ * exactly the header and then the body, as iso_recv_msg() used to, and once
+ * through a read-ahead buffer. For each it reports the number of read calls
+ * and the throughput.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define READ_AHEAD_SIZE 0x10000
+
+typedef struct
+{
+	unsigned char *data;
+	unsigned int size, start, end;
+} read_buffer;
+
+static long reads;
+
+static int
+pdu_length(unsigned int n)
+{
+	/* deterministic mix: 80% 40-400 bytes, 15% 1-4 KB, 5% 8-16 KB */
+	unsigned int r = (n * 2654435761u) >> 8;
+
+	if (r % 100 < 80)
+		return 40 + r % 360;
+	if (r % 100 < 95)
+		return 1024 + r % 3072;
+	return 8192 + r % 8192;
+}
+
+static void
+serve(int fd, int pdus)
+{
+	unsigned char *out = malloc(0x40000);
+	unsigned int used = 0;
+	int n, length;
+
+	for (n = 0; n < pdus; n++)
+	{
+		length = pdu_length(n);
+		if (used + length > 0x40000)
+		{
+			write(fd, out, used);
+			used = 0;
+		}
+
+		out[used] = 3;
+		out[used + 1] = 0;
+		out[used + 2] = length >> 8;
+		out[used + 3] = length & 0xff;
+		memset(out + used + 4, n, length - 4);
+		used += length;
+	}
+
+	write(fd, out, used);
+	close(fd);
+	exit(0);
+}
+
+static int
+read_exact(int fd, unsigned char *p, unsigned int length)
+{
+	int rcvd;
+
+	while (length > 0)
+	{
+		rcvd = read(fd, p, length);
+		reads++;
+		if (rcvd <= 0)
+			return 0;
+		p += rcvd;
+		length -= rcvd;
+	}
+	return 1;
+}
+
+/* Same strategy as tcp_read_ahead() */
+static int
+read_ahead(int fd, read_buffer * b, unsigned int *keep, unsigned int length)
+{
+	int rcvd;
+
+	if (b->end - *keep >= length)
+		return 1;
+
+	if (*keep == b->end)
+		b->start = b->end = *keep = 0;
+
+	if (*keep + length > b->size)
+	{
+		memmove(b->data, b->data + *keep, b->end - *keep);
+		b->start -= *keep;
+		b->end -= *keep;
+		*keep = 0;
+
+		if (length > b->size)
+		{
+			b->size = length;
+			b->data = realloc(b->data, b->size);
+		}
+	}
+
+	while (b->end - *keep < length)
+	{
+		rcvd = read(fd, b->data + b->end, b->size - b->end);
+		reads++;
+		if (rcvd <= 0)
+			return 0;
+		b->end += rcvd;
+	}
+	return 1;
+}
+
+static int
+receive_exact(int fd)
+{
+	unsigned char *pdu = malloc(0x10000);
+	int count = 0;
+
+	while (read_exact(fd, pdu, 4))
+	{
+		if (!read_exact(fd, pdu + 4, ((pdu[2] << 8) | pdu[3]) - 4))
+			break;
+		count++;
+	}
+
+	free(pdu);
+	return count;
+}
+
+static int
+receive_read_ahead(int fd)
+{
+	read_buffer b = { malloc(READ_AHEAD_SIZE), READ_AHEAD_SIZE, 0, 0 };
+	unsigned char *pdu;
+	unsigned int keep, length;
+	int count = 0;
+
+	for (;;)
+	{
+		keep = b.start;
+		if (!read_ahead(fd, &b, &keep, 4))
+			break;
+		pdu = b.data + keep;
+		length = (pdu[2] << 8) | pdu[3];
+		if (!read_ahead(fd, &b, &keep, length))
+			break;
+		b.start = keep + length;
+		count++;
+	}
+
+	free(b.data);
+	return count;
+}
+
+static void
+run(const char *name, int (*receive) (int), int pdus)
+{
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+	struct timeval start, end;
+	int listener, fd, count;
+	long bytes = 0;
+	double seconds;
+	pid_t pid;
+
+	for (count = 0; count < pdus; count++)
+		bytes += pdu_length(count);
+
+	listener = socket(AF_INET, SOCK_STREAM, 0);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	bind(listener, (struct sockaddr *) &addr, sizeof(addr));
+	getsockname(listener, (struct sockaddr *) &addr, &len);
+	listen(listener, 1);
+
+	fflush(stdout);
+	if ((pid = fork()) == 0)
+	{
+		close(listener);
+		fd = socket(AF_INET, SOCK_STREAM, 0);
+		if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0)
+			exit(1);
+		serve(fd, pdus);
+	}
+
+	fd = accept(listener, NULL, NULL);
+	close(listener);
+
+	reads = 0;
+	gettimeofday(&start, NULL);
+	count = receive(fd);
+	gettimeofday(&end, NULL);
+	close(fd);
+	waitpid(pid, NULL, 0);
+
+	seconds = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+	printf("%-12s %8d PDUs  %9ld reads  %6.2f reads/PDU  %8.1f MB/s\n", name, count, reads,
+	       count ? (double) reads / count : 0.0, seconds > 0 ? bytes / seconds / 1e6 : 0.0);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int pdus = argc > 1 ? atoi(argv[1]) : 200000;
+
+	signal(SIGPIPE, SIG_IGN);
+	run("exact", receive_exact, pdus);
+	run("read-ahead", receive_read_ahead, pdus);
+	return 0;
+}
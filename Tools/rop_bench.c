@@ -0,0 +1,198 @@
+/*	Copyright (c) 2007-2012 Dorian Johnson <2011@dorianj.net>
+
+	This file is part of CoRD.
+	CoRD is free software; you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation; either version 2 of the License, or (at your option) any later
+	version.
+
+	CoRD is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+	FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License along with
+	CoRD; if not, write to the Free Software Foundation, Inc., 51 Franklin St,
+	Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+/*
+ * rop_bench: check and measure the ROP3 engine behind MEMBLT, PATBLT,
+ * DSTBLT and TRIBLT (Source/rop.c).
+ *
+ *	cc -O2 -I../Source -o rop_bench rop_bench.c ../Source/rop.c
+ *	./rop_bench [width] [height]
+ *
+ * Build a second time with -DROP_NO_SIMD to time the scalar kernels.
+ *
+ * First it checks rop3_pixel() against the definition of a ROP3 code, one
+ * bit at a time, and then every one of the 256 codes through rop3_blt() on
+ * blocks of awkward sizes and pattern phases against rop3_pixel(), in a
+ * bottom-up destination like the backing store. It exits with status 1 if
+ * any check fails.
+ *
+ * Then it times a full screen of each code that has a kernel of its own,
+ * and of a few that servers send which go through the generic evaluator.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "rop.h"
+
+#define OPAQUE 0xff000000
+
+static double
+now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static uint32_t
+random_pixel(void)
+{
+	return ((uint32_t) rand() << 16) ^ (uint32_t) rand();
+}
+
+/* The definition: each result bit is the bit of rop indexed by P S D */
+static uint32_t
+reference(uint8_t rop, uint32_t p, uint32_t s, uint32_t d)
+{
+	uint32_t r = 0;
+	int bit;
+
+	for (bit = 0; bit < 32; bit++)
+	{
+		int index = ((p >> bit) & 1) << 2 | ((s >> bit) & 1) << 1 | ((d >> bit) & 1);
+
+		r |= (uint32_t) ((rop >> index) & 1) << bit;
+	}
+	return r;
+}
+
+static int
+check(void)
+{
+	uint32_t pattern[64], source[67 * 13], dest[67 * 13], before[67 * 13], expected;
+	int rop, i, x, y, cx, cy, px, py, failures = 0;
+
+	srand(1);
+	for (rop = 0; rop < 256 && !failures; rop++)
+		for (i = 0; i < 1000; i++)
+		{
+			uint32_t p = random_pixel(), s = random_pixel(), d = random_pixel();
+
+			if (rop3_pixel(rop, p, s, d) != reference(rop, p, s, d))
+			{
+				printf("FAIL: rop3_pixel 0x%02x\n", rop);
+				failures++;
+				break;
+			}
+		}
+
+	for (rop = 0; rop < 256 && !failures; rop++)
+	{
+		for (i = 0; i < 20 && !failures; i++)
+		{
+			/* Widths around the vector and span lengths */
+			cx = 1 + rand() % 67;
+			cy = 1 + rand() % 13;
+			px = rand() % 16 - 8;
+			py = rand() % 16 - 8;
+
+			for (x = 0; x < 64; x++)
+				pattern[x] = random_pixel();
+			for (x = 0; x < cx * cy; x++)
+			{
+				source[x] = random_pixel();
+				before[x] = dest[x] = random_pixel();
+			}
+
+			/* Destination rows bottom-up, as in the backing store */
+			rop3_blt(rop, dest + (cy - 1) * cx, -cx * 4, source, cx * 4, pattern, px, py, cx, cy, OPAQUE);
+
+			for (y = 0; y < cy && !failures; y++)
+				for (x = 0; x < cx && !failures; x++)
+				{
+					int di = (cy - 1 - y) * cx + x;
+
+					expected = reference(rop, pattern[((py + y) & 7) * 8 + ((px + x) & 7)], source[y * cx + x],
+							     before[di]) | OPAQUE;
+					if (dest[di] != expected)
+					{
+						printf("FAIL: rop 0x%02x %dx%d at %d,%d: %08x, expected %08x\n", rop, cx, cy, x, y,
+						       dest[di], expected);
+						failures++;
+					}
+				}
+		}
+	}
+
+	if (!failures)
+		printf("check: all 256 ROP3 codes match their truth tables\n\n");
+	return failures;
+}
+
+static void
+time_rop(const char *name, uint8_t rop, uint32_t * dest, const uint32_t * source, const uint32_t * pattern,
+	 int width, int height)
+{
+	double start, us;
+	int i, reps = 50;
+
+	start = now_us();
+	for (i = 0; i < reps; i++)
+		rop3_blt(rop, dest + (height - 1) * width, -width * 4, source, width * 4, pattern, i, i, width, height,
+			 OPAQUE);
+	us = (now_us() - start) / reps;
+
+	printf("%-11s 0x%02x  %8.1f us  %7.0f Mpixel/s\n", name, rop, us, width * (double) height / us);
+}
+
+int
+main(int argc, char *argv[])
+{
+	uint32_t *dest, *source, pattern[64];
+	int width, height, i;
+
+	width = argc > 1 ? atoi(argv[1]) : 1920;
+	height = argc > 2 ? atoi(argv[2]) : 1200;
+
+	if (check())
+		return 1;
+
+	dest = malloc(width * height * 4);
+	source = malloc(width * height * 4);
+	for (i = 0; i < width * height; i++)
+	{
+		dest[i] = random_pixel();
+		source[i] = random_pixel();
+	}
+	for (i = 0; i < 64; i++)
+		pattern[i] = random_pixel();
+
+#ifdef ROP_NO_SIMD
+	printf("%dx%d screen, scalar kernels\n", width, height);
+#else
+	printf("%dx%d screen\n", width, height);
+#endif
+	time_rop("SRCCOPY", ROP3_SRCCOPY, dest, source, pattern, width, height);
+	time_rop("PATCOPY", ROP3_PATCOPY, dest, source, pattern, width, height);
+	time_rop("SRCINVERT", ROP3_SRCINVERT, dest, source, pattern, width, height);
+	time_rop("SRCAND", ROP3_SRCAND, dest, source, pattern, width, height);
+	time_rop("DSTINVERT", ROP3_DSTINVERT, dest, source, pattern, width, height);
+	printf("\n");
+	time_rop("SRCPAINT", ROP3_SRCPAINT, dest, source, pattern, width, height);
+	time_rop("PATINVERT", ROP3_PATINVERT, dest, source, pattern, width, height);
+	time_rop("MERGECOPY", ROP3_MERGECOPY, dest, source, pattern, width, height);
+	time_rop("PSDPxax", 0xb8, dest, source, pattern, width, height);
+
+	free(dest);
+	free(source);
+	return 0;
+}
@@ -0,0 +1,242 @@
+/*	Copyright (c) 2007-2012 Dorian Johnson <2011@dorianj.net>
+
+	This file is part of CoRD.
+	CoRD is free software; you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation; either version 2 of the License, or (at your option) any later
+	version.
+
+	CoRD is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+	FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License along with
+	CoRD; if not, write to the Free Software Foundation, Inc., 51 Franklin St,
+	Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+/*
+ * scale_bench: check and measure the thumbnail downscaler (Source/scale.c).
+ *
+ *	cc -O2 -I../Source -o scale_bench scale_bench.c ../Source/scale.c
+ *	./scale_bench [width] [height] [thumbnail width] [thumbnail height]
+ *
+ * Build with -DSCALE_NO_SIMD to time the plain C passes alone.
+ *
+ * First it scales random pictures between awkward sizes, down and up, with
+ * both filters, and compares every channel with the same filter worked out
+ * in floating point; they may differ by one. Then it changes random
+ * rectangles of a picture, rescales only what depends on them, and
+ * compares the result with scaling the whole picture again, which must
+ * match exactly. It exits with status 1 if any check fails.
+ *
+ * Then it times making a thumbnail of a whole screen, and remaking the
+ * parts of it that typing and scrolling change.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+
+#include "scale.h"
+
+static double
+now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void
+randomise(uint32_t * pixels, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		pixels[i] = rand() ^ (rand() << 16);
+}
+
+/* How much of destination pixel i, along one axis, source pixel j is worth */
+static double
+reference_weight(int filter, int s, int d, int i, int j)
+{
+	double lo, hi, centre, dist;
+
+	if (filter == SCALE_AREA)
+	{
+		lo = (double) i * s / d;
+		hi = (double) (i + 1) * s / d;
+		lo = lo > j ? lo : j;
+		hi = hi < j + 1 ? hi : j + 1;
+		return hi > lo ? (hi - lo) * d / s : 0;
+	}
+
+	centre = ((2.0 * i + 1) * s / d - 1) / 2;
+	centre = centre < 0 ? 0 : centre > s - 1 ? s - 1 : centre;
+	dist = fabs(centre - j);
+	return dist < 1 ? 1 - dist : 0;
+}
+
+static int
+check_filter(int filter, int sw, int sh, int dw, int dh)
+{
+	uint32_t *src = malloc(sw * sh * 4), *dst = malloc(dw * dh * 4);
+	double *wx = malloc(dw * sw * sizeof(double)), *wy = malloc(dh * sh * sizeof(double));
+	RDScaler sc;
+	int i, j, x, y, c, failures = 0;
+
+	randomise(src, sw * sh);
+	scale_init(&sc, filter, sw, sh, dw, dh);
+	scale_rect(&sc, src, sw * 4, dst, dw * 4, 0, 0, sw, sh);
+
+	for (i = 0; i < dw; i++)
+		for (j = 0; j < sw; j++)
+			wx[i * sw + j] = reference_weight(filter, sw, dw, i, j);
+	for (i = 0; i < dh; i++)
+		for (j = 0; j < sh; j++)
+			wy[i * sh + j] = reference_weight(filter, sh, dh, i, j);
+
+	for (y = 0; y < dh && !failures; y++)
+		for (x = 0; x < dw && !failures; x++)
+			for (c = 0; c < 4; c++)
+			{
+				double sum = 0;
+				int want, got = ((uint8_t *) & dst[y * dw + x])[c];
+
+				for (i = 0; i < sh; i++)
+					if (wy[y * sh + i] != 0)
+						for (j = 0; j < sw; j++)
+							sum += wy[y * sh + i] * wx[x * sw + j] * ((uint8_t *) & src[i * sw + j])[c];
+
+				want = (int) floor(sum + 0.5);
+				if (abs(got - want) > 1)
+				{
+					printf("FAIL: %s %dx%d to %dx%d, pixel %d,%d channel %d: %d, expected %d\n",
+					       filter == SCALE_AREA ? "area" : "bilinear", sw, sh, dw, dh, x, y, c, got, want);
+					failures++;
+					break;
+				}
+			}
+
+	scale_destroy(&sc);
+	free(src);
+	free(dst);
+	free(wx);
+	free(wy);
+	return failures;
+}
+
+static int
+check_dirty(int filter, int sw, int sh, int dw, int dh)
+{
+	uint32_t *src = malloc(sw * sh * 4), *dst = malloc(dw * dh * 4), *whole = malloc(dw * dh * 4);
+	uint32_t *src_origin = src + (sh - 1) * sw;
+	RDScaler sc;
+	int round, i, failures = 0;
+
+	randomise(src, sw * sh);
+	scale_init(&sc, filter, sw, sh, dw, dh);
+	scale_rect(&sc, src_origin, -sw * 4, dst, dw * 4, 0, 0, sw, sh);
+
+	for (round = 0; round < 200 && !failures; round++)
+	{
+		int cx = 1 + rand() % (round % 4 && sw > 40 ? 40 : sw), cy = 1 + rand() % (round % 4 && sh > 40 ? 40 : sh);
+		int x = rand() % (sw - cx + 1), y = rand() % (sh - cy + 1), row;
+
+		for (row = y; row < y + cy; row++)
+			randomise((uint32_t *) ((uint8_t *) src_origin - row * sw * 4) + x, cx);
+
+		scale_rect(&sc, src_origin, -sw * 4, dst, dw * 4, x, y, cx, cy);
+		scale_rect(&sc, src_origin, -sw * 4, whole, dw * 4, 0, 0, sw, sh);
+
+		for (i = 0; i < dw * dh; i++)
+			if (dst[i] != whole[i])
+			{
+				printf("FAIL: %s %dx%d to %dx%d, after changing %dx%d at %d,%d pixel %d,%d wasn't remade\n",
+				       filter == SCALE_AREA ? "area" : "bilinear", sw, sh, dw, dh, cx, cy, x, y, i % dw, i / dw);
+				failures++;
+				break;
+			}
+	}
+
+	scale_destroy(&sc);
+	free(src);
+	free(dst);
+	free(whole);
+	return failures;
+}
+
+static int
+check(void)
+{
+	static const int sizes[][4] = {
+		{ 64, 48, 8, 6 }, { 97, 61, 13, 7 }, { 100, 100, 33, 66 }, { 37, 23, 37, 23 },
+		{ 20, 15, 47, 31 }, { 1, 1, 5, 3 }, { 200, 9, 31, 1 }, { 257, 130, 36, 20 }
+	};
+	int i, filter, failures = 0;
+
+	srand(1);
+	for (i = 0; i < (int) (sizeof(sizes) / sizeof(sizes[0])); i++)
+		for (filter = SCALE_AREA; filter <= SCALE_BILINEAR; filter++)
+		{
+			failures += check_filter(filter, sizes[i][0], sizes[i][1], sizes[i][2], sizes[i][3]);
+			failures += check_dirty(filter, sizes[i][0], sizes[i][1], sizes[i][2], sizes[i][3]);
+		}
+
+	if (!failures)
+		printf("check: area and bilinear scaling match, and partial rescaling matches whole\n\n");
+	return failures;
+}
+
+static void
+report(const char *name, int filter, int sw, int sh, int dw, int dh, int x, int y, int cx, int cy)
+{
+	uint32_t *src = malloc(sw * sh * 4), *dst = malloc(dw * dh * 4);
+	uint32_t *src_origin = src + (sh - 1) * sw;
+	double start, us;
+	RDScaler sc;
+	int i, reps = 50;
+
+	randomise(src, sw * sh);
+	scale_init(&sc, filter, sw, sh, dw, dh);
+
+	start = now_us();
+	for (i = 0; i < reps; i++)
+		scale_rect(&sc, src_origin, -sw * 4, dst, dw * 4, x, y, cx, cy);
+	us = (now_us() - start) / reps;
+
+	printf("%-26s %-8s %8.1f us\n", name, filter == SCALE_AREA ? "area" : "bilinear", us);
+	scale_destroy(&sc);
+	free(src);
+	free(dst);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int sw = argc > 1 ? atoi(argv[1]) : 1920, sh = argc > 2 ? atoi(argv[2]) : 1080;
+	int dw = argc > 3 ? atoi(argv[3]) : 240, dh = argc > 4 ? atoi(argv[4]) : 135;
+	int filter;
+
+	if (check())
+		return 1;
+
+#ifdef SCALE_NO_SIMD
+	printf("%dx%d to %dx%d, plain C\n", sw, sh, dw, dh);
+#else
+	printf("%dx%d to %dx%d\n", sw, sh, dw, dh);
+#endif
+	for (filter = SCALE_AREA; filter <= SCALE_BILINEAR; filter++)
+	{
+		report("whole screen", filter, sw, sh, dw, dh, 0, 0, sw, sh);
+		report("typing (a line of text)", filter, sw, sh, dw, dh, sw / 8, sh / 2, sw / 4, 16);
+		report("scrolling (a window)", filter, sw, sh, dw, dh, sw / 8, sh / 8, sw * 3 / 4, sh * 3 / 4);
+	}
+
+	return 0;
+}
@@ -0,0 +1,300 @@
+/*	Copyright (c) 2007-2012 Dorian Johnson <2011@dorianj.net>
+
+	This file is part of CoRD.
+	CoRD is free software; you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation; either version 2 of the License, or (at your option) any later
+	version.
+
+	CoRD is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+	FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License along with
+	CoRD; if not, write to the Free Software Foundation, Inc., 51 Franklin St,
+	Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+/*
+ * tiles_bench: check and measure the tile maps that say which parts of the
+ * screen changed (Source/tiles.c).
+ *
+ *	cc -O2 -I../Source -o tiles_bench tiles_bench.c ../Source/tiles.c
+ *	./tiles_bench [width] [height]
+ *
+ * First it adds random rectangles, some partly off screen, to maps of odd
+ * sizes and checks that exactly the tiles touched are set, that their
+ * count, area, bounds and row spans agree with a pixel by pixel map, and
+ * that union and copy do what they say. It exits with status 1 if any
+ * check fails.
+ *
+ * Then, for a few typical updates (a blinking caret, typing, a clock and a
+ * caret together, a window of bitmap tiles, the whole screen) on a
+ * 3840x2160 screen unless told otherwise, it reports the tiles set, how
+ * much of the screen they cover and the time to copy just their rows out
+ * of a 32 bpp frame compared with copying all of it, the way
+ * -[CRDSessionView generateTexture] uploads.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "tiles.h"
+
+static int width, height;
+static unsigned char *frame, *texture;
+
+static double
+now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/* Compares map with the pixels marked in added, a w x h screen */
+static int
+compare(const RDTileMap * map, const unsigned char *added, int w, int h, RDTileRect * spans)
+{
+	RDTileRect bounds, expect = { w, h, 0, 0 };
+	long count = 0, area = 0, span_area = 0;
+	int column, row, x, y, i, n, set, any = 0;
+
+	for (row = 0; row < map->rows; row++)
+		for (column = 0; column < map->columns; column++)
+		{
+			for (set = 0, y = row * TILE_SIZE; y < (row + 1) * TILE_SIZE && y < h && !set; y++)
+				for (x = column * TILE_SIZE; x < (column + 1) * TILE_SIZE && x < w && !set; x++)
+					set = added[y * w + x];
+
+			if (set != tilemap_test(map, column, row))
+			{
+				printf("FAIL: %dx%d tile %d,%d is %s\n", w, h, column, row, set ? "clear" : "set");
+				return 1;
+			}
+			if (!set)
+				continue;
+
+			count++;
+			area += (long) ((column + 1) * TILE_SIZE > w ? w - column * TILE_SIZE : TILE_SIZE)
+				* ((row + 1) * TILE_SIZE > h ? h - row * TILE_SIZE : TILE_SIZE);
+			any = 1;
+			if (column * TILE_SIZE < expect.x)
+				expect.x = column * TILE_SIZE;
+			if (row * TILE_SIZE < expect.y)
+				expect.y = row * TILE_SIZE;
+			if ((column + 1) * TILE_SIZE > expect.cx)
+				expect.cx = (column + 1) * TILE_SIZE;
+			if ((row + 1) * TILE_SIZE > expect.cy)
+				expect.cy = (row + 1) * TILE_SIZE;
+		}
+
+	for (row = 0; row < map->rows; row++)
+		for (i = 0, n = tilemap_row_spans(map, row, spans); i < n; i++)
+		{
+			RDTileRect *s = &spans[i];
+
+			if (s->x < 0 || s->y < 0 || s->cx <= 0 || s->cy <= 0 || s->x + s->cx > w || s->y + s->cy > h
+			    || (i > 0 && s->x <= spans[i - 1].x + spans[i - 1].cx))
+			{
+				printf("FAIL: %dx%d span %d,%d %dx%d out of place\n", w, h, s->x, s->y, s->cx, s->cy);
+				return 1;
+			}
+			for (x = s->x; x < s->x + s->cx; x += TILE_SIZE)
+				if (!tilemap_test(map, x / TILE_SIZE, row))
+				{
+					printf("FAIL: %dx%d span %d,%d %dx%d covers a clear tile\n", w, h, s->x, s->y, s->cx, s->cy);
+					return 1;
+				}
+			span_area += (long) s->cx * s->cy;
+		}
+
+	if (map->count != count || tilemap_area(map) != area || span_area != area)
+	{
+		printf("FAIL: %dx%d %ld tiles, area %ld, spans %ld; expected %ld tiles, area %ld\n", w, h, map->count,
+		       tilemap_area(map), span_area, count, area);
+		return 1;
+	}
+
+	expect.cx = (expect.cx > w ? w : expect.cx) - expect.x;
+	expect.cy = (expect.cy > h ? h : expect.cy) - expect.y;
+	if (tilemap_bounds(map, &bounds) != any || (any && memcmp(&bounds, &expect, sizeof(bounds)) != 0))
+	{
+		printf("FAIL: %dx%d bounds %d,%d %dx%d, expected %d,%d %dx%d\n", w, h, bounds.x, bounds.y, bounds.cx,
+		       bounds.cy, expect.x, expect.y, expect.cx, expect.cy);
+		return 1;
+	}
+
+	return 0;
+}
+
+static int
+check(void)
+{
+	/* Odd sizes, and wide enough for rows of more than one word */
+	static const int sizes[][2] = { {1, 1}, {63, 65}, {640, 480}, {1000, 700}, {4097, 129}, {8200, 70} };
+	RDTileMap map = { 0 }, other = { 0 };
+	RDTileRect *spans;
+	unsigned char *added;
+	int size, round, n, x, y, failures = 0, rounds = 0;
+
+	srand(1);
+	for (size = 0; size < (int) (sizeof(sizes) / sizeof(sizes[0])) && !failures; size++)
+	{
+		int w = sizes[size][0], h = sizes[size][1];
+
+		if (!tilemap_init(&map, w, h) || !tilemap_init(&other, w, h))
+			return 1;
+		added = calloc(w, h);
+		spans = malloc((map.columns + 1) / 2 * sizeof(*spans));
+
+		failures += compare(&map, added, w, h, spans);
+		for (round = 0; round < 30 && !failures; round++, rounds++)
+		{
+			tilemap_clear(&map);
+			memset(added, 0, (size_t) w * h);
+
+			for (n = 0; n < 1 + rand() % 40 && !failures; n++)
+			{
+				int rx = rand() % (w + 200) - 100, ry = rand() % (h + 200) - 100;
+				int rcx = 1 + rand() % (rand() % 8 ? 100 : w), rcy = 1 + rand() % (rand() % 8 ? 40 : h);
+
+				tilemap_add(&map, rx, ry, rcx, rcy);
+				for (y = ry < 0 ? 0 : ry; y < ry + rcy && y < h; y++)
+					for (x = rx < 0 ? 0 : rx; x < rx + rcx && x < w; x++)
+						added[y * w + x] = 1;
+				failures += compare(&map, added, w, h, spans);
+			}
+
+			/* Half of it again in another map, joined back on */
+			tilemap_clear(&other);
+			for (y = 0; y < h; y += 2 * TILE_SIZE)
+				for (x = 0; x < w; x++)
+					if (added[y * w + x])
+						tilemap_add(&other, x, y, 1, 1);
+			tilemap_union(&other, &map);
+			failures = failures || compare(&other, added, w, h, spans);
+			tilemap_clear(&other);
+			tilemap_copy(&other, &map);
+			failures = failures || compare(&other, added, w, h, spans);
+		}
+
+		tilemap_fill(&map);
+		memset(added, 1, (size_t) w * h);
+		failures = failures || compare(&map, added, w, h, spans) || !tilemap_is_full(&map);
+
+		free(added);
+		free(spans);
+	}
+
+	tilemap_destroy(&map);
+	tilemap_destroy(&other);
+	if (!failures)
+		printf("check: %d rounds of random rectangles on %d screen sizes, all exact\n\n", rounds, size);
+	return failures;
+}
+
+/* Copy the rows of each span the way glTexSubImage2D with GL_UNPACK_ROW_LENGTH reads them */
+static void
+upload(const RDTileMap * map, RDTileRect * spans)
+{
+	int row, i, n, y;
+
+	for (row = 0; row < map->rows; row++)
+		for (i = 0, n = tilemap_row_spans(map, row, spans); i < n; i++)
+			for (y = spans[i].y; y < spans[i].y + spans[i].cy; y++)
+				memcpy(texture + ((long) y * width + spans[i].x) * 4, frame + ((long) y * width + spans[i].x) * 4,
+				       spans[i].cx * 4);
+}
+
+static void
+report(const char *name, const RDTileMap * map)
+{
+	RDTileMap full = { 0 };
+	RDTileRect *spans = malloc((map->columns + 1) / 2 * sizeof(*spans));
+	double start, partial_us, full_us;
+	int i, reps = 50;
+
+	tilemap_init(&full, width, height);
+	tilemap_fill(&full);
+
+	start = now_us();
+	for (i = 0; i < reps; i++)
+		upload(map, spans);
+	partial_us = (now_us() - start) / reps;
+
+	start = now_us();
+	for (i = 0; i < reps; i++)
+		upload(&full, spans);
+	full_us = (now_us() - start) / reps;
+
+	printf("%-14s %4ld tiles %6.2f%% of screen  upload %8.1f us vs %8.1f us full  (%6.1fx)\n", name, map->count,
+	       100.0 * tilemap_area(map) / ((double) width * height), partial_us, full_us, full_us / partial_us);
+
+	tilemap_destroy(&full);
+	free(spans);
+}
+
+int
+main(int argc, char *argv[])
+{
+	RDTileMap map = { 0 };
+	double start;
+	int i, adds = 0;
+
+	width = argc > 1 ? atoi(argv[1]) : 3840;
+	height = argc > 2 ? atoi(argv[2]) : 2160;
+
+	if (check())
+		return 1;
+
+	frame = calloc((size_t) width * height, 4);
+	texture = calloc((size_t) width * height, 4);
+	if (frame == NULL || texture == NULL || !tilemap_init(&map, width, height))
+		return 1;
+	printf("%dx%d screen, %dx%d tiles\n", width, height, map.columns, map.rows);
+
+	tilemap_add(&map, 300, 200, 2, 18);
+	report("caret", &map);
+
+	/* A word typed: a glyph at a time, then the caret */
+	tilemap_clear(&map);
+	for (i = 0; i < 12; i++)
+		tilemap_add(&map, 300 + i * 8, 200, 8, 16);
+	tilemap_add(&map, 396, 200, 2, 18);
+	report("typing", &map);
+
+	tilemap_clear(&map);
+	tilemap_add(&map, 300, 200, 2, 18);
+	tilemap_add(&map, width - 80, height - 30, 60, 20);
+	report("caret+clock", &map);
+
+	/* A window repainted as 64x64 bitmap tiles */
+	tilemap_clear(&map);
+	for (i = 0; i < 12 * 8; i++)
+		tilemap_add(&map, 200 + (i % 12) * 64, 150 + (i / 12) * 64, 64, 64);
+	report("window tiles", &map);
+
+	tilemap_fill(&map);
+	report("full screen", &map);
+
+	/* Cost of accumulating: the glyphs and tiles of a busy update */
+	start = now_us();
+	for (i = 0; i < 1000; i++)
+	{
+		int n;
+
+		tilemap_clear(&map);
+		for (n = 0; n < 200; n++, adds++)
+			tilemap_add(&map, (n * 37) % width, (n * 53) % height, 8 + n % 64, 16 + n % 32);
+	}
+	printf("\ntilemap_add: %.3f us per rectangle\n", (now_us() - start) / adds);
+
+	tilemap_destroy(&map);
+	free(frame);
+	free(texture);
+	return 0;
+}